@@ -0,0 +1,687 @@
+/*
+	RLFL benchmarks
+
+	Times the map-wide kernels on a large random cave for each map
+	layout. Build with `make rlfl-bench` and run
+	`./rlfl-bench [size] [iterations] [path map size]`.
+
+	To compare cell widths rebuild with a different cell type, ie.
+	`make clean rlfl-bench FLAGS='-DRLFL_CELL_TYPE="unsigned long"'`
+
+    Copyright (C) 2011
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+    <jtm@robot.is>
+*/
+#include <pthread.h>
+
+#include "../src/headers/rlfl.h"
+
+/*
+ +-----------------------------------------------------------+
+ * @desc	Monotonic clock in seconds
+ +-----------------------------------------------------------+
+ */
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Open map with one pillar in `density`
+ +-----------------------------------------------------------+
+ */
+static int
+make_cave(unsigned int w, unsigned int h, int density, unsigned int layout)
+{
+	int m = RLFL_new_map_layout(w, h, layout);
+	if(m < 0) return m;
+
+	unsigned int x, y;
+	for(y=1; y<h-1; y++)
+	{
+		for(x=1; x<w-1; x++)
+		{
+			if(RLFL_randint(density))
+				RLFL_set_flag(m, x, y, CELL_OPEN|CELL_WALK);
+		}
+	}
+	return m;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Report one result line
+ +-----------------------------------------------------------+
+ */
+static void
+report(const char *name, double secs, int iterations, double bytes)
+{
+	double per = (secs / iterations);
+	printf("%-24s %10.3f ms/iter", name, per * 1000.0);
+	if(bytes > 0)
+		printf("  %10.1f MB/s", (bytes / per) / (1024.0 * 1024.0));
+	printf("\n");
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Map wide kernels
+ +-----------------------------------------------------------+
+ */
+static void
+bench_map(unsigned int m, int iterations)
+{
+	unsigned int w, h;
+	RLFL_map_size(m, &w, &h);
+	double cells = (double)w * h;
+	double t;
+
+	/* Bytes of one flag over the whole map */
+	double plane = (RLFL_map_layout(m) == MAP_PLANES) ? (cells / 8) : (cells * sizeof(RLFL_cell_t));
+	int i;
+
+	/* Read and write every cell */
+	t = now();
+	for(i=0; i<iterations; i++)
+		RLFL_clear_map(m, CELL_SEEN|CELL_LIT);
+	report("clear_map", now() - t, iterations, 2 * plane);
+
+	/* Small radius, only the cells of the last fov are cleared */
+	t = now();
+	for(i=0; i<iterations; i++)
+		RLFL_fov(m, w / 2, h / 2, 8, FOV_SHADOW, true, true);
+	report("fov (r8, lit)", now() - t, iterations, 0);
+
+	/* Largest radius, cost is dominated by walking the octants */
+	t = now();
+	for(i=0; i<iterations; i++)
+		RLFL_fov(m, w / 2, h / 2, 50, FOV_SHADOW, false, true);
+	report("fov (r50)", now() - t, iterations, 0);
+
+	/* The same walking tables of the radius */
+	t = now();
+	for(i=0; i<iterations; i++)
+		RLFL_fov(m, w / 2, h / 2, 8, FOV_TABLE, true, true);
+	report("fov table (r8, lit)", now() - t, iterations, 0);
+
+	t = now();
+	for(i=0; i<iterations; i++)
+		RLFL_fov(m, w / 2, h / 2, 50, FOV_TABLE, false, true);
+	report("fov table (r50)", now() - t, iterations, 0);
+
+	t = now();
+	for(i=0; i<iterations; i++)
+		RLFL_fov(m, w / 2, h / 2, 50, FOV_SHADOW_ITER, false, true);
+	report("fov shadow iter (r50)", now() - t, iterations, 0);
+
+	t = now();
+	for(i=0; i<iterations; i++)
+		RLFL_fov(m, w / 2, h / 2, 50, FOV_RESTRICTIVE, false, true);
+	report("fov restrictive (r50)", now() - t, iterations, 0);
+
+	/* Statistics of the whole map */
+	t = now();
+	for(i=0; i<iterations; i++)
+		RLFL_count_flags(m, CELL_WALK);
+	report("count_flags", now() - t, iterations, plane);
+
+	unsigned int counts[RLFL_PLANES];
+	t = now();
+	for(i=0; i<iterations; i++)
+		RLFL_flag_histogram(m, counts);
+	report("flag_histogram", now() - t, iterations, RLFL_PLANES * plane);
+
+	/* One flag on a 64x64 block, per cell and in one call */
+	unsigned int x, y;
+	t = now();
+	for(i=0; i<iterations; i++)
+		for(y=0; y<64; y++)
+			for(x=0; x<64; x++)
+				RLFL_set_flag(m, x + 1, y + 1, CELL_MARK);
+	report("set_flag (64x64)", now() - t, iterations, 0);
+
+	t = now();
+	for(i=0; i<iterations; i++)
+		RLFL_set_flag_rect(m, 1, 1, 64, 64, CELL_MARK);
+	report("set_flag_rect (64x64)", now() - t, iterations, 0);
+
+	/* The same with changes tracked, then the changed rectangles
+	   of every set_flag since tracking started */
+	RLFL_map_track(m, CELL_MARK);
+	unsigned int since;
+	RLFL_map_version(m, &since);
+	t = now();
+	for(i=0; i<iterations; i++)
+		for(y=0; y<64; y++)
+			for(x=0; x<64; x++)
+				RLFL_set_flag(m, x + 1, y + 1, CELL_MARK);
+	report("set_flag tracked", now() - t, iterations, 0);
+
+	t = now();
+	for(i=0; i<iterations; i++)
+		RLFL_map_dirty(m, since, NULL, 0);
+	report("map_dirty", now() - t, iterations, 0);
+	RLFL_map_track(m, 0);
+
+	static uint8_t bits[(64 * 64) / 8];
+	t = now();
+	for(i=0; i<iterations; i++)
+		RLFL_has_flag_rect(m, 1, 1, 64, 64, CELL_WALK, bits);
+	report("has_flag_rect (64x64)", now() - t, iterations, 0);
+
+	/* Whole map layer, read two maps and write one */
+	int other = RLFL_new_map_layout(w, h, RLFL_map_layout(m));
+	if(other >= 0)
+	{
+		t = now();
+		for(i=0; i<iterations; i++)
+			RLFL_merge_map(m, other, MERGE_OR, CELL_MEMO|CELL_LIT);
+		report("merge_map", now() - t, iterations, 3 * plane);
+		RLFL_wipe_map(other);
+	}
+
+	/* Snapshot, change one cell and discard */
+	t = now();
+	for(i=0; i<iterations; i++)
+	{
+		int c = RLFL_clone_map(m);
+		if(c < 0) break;
+		RLFL_set_flag(c, w / 2, h / 2, CELL_OPEN);
+		RLFL_wipe_map(c);
+	}
+	report("clone_map", now() - t, iterations, 0);
+
+	/* The same with the journal, and a 64x64 batch of changes */
+	RLFL_map_journal(m, 1 << 16);
+	unsigned int mark;
+	t = now();
+	for(i=0; i<iterations; i++)
+	{
+		RLFL_map_checkpoint(m, &mark);
+		RLFL_set_flag(m, w / 2, h / 2, CELL_OPEN);
+		RLFL_map_rollback(m, mark);
+	}
+	report("checkpoint+rollback", now() - t, iterations, 0);
+
+	t = now();
+	for(i=0; i<iterations; i++)
+	{
+		RLFL_map_checkpoint(m, &mark);
+		for(y=0; y<64; y++)
+			for(x=0; x<64; x++)
+				RLFL_set_flag(m, x + 1, y + 1, CELL_OCUP);
+		RLFL_map_rollback(m, mark);
+	}
+	report("rollback (64x64)", now() - t, iterations, 0);
+	RLFL_map_journal(m, 0);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Dijkstra maps, the scan is far slower than the
+ * 			set up pass so this runs on a smaller map
+ +-----------------------------------------------------------+
+ */
+static void
+bench_path(unsigned int m, int iterations)
+{
+	unsigned int w, h;
+	RLFL_map_size(m, &w, &h);
+	double t;
+	int i;
+
+	t = now();
+	for(i=0; i<iterations; i++)
+	{
+		int p = RLFL_path_fill_map(m, w / 2, h / 2, 0.0, false);
+		if(p >= 0) RLFL_path_wipe_map(m, p);
+	}
+	report("path_fill_map", now() - t, iterations, 0);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Connected regions, building them, a door opened
+ * 			and closed in the middle and the query a flood
+ * 			fill would answer
+ +-----------------------------------------------------------+
+ */
+static void
+bench_regions(unsigned int m, int iterations)
+{
+	unsigned int w, h;
+	RLFL_map_size(m, &w, &h);
+	unsigned int cx = w / 2, cy = h / 2;
+	double t;
+	int i;
+
+	t = now();
+	for(i=0; i<iterations; i++)
+		RLFL_region_track(m, CELL_WALK);
+	report("region build", now() - t, iterations, 0);
+
+	t = now();
+	for(i=0; i<iterations * 100; i++)
+	{
+		RLFL_set_flag(m, cx, cy, CELL_WALK);
+		RLFL_clear_flag(m, cx, cy, CELL_WALK);
+	}
+	report("region open+close", now() - t, iterations * 100, 0);
+
+	t = now();
+	for(i=0; i<iterations * 100; i++)
+		RLFL_region_connected(m, w / 4, h / 4, (3 * w) / 4, (3 * h) / 4);
+	report("region connected", now() - t, iterations * 100, 0);
+
+	RLFL_region_track(m, 0);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	A stack of forty levels joined by stairs, a path
+ * 			from level 3 to level 7 and a path map of all of it
+ +-----------------------------------------------------------+
+ */
+static void
+bench_stack(unsigned int size, int iterations)
+{
+	unsigned int levels = 40, l, m[40];
+	int s = RLFL_stack_new();
+	RLFL_set_max_maps(levels + 8);
+	for(l=0; l<levels; l++)
+	{
+		m[l] = make_cave(size, size, 8, MAP_DENSE);
+		RLFL_stack_add(s, m[l]);
+	}
+
+	/* Two stairs down from every level, walkable at both ends */
+	for(l=0; l+1<levels; l++)
+	{
+		int k;
+		for(k=0; k<2; k++)
+		{
+			unsigned int x = 1 + RLFL_randint(size - 2), y = 1 + RLFL_randint(size - 2);
+			RLFL_set_flag(m[l], x, y, CELL_OPEN|CELL_WALK);
+			RLFL_set_flag(m[l + 1], x, y, CELL_OPEN|CELL_WALK);
+			RLFL_stack_link(s, l, x, y, l + 1, x, y, PORTAL_STAIRS, 1);
+			RLFL_stack_link(s, l + 1, x, y, l, x, y, PORTAL_STAIRS, 1);
+		}
+	}
+	RLFL_set_flag(m[3], 1, 1, CELL_OPEN|CELL_WALK);
+	RLFL_set_flag(m[7], size - 2, size - 2, CELL_OPEN|CELL_WALK);
+
+	printf("%u levels of %ux%u\n", levels, size, size);
+	unsigned int *steps = (unsigned int *)malloc(sizeof(unsigned int) * 3 * size * size);
+	double t = now();
+	int i, n = 0;
+	for(i=0; i<iterations; i++)
+		n = RLFL_stack_path(s, 3, 1, 1, 7, size - 2, size - 2, PORTAL_ALL, 0.0, steps, size * size);
+	report("stack_path 3 to 7", now() - t, iterations, 0);
+	if(n < 0)
+		printf("  (no path %d)\n", n);
+
+	t = now();
+	for(i=0; i<iterations; i++)
+	{
+		int p = RLFL_stack_fill_map(s, 7, size - 2, size - 2, PORTAL_ALL, 0.0);
+		if(p >= 0) RLFL_stack_wipe_map(s, p);
+	}
+	report("stack_fill_map", now() - t, iterations, 0);
+
+	free(steps);
+	RLFL_stack_delete(s);
+	RLFL_wipe_all();
+	RLFL_set_max_maps(RLFL_MAX_MAPS);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Each algorithm on its own, from the middle of the map
+ +-----------------------------------------------------------+
+ */
+static void
+bench_kernels(unsigned int m, int iterations)
+{
+	const char *fov_names[] = { "", "fov circular (r20)", "fov diamond (r20)",
+								"fov shadow (r20)", "fov digital (r20)",
+								"fov restrictive (r20)", "fov permissive (r20)",
+								"fov table (r20)", "fov shadow iter (r20)",
+								"fov symmetric (r20)" };
+	unsigned int w, h;
+	RLFL_map_size(m, &w, &h);
+	unsigned int cx = w / 2, cy = h / 2;
+	double t;
+	int i, k, a;
+
+	/* Lines to every cell of a 41x41 square */
+	t = now();
+	for(i=0; i<iterations; i++)
+		for(k=0; k<(41 * 41); k++)
+			RLFL_los(m, cx, cy, cx + (k % 41) - 20, cy + (k / 41) - 20);
+	report("los (41x41)", now() - t, iterations, 0);
+
+	for(a=FOV_CIRCULAR; a<=FOV_SYMMETRIC; a++)
+	{
+		t = now();
+		for(i=0; i<iterations; i++)
+			RLFL_fov(m, cx, cy, 20, a, false, true);
+		report(fov_names[a], now() - t, iterations, 0);
+	}
+
+	/* Paths corner to corner of the middle half */
+	RLFL_set_flag(m, w / 4, h / 4, CELL_OPEN|CELL_WALK);
+	RLFL_set_flag(m, (3 * w) / 4, (3 * h) / 4, CELL_OPEN|CELL_WALK);
+	t = now();
+	for(i=0; i<iterations; i++)
+	{
+		int p = RLFL_path_create(m, w / 4, h / 4, (3 * w) / 4, (3 * h) / 4, PATH_BASIC, -1, 0, 0.0);
+		if(p >= 0) RLFL_path_delete(p);
+	}
+	report("path basic", now() - t, iterations, 0);
+
+	t = now();
+	for(i=0; i<iterations; i++)
+	{
+		int p = RLFL_path_create(m, w / 4, h / 4, (3 * w) / 4, (3 * h) / 4, PATH_ASTAR, -1, 0, 0.0);
+		if(p >= 0) RLFL_path_delete(p);
+	}
+	report("path astar", now() - t, iterations, 0);
+
+	t = now();
+	for(i=0; i<iterations; i++)
+	{
+		int p = RLFL_project_beam(m, cx, cy, cx + 20, cy + 7, -1, 0);
+		if(p >= 0) RLFL_project_delete(p);
+	}
+	report("project beam", now() - t, iterations, 0);
+
+	t = now();
+	for(i=0; i<iterations; i++)
+	{
+		int p = RLFL_project_ball(m, cx, cy, cx + 10, cy + 4, 8, -1, 0);
+		if(p >= 0) RLFL_project_delete(p);
+	}
+	report("project ball (r8)", now() - t, iterations, 0);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Map files against copying the cells into a new map.
+ * 			A load only maps the file, reads fault in the pages
+ * 			they touch. (The first fov on a map clears all of it
+ * 			and so copies every page.)
+ +-----------------------------------------------------------+
+ */
+static void
+bench_file(unsigned int m, int iterations)
+{
+	const char *path = "/tmp/rlfl-bench.map";
+	unsigned int w, h;
+	RLFL_map_size(m, &w, &h);
+	double t;
+	int i;
+
+	t = now();
+	for(i=0; i<iterations; i++)
+		RLFL_map_save(m, path);
+	report("map_save", now() - t, iterations, 0);
+
+	t = now();
+	for(i=0; i<iterations; i++)
+	{
+		int l = RLFL_map_load(path);
+		if(l < 0) break;
+		RLFL_los(l, w / 2, h / 2, (w / 2) + 8, (h / 2) + 5);
+		RLFL_wipe_map(l);
+	}
+	report("map_load + los", now() - t, iterations, 0);
+
+	RLFL_cell_t *cells = (RLFL_cell_t *)malloc(sizeof(RLFL_cell_t) * w * h);
+	RLFL_map_read(m, cells);
+	t = now();
+	for(i=0; i<iterations; i++)
+	{
+		int c = RLFL_new_map(w, h);
+		if(c < 0) break;
+		RLFL_map_write(c, cells);
+		RLFL_los(c, w / 2, h / 2, (w / 2) + 8, (h / 2) + 5);
+		RLFL_wipe_map(c);
+	}
+	report("new_map + write + los", now() - t, iterations, 0);
+	free(cells);
+	remove(path);
+}
+
+/*
+ +-----------------------------------------------------------+
+ * @desc	Mostly empty world with scattered rooms
+ +-----------------------------------------------------------+
+ */
+static void
+bench_sparse(unsigned int size, int iterations)
+{
+	int m = RLFL_new_map_layout(size, size, MAP_SPARSE);
+	if(m < 0)
+	{
+		fprintf(stderr, "Unable to create %ux%u sparse map (%d)\n", size, size, m);
+		return;
+	}
+
+	/* One 40x40 room per 1000x1000 */
+	unsigned int rx, ry, x, y, rooms = 0;
+	for(ry=500; ry+40<size; ry+=1000)
+	{
+		for(rx=500; rx+40<size; rx+=1000)
+		{
+			for(y=ry; y<ry+40; y++)
+				for(x=rx; x<rx+40; x++)
+					RLFL_set_flag(m, x, y, CELL_SEEN|CELL_OPEN|CELL_WALK);
+			rooms++;
+		}
+	}
+
+	unsigned int used, total;
+	RLFL_map_tiles(m, &used, &total);
+	printf("%ux%u sparse map, %u rooms, %u of %u tiles, %.1f MB (dense %.1f MB)\n",
+		   size, size, rooms, used, total,
+		   (used * RLFL_TILE * RLFL_TILE * sizeof(RLFL_cell_t)) / (1024.0 * 1024.0),
+		   ((double)size * size * sizeof(RLFL_cell_t)) / (1024.0 * 1024.0));
+
+	double t;
+	int i;
+	t = now();
+	for(i=0; i<iterations; i++)
+		RLFL_fov(m, 520, 520, 50, FOV_SHADOW, true, true);
+	report("fov (r50, lit)", now() - t, iterations, 0);
+
+	t = now();
+	for(i=0; i<iterations; i++)
+		RLFL_los(m, 501, 501, 538, 530);
+	report("los", now() - t, iterations, 0);
+
+	t = now();
+	for(i=0; i<iterations; i++)
+	{
+		int p = RLFL_path_create(m, 501, 501, 538, 530, PATH_ASTAR, -1, 0, 0.0);
+		if(p >= 0) RLFL_path_delete(p);
+	}
+	report("path astar", now() - t, iterations, 0);
+
+	RLFL_wipe_map(m);
+}
+
+/*
+ +-----------------------------------------------------------+
+ * @desc	One worker of bench_ctx, fov all over its own map
+ +-----------------------------------------------------------+
+ */
+typedef struct {
+	unsigned int m;
+	int iterations;
+	RLFL_ctx_t *ctx;
+} worker_t;
+
+static void *
+fov_worker(void *arg)
+{
+	worker_t *w = (worker_t *)arg;
+	unsigned int mw, mh;
+	RLFL_map_size(w->m, &mw, &mh);
+	int i;
+	for(i=0; i<w->iterations; i++)
+	{
+		unsigned int x = 1 + RLFL_randint_ctx(w->ctx, mw - 2);
+		unsigned int y = 1 + RLFL_randint_ctx(w->ctx, mh - 2);
+		RLFL_fov_ctx(w->ctx, w->m, x, y, 20, FOV_PERMISSIVE, false, true);
+	}
+	return NULL;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	The same fov work on `threads` maps, one after the
+ * 			other and then each map on its own thread with its
+ * 			own context
+ +-----------------------------------------------------------+
+ */
+static void
+bench_ctx(unsigned int size, int threads, int iterations)
+{
+	worker_t w[threads];
+	pthread_t tid[threads];
+	int i;
+	for(i=0; i<threads; i++)
+	{
+		w[i].m = make_cave(size, size, 8, MAP_DENSE);
+		w[i].iterations = iterations * 100;
+		w[i].ctx = RLFL_ctx_new();
+		RLFL_ctx_seed(w[i].ctx, i);
+	}
+
+	printf("%d %ux%u maps, fov permissive r20\n", threads, size, size);
+	double t = now();
+	for(i=0; i<threads; i++)
+		fov_worker(&w[i]);
+	report("fov serial", now() - t, iterations * 100 * threads, 0);
+
+	t = now();
+	for(i=0; i<threads; i++)
+		pthread_create(&tid[i], NULL, fov_worker, &w[i]);
+	for(i=0; i<threads; i++)
+		pthread_join(tid[i], NULL);
+	report("fov threads", now() - t, iterations * 100 * threads, 0);
+
+	for(i=0; i<threads; i++)
+	{
+		RLFL_ctx_delete(w[i].ctx);
+		RLFL_wipe_map(w[i].m);
+	}
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	FOV of `n` viewers, one after the other with the
+ * 			SEEN flags read back, and as a batch on one thread
+ * 			and on all of them
+ +-----------------------------------------------------------+
+ */
+static void
+bench_batch(unsigned int size, unsigned int n, int iterations)
+{
+	int m = make_cave(size, size, 8, MAP_DENSE);
+	RLFL_viewer_t *v = (RLFL_viewer_t *)calloc(n, sizeof(RLFL_viewer_t));
+	if(m < 0 || v == NULL)
+		return;
+
+	unsigned int i, rect[4];
+	for(i=0; i<n; i++)
+	{
+		v[i].x = 1 + RLFL_randint(size - 2);
+		v[i].y = 1 + RLFL_randint(size - 2);
+		v[i].radius = 8;
+		v[i].algorithm = FOV_SHADOW;
+		RLFL_fov_window(m, v[i].x, v[i].y, v[i].radius, rect);
+		v[i].bits = (uint8_t *)malloc(((rect[2] * rect[3]) + 7) / 8);
+	}
+
+	printf("%ux%u map, %u viewers, fov r8\n", size, size, n);
+	int k;
+	double t = now();
+	for(k=0; k<iterations; k++)
+	{
+		for(i=0; i<n; i++)
+		{
+			RLFL_fov(m, v[i].x, v[i].y, v[i].radius, v[i].algorithm, false, true);
+			RLFL_fov_window(m, v[i].x, v[i].y, v[i].radius, rect);
+			RLFL_has_flag_rect(m, rect[0], rect[1], rect[2], rect[3], CELL_SEEN, v[i].bits);
+		}
+	}
+	report("fov+has_flag_rect", now() - t, iterations, 0);
+
+	t = now();
+	for(k=0; k<iterations; k++)
+		RLFL_fov_batch(m, v, n, true, 1);
+	report("fov_batch (1 thread)", now() - t, iterations, 0);
+
+	t = now();
+	for(k=0; k<iterations; k++)
+		RLFL_fov_batch(m, v, n, true, 0);
+	report("fov_batch", now() - t, iterations, 0);
+
+	for(i=0; i<n; i++)
+		free(v[i].bits);
+	free(v);
+	RLFL_wipe_map(m);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned int size = (argc > 1) ? atoi(argv[1]) : 2000;
+	int iterations = (argc > 2) ? atoi(argv[2]) : 10;
+	unsigned int psize = (argc > 3) ? atoi(argv[3]) : (size / 8);
+
+	const char *names[] = { "", "dense", "planes", "tiled", "sparse" };
+	unsigned int layout;
+
+	/* The same maps every run, so runs can be compared */
+	RLFL_seed(1);
+
+	printf("%d bytes per cell, %d iterations\n", (int)sizeof(RLFL_cell_t), iterations);
+	for(layout=MAP_DENSE; layout<=MAP_SPARSE; layout++)
+	{
+		int m = make_cave(size, size, 8, layout);
+		if(m < 0)
+		{
+			fprintf(stderr, "Unable to create %ux%u map (%d)\n", size, size, m);
+			return 1;
+		}
+
+		printf("%ux%u map, %s\n", size, size, names[layout]);
+		bench_map(m, iterations);
+		bench_file(m, iterations);
+
+		int pm = make_cave(psize, psize, 8, layout);
+		if(pm >= 0)
+		{
+			printf("%ux%u map, %s\n", psize, psize, names[layout]);
+			bench_path(pm, iterations);
+			bench_regions(pm, iterations);
+			bench_kernels(pm, iterations * 10);
+		}
+		RLFL_wipe_all();
+	}
+
+	bench_sparse(20000, iterations);
+	bench_stack(psize, iterations);
+	bench_ctx(256, 4, iterations);
+	bench_batch(size, 300, iterations);
+	return 0;
+}
@@ -8,19 +8,27 @@ rlfl = Extension('rlfl',
                     ('RLFL_MAX_MAPS', 16),
                     ('RLFL_MAX_PATHS', 16),
                     ('RLFL_MAX_PROJECTS', 16),
+                    ('RLFL_MAX_STACKS', 16),
                     ('RLFL_MAX_RANGE', 60),
                     ('RLFL_MAX_RADIUS', 60),
                     ('RLFL_MAX_WIDTH', 5000),
                     ('RLFL_MAX_HEIGHT', 5000),
                  ],
+                 libraries = ['rt'],
                  sources = [
+                    'src/ctx.c',
                     'src/random.c',
                     'src/list_t.c',
                     'src/rlfl.c',
+                    'src/map.c',
+                    'src/mapfile.c',
+                    'src/region.c',
+                    'src/journal.c',
                     'src/los.c',
                     'src/dijkstra.c',
                     'src/path_astar.c',
                     'src/path_basic.c',
+                    'src/stack.c',
                     'src/project.c',
                     'src/fov_circular_raycasting.c',
                     'src/fov_recursive_shadowcasting.c',
@@ -28,6 +36,10 @@ rlfl = Extension('rlfl',
                     'src/fov_permissive.c',
                     'src/fov_restrictive.c',
                     'src/fov_digital.c',
+                    'src/fov_view_table.c',
+                    'src/fov_iterative_shadowcasting.c',
+                    'src/fov_symmetric_shadowcasting.c',
+                    'src/fov_batch.c',
                     'src/rlftopy.c'
                 ]
 )
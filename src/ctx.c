@@ -0,0 +1,100 @@
+/*
+	RLFL contexts.
+
+	Create one context per thread to run the algorithms in parallel.
+
+    Copyright (C) 2011
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+    <jtm@robot.is>
+*/
+#include "headers/rlfl.h"
+#include "headers/ctx.h"
+
+RLFL_ctx_t RLFL_default_ctx = { .mti = RLFL_MT_N + 1 };
+/*
+ +-----------------------------------------------------------+
+ * @desc	New context, seeded from the clock on first use
+ +-----------------------------------------------------------+
+ */
+RLFL_ctx_t *
+RLFL_ctx_new(void)
+{
+	RLFL_ctx_t *ctx = (RLFL_ctx_t *)calloc(sizeof(RLFL_ctx_t), 1);
+	if(ctx == NULL)
+		return NULL;
+
+	ctx->mti = RLFL_MT_N + 1;
+	return ctx;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Free context and its scratch
+ +-----------------------------------------------------------+
+ */
+void
+RLFL_ctx_delete(RLFL_ctx_t *ctx)
+{
+	if(ctx == NULL)
+		return;
+
+	unsigned int s;
+	for(s=0; s<SCRATCH_COUNT; s++)
+		free(ctx->scratch[s]);
+	free(ctx);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Seed the random numbers of a context
+ +-----------------------------------------------------------+
+ */
+void
+RLFL_ctx_seed(RLFL_ctx_t *ctx, unsigned long seed)
+{
+	ctx_seed(ctx, seed);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Seed the random numbers of the default context
+ +-----------------------------------------------------------+
+ */
+void
+RLFL_seed(unsigned long seed)
+{
+	ctx_seed(&RLFL_default_ctx, seed);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Scratch buffer `s` of at least `size` bytes. The
+ * 			contents are kept when it grows.
+ * @return	NULL if out of memory, the old buffer is kept
+ +-----------------------------------------------------------+
+ */
+void *
+ctx_scratch(RLFL_ctx_t *ctx, unsigned int s, size_t size)
+{
+	if(size <= ctx->scratch_size[s])
+		return ctx->scratch[s];
+
+	/* Grow geometrically, repeated calls settle quickly */
+	size_t grow = MAX(size, ctx->scratch_size[s] * 2);
+	void *p = realloc(ctx->scratch[s], grow);
+	if(p == NULL)
+		return NULL;
+
+	ctx->scratch[s] = p;
+	ctx->scratch_size[s] = grow;
+	return p;
+}
@@ -24,16 +24,17 @@
 */
 #include "headers/rlfl.h"
 #include "headers/dijkstra.h"
+#include "headers/map.h"
 
 const short nbDirs[8][2] = {{0,-1},{0,1},{-1,0},{1,0},{-1,-1},{-1,1},{1,-1},{1,1}};
 
 static err dijkstra_scan(RLFL_dijkstra_map* map, int range);
-static RLFL_dijkstra_map* init_dijkstra_map(unsigned int m, float dcost);
+static RLFL_dijkstra_map* init_dijkstra_map(const map_view_t *v, float dcost);
 static err add_goal_point(RLFL_dijkstra_map* map, unsigned int x, unsigned int y);
 //static err add_cost_point(RLFL_dijkstra_map* map, unsigned int x, unsigned int y);
 static void free_dijkstra_map(RLFL_dijkstra_map* map);
 //static void DEBUG_print_map(RLFL_dijkstra_map* map);
-static err save_dijkstra_map(unsigned int m, unsigned int p, RLFL_dijkstra_map* dmap);
+static err save_dijkstra_map(const map_view_t *v, unsigned int p, RLFL_dijkstra_map* dmap);
 
 /*
  +-----------------------------------------------------------+
@@ -43,13 +44,14 @@ static err save_dijkstra_map(unsigned int m, unsigned int p, RLFL_dijkstra_map*
 err
 RLFL_path_fill_map(unsigned int m, unsigned int ox, unsigned int oy, float dcost, bool safety)
 {
-	if(!RLFL_map_valid(m))
+	map_view_t v;
+	if(view_open(&v, m))
 		return RLFL_ERR_NO_MAP;
 
-	if(!(RLFL_cell_valid(m, ox, oy)))
+	if(!view_in(&v, ox, oy))
 		return RLFL_ERR_OUT_OF_BOUNDS;
 
-	RLFL_map_t* map = RLFL_map_store[m];
+	RLFL_map_t* map = v.map;
 	unsigned int pm;
 	for(pm=0; pm<RLFL_MAX_PATHS; pm++){
 		if(!map->path_map[pm]) break;
@@ -62,7 +64,7 @@ RLFL_path_fill_map(unsigned int m, unsigned int ox, unsigned int oy, float dcost
 		return RLFL_ERR_GENERIC;
 
 	/* prepare */
-	RLFL_dijkstra_map* dmap = init_dijkstra_map(m, dcost);
+	RLFL_dijkstra_map* dmap = init_dijkstra_map(&v, dcost);
 
 	/* Add the origin as a goal */
 	add_goal_point(dmap, ox, oy);
@@ -93,7 +95,7 @@ RLFL_path_fill_map(unsigned int m, unsigned int ox, unsigned int oy, float dcost
 	}
 
 	/* Save the map */
-	save_dijkstra_map(m, pm, dmap);
+	save_dijkstra_map(&v, pm, dmap);
 
 	/* Cleanup */
 	free_dijkstra_map(dmap);
@@ -106,10 +108,11 @@ RLFL_path_fill_map(unsigned int m, unsigned int ox, unsigned int oy, float dcost
 err
 RLFL_path_fill_custom_map(unsigned int m, unsigned long flags, float dcost)
 {
-	if(!RLFL_map_valid(m))
+	map_view_t v;
+	if(view_open(&v, m))
 		return RLFL_ERR_NO_MAP;
 
-	RLFL_map_t* map = RLFL_map_store[m];
+	RLFL_map_t* map = v.map;
 	unsigned int pm;
 	for(pm=0; pm<RLFL_MAX_PATHS; pm++){
 		if(!map->path_map[pm]) break;
@@ -122,13 +125,13 @@ RLFL_path_fill_custom_map(unsigned int m, unsigned long flags, float dcost)
 		return RLFL_ERR_GENERIC;
 
 	/* prepare */
-	RLFL_dijkstra_map* dmap = init_dijkstra_map(m, dcost);
+	RLFL_dijkstra_map* dmap = init_dijkstra_map(&v, dcost);
 
 	int x, y;
 	for(x=0; x<map->width; x++)
 		for(y=0; y<map->height; y++)
 	{
-		if(CELL(m, x, y) & flags)
+		if(view_get(&v, x, y) & flags)
 		{
 			/* Add the unexplored cell */
 			add_goal_point(dmap, x, y);
@@ -141,7 +144,7 @@ RLFL_path_fill_custom_map(unsigned int m, unsigned long flags, float dcost)
 //	DEBUG_print_map(dmap);
 
 	/* Save the map */
-	save_dijkstra_map(m, pm, dmap);
+	save_dijkstra_map(&v, pm, dmap);
 
 	/* Cleanup */
 	free_dijkstra_map(dmap);
@@ -155,10 +158,11 @@ RLFL_path_fill_custom_map(unsigned int m, unsigned long flags, float dcost)
 err
 RLFL_path_fill_autoexplore_map(unsigned int m, unsigned long flags, float dcost)
 {
-	if(!RLFL_map_valid(m))
+	map_view_t v;
+	if(view_open(&v, m))
 		return RLFL_ERR_NO_MAP;
 
-	RLFL_map_t* map = RLFL_map_store[m];
+	RLFL_map_t* map = v.map;
 	unsigned int pm;
 	for(pm=0; pm<RLFL_MAX_PATHS; pm++){
 		if(!map->path_map[pm]) break;
@@ -171,27 +175,27 @@ RLFL_path_fill_autoexplore_map(unsigned int m, unsigned long flags, float dcost)
 		return RLFL_ERR_GENERIC;
 
 	/* prepare */
-	RLFL_dijkstra_map* dmap = init_dijkstra_map(m, dcost);
+	RLFL_dijkstra_map* dmap = init_dijkstra_map(&v, dcost);
 
 	int x, y;
 	for(x=0; x<map->width; x++)
 		for(y=0; y<map->height; y++)
 	{
 		/* handle CELL_PASS */
-		if(CELL(m, x, y) & (CELL_PASS))
+		if(view_get(&v, x, y) & (CELL_PASS))
 		{
 			/* Remove impassibility */
-			if(!(CELL(m, x, y) & (CELL_PERM)))
+			if(!(view_get(&v, x, y) & (CELL_PERM)))
 				dmap->links[x + (y * map->width)].state = 0;
 		}
 		/*
 		 * Add all unseen cells as goals
 		 * */
-		if(!(CELL(m, x, y) & CELL_MEMO)
-			|| CELL(m, x, y) & (flags))
+		if(!(view_get(&v, x, y) & CELL_MEMO)
+			|| view_get(&v, x, y) & (flags))
 		{
 			/* Remove impassibility */
-			if(!(CELL(m, x, y) & (CELL_PERM)))
+			if(!(view_get(&v, x, y) & (CELL_PERM)))
 				dmap->links[x + (y * map->width)].state = 0;
 
 			/* Add the unexplored cell */
@@ -205,7 +209,7 @@ RLFL_path_fill_autoexplore_map(unsigned int m, unsigned long flags, float dcost)
 //	DEBUG_print_map(dmap);
 
 	/* Save the map */
-	save_dijkstra_map(m, pm, dmap);
+	save_dijkstra_map(&v, pm, dmap);
 
 	/* Cleanup */
 	free_dijkstra_map(dmap);
@@ -217,12 +221,12 @@ RLFL_path_fill_autoexplore_map(unsigned int m, unsigned long flags, float dcost)
  *
  * */
 err
-save_dijkstra_map(unsigned int m, unsigned int p, RLFL_dijkstra_map* dmap)
+save_dijkstra_map(const map_view_t *v, unsigned int p, RLFL_dijkstra_map* dmap)
 {
-	if(!RLFL_map_valid(m) || !RLFL_map_store[m]->path_map[p])
+	RLFL_map_t* map = v->map;
+	if(!map->path_map[p])
 		return RLFL_ERR_NO_MAP;
 
-	RLFL_map_t* map = RLFL_map_store[m];
 	int i;
 	for(i=0; i<map->cellcnt; i++)
 	{
@@ -241,17 +245,18 @@ err
 RLFL_path_step_map(unsigned int m, unsigned int p, unsigned int ox, unsigned int oy,
 				   unsigned int *x, unsigned int *y)
 {
-	if(!RLFL_map_valid(m))
+	map_view_t v;
+	if(view_open(&v, m))
 		return RLFL_ERR_NO_MAP;
 
-	if(!(RLFL_cell_valid(m, ox, oy)))
+	if(!view_in(&v, ox, oy))
 		return RLFL_ERR_OUT_OF_BOUNDS;
 
 	if(p > RLFL_MAX_PATHS)
 		return RLFL_ERR_NO_PATH;
 
-	RLFL_map_t* map = RLFL_map_store[m];
-	if(!RLFL_map_store[m]->path_map[p])
+	RLFL_map_t* map = v.map;
+	if(!map->path_map[p])
 		return RLFL_ERR_NO_PATH;
 
 	int i, xx, yy, j=-1;
@@ -260,7 +265,7 @@ RLFL_path_step_map(unsigned int m, unsigned int p, unsigned int ox, unsigned int
 	{
 		xx = (ox + nbDirs[i][0]);
 		yy = (oy + nbDirs[i][1]);
-		if(!RLFL_cell_valid(m, xx, yy))
+		if(!view_in(&v, xx, yy))
 			continue;
 
 		int cc = map->path_map[p][(xx + (yy * map->width))];
@@ -297,9 +302,10 @@ RLFL_path_wipe_map(unsigned int m, unsigned int p)
 	if(!RLFL_map_valid(m))
 		return RLFL_ERR_NO_MAP;
 
-	RLFL_map_t *map = RLFL_map_store[m];
+	RLFL_map_t *map = RLFL_MAP(m);
 	if(map->path_map[p]) {
-		free(map->path_map[p]);
+		if(!map_in_file(map, map->path_map[p]))
+			free(map->path_map[p]);
 		map->path_map[p] = NULL;
 	}
 
@@ -482,7 +488,7 @@ DEBUG_print_map(RLFL_dijkstra_map* map)
 void
 DEBUG_print_path_map(unsigned int m, unsigned int p)
 {
-	RLFL_map_t* map = RLFL_map_store[m];
+	RLFL_map_t* map = RLFL_MAP(m);
 
 	int x, y;
 	for (y=0; y<map->height; y++) {
@@ -515,9 +521,9 @@ DEBUG_print_path_map(unsigned int m, unsigned int p)
  *
  */
 RLFL_dijkstra_map*
-init_dijkstra_map(unsigned int m, float dcost)
+init_dijkstra_map(const map_view_t *v, float dcost)
 {
-	RLFL_map_t* map = RLFL_map_store[m];
+	RLFL_map_t* map = v->map;
 
 	RLFL_dijkstra_map* dmap = (RLFL_dijkstra_map *)calloc(sizeof(RLFL_dijkstra_map), 1);
 	dmap->links = (link *)calloc(sizeof(link), (map->width * map->height));
@@ -532,7 +538,7 @@ init_dijkstra_map(unsigned int m, float dcost)
 			dmap->links[k].x = x;
 			dmap->links[k].y = y;
 
-			if(RLFL_has_flag(m, x, y, (CELL_OPEN|CELL_WALK)))
+			if(view_has(v, x, y, (CELL_OPEN|CELL_WALK)))
 			{
 				// Terrain cost
 				dmap->links[k].cost = 1;
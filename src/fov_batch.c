@@ -0,0 +1,192 @@
+/*
+	RLFL FOV batches.
+
+	Many FOVs on one map, each marking a bitset of its own rather
+	than the flags of the map, so the map is only read and the FOVs
+	can run at once. Threads take the next viewer as they finish
+	one, each with a context of its own.
+
+    Copyright (C) 2011
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+    <jtm@robot.is>
+*/
+#include <unistd.h>
+
+#include "headers/rlfl.h"
+#include "headers/map.h"
+#include "headers/fov.h"
+#include "headers/ctx.h"
+
+/* Work shared by the threads of a batch */
+typedef struct {
+	const map_view_t *v;
+	RLFL_viewer_t *viewers;
+	unsigned int n;
+	bool light_walls;
+	unsigned int next;		/* Next viewer to take */
+	err e;					/* First error, RLFL_SUCCESS if none */
+} batch_t;
+
+/* One thread of a batch */
+typedef struct {
+	batch_t *b;
+	RLFL_ctx_t *ctx;
+	pthread_t tid;
+} batch_worker_t;
+
+static void window(const map_view_t *v, unsigned int ox, unsigned int oy, unsigned int radius,
+				   unsigned int *rect);
+static void *work(void *arg);
+/*
+ +-----------------------------------------------------------+
+ * @desc	Rectangle the bits of a FOV cover, x, y, w, h in
+ * 			`rect`. Cells further than `radius` from the origin
+ * 			are never seen.
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_fov_window(unsigned int m, unsigned int ox, unsigned int oy, unsigned int radius,
+				unsigned int *rect)
+{
+	map_view_t v;
+	if(view_open(&v, m))
+		return RLFL_ERR_NO_MAP;
+
+	if(!view_in(&v, ox, oy))
+		return RLFL_ERR_OUT_OF_BOUNDS;
+
+	if(radius >= RLFL_MAX_RADIUS)
+		return RLFL_ERR_GENERIC;
+
+	window(&v, ox, oy, radius, rect);
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	FOV of `n` viewers on map `m`, into the bits of
+ * 			each. The map is not changed. `threads` threads
+ * 			share the work, 0 for one per processor.
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_fov_batch(unsigned int m, RLFL_viewer_t *viewers, unsigned int n, bool light_walls,
+			   unsigned int threads)
+{
+	return RLFL_fov_batch_ctx(&RLFL_default_ctx, m, viewers, n, light_walls, threads);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	RLFL_fov_batch(), the calling thread uses `ctx`
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_fov_batch_ctx(RLFL_ctx_t *ctx, unsigned int m, RLFL_viewer_t *viewers, unsigned int n,
+				   bool light_walls, unsigned int threads)
+{
+	map_view_t v;
+	if(view_open(&v, m))
+		return RLFL_ERR_NO_MAP;
+
+	/* Every viewer is checked before any runs */
+	unsigned int i;
+	for(i=0; i<n; i++)
+	{
+		const RLFL_viewer_t *r = &viewers[i];
+		if(!view_in(&v, r->x, r->y) || r->algorithm < FOV_CIRCULAR || r->algorithm > FOV_SYMMETRIC)
+			return RLFL_ERR_OUT_OF_BOUNDS;
+		if(fov_radius(&v, r->x, r->y, r->radius) >= RLFL_MAX_RADIUS || r->bits == NULL)
+			return RLFL_ERR_GENERIC;
+	}
+
+	if(!threads)
+	{
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = (cpus > 0) ? cpus : 1;
+	}
+	threads = MIN(MIN(threads, n), RLFL_MAX_THREADS);
+
+	batch_t b = { &v, viewers, n, light_walls, 0, RLFL_SUCCESS };
+	batch_worker_t w[RLFL_MAX_THREADS];
+	unsigned int started = 0;
+
+	/* The calling thread is the first worker */
+	for(i=1; i<threads; i++, started++)
+	{
+		w[started].b = &b;
+		if((w[started].ctx = RLFL_ctx_new()) == NULL)
+			break;
+		if(pthread_create(&w[started].tid, NULL, work, &w[started]))
+		{
+			RLFL_ctx_delete(w[started].ctx);
+			break;
+		}
+	}
+	batch_worker_t self = { &b, ctx };
+	work(&self);
+
+	for(i=0; i<started; i++)
+	{
+		pthread_join(w[i].tid, NULL);
+		RLFL_ctx_delete(w[i].ctx);
+	}
+	return b.e;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Rectangle of a FOV, see RLFL_fov_window()
+ +-----------------------------------------------------------+
+ */
+static void
+window(const map_view_t *v, unsigned int ox, unsigned int oy, unsigned int radius,
+	   unsigned int *rect)
+{
+	radius = fov_radius(v, ox, oy, radius);
+	rect[0] = (ox > radius) ? (ox - radius) : 0;
+	rect[1] = (oy > radius) ? (oy - radius) : 0;
+	rect[2] = MIN(ox + radius + 1, v->width) - rect[0];
+	rect[3] = MIN(oy + radius + 1, v->height) - rect[1];
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Run viewers until none is left
+ +-----------------------------------------------------------+
+ */
+static void *
+work(void *arg)
+{
+	batch_worker_t *w = (batch_worker_t *)arg;
+	batch_t *b = w->b;
+	unsigned int i, rect[4];
+	while((i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->n)
+	{
+		const RLFL_viewer_t *r = &b->viewers[i];
+		map_view_t v = *b->v;
+		window(&v, r->x, r->y, r->radius, rect);
+		v.seen = r->bits;
+		v.seen_x = rect[0];
+		v.seen_y = rect[1];
+		v.seen_w = rect[2];
+		v.seen_h = rect[3];
+		memset(r->bits, 0, PACKED_SIZE(rect[2] * rect[3]));
+
+		err e = fov_run(w->ctx, &v, r->x, r->y, fov_radius(&v, r->x, r->y, r->radius),
+						r->algorithm, b->light_walls);
+		err none = RLFL_SUCCESS;
+		if(e)
+			__atomic_compare_exchange_n(&b->e, &none, e, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
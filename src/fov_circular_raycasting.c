@@ -22,6 +22,8 @@
     <jtm@robot.is>
 */
 #include "headers/rlfl.h"
+#include "headers/map.h"
+#include "headers/fov.h"
 
 #define CELL_RADIUS 0.4f
 #define RAY_RADIUS 0.2f
@@ -37,12 +39,11 @@ typedef struct {
 	int destx;
 	int desty;
 } RLFL_bresenham_data_t;
-static RLFL_bresenham_data_t bresenham_data;
 
 // Private
-static void cast_ray(unsigned int m, int xo, int yo, int xd, int yd, int r2, bool light_walls);
-static void RLFL_line_init(int xFrom, int yFrom, int xTo, int yTo);
-static bool RLFL_line_step(int *xCur, int *yCur);
+static void cast_ray(const map_view_t *v, int xo, int yo, int xd, int yd, int r2, bool light_walls);
+static void RLFL_line_init(RLFL_bresenham_data_t *data, int xFrom, int yFrom, int xTo, int yTo);
+static bool RLFL_line_step(RLFL_bresenham_data_t *data, int *xCur, int *yCur);
 /*
  +-----------------------------------------------------------+
  * @desc	Circular ray casting
@@ -52,57 +53,68 @@ err
 RLFL_fov_circular_raycasting(unsigned int m, unsigned int ox, unsigned int oy,
 							unsigned int radius, bool light_walls)
 {
-	if(!RLFL_map_valid(m))
+	map_view_t v;
+	if(view_open(&v, m))
 		return RLFL_ERR_NO_MAP;
 
-	if(!RLFL_cell_valid(m, ox, oy))
+	if(!view_in(&v, ox, oy))
 		return RLFL_ERR_OUT_OF_BOUNDS;
 
 	if(radius >= RLFL_MAX_RADIUS)
 		return RLFL_ERR_GENERIC;
 
+	return fov_circular_raycasting(&v, ox, oy, radius, light_walls);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Circular ray casting on a checked view
+ +-----------------------------------------------------------+
+ */
+err
+fov_circular_raycasting(const map_view_t *v, unsigned int ox, unsigned int oy,
+						unsigned int radius, bool light_walls)
+{
 	int xo, yo;
-	RLFL_map_t *map = RLFL_map_store[m];
 	int xmin = 0, ymin = 0;
-	int xmax = map->width, ymax = map->height;
+	int xmax = v->width, ymax = v->height;
 	int r2 = radius * radius;
 	if(radius > 0)
 	{
 		xmin = MAX(0, ox - radius);
 		ymin = MAX(0, oy - radius);
-		xmax = MIN(map->width, ox + radius + 1);
-		ymax = MIN(map->height, oy + radius + 1);
+		xmax = MIN(v->width, ox + radius + 1);
+		ymax = MIN(v->height, oy + radius + 1);
 	}
 	xo = xmin;
 	yo = ymin;
 	while(xo < xmax)
 	{
-		cast_ray(m, ox, oy, xo++, yo, r2, light_walls);
+		cast_ray(v, ox, oy, xo++, yo, r2, light_walls);
 	}
 	xo = xmax - 1;
 	yo = ymin + 1;
 	while(yo < ymax)
 	{
-		cast_ray(m, ox, oy, xo, yo++, r2, light_walls);
+		cast_ray(v, ox, oy, xo, yo++, r2, light_walls);
 	}
 	xo = xmax-2;
 	yo = ymax-1;
 	while ( xo >= 0 )
 	{
-		cast_ray(m, ox, oy, xo--, yo, r2, light_walls);
+		cast_ray(v, ox, oy, xo--, yo, r2, light_walls);
 	}
 	xo = xmin;
 	yo = ymax - 2;
 	while (yo > 0)
 	{
-		cast_ray(m, ox, oy, xo, yo--, r2, light_walls);
+		cast_ray(v, ox, oy, xo, yo--, r2, light_walls);
 	}
 	if(light_walls)
 	{
-		RLFL_fov_finish(m, xmin, ymin, ox, oy, -1, -1);
-		RLFL_fov_finish(m, ox, ymin, xmax - 1, oy, 1, -1);
-		RLFL_fov_finish(m, xmin, oy, ox, ymax - 1, -1, 1);
-		RLFL_fov_finish(m, ox, oy, xmax - 1, ymax - 1, 1, 1);
+		fov_finish(v, xmin, ymin, ox, oy, -1, -1);
+		fov_finish(v, ox, ymin, xmax - 1, oy, 1, -1);
+		fov_finish(v, xmin, oy, ox, ymax - 1, -1, 1);
+		fov_finish(v, ox, oy, xmax - 1, ymax - 1, 1, 1);
 	}
 
 	return RLFL_SUCCESS;
@@ -113,25 +125,22 @@ RLFL_fov_circular_raycasting(unsigned int m, unsigned int ox, unsigned int oy,
  +-----------------------------------------------------------+
  */
 static void
-cast_ray(unsigned int m, int xo, int yo, int xd, int yd, int r2, bool light_walls)
+cast_ray(const map_view_t *v, int xo, int yo, int xd, int yd, int r2, bool light_walls)
 {
-	RLFL_map_t *map = RLFL_map_store[m];
 	int curx = xo, cury = yo;
 	bool in = false;
 	bool blocked = false;
 	bool end = false;
-	RLFL_line_init(xo, yo, xd, yd);
-	int nc = (map->width * map->height);
-	int offset = curx + (cury * map->width);
-	if (0 <= offset && offset < nc)
+	RLFL_bresenham_data_t data;
+	RLFL_line_init(&data, xo, yo, xd, yd);
+	if (view_in(v, curx, cury))
 	{
 		in = true;
-		RLFL_set_flag(m, curx, cury, CELL_FOV);
+		view_fov(v, curx, cury);
 	}
 	while(!end)
 	{
-		end = RLFL_line_step(&curx, &cury);	// reached xd,yd
-		offset = curx + (cury*map->width);
+		end = RLFL_line_step(&data, &curx, &cury);	// reached xd,yd
 		if (r2 > 0)
 		{
 			// check radius
@@ -139,10 +148,10 @@ cast_ray(unsigned int m, int xo, int yo, int xd, int yd, int r2, bool light_wall
 			if (cur_radius > r2)
 				return;
 		}
-		if (0 <= offset && offset < nc)
+		if (view_in(v, curx, cury))
 		{
 			in = true;
-			if (!blocked && !RLFL_has_flag(m, curx, cury, CELL_OPEN))
+			if (!blocked && !view_has(v, curx, cury, CELL_OPEN))
 			{
 				blocked = true;
 			}
@@ -152,7 +161,7 @@ cast_ray(unsigned int m, int xo, int yo, int xd, int yd, int r2, bool light_wall
 			}
 			if (light_walls || !blocked)
 			{
-				RLFL_set_flag(m, curx, cury, CELL_FOV);
+				view_fov(v, curx, cury);
 			}
 		}
 		else if (in)
@@ -168,9 +177,8 @@ cast_ray(unsigned int m, int xo, int yo, int xd, int yd, int r2, bool light_wall
  +-----------------------------------------------------------+
  */
 static void
-RLFL_line_init(int xFrom, int yFrom, int xTo, int yTo)
+RLFL_line_init(RLFL_bresenham_data_t *data, int xFrom, int yFrom, int xTo, int yTo)
 {
-	RLFL_bresenham_data_t *data = &bresenham_data;
 	if(!data) return;
 	data->origx = xFrom;
 	data->origy = yFrom;
@@ -223,9 +231,8 @@ RLFL_line_init(int xFrom, int yFrom, int xTo, int yTo)
  +-----------------------------------------------------------+
  */
 static bool
-RLFL_line_step(int *xCur, int *yCur)
+RLFL_line_step(RLFL_bresenham_data_t *data, int *xCur, int *yCur)
 {
-	RLFL_bresenham_data_t *data = &bresenham_data;
 	if(!data || !xCur || !yCur)  return false;
 	if((data->stepx * data->deltax) > (data->stepy * data->deltay))
 	{
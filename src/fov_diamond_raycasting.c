@@ -22,6 +22,9 @@
     <jtm@robot.is>
 */
 #include "headers/rlfl.h"
+#include "headers/map.h"
+#include "headers/fov.h"
+#include "headers/ctx.h"
 
 #define IS_OBSCURE(r) ((r->xerr > 0 && r->xerr <= r->xob) || (r->yerr > 0 && r->yerr <= r->yob) )
 
@@ -34,19 +37,22 @@ typedef struct _ray_data_t {
 	bool ignore; // non visible. don't bother processing it
 } ray_data_t;
 
-// variables
-static int origx, origy; // fov origin
-static ray_data_t **raymap; // result rays
-static ray_data_t *raymap2; // temporary rays
-static int perimidx;
+/* State of one call */
+typedef struct {
+	int origx, origy; // fov origin
+	int winx, winy, winw, winh; // part of the map rays can reach
+	ray_data_t **raymap; // result rays
+	ray_data_t *raymap2; // temporary rays
+	int perimidx;
+} diamond_t;
 
 // functions
-static ray_data_t *new_ray(RLFL_map_t *m,int x, int y);
-static void processRay(RLFL_map_t *m, RLFL_list_t perim, ray_data_t *new_ray, ray_data_t *input_ray);
+static ray_data_t *new_ray(diamond_t *d, const map_view_t *v, int x, int y);
+static void processRay(diamond_t *d, const map_view_t *v, RLFL_list_t perim, ray_data_t *new_ray, ray_data_t *input_ray);
 static void process_x_input(ray_data_t *new_ray, ray_data_t *xinput);
 static void process_y_input(ray_data_t *new_ray, ray_data_t *yinput);
-static void merge_input(RLFL_map_t *m, ray_data_t *r);
-static void expandPerimeterFrom(RLFL_map_t *m,RLFL_list_t perim,ray_data_t *r);
+static void merge_input(diamond_t *d, const map_view_t *v, ray_data_t *r);
+static void expandPerimeterFrom(diamond_t *d, const map_view_t *v, RLFL_list_t perim,ray_data_t *r);
 /*
  +-----------------------------------------------------------+
  * @desc	Diamond raycasting
@@ -56,51 +62,97 @@ err
 RLFL_fov_diamond_raycasting(unsigned int m, unsigned int ox, unsigned int oy,
 						   unsigned int radius, bool light_walls)
 {
-	if(!RLFL_map_valid(m))
+	return RLFL_fov_diamond_raycasting_ctx(&RLFL_default_ctx, m, ox, oy, radius, light_walls);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Diamond raycasting with the scratch of `ctx`
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_fov_diamond_raycasting_ctx(RLFL_ctx_t *ctx, unsigned int m, unsigned int ox, unsigned int oy,
+								unsigned int radius, bool light_walls)
+{
+	map_view_t v;
+	if(view_open(&v, m))
 		return RLFL_ERR_NO_MAP;
 
-	if(!RLFL_cell_valid(m, ox, oy))
+	if(!view_in(&v, ox, oy))
 		return RLFL_ERR_OUT_OF_BOUNDS;
 
 	if(radius >= RLFL_MAX_RADIUS)
 		return RLFL_ERR_GENERIC;
 
-	RLFL_map_t *map = RLFL_map_store[m];
+	return fov_diamond_raycasting(ctx, &v, ox, oy, radius, light_walls);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Diamond raycasting on a checked view
+ +-----------------------------------------------------------+
+ */
+err
+fov_diamond_raycasting(RLFL_ctx_t *ctx, const map_view_t *v, unsigned int ox, unsigned int oy,
+					   unsigned int radius, bool light_walls)
+{
 	ray_data_t **rd;
-	int nbcells = map->width*map->height;
+	diamond_t state, *d = &state;
+
+	/* Rays are never further than radius + 1 from the origin */
+	if (radius > 0)
+	{
+		d->winx = MAX((int)ox - (int)radius - 1, 0);
+		d->winy = MAX((int)oy - (int)radius - 1, 0);
+		d->winw = MIN(ox + radius + 2, v->width) - d->winx;
+		d->winh = MIN(oy + radius + 2, v->height) - d->winy;
+	}
+	else
+	{
+		d->winx = d->winy = 0;
+		d->winw = v->width;
+		d->winh = v->height;
+	}
+
+	int nbcells = d->winw*d->winh;
 	RLFL_list_t perim = RLFL_list_create_size(nbcells);
 	int r2 = radius * radius;
 
-	perimidx = 0;
-	raymap = (ray_data_t **)calloc(sizeof(ray_data_t*), nbcells);
-	raymap2 = (ray_data_t *)calloc(sizeof(ray_data_t), nbcells);
-	origx = ox;
-	origy = oy;
+	d->perimidx = 0;
+	d->raymap = (ray_data_t **)ctx_scratch(ctx, SCRATCH_RAYMAP, sizeof(ray_data_t*) * nbcells);
+	d->raymap2 = (ray_data_t *)ctx_scratch(ctx, SCRATCH_RAYS, sizeof(ray_data_t) * nbcells);
+	if(d->raymap == NULL || d->raymap2 == NULL)
+	{
+		RLFL_list_delete(perim);
+		return RLFL_ERR_GENERIC;
+	}
+	memset(d->raymap, 0, sizeof(ray_data_t*) * nbcells);
+	memset(d->raymap2, 0, sizeof(ray_data_t) * nbcells);
+	d->origx = ox;
+	d->origy = oy;
 
-	expandPerimeterFrom(map, perim, new_ray(map, 0, 0));
-	while(perimidx < RLFL_list_size(perim))
+	expandPerimeterFrom(d, v, perim, new_ray(d, v, 0, 0));
+	while(d->perimidx < RLFL_list_size(perim))
 	{
-		ray_data_t *ray = (ray_data_t *)RLFL_list_get(perim, perimidx);
+		ray_data_t *ray = (ray_data_t *)RLFL_list_get(perim, d->perimidx);
 		int distance = 0;
 		if (r2 > 0)
 		{
 			distance = ((ray->xloc * ray->xloc) + (ray->yloc * ray->yloc));
 		}
 
-		perimidx++;
+		d->perimidx++;
 
 		if (distance <= r2)
 		{
-			merge_input(map, ray);
+			merge_input(d, v, ray);
 			if (!ray->ignore)
 			{
-				expandPerimeterFrom(map, perim, ray);
+				expandPerimeterFrom(d, v, perim, ray);
 			}
 		} else ray->ignore=true;
 	}
 
 	// set fov data
-	rd = raymap;
+	rd = d->raymap;
 	int c = nbcells;
 	while(c)
 	{
@@ -112,26 +164,25 @@ RLFL_fov_diamond_raycasting(unsigned int m, unsigned int ox, unsigned int oy,
 		}
 		else
 		{
-			map->cells[(nbcells - c)] |= CELL_FOV;
+			int i = (nbcells - c);
+			view_fov(v, d->winx + (i % d->winw), d->winy + (i / d->winw));
 		}
 		c--;
 		rd++;
 	}
 
 	// Origin always seen
-	RLFL_set_flag(m, origx, origy, CELL_FOV);
+	view_fov(v, d->origx, d->origy);
 
 	// light walls
 	if (light_walls) {
-		int xmin=0, ymin=0, xmax=map->width, ymax=map->height;
-		RLFL_fov_finish(m, xmin, ymin, ox, oy, -1, -1);
-		RLFL_fov_finish(m, ox, ymin, xmax-1, oy, 1, -1);
-		RLFL_fov_finish(m, xmin, oy, ox, ymax-1, -1, 1);
-		RLFL_fov_finish(m, ox, oy, xmax-1, ymax-1, 1, 1);
+		int xmin=d->winx, ymin=d->winy, xmax=d->winx+d->winw, ymax=d->winy+d->winh;
+		fov_finish(v, xmin, ymin, ox, oy, -1, -1);
+		fov_finish(v, ox, ymin, xmax-1, oy, 1, -1);
+		fov_finish(v, xmin, oy, ox, ymax-1, -1, 1);
+		fov_finish(v, ox, oy, xmax-1, ymax-1, 1, 1);
 	}
 
-	free(raymap);
-	free(raymap2);
 	RLFL_list_delete(perim);
 	return RLFL_SUCCESS;
 }
@@ -141,14 +192,14 @@ RLFL_fov_diamond_raycasting(unsigned int m, unsigned int ox, unsigned int oy,
  +-----------------------------------------------------------+
  */
 static ray_data_t *
-new_ray(RLFL_map_t *m, int x, int y)
+new_ray(diamond_t *d, const map_view_t *v, int x, int y)
 {
     ray_data_t *r;
-	if ((unsigned) (x+origx) >= (unsigned)m->width)
+	if ((unsigned) (x+d->origx-d->winx) >= (unsigned)d->winw)
 		return NULL;
-	if ((unsigned) (y+origy) >= (unsigned)m->height)
+	if ((unsigned) (y+d->origy-d->winy) >= (unsigned)d->winh)
 		return NULL;
-	r = &raymap2[x + origx + ((y+origy) * m->width)];
+	r = &d->raymap2[x + d->origx - d->winx + ((y+d->origy-d->winy) * d->winw)];
 	r->xloc = x;
 	r->yloc = y;
 	return r;
@@ -159,14 +210,14 @@ new_ray(RLFL_map_t *m, int x, int y)
  +-----------------------------------------------------------+
  */
 static void
-processRay(RLFL_map_t *m, RLFL_list_t perim, ray_data_t *new_ray, ray_data_t *input_ray)
+processRay(diamond_t *d, const map_view_t *v, RLFL_list_t perim, ray_data_t *new_ray, ray_data_t *input_ray)
 {
 	if(new_ray)
 	{
-		int mapx = origx + new_ray->xloc;
-		int mapy = origy + new_ray->yloc;
+		int mapx = d->origx + new_ray->xloc - d->winx;
+		int mapy = d->origy + new_ray->yloc - d->winy;
 		int newrayidx;
-		newrayidx = mapx + (mapy * m->width);
+		newrayidx = mapx + (mapy * d->winw);
 		if (new_ray->yloc == input_ray->yloc)
 		{
 			new_ray->xinput = input_ray;
@@ -179,7 +230,7 @@ processRay(RLFL_map_t *m, RLFL_list_t perim, ray_data_t *new_ray, ray_data_t *in
 		{
 			RLFL_list_append(perim, new_ray);
 			new_ray->added = true;
-			raymap[newrayidx] = new_ray;
+			d->raymap[newrayidx] = new_ray;
 		}
 	}
 }
@@ -241,7 +292,7 @@ process_y_input(ray_data_t *new_ray, ray_data_t *yinput)
  +-----------------------------------------------------------+
  */
 static void
-merge_input(RLFL_map_t *m, ray_data_t *r)
+merge_input(diamond_t *d, const map_view_t *v, ray_data_t *r)
 {
 	ray_data_t *xi = r->xinput;
 	ray_data_t *yi = r->yinput;
@@ -261,7 +312,7 @@ merge_input(RLFL_map_t *m, ray_data_t *r)
 	{
 		r->ignore=true;
 	}
-	if (! r->ignore && !RLFL_has_flag(m->mnum, r->xloc+origx, r->yloc+origy, CELL_OPEN)) {
+	if (! r->ignore && !view_has(v, r->xloc+d->origx, r->yloc+d->origy, CELL_OPEN)) {
 		r->xerr = r->xob = ABS(r->xloc);
 		r->yerr = r->yob = ABS(r->yloc);
 	}
@@ -272,21 +323,21 @@ merge_input(RLFL_map_t *m, ray_data_t *r)
  +-----------------------------------------------------------+
  */
 static void
-expandPerimeterFrom(RLFL_map_t *m,RLFL_list_t perim,ray_data_t *r) {
+expandPerimeterFrom(diamond_t *d, const map_view_t *v, RLFL_list_t perim,ray_data_t *r) {
 	if ( r->xloc >= 0 )
 	{
-		processRay(m, perim, new_ray(m, r->xloc+1, r->yloc), r);
+		processRay(d, v, perim, new_ray(d, v, r->xloc+1, r->yloc), r);
 	}
 	if ( r->xloc <= 0 )
 	{
-		processRay(m, perim, new_ray(m, r->xloc-1, r->yloc), r);
+		processRay(d, v, perim, new_ray(d, v, r->xloc-1, r->yloc), r);
 	}
 	if ( r->yloc >= 0 )
 	{
-		processRay(m, perim, new_ray(m, r->xloc, r->yloc+1), r);
+		processRay(d, v, perim, new_ray(d, v, r->xloc, r->yloc+1), r);
 	}
 	if ( r->yloc <= 0 )
 	{
-		processRay(m, perim, new_ray(m, r->xloc, r->yloc-1), r);
+		processRay(d, v, perim, new_ray(d, v, r->xloc, r->yloc-1), r);
 	}
 }
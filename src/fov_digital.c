@@ -22,11 +22,13 @@
     <jtm@robot.is>
 */
 #include "headers/rlfl.h"
+#include "headers/map.h"
+#include "headers/fov.h"
 
 #define CCW(x1,y1,x2,y2,x3,y3) ((x1)*(y2) + (x2)*(y3) + (x3)*(y1) - (x1)*(y3) - (x2)*(y1) - (x3)*(y2))
 
-static void draw (RLFL_map_t *m,int cx, int cy, int dis, int px, int py, short light_walls);
-static void trace(RLFL_map_t *m, int dir, int n, int h, int px, int py, bool light_walls);
+static void draw (const map_view_t *v, int cx, int cy, int dis, int px, int py, short light_walls);
+static void trace(const map_view_t *v, int dir, int n, int h, int px, int py, bool light_walls);
 /*
  +-----------------------------------------------------------+
  * @desc	RLFL_fov_digital
@@ -35,25 +37,35 @@ static void trace(RLFL_map_t *m, int dir, int n, int h, int px, int py, bool lig
 err
 RLFL_fov_digital(unsigned int m, unsigned int ox, unsigned int oy, int radius, bool light_walls)
 {
-	if(!RLFL_map_valid(m))
+	map_view_t v;
+	if(view_open(&v, m))
 		return RLFL_ERR_NO_MAP;
 
-	if(!RLFL_cell_valid(m, ox, oy))
+	if(!view_in(&v, ox, oy))
 		return RLFL_ERR_OUT_OF_BOUNDS;
 
 	if(radius >= RLFL_MAX_RADIUS)
 		return RLFL_ERR_GENERIC;
 
+	return fov_digital(&v, ox, oy, radius, light_walls);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Digital fov on a checked view
+ +-----------------------------------------------------------+
+ */
+err
+fov_digital(const map_view_t *v, unsigned int ox, unsigned int oy, int radius, bool light_walls)
+{
 	int dir, i;
-	RLFL_map_t *map = RLFL_map_store[m];
 
 	// Player cell
-	RLFL_set_flag(m, ox, oy, CELL_FOV);
+	view_fov(v, ox, oy);
 
 	// calculate fov using digital lines
 	for (dir=0; dir < 8; dir++) {
 		for (i =0; i < radius+1; i++) {
-			trace(map, dir, radius, i, ox, oy, light_walls);
+			trace(v, dir, radius, i, ox, oy, light_walls);
 		}
 	}
 
@@ -65,18 +77,18 @@ RLFL_fov_digital(unsigned int m, unsigned int ox, unsigned int oy, int radius, b
  +-----------------------------------------------------------+
  */
 static void
-draw(RLFL_map_t *m,int cx, int cy, int dis, int px, int py, short light_walls)
+draw(const map_view_t *v, int cx, int cy, int dis, int px, int py, short light_walls)
 {
-	if(!RLFL_cell_valid(m->mnum, (unsigned)cx, (unsigned)cy))
+	if(!view_in(v, cx, cy))
 	{
 		return;
 	}
 	// circular view - can be changed if you like
 	if ((cx-px)*(cx-px) + (cy-py)*(cy-py) <= dis*dis + 1)
 	{
-		if(RLFL_has_flag(m->mnum, cx, cy, CELL_OPEN) || light_walls)
+		if(view_has(v, cx, cy, CELL_OPEN) || light_walls)
 		{
-			RLFL_set_flag(m->mnum, cx, cy, CELL_FOV);
+			view_fov(v, cx, cy);
 		}
 	}
 }
@@ -86,7 +98,7 @@ draw(RLFL_map_t *m,int cx, int cy, int dis, int px, int py, short light_walls)
  +-----------------------------------------------------------+
  */
 static void
-trace(RLFL_map_t *m, int dir, int n, int h, int px, int py, bool light_walls)
+trace(const map_view_t *v, int dir, int n, int h, int px, int py, bool light_walls)
 {
 	/* convex hull of obstructions */
 	int topx[n+2], topy[n+2], botx[n+2], boty[n+2];
@@ -116,11 +128,11 @@ trace(RLFL_map_t *m, int dir, int n, int h, int px, int py, bool light_walls)
 			cx[i] += px, cy[i] += py;
 
 			if (CCW(topx[s[i][1]], topy[s[i][1]], botx[s[!i][0]], boty[s[!i][0]], ad1, ad2[i]+1-i) > 0) {
-				draw(m,cx[i], cy[i], n,px,py,light_walls);
+				draw(v,cx[i], cy[i], n,px,py,light_walls);
 			}
 		}
-		if ( (unsigned)cx[0] < (unsigned)m->width && (unsigned)cy[0] < (unsigned)m->height) {
-			if (!RLFL_has_flag(m->mnum, cx[0], cy[0], CELL_OPEN)) { // new obstacle, update convex hull
+		if (view_in(v, cx[0], cy[0])) {
+			if (!view_has(v, cx[0], cy[0], CELL_OPEN)) { // new obstacle, update convex hull
 				++curb;
 				botx[curb] = ad1, boty[curb] = ad2[0]+1;
 				if (CCW(botx[s[0][0]], boty[s[0][0]], topx[s[1][1]], topy[s[1][1]], ad1, ad2[0]+1) >= 0)
@@ -138,9 +150,9 @@ trace(RLFL_map_t *m, int dir, int n, int h, int px, int py, bool light_walls)
 			}
 		}
 
-		if ( (unsigned)cx[1] < (unsigned)m->width && (unsigned)cy[1] < (unsigned)m->height)
+		if (view_in(v, cx[1], cy[1]))
 		{
-			if (!RLFL_has_flag(m->mnum, cx[1], cy[1], CELL_OPEN))
+			if (!view_has(v, cx[1], cy[1], CELL_OPEN))
 			{
 				++curt;
 				topx[curt] = ad1, topy[curt] = ad2[1];
@@ -0,0 +1,170 @@
+/*
+	RLFL Iterative shadowcasting algorithm.
+
+	Recursive shadowcasting, see fov_recursive_shadowcasting.c,
+	without the recursion. A blocked run pushes the interval of
+	slopes behind it on a stack rather than casting it at once,
+	the cells seen are the same. Slopes are exact fractions of
+	small integers, the cells of a row in the interval are worked
+	out once rather than tested one by one, and each octant is a
+	copy of the scan with its transform folded in, stepping along
+	a row by adding.
+
+    Copyright (C) 2011
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+    <jtm@robot.is>
+*/
+#include "headers/rlfl.h"
+#include "headers/map.h"
+#include "headers/fov.h"
+
+/* Inlined into each octant, so the transform is constant */
+#define OCTANT static inline __attribute__((always_inline)) void
+
+/* Slope n / d, d > 0 */
+typedef struct {
+	int16_t n, d;
+} slope_t;
+
+/* Rows from `row` out, between slopes `start` and `end` */
+typedef struct {
+	int16_t row;
+	slope_t start, end;
+} interval_t;
+
+/* A row of k cells pushes at most 2k intervals, as no cell of it
+   spans the whole shadow between two intervals */
+#define STACK_SIZE ((RLFL_MAX_RADIUS + 2) * (RLFL_MAX_RADIUS + 2))
+
+#define SLOPE_LT(a, b) (((int)(a).n * (b).d) < ((int)(b).n * (a).d))
+
+OCTANT scan(const map_view_t *v, interval_t *stack, int ox, int oy, int radius, bool light_walls,
+			int xx, int xy, int yx, int yy);
+/*
+ +-----------------------------------------------------------+
+ * @desc	Field of view
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_fov_iterative_shadowcasting(unsigned int m, unsigned int ox, unsigned int oy, int radius,
+								 bool light_walls)
+{
+	map_view_t v;
+	if(view_open(&v, m))
+		return RLFL_ERR_NO_MAP;
+
+	if(!view_in(&v, ox, oy))
+		return RLFL_ERR_OUT_OF_BOUNDS;
+
+	if(radius >= RLFL_MAX_RADIUS)
+		return RLFL_ERR_GENERIC;
+
+	return fov_iterative_shadowcasting(&v, ox, oy, radius, light_walls);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Field of view on a checked view
+ +-----------------------------------------------------------+
+ */
+err
+fov_iterative_shadowcasting(const map_view_t *v, unsigned int ox, unsigned int oy, int radius,
+							bool light_walls)
+{
+	interval_t stack[STACK_SIZE];
+
+	/* The octants of the recursive version, in its order */
+	scan(v, stack, ox, oy, radius, light_walls,  1,  0,  0,  1);
+	scan(v, stack, ox, oy, radius, light_walls,  0,  1,  1,  0);
+	scan(v, stack, ox, oy, radius, light_walls,  0, -1,  1,  0);
+	scan(v, stack, ox, oy, radius, light_walls, -1,  0,  0,  1);
+	scan(v, stack, ox, oy, radius, light_walls, -1,  0,  0, -1);
+	scan(v, stack, ox, oy, radius, light_walls,  0, -1, -1,  0);
+	scan(v, stack, ox, oy, radius, light_walls,  0,  1, -1,  0);
+	scan(v, stack, ox, oy, radius, light_walls,  1,  0,  0, -1);
+
+	/* The origin is always seen */
+	view_fov(v, ox, oy);
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Scan one octant. Row j is j cells out, cell i of it
+ * 			i cells across, at ox - (i * xx) - (j * xy),
+ * 			oy - (i * yx) - (j * yy), walked from i = j to 0.
+ +-----------------------------------------------------------+
+ */
+OCTANT
+scan(const map_view_t *v, interval_t *stack, int ox, int oy, int radius, bool light_walls,
+	 int xx, int xy, int yx, int yy)
+{
+	int top = 0, r2 = radius * radius;
+	stack[top++] = (interval_t){ 1, { 1, 1 }, { 0, 1 } };
+	while(top)
+	{
+		interval_t s = stack[--top];
+		if(SLOPE_LT(s.start, s.end))
+			continue;
+
+		int i, j;
+		for(j=s.row; j<=radius; j++)
+		{
+			/* Cells of the row in the interval, the first with its far
+			   corner, (2i - 1) / (2j + 1), at most `start` and the last
+			   with its near one, (2i + 1) / (2j - 1), at least `end` */
+			int first = ((s.start.n * ((2 * j) + 1)) + s.start.d) / (2 * s.start.d);
+			int last = (s.end.n * ((2 * j) - 1)) - s.end.d;
+			last = (last > 0) ? ((last + (2 * s.end.d) - 1) / (2 * s.end.d)) : 0;
+			first = MIN(first, j);
+
+			bool blocked = false;
+			slope_t new_start = { 0, 1 };
+			int x = ox - (first * xx) - (j * xy);
+			int y = oy - (first * yx) - (j * yy);
+			for(i=first; i>=last; i--, x += xx, y += yx)
+			{
+				if(!view_in(v, x, y))
+					continue;
+
+				/* The slopes of the far and near corner */
+				slope_t l = { (2 * i) + 1, (2 * j) - 1 };
+				slope_t r = { (2 * i) - 1, (2 * j) + 1 };
+				bool open = view_has(v, x, y, CELL_OPEN);
+				if((i * i) + (j * j) <= r2 && (light_walls || open))
+					view_fov(v, x, y);
+
+				if(blocked)
+				{
+					if(!open)
+					{
+						new_start = r;
+						continue;
+					}
+					blocked = false;
+					s.start = new_start;
+				}
+				else if(!open && j < radius)
+				{
+					/* A run of walls starts, cast behind it later */
+					blocked = true;
+					stack[top++] = (interval_t){ j + 1, s.start, l };
+					new_start = r;
+				}
+			}
+			if(blocked)
+				break;
+		}
+	}
+}
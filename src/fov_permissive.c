@@ -22,6 +22,9 @@
     <jtm@robot.is>
 */
 #include "headers/rlfl.h"
+#include "headers/map.h"
+#include "headers/fov.h"
+#include "headers/ctx.h"
 
 #define RELATIVE_SLOPE(l,x,y) (((l)->yf-(l)->yi)*((l)->xf-(x)) - ((l)->xf-(l)->xi)*((l)->yf-(y)))
 #define BELOW(l,x,y) (RELATIVE_SLOPE(l,x,y) > 0)
@@ -48,17 +51,21 @@ typedef struct {
 	viewbump_t *steep_bump;
 } view_t;
 
-static view_t **current_view=NULL;
-static view_t *views=NULL;
-static viewbump_t *bumps=NULL;
-static int bumpidx=0;
+/* State of one call */
+typedef struct {
+	view_t **current_view;
+	view_t *views;
+	viewbump_t *bumps;
+	int bumpidx;
+	int view_stride; // views per row of the quadrant
+} permissive_t;
 
-static void add_shallow_bump(int x, int y, view_t *view);
-static void add_steep_bump(int x, int y, view_t *view);
+static void add_shallow_bump(permissive_t *q, int x, int y, view_t *view);
+static void add_steep_bump(permissive_t *q, int x, int y, view_t *view);
 static bool check_view(RLFL_list_t active_views, view_t **it);
-static void check_quadrant(RLFL_map_t *m,int startX,int startY,int dx, int dy, int extentX,int extentY,
-						   bool light_walls);
-static void visit_coords(RLFL_map_t *m,int startX, int startY, int x, int y, int dx, int dy,
+static void check_quadrant(permissive_t *q, const map_view_t *v, int startX,int startY,int dx, int dy,
+						   int extentX,int extentY, bool light_walls);
+static void visit_coords(permissive_t *q, const map_view_t *v, int startX, int startY, int x, int y, int dx, int dy,
 						 RLFL_list_t active_views, bool light_walls);
 /*
  +-----------------------------------------------------------+
@@ -68,54 +75,78 @@ static void visit_coords(RLFL_map_t *m,int startX, int startY, int x, int y, int
 err
 RLFL_fov_permissive(unsigned int m, unsigned int ox, unsigned int oy, unsigned int radius, bool light_walls)
 {
-	if(!RLFL_map_valid(m))
+	return RLFL_fov_permissive_ctx(&RLFL_default_ctx, m, ox, oy, radius, light_walls);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Permissive fov with the scratch of `ctx`
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_fov_permissive_ctx(RLFL_ctx_t *ctx, unsigned int m, unsigned int ox, unsigned int oy,
+						unsigned int radius, bool light_walls)
+{
+	map_view_t v;
+	if(view_open(&v, m))
 		return RLFL_ERR_NO_MAP;
 
-	if(!RLFL_cell_valid(m, ox, oy))
+	if(!view_in(&v, ox, oy))
 		return RLFL_ERR_OUT_OF_BOUNDS;
 
 	if(radius >= RLFL_MAX_RADIUS)
 		return RLFL_ERR_GENERIC;
 
-	RLFL_map_t *map = RLFL_map_store[m];
+	return fov_permissive(ctx, &v, ox, oy, radius, light_walls);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Permissive fov on a checked view
+ +-----------------------------------------------------------+
+ */
+err
+fov_permissive(RLFL_ctx_t *ctx, const map_view_t *v, unsigned int ox, unsigned int oy,
+			   unsigned int radius, bool light_walls)
+{
 	int minx, maxx, miny, maxy;
+	permissive_t state, *q = &state;
 
 	/* The origin is always seen */
-	RLFL_set_flag(m, ox, oy, CELL_FOV);
-
-	/* preallocate views and bumps */
-	views = (view_t *)calloc(sizeof(view_t), map->width*map->height);
-	bumps = (viewbump_t *)calloc(sizeof(viewbump_t), map->width*map->height);
+	view_fov(v, ox, oy);
 
 	/* set the fov range */
 	if (radius > 0)
 	{
 		minx = MIN(ox, radius);
-		maxx = MIN(map->width-ox - 1, radius);
+		maxx = MIN(v->width-ox - 1, radius);
 		miny = MIN(oy, radius);
-		maxy = MIN(map->height-oy - 1, radius);
+		maxy = MIN(v->height-oy - 1, radius);
 	}
 	else
 	{
 		minx = ox;
-		maxx = map->width - ox - 1;
+		maxx = v->width - ox - 1;
 		miny = oy;
-		maxy = map->height - oy -1;
+		maxy = v->height - oy -1;
 	}
 
-	/* calculate fov. precise permissive field of view */
-	bumpidx = 0;
-	check_quadrant(map, ox, oy, 1, 1, maxx, maxy, light_walls);
-	bumpidx = 0;
-	check_quadrant(map, ox, oy, 1, -1, maxx, miny, light_walls);
-	bumpidx = 0;
-	check_quadrant(map, ox, oy, -1, -1, minx, miny, light_walls);
-	bumpidx = 0;
-	check_quadrant(map, ox, oy, -1, 1, minx, maxy, light_walls);
+	/* preallocate views and bumps, one view and at most two bumps per
+	 * cell of the largest quadrant. Every entry is written before it
+	 * is read. */
+	int qcells = ((MAX(minx, maxx) + 1) * (MAX(miny, maxy) + 1));
+	q->views = (view_t *)ctx_scratch(ctx, SCRATCH_VIEWS, sizeof(view_t) * qcells);
+	q->bumps = (viewbump_t *)ctx_scratch(ctx, SCRATCH_BUMPS, sizeof(viewbump_t) * 2 * qcells);
+	if(q->views == NULL || q->bumps == NULL)
+		return RLFL_ERR_GENERIC;
 
-	/* cleanup */
-	free(bumps);
-	free(views);
+	/* calculate fov. precise permissive field of view */
+	q->bumpidx = 0;
+	check_quadrant(q, v, ox, oy, 1, 1, maxx, maxy, light_walls);
+	q->bumpidx = 0;
+	check_quadrant(q, v, ox, oy, 1, -1, maxx, miny, light_walls);
+	q->bumpidx = 0;
+	check_quadrant(q, v, ox, oy, -1, -1, minx, miny, light_walls);
+	q->bumpidx = 0;
+	check_quadrant(q, v, ox, oy, -1, 1, minx, maxy, light_walls);
 
 	return RLFL_SUCCESS;
 }
@@ -125,11 +156,11 @@ RLFL_fov_permissive(unsigned int m, unsigned int ox, unsigned int oy, unsigned i
  +-----------------------------------------------------------+
  */
 static void
-add_shallow_bump(int x, int y, view_t *view) {
+add_shallow_bump(permissive_t *q, int x, int y, view_t *view) {
 	viewbump_t *shallow, *curbump;
 	view->shallow_line.xf = x;
 	view->shallow_line.yf = y;
-	shallow= &bumps[bumpidx++];
+	shallow= &q->bumps[q->bumpidx++];
 	shallow->x=x;
 	shallow->y=y;
 	shallow->parent=view->shallow_bump;
@@ -151,12 +182,12 @@ add_shallow_bump(int x, int y, view_t *view) {
  +-----------------------------------------------------------+
  */
 static void
-add_steep_bump(int x, int y, view_t *view)
+add_steep_bump(permissive_t *q, int x, int y, view_t *view)
 {
 	viewbump_t *steep, *curbump;
 	view->steep_line.xf=x;
 	view->steep_line.yf=y;
-	steep=&bumps[bumpidx++];
+	steep=&q->bumps[q->bumpidx++];
 	steep->x=x;
 	steep->y=y;
 	steep->parent=view->steep_bump;
@@ -197,7 +228,7 @@ check_view(RLFL_list_t active_views, view_t **it)
  +-----------------------------------------------------------+
  */
 static void
-visit_coords(RLFL_map_t *m,int startX, int startY, int x, int y, int dx, int dy,
+visit_coords(permissive_t *q, const map_view_t *v, int startX, int startY, int x, int y, int dx, int dy,
 			 RLFL_list_t active_views, bool light_walls)
 {
 	// top left
@@ -207,64 +238,62 @@ visit_coords(RLFL_map_t *m,int startX, int startY, int x, int y, int dx, int dy,
 	int brx = (x+1), bry = y;
 
 	int realX = (x*dx), realY = (y*dy);
-	int offset;
 	view_t *view = NULL;
 
-	while (current_view != (view_t **)RLFL_list_end(active_views))
+	while (q->current_view != (view_t **)RLFL_list_end(active_views))
 	{
-		view = *current_view;
+		view = *q->current_view;
 		if ( !BELOW_OR_COLINEAR(&view->steep_line, brx, bry) ) {
 			break;
 		}
-		current_view++;
+		q->current_view++;
 	}
-	if(current_view == (view_t **)RLFL_list_end(active_views)
+	if(q->current_view == (view_t **)RLFL_list_end(active_views)
 			|| ABOVE_OR_COLINEAR(&view->shallow_line, tlx, tly)) {
 		return;
 	}
 
-	offset = (startX + realX + ((startY+realY) * m->width));
-	if (light_walls || RLFL_has_flag(m->mnum, startX+realX, startY+realY, CELL_OPEN)) {
-		RLFL_set_flag(m->mnum, startX+realX, startY+realY, CELL_FOV);
+	if (light_walls || view_has(v, startX+realX, startY+realY, CELL_OPEN)) {
+		view_fov(v, startX+realX, startY+realY);
 	}
 
-	if (RLFL_has_flag(m->mnum, startX+realX, startY+realY, CELL_OPEN))
+	if (view_has(v, startX+realX, startY+realY, CELL_OPEN))
 		return;
 
 	if ( ABOVE(&view->shallow_line, brx, bry)
 		&& BELOW(&view->steep_line, tlx, tly)) {
 		// slow !
-		RLFL_list_remove_iterator(active_views, (void **)current_view);
+		RLFL_list_remove_iterator(active_views, (void **)q->current_view);
 	}
 	else if( ABOVE(&view->shallow_line, brx, bry))
 	{
-		add_shallow_bump(tlx, tly, view);
-		check_view(active_views, current_view);
+		add_shallow_bump(q, tlx, tly, view);
+		check_view(active_views, q->current_view);
 	}
 	else if(BELOW(&view->steep_line, tlx, tly))
 	{
-		add_steep_bump(brx,bry,view);
-		check_view(active_views,current_view);
+		add_steep_bump(q, brx,bry,view);
+		check_view(active_views,q->current_view);
 	}
 	else
 	{
-		view_t *shallower_view = &views[offset];
-		int view_index = (current_view - (view_t **)RLFL_list_begin(active_views));
+		view_t *shallower_view = &q->views[x + (y * q->view_stride)];
+		int view_index = (q->current_view - (view_t **)RLFL_list_begin(active_views));
 		view_t **shallower_view_it;
 		view_t **steeper_view_it;
-		*shallower_view = **current_view;
+		*shallower_view = **q->current_view;
 		// slow !
 		shallower_view_it = (view_t **)RLFL_list_insert(active_views, shallower_view, view_index);
 		steeper_view_it = shallower_view_it+1;
-		current_view = shallower_view_it;
-		add_steep_bump(brx, bry, shallower_view);
+		q->current_view = shallower_view_it;
+		add_steep_bump(q, brx, bry, shallower_view);
 		if (!check_view(active_views,shallower_view_it)) {
 			steeper_view_it--;
 		}
-		add_shallow_bump(tlx, tly, *steeper_view_it);
+		add_shallow_bump(q, tlx, tly, *steeper_view_it);
 		check_view(active_views, steeper_view_it);
 		if ( view_index > RLFL_list_size(active_views)) {
-			current_view = (view_t **)RLFL_list_end(active_views);
+			q->current_view = (view_t **)RLFL_list_end(active_views);
 		}
 	}
 }
@@ -274,7 +303,7 @@ visit_coords(RLFL_map_t *m,int startX, int startY, int x, int y, int dx, int dy,
  +-----------------------------------------------------------+
  */
 static void
-check_quadrant(RLFL_map_t *m, int startX, int startY, int dx, int dy, int extentX,
+check_quadrant(permissive_t *q, const map_view_t *v, int startX, int startY, int dx, int dy, int extentX,
 			   int extentY, bool light_walls)
 {
 	RLFL_list_t active_views = RLFL_list_create();
@@ -284,14 +313,15 @@ check_quadrant(RLFL_map_t *m, int startX, int startY, int dx, int dy, int extent
 	int maxI = (extentX + extentY);
 	int i = 1;
 
-	view_t *view= &views[(startX + (startY * m->width))];
+	q->view_stride = (extentX + 1);
+	view_t *view= &q->views[0];
 	view->shallow_line	= shallow_line;
 	view->steep_line	= steep_line;
 	view->shallow_bump	= NULL;
 	view->steep_bump	= NULL;
 
 	RLFL_list_append(active_views, view);
-	current_view = (view_t **)RLFL_list_begin(active_views);
+	q->current_view = (view_t **)RLFL_list_begin(active_views);
 
 	while ( (i != maxI + 1) && RLFL_list_size(active_views))
 	{
@@ -300,14 +330,14 @@ check_quadrant(RLFL_map_t *m, int startX, int startY, int dx, int dy, int extent
 		int j 		= startJ;
 		while ( (j != maxJ + 1)
 				&& RLFL_list_size(active_views)
-				&& (current_view != (view_t **)RLFL_list_end(active_views)))
+				&& (q->current_view != (view_t **)RLFL_list_end(active_views)))
 		{
 			int x = (i - j);
 			int y = j;
-			visit_coords(m, startX, startY, x, y, dx, dy, active_views, light_walls);
+			visit_coords(q, v, startX, startY, x, y, dx, dy, active_views, light_walls);
 			j++;
 		}
 		i++;
-		current_view=(view_t **)RLFL_list_begin(active_views);
+		q->current_view=(view_t **)RLFL_list_begin(active_views);
 	}
 }
@@ -26,6 +26,8 @@
     <jtm@robot.is>
 */
 #include "headers/rlfl.h"
+#include "headers/map.h"
+#include "headers/fov.h"
 /*
  *	Multipliers for transforming coordinates to other octant
  * */
@@ -37,7 +39,7 @@ mult[4][8]= {
 	{1,  0,  0,   1,  -1,   0,  0, -1},
 };
 // functions
-static void cast_light(unsigned int m, int cx, int cy,int row,float start, float end, int radius,
+static void cast_light(const map_view_t *v, int cx, int cy,int row,float start, float end, int radius,
 					   int xx, int xy, int yx, int yy, int id, bool light_walls);
 /*
  +-----------------------------------------------------------+
@@ -47,23 +49,35 @@ static void cast_light(unsigned int m, int cx, int cy,int row,float start, float
 err
 RLFL_fov_recursive_shadowcasting(unsigned int m, unsigned int ox, unsigned int oy, int radius, bool light_walls)
 {
-	if(!RLFL_map_valid(m))
+	map_view_t v;
+	if(view_open(&v, m))
 		return RLFL_ERR_NO_MAP;
 
-	if(!RLFL_cell_valid(m, ox, oy))
+	if(!view_in(&v, ox, oy))
 		return RLFL_ERR_OUT_OF_BOUNDS;
 
 	if(radius >= RLFL_MAX_RADIUS)
 		return RLFL_ERR_GENERIC;
 
+	return fov_recursive_shadowcasting(&v, ox, oy, radius, light_walls);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Field of view on a checked view
+ +-----------------------------------------------------------+
+ */
+err
+fov_recursive_shadowcasting(const map_view_t *v, unsigned int ox, unsigned int oy, int radius,
+							bool light_walls)
+{
 	int oct;
 	for(oct=0; oct<8; oct++)
 	{
-		cast_light(m, ox, oy, 1, 1.0, 0.0, radius, mult[0][oct], mult[1][oct],
+		cast_light(v, ox, oy, 1, 1.0, 0.0, radius, mult[0][oct], mult[1][oct],
 				   mult[2][oct], mult[3][oct], 0, light_walls);
 	}
 	/* The origin is always seen */
-	RLFL_set_flag(m, ox, oy, CELL_FOV);
+	view_fov(v, ox, oy);
 
 	return 0;
 }
@@ -73,12 +87,11 @@ RLFL_fov_recursive_shadowcasting(unsigned int m, unsigned int ox, unsigned int o
  +-----------------------------------------------------------+
  */
 static void
-cast_light(unsigned int m, int cx, int cy,int row,float start, float end, int radius,
+cast_light(const map_view_t *v, int cx, int cy,int row,float start, float end, int radius,
 		   int xx, int xy, int yx, int yy, int id, bool light_walls)
 {
 	if (start < end)
 		return;
-	RLFL_map_t *map = RLFL_map_store[m];
 	int r2 = radius * radius;
 	int j, dx, dy;
 	float new_start = 0.0f;
@@ -96,7 +109,7 @@ cast_light(unsigned int m, int cx, int cy,int row,float start, float end, int ra
 			Y = cy + dx * yx + dy * yy;
 			/* l_slope and r_slope store the slopes of the left and right
                extremities of the square we're considering */
-			if ((unsigned)X < (unsigned)map->width && (unsigned)Y < (unsigned)map->height) {
+			if (view_in(v, X, Y)) {
 				l_slope = (dx - 0.5f) / (dy + 0.5f);
 				r_slope = (dx + 0.5f) / (dy - 0.5f);
 				if(start < r_slope)
@@ -104,14 +117,14 @@ cast_light(unsigned int m, int cx, int cy,int row,float start, float end, int ra
 				else if(end > l_slope)
 					break;
 				if(dx * dx + dy * dy <= r2) {
-					if(light_walls || RLFL_has_flag(m, X, Y, CELL_OPEN)) {
+					if(light_walls || view_has(v, X, Y, CELL_OPEN)) {
 						/* Our light beam is touching this square; light it */
-						RLFL_set_flag(m, X, Y, CELL_FOV);
+						view_fov(v, X, Y);
 					}
 				}
 				if(blocked) {
 					/* we're scanning a row of blocked squares */
-					if (!RLFL_has_flag(m, X, Y, CELL_OPEN)) {
+					if (!view_has(v, X, Y, CELL_OPEN)) {
 						new_start = r_slope;
 						continue;
 					} else {
@@ -119,10 +132,10 @@ cast_light(unsigned int m, int cx, int cy,int row,float start, float end, int ra
 						start = new_start;
 					}
 				} else {
-					if(!RLFL_has_flag(m, X, Y, CELL_OPEN) && j < radius) {
+					if(!view_has(v, X, Y, CELL_OPEN) && j < radius) {
 						/* This is a blocking square, start a child scan */
 						blocked = true;
-						cast_light(m, cx, cy, (j + 1), start, l_slope, radius,
+						cast_light(v, cx, cy, (j + 1), start, l_slope, radius,
 								   xx, xy, yx, yy, (id + 1), light_walls);
 						new_start = r_slope;
 					}
@@ -25,13 +25,25 @@
     <jtm@robot.is>
 */
 #include "headers/rlfl.h"
+#include "headers/map.h"
+#include "headers/fov.h"
+/*
+ +-----------------------------------------------------------+
+ * @desc	True if cell is seen or open
+ +-----------------------------------------------------------+
+ */
+static inline bool
+seen_or_open(const map_view_t *v, unsigned int x, unsigned int y)
+{
+	return (view_seen(v, x, y) || view_has(v, x, y, CELL_OPEN));
+}
 /*
  +-----------------------------------------------------------+
  * @desc	FIXME
  +-----------------------------------------------------------+
  */
 static inline void
-restrictive_shadowcasting_quadrant (RLFL_map_t *m, int player_x, int player_y, int max_radius,
+restrictive_shadowcasting_quadrant (const map_view_t *v, int player_x, int player_y, int max_radius,
 									bool light_walls, int maxObstacles, int dx, int dy)
 {
     //octant: vertical edge
@@ -46,24 +58,24 @@ restrictive_shadowcasting_quadrant (RLFL_map_t *m, int player_x, int player_y, i
         //do while there are unblocked slopes left and the algo is within the map's boundaries
         //scan progressive lines/columns from the PC outwards
         int x, y = player_y+dy; //the outer slope's coordinates (first processed line)
-        if (y < 0 || y >= m->height) done = true;
+        if (y < 0 || y >= v->height) done = true;
 		while(!done) {
             done = true;
             //process cells in the line
 			double slopesPerCell = 1.0f/(double)(iteration+1);
 			double halfSlopes = slopesPerCell*0.5f;
 			int processedCell = minAngle / slopesPerCell;
-            int minx = MAX(0,player_x-iteration), maxx = MIN(m->width-1,player_x+iteration);
+            int minx = MAX(0,player_x-iteration), maxx = MIN(v->width-1,player_x+iteration);
             for (x = player_x + (processedCell * dx); x >= minx && x <= maxx; x+=dx) {
                 //calculate slopes per cell
                 bool visible = true;
                 double startSlope = (double)processedCell*slopesPerCell;
                 double centreSlope = startSlope+halfSlopes;
                 double endSlope = startSlope+slopesPerCell;
-                if (obstaclesInLastLine > 0 && !RLFL_has_flag(m->mnum, x, y, CELL_SEEN)) {
+                if (obstaclesInLastLine > 0 && !view_seen(v, x, y)) {
                     int idx = 0;
                     while(visible && idx < obstaclesInLastLine) {
-                        if (RLFL_has_flag(m->mnum, x, y, CELL_OPEN)) {
+                        if (view_has(v, x, y, CELL_OPEN)) {
                             if (centreSlope > startAngle[idx] && centreSlope < endAngle[idx])
                                 visible = false;
                             }
@@ -71,25 +83,25 @@ restrictive_shadowcasting_quadrant (RLFL_map_t *m, int player_x, int player_y, i
                             if (startSlope >= startAngle[idx] && endSlope <= endAngle[idx])
                                 visible = false;
                         }
-                        if (visible && !RLFL_has_flag(m->mnum, x, y-dy, CELL_SEEN | CELL_OPEN)
-                        		&& (x-dx >= 0 && x-dx < m->width
-                        		&& !RLFL_has_flag(m->mnum, x-dx, y-dy, CELL_SEEN | CELL_OPEN))) {
+                        if (visible && !seen_or_open(v, x, y-dy)
+                        		&& (x-dx >= 0 && x-dx < v->width
+                        		&& !seen_or_open(v, x-dx, y-dy))) {
                         	visible = false;
                         }
                         idx++;
                     }
                 }
                 if (visible) {
-                	RLFL_set_flag(m->mnum, x, y, CELL_FOV);
+                	view_fov(v, x, y);
                     done = false;
                     //if the cell is opaque, block the adjacent slopes
-                    if (!RLFL_has_flag(m->mnum, x, y, CELL_OPEN)) {
+                    if (!view_has(v, x, y, CELL_OPEN)) {
                         if (minAngle >= startSlope) minAngle = endSlope;
                         else {
                         	startAngle[totalObstacles] = startSlope;
                         	endAngle[totalObstacles++] = endSlope;
                         }
-                        if (!light_walls) RLFL_clear_flag(m->mnum, x, y, CELL_SEEN);
+                        if (!light_walls) view_unsee(v, x, y);
                     }
                 }
                 processedCell++;
@@ -98,7 +110,7 @@ restrictive_shadowcasting_quadrant (RLFL_map_t *m, int player_x, int player_y, i
             iteration++;
             obstaclesInLastLine = totalObstacles;
             y += dy;
-            if (y < 0 || y >= m->height) done = true;
+            if (y < 0 || y >= v->height) done = true;
 			if ( minAngle == 1.0f ) done=true;
         }
     }
@@ -114,24 +126,24 @@ restrictive_shadowcasting_quadrant (RLFL_map_t *m, int player_x, int player_y, i
         //do while there are unblocked slopes left and the algo is within the map's boundaries
         //scan progressive lines/columns from the PC outwards
         int x = player_x+dx, y; //the outer slope's coordinates (first processed line)
-        if (x < 0 || x >= m->width) done = true;
+        if (x < 0 || x >= v->width) done = true;
 		while(!done) {
             done = true;
             //process cells in the line
 			double slopesPerCell = 1.0f/(double)(iteration+1);
 			double halfSlopes = slopesPerCell*0.5f;
 			int processedCell = minAngle / slopesPerCell;
-            int miny = MAX(0,player_y-iteration), maxy = MIN(m->height-1,player_y+iteration);
+            int miny = MAX(0,player_y-iteration), maxy = MIN(v->height-1,player_y+iteration);
             for (y = player_y + (processedCell * dy); y >= miny && y <= maxy; y+=dy) {
                 //calculate slopes per cell
                 bool visible = true;
                 double startSlope = (double)processedCell*slopesPerCell;
                 double centreSlope = startSlope+halfSlopes;
                 double endSlope = startSlope+slopesPerCell;
-                if (obstaclesInLastLine > 0 && !RLFL_has_flag(m->mnum, x, y, CELL_SEEN)) {
+                if (obstaclesInLastLine > 0 && !view_seen(v, x, y)) {
                     int idx = 0;
                     while(visible && idx < obstaclesInLastLine) {
-                        if (RLFL_has_flag(m->mnum, x, y, CELL_OPEN)) {
+                        if (view_has(v, x, y, CELL_OPEN)) {
                             if (centreSlope > startAngle[idx] && centreSlope < endAngle[idx])
                                 visible = false;
                             }
@@ -139,25 +151,25 @@ restrictive_shadowcasting_quadrant (RLFL_map_t *m, int player_x, int player_y, i
                             if (startSlope >= startAngle[idx] && endSlope <= endAngle[idx])
                                 visible = false;
                         }
-                        if (visible && !RLFL_has_flag(m->mnum, x-dx, y, CELL_SEEN | CELL_OPEN)
-                                && (y-dy >= 0 && y-dy < m->height
-                                && !RLFL_has_flag(m->mnum, x-dx, y-dy, CELL_SEEN | CELL_OPEN))) {
+                        if (visible && !seen_or_open(v, x-dx, y)
+                                && (y-dy >= 0 && y-dy < v->height
+                                && !seen_or_open(v, x-dx, y-dy))) {
                         	visible = false;
                         }
                         idx++;
                     }
                 }
                 if (visible) {
-                	RLFL_set_flag(m->mnum, x, y, CELL_FOV);
+                	view_fov(v, x, y);
                     done = false;
                     //if the cell is opaque, block the adjacent slopes
-                    if (!RLFL_has_flag(m->mnum, x, y, CELL_OPEN)) {
+                    if (!view_has(v, x, y, CELL_OPEN)) {
                         if (minAngle >= startSlope) minAngle = endSlope;
                         else {
                         	startAngle[totalObstacles] = startSlope;
                         	endAngle[totalObstacles++] = endSlope;
                         }
-                        if (!light_walls) RLFL_clear_flag(m->mnum, x, y, CELL_SEEN);;
+                        if (!light_walls) view_unsee(v, x, y);;
                     }
                 }
                 processedCell++;
@@ -166,7 +178,7 @@ restrictive_shadowcasting_quadrant (RLFL_map_t *m, int player_x, int player_y, i
             iteration++;
             obstaclesInLastLine = totalObstacles;
             x += dx;
-            if (x < 0 || x >= m->width) done = true;
+            if (x < 0 || x >= v->width) done = true;
 			if ( minAngle == 1.0f ) done=true;
         }
     }
@@ -179,28 +191,41 @@ restrictive_shadowcasting_quadrant (RLFL_map_t *m, int player_x, int player_y, i
 err
 RLFL_fov_restrictive_shadowcasting(unsigned int m, unsigned int ox, unsigned int oy, int radius, bool light_walls)
 {
-	if(!RLFL_map_valid(m))
+	map_view_t v;
+	if(view_open(&v, m))
 		return RLFL_ERR_NO_MAP;
 
-	if(!RLFL_cell_valid(m, ox, oy))
+	if(!view_in(&v, ox, oy))
 		return RLFL_ERR_OUT_OF_BOUNDS;
 
 	if(radius >= RLFL_MAX_RADIUS)
 		return RLFL_ERR_GENERIC;
 
-	RLFL_map_t *map = RLFL_map_store[m];
-
+	return fov_restrictive_shadowcasting(&v, ox, oy, radius, light_walls);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	RLF Fov on a checked view
+ +-----------------------------------------------------------+
+ */
+err
+fov_restrictive_shadowcasting(const map_view_t *v, unsigned int ox, unsigned int oy, int radius,
+							  bool light_walls)
+{
     //calculate an approximated (excessive, just in case) maximum number of obstacles per octant
-    int maxObstacles = (map->width * map->height) / 7;
+    int maxObstacles = (v->width * v->height) / 7;
+
+    /* No more than the cells an octant visits, this lives on the stack */
+    maxObstacles = MIN(maxObstacles, ((radius + 1) * (radius + 2)) / 2);
 
     /* The origin is always seen */
-    RLFL_set_flag(m, ox, oy, CELL_FOV);
+    view_fov(v, ox, oy);
 
     //compute the 4 quadrants of the map
-    restrictive_shadowcasting_quadrant(map, ox, oy, radius, light_walls, maxObstacles, 1, 1);
-    restrictive_shadowcasting_quadrant(map, ox, oy, radius, light_walls, maxObstacles, 1, -1);
-    restrictive_shadowcasting_quadrant(map, ox, oy, radius, light_walls, maxObstacles, -1, 1);
-    restrictive_shadowcasting_quadrant(map, ox, oy, radius, light_walls, maxObstacles, -1, -1);
+    restrictive_shadowcasting_quadrant(v, ox, oy, radius, light_walls, maxObstacles, 1, 1);
+    restrictive_shadowcasting_quadrant(v, ox, oy, radius, light_walls, maxObstacles, 1, -1);
+    restrictive_shadowcasting_quadrant(v, ox, oy, radius, light_walls, maxObstacles, -1, 1);
+    restrictive_shadowcasting_quadrant(v, ox, oy, radius, light_walls, maxObstacles, -1, -1);
 
     return RLFL_SUCCESS;
 }
@@ -0,0 +1,166 @@
+/*
+	RLFL Symmetric shadowcasting algorithm.
+
+	Albert Ford's symmetric shadowcasting. Rows of a quadrant are
+	scanned out from the origin between two slopes, a floor cell is
+	seen if its centre is between them, so a floor cell sees the
+	origin when the origin sees it. Walls are seen if any of them
+	is between the slopes. Slopes are exact fractions of small
+	integers, rows waiting to be scanned are kept on a stack.
+
+	<https://www.albertford.com/shadowcasting/>
+
+    Copyright (C) 2011
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+    <jtm@robot.is>
+*/
+#include "headers/rlfl.h"
+#include "headers/map.h"
+#include "headers/fov.h"
+
+/* Inlined into each quadrant, so the transform is constant */
+#define QUADRANT static inline __attribute__((always_inline)) void
+
+/* Slope n / d, d > 0 */
+typedef struct {
+	int16_t n, d;
+} slope_t;
+
+/* Row `depth` out, between slopes `start` and `end` */
+typedef struct {
+	int16_t depth;
+	slope_t start, end;
+} row_t;
+
+/* A row of k cells pushes at most k / 2 + 1 rows */
+#define STACK_SIZE ((RLFL_MAX_RADIUS + 2) * (RLFL_MAX_RADIUS + 2))
+
+/* Cell kinds as the scan sees them, off the map is a wall never seen */
+#define SCAN_NONE	0
+#define SCAN_FLOOR	1
+#define SCAN_WALL	2
+
+QUADRANT scan(const map_view_t *v, row_t *stack, int ox, int oy, int radius, bool light_walls,
+			  int cx, int cy, int rx, int ry);
+static inline int floor_div(int n, int d);
+/*
+ +-----------------------------------------------------------+
+ * @desc	Field of view
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_fov_symmetric_shadowcasting(unsigned int m, unsigned int ox, unsigned int oy, int radius,
+								 bool light_walls)
+{
+	map_view_t v;
+	if(view_open(&v, m))
+		return RLFL_ERR_NO_MAP;
+
+	if(!view_in(&v, ox, oy))
+		return RLFL_ERR_OUT_OF_BOUNDS;
+
+	if(radius >= RLFL_MAX_RADIUS)
+		return RLFL_ERR_GENERIC;
+
+	return fov_symmetric_shadowcasting(&v, ox, oy, radius, light_walls);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Field of view on a checked view
+ +-----------------------------------------------------------+
+ */
+err
+fov_symmetric_shadowcasting(const map_view_t *v, unsigned int ox, unsigned int oy, int radius,
+							bool light_walls)
+{
+	row_t stack[STACK_SIZE];
+
+	/* North, south, east and west */
+	scan(v, stack, ox, oy, radius, light_walls, 1, 0,  0, -1);
+	scan(v, stack, ox, oy, radius, light_walls, 1, 0,  0,  1);
+	scan(v, stack, ox, oy, radius, light_walls, 0, 1,  1,  0);
+	scan(v, stack, ox, oy, radius, light_walls, 0, 1, -1,  0);
+
+	/* The origin is always seen */
+	view_fov(v, ox, oy);
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Scan one quadrant. Cell `col` of row `depth` is at
+ * 			ox + (col * cx) + (depth * rx),
+ * 			oy + (col * cy) + (depth * ry).
+ +-----------------------------------------------------------+
+ */
+QUADRANT
+scan(const map_view_t *v, row_t *stack, int ox, int oy, int radius, bool light_walls,
+	 int cx, int cy, int rx, int ry)
+{
+	int top = 0, r2 = radius * radius;
+	stack[top++] = (row_t){ 1, { -1, 1 }, { 1, 1 } };
+	while(top)
+	{
+		row_t row = stack[--top];
+		int depth = row.depth;
+		if(depth > radius)
+			continue;
+
+		/* Cells with their centre between the slopes, ties rounded
+		   into the row */
+		int first = floor_div((2 * depth * row.start.n) + row.start.d, 2 * row.start.d);
+		int last = -floor_div((2 * depth * -row.end.n) + row.end.d, 2 * row.end.d);
+
+		int col, prev = SCAN_NONE;
+		int x = ox + (first * cx) + (depth * rx);
+		int y = oy + (first * cy) + (depth * ry);
+		for(col=first; col<=last; col++, x += cx, y += cy)
+		{
+			bool in = view_in(v, x, y);
+			int cell = (in && view_has(v, x, y, CELL_OPEN)) ? SCAN_FLOOR : SCAN_WALL;
+			if(in && (col * col) + (depth * depth) <= r2)
+			{
+				/* Floor only if its centre is in, depth * start <= col <= depth * end */
+				if((cell == SCAN_WALL) ? light_walls
+				   : ((col * row.start.d) >= (depth * row.start.n)
+					  && (col * row.end.d) <= (depth * row.end.n)))
+					view_fov(v, x, y);
+			}
+			if(prev == SCAN_WALL && cell == SCAN_FLOOR)
+			{
+				/* Start at the near edge of the floor */
+				row.start = (slope_t){ (2 * col) - 1, 2 * depth };
+			}
+			if(prev == SCAN_FLOOR && cell == SCAN_WALL)
+			{
+				/* The rows behind up to the near edge of the wall */
+				stack[top++] = (row_t){ depth + 1, row.start, { (2 * col) - 1, 2 * depth } };
+			}
+			prev = cell;
+		}
+		if(prev == SCAN_FLOOR)
+			stack[top++] = (row_t){ depth + 1, row.start, row.end };
+	}
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	n / d rounded down, d > 0
+ +-----------------------------------------------------------+
+ */
+static inline int
+floor_div(int n, int d)
+{
+	return (n >= 0) ? (n / d) : -((d - 1 - n) / d);
+}
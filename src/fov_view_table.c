@@ -0,0 +1,269 @@
+/*
+	RLFL view table FOV.
+
+	Shadowcasting over a table of the cells of one octant, built
+	once per radius and shared by every map and thread. Each octant
+	is cut into 64 rays per word of `words` and every cell of the
+	table keeps the rays that cross it, so a FOV is a walk of the
+	table, row by row, testing the rays of each cell against the
+	shadow so far. Walls add their rays to the shadow once the row
+	is done, as a wall only shadows the rows behind it.
+
+	It sees what shadowcasting sees, less the cells no ray crosses
+	in light, such as those only a corner of which is lit. The
+	tables are never freed, the largest radius needs ~32kb.
+
+    Copyright (C) 2011
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+    <jtm@robot.is>
+*/
+#include "headers/rlfl.h"
+#include "headers/map.h"
+#include "headers/fov.h"
+
+/* Words of rays, 8 rays per step of radius in each octant */
+#define TABLE_WORDS(radius) (((radius) + 7) / 8)
+
+/* Cell `dx` rows out and `dy` across, in octant 0 */
+typedef struct {
+	uint16_t dx, dy;
+	uint16_t word, words;	/* Words of its rays */
+	unsigned int mask;		/* First of its masks */
+} table_cell_t;
+
+typedef struct {
+	unsigned int words;
+	unsigned int *row;		/* Cells of row dx are row[dx] to row[dx + 1] */
+	table_cell_t *cells;
+	uint64_t *masks;
+} view_table_t;
+
+/*
+ *	Octant 0 to the others, x = dx * xx + dy * xy, y = dx * yx + dy * yy
+ * */
+static const int
+mult[4][8]= {
+	{1,  0,  0, -1, -1,  0,  0,  1},
+	{0,  1, -1,  0,  0, -1,  1,  0},
+	{0,  1,  1,  0,  0, -1, -1,  0},
+	{1,  0,  0,  1, -1,  0,  0, -1},
+};
+
+static view_table_t *tables[RLFL_MAX_RADIUS];
+static pthread_mutex_t tables_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const view_table_t *table(unsigned int radius);
+static view_table_t *table_build(unsigned int radius);
+static void table_rays(unsigned int dx, unsigned int dy, unsigned int rays, unsigned int *first,
+					   unsigned int *last);
+static void cast(const map_view_t *v, const view_table_t *t, unsigned int radius, int ox, int oy,
+				 int oct, bool light_walls);
+/*
+ +-----------------------------------------------------------+
+ * @desc	Field of view
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_fov_view_table(unsigned int m, unsigned int ox, unsigned int oy, unsigned int radius,
+					bool light_walls)
+{
+	map_view_t v;
+	if(view_open(&v, m))
+		return RLFL_ERR_NO_MAP;
+
+	if(!view_in(&v, ox, oy))
+		return RLFL_ERR_OUT_OF_BOUNDS;
+
+	if(radius >= RLFL_MAX_RADIUS)
+		return RLFL_ERR_GENERIC;
+
+	return fov_view_table(&v, ox, oy, radius, light_walls);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Field of view on a checked view
+ +-----------------------------------------------------------+
+ */
+err
+fov_view_table(const map_view_t *v, unsigned int ox, unsigned int oy, unsigned int radius,
+			   bool light_walls)
+{
+	const view_table_t *t = table(radius);
+	if(t == NULL)
+		return RLFL_ERR_GENERIC;
+
+	int oct;
+	for(oct=0; oct<8; oct++)
+		cast(v, t, radius, ox, oy, oct, light_walls);
+
+	/* The origin is always seen */
+	view_fov(v, ox, oy);
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Table of `radius`, built by the first to ask
+ +-----------------------------------------------------------+
+ */
+static const view_table_t *
+table(unsigned int radius)
+{
+	view_table_t *t = __atomic_load_n(&tables[radius], __ATOMIC_ACQUIRE);
+	if(t != NULL)
+		return t;
+
+	pthread_mutex_lock(&tables_lock);
+	if((t = tables[radius]) == NULL && (t = table_build(radius)) != NULL)
+		__atomic_store_n(&tables[radius], t, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&tables_lock);
+	return t;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Build the table of `radius`, the cells of octant 0
+ * 			in it, 0 <= dy <= dx, row by row
+ +-----------------------------------------------------------+
+ */
+static view_table_t *
+table_build(unsigned int radius)
+{
+	unsigned int words = MAX(TABLE_WORDS(radius), 1), rays = words * 64;
+	unsigned int dx, dy, first, last, count = 0, masks = 0;
+	for(dx=1; dx<=radius; dx++)
+	{
+		for(dy=0; dy<=dx && (dx * dx) + (dy * dy) <= radius * radius; dy++)
+		{
+			table_rays(dx, dy, rays, &first, &last);
+			count++;
+			masks += (last / 64) - (first / 64) + 1;
+		}
+	}
+
+	view_table_t *t = (view_table_t *)calloc(1, sizeof(view_table_t));
+	if(t == NULL)
+		return NULL;
+
+	t->words = words;
+	t->row = (unsigned int *)malloc(sizeof(unsigned int) * (radius + 2));
+	t->cells = (table_cell_t *)malloc(sizeof(table_cell_t) * MAX(count, 1));
+	t->masks = (uint64_t *)calloc(MAX(masks, 1), sizeof(uint64_t));
+	if(t->row == NULL || t->cells == NULL || t->masks == NULL)
+	{
+		free(t->row);
+		free(t->cells);
+		free(t->masks);
+		free(t);
+		return NULL;
+	}
+
+	table_cell_t *c = t->cells;
+	unsigned int mask = 0, ray;
+	t->row[0] = t->row[1] = 0;
+	for(dx=1; dx<=radius; dx++)
+	{
+		for(dy=0; dy<=dx && (dx * dx) + (dy * dy) <= radius * radius; dy++, c++)
+		{
+			table_rays(dx, dy, rays, &first, &last);
+			c->dx = dx;
+			c->dy = dy;
+			c->word = first / 64;
+			c->words = (last / 64) - c->word + 1;
+			c->mask = mask;
+			for(ray=first; ray<=last; ray++)
+				t->masks[mask + (ray / 64) - c->word] |= (uint64_t)1 << (ray % 64);
+			mask += c->words;
+		}
+		t->row[dx + 1] = c - t->cells;
+	}
+	return t;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Rays of `rays` across octant 0 that cross cell dx,
+ * 			dy. Ray i has the slope (i + 0.5) / rays, the cell
+ * 			spans the slopes of its corners.
+ +-----------------------------------------------------------+
+ */
+static void
+table_rays(unsigned int dx, unsigned int dy, unsigned int rays, unsigned int *first,
+		   unsigned int *last)
+{
+	double lo = (dy - 0.5) / (dx + 0.5);
+	double hi = (dy + 0.5) / (dx - 0.5);
+	int f = (int)ceil((lo * rays) - 0.5);
+	int l = (int)floor((hi * rays) - 0.5);
+	f = MAX(f, 0);
+	l = MIN(l, (int)rays - 1);
+	(*first) = f;
+	(*last) = MAX(l, f);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Walk the table in octant `oct`
+ +-----------------------------------------------------------+
+ */
+static void
+cast(const map_view_t *v, const view_table_t *t, unsigned int radius, int ox, int oy, int oct,
+	 bool light_walls)
+{
+	int xx = mult[0][oct], xy = mult[1][oct], yx = mult[2][oct], yy = mult[3][oct];
+	uint64_t shadow[TABLE_WORDS(RLFL_MAX_RADIUS)] = { 0 };
+	uint64_t walls[TABLE_WORDS(RLFL_MAX_RADIUS)];
+	unsigned int dx, i, k;
+	for(dx=1; dx<=radius; dx++)
+	{
+		memset(walls, 0, sizeof(uint64_t) * t->words);
+		bool any = false;
+		for(i=t->row[dx]; i<t->row[dx + 1]; i++)
+		{
+			const table_cell_t *c = &t->cells[i];
+			int x = ox + (c->dx * xx) + (c->dy * xy);
+			int y = oy + (c->dx * yx) + (c->dy * yy);
+			if(!view_in(v, x, y))
+				continue;
+
+			const uint64_t *mask = &t->masks[c->mask];
+			uint64_t lit = 0;
+			for(k=0; k<c->words; k++)
+				lit |= mask[k] & ~shadow[c->word + k];
+			if(!lit)
+				continue;
+
+			if(view_has(v, x, y, CELL_OPEN))
+			{
+				view_fov(v, x, y);
+				continue;
+			}
+			if(light_walls)
+				view_fov(v, x, y);
+			for(k=0; k<c->words; k++)
+				walls[c->word + k] |= mask[k];
+			any = true;
+		}
+		if(!any)
+			continue;
+
+		/* Done once every ray is in shadow */
+		uint64_t open = 0;
+		for(k=0; k<t->words; k++)
+		{
+			shadow[k] |= walls[k];
+			open |= ~shadow[k];
+		}
+		if(!open)
+			return;
+	}
+}
@@ -0,0 +1,53 @@
+/*
+	RLFL contexts.
+
+	A context owns the random state and the scratch buffers of the
+	algorithms. Calls with different contexts share nothing but the
+	maps and the path and projection stores. Functions without a
+	context use RLFL_default_ctx.
+
+    Copyright (C) 2011
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+    <jtm@robot.is>
+*/
+/* Mersenne Twister state words */
+#define RLFL_MT_N 624
+
+/* Scratch buffers, see ctx_scratch() */
+#define SCRATCH_OPEN	0	/* A* open stack */
+#define SCRATCH_RAYS	1	/* Diamond raycasting rays */
+#define SCRATCH_RAYMAP	2	/* Diamond raycasting rays by cell */
+#define SCRATCH_VIEWS	3	/* Permissive views */
+#define SCRATCH_BUMPS	4	/* Permissive view bumps */
+#define SCRATCH_HEAP	5	/* Map stack open heap */
+#define SCRATCH_COUNT	6
+
+struct RLFL_ctx {
+	/* Random, mti == RLFL_MT_N + 1 until seeded */
+	unsigned long mt[RLFL_MT_N];
+	int mti;
+
+	/* Scratch, kept and grown between calls */
+	void *scratch[SCRATCH_COUNT];
+	size_t scratch_size[SCRATCH_COUNT];
+};
+
+/* Context of the functions without one */
+extern RLFL_ctx_t RLFL_default_ctx;
+
+extern void *ctx_scratch(RLFL_ctx_t *ctx, unsigned int s, size_t size);
+extern void ctx_seed(RLFL_ctx_t *ctx, unsigned long seed);
+extern unsigned long ctx_rand32(RLFL_ctx_t *ctx);
@@ -18,6 +18,7 @@
 
     <jtm@robot.is>
 */
+/* Default limit on live maps, see RLFL_set_max_maps() */
 #ifndef RLFL_MAX_MAPS
 #define RLFL_MAX_MAPS 12
 #endif
@@ -27,6 +28,14 @@
 #ifndef RLFL_MAX_PROJECTS
 #define RLFL_MAX_PROJECTS 12
 #endif
+/* Map stacks, see RLFL_stack_new() */
+#ifndef RLFL_MAX_STACKS
+#define RLFL_MAX_STACKS 12
+#endif
+/* Threads of a FOV batch, see RLFL_fov_batch() */
+#ifndef RLFL_MAX_THREADS
+#define RLFL_MAX_THREADS 16
+#endif
 #ifndef RLFL_MAX_RANGE
 #define RLFL_MAX_RANGE 60
 #endif
@@ -39,6 +48,17 @@
 #ifndef RLFL_MAX_HEIGHT
 #define RLFL_MAX_HEIGHT 5000
 #endif
+/* Size limits of MAP_SPARSE maps */
+#ifndef RLFL_MAX_SPARSE_WIDTH
+#define RLFL_MAX_SPARSE_WIDTH 32768
+#endif
+#ifndef RLFL_MAX_SPARSE_HEIGHT
+#define RLFL_MAX_SPARSE_HEIGHT 32768
+#endif
+/* Storage type for one cell, must hold CELL_MASK (16 bits) */
+#ifndef RLFL_CELL_TYPE
+#define RLFL_CELL_TYPE unsigned short
+#endif
 
 #define RLFL_SUCCESS			0
 #define RLFL_ERR_GENERIC		-1
@@ -48,6 +68,14 @@
 #define RLFL_ERR_OUT_OF_BOUNDS 	-5
 #define RLFL_ERR_NO_PROJECTION	-6
 #define RLFL_ERR_SIZE			-7
+#define RLFL_ERR_BUSY			-8
+#define RLFL_ERR_FILE			-9
+#define RLFL_ERR_NO_STACK		-10
+
+/* Map handles, (generation << RLFL_MAP_SLOT_BITS) | slot */
+#define RLFL_MAP_SLOT_BITS		20
+#define RLFL_MAP_SLOTS			(1 << RLFL_MAP_SLOT_BITS)
+#define RLFL_MAP_GEN_MASK		0x7FF
 
 /* CELL flags */
 #define CELL_NONE      		0x0000    /* No state */
@@ -99,13 +127,39 @@
 #define FOV_DIGITAL			4
 #define FOV_RESTRICTIVE		5
 #define FOV_PERMISSIVE		6
+#define FOV_TABLE			7
+#define FOV_SHADOW_ITER		8
+#define FOV_SYMMETRIC		9
 
 /* Path algorithms */
 #define PATH_BASIC			1
 #define PATH_ASTAR			2
 
-/* Access cell, (Map not validated) */
-#define CELL(m, x, y) RLFL_map_store[m]->cells[x + (y * RLFL_map_store[m]->width)]
+/* Portal types of map stacks, see RLFL_stack_link() */
+#define PORTAL_STAIRS		0x0001	/* Stairs */
+#define PORTAL_LADDER		0x0002	/* Ladder */
+#define PORTAL_PIT			0x0004	/* Pit or trapdoor, usually one way */
+#define PORTAL_GATE			0x0008	/* Gate or teleporter */
+#define PORTAL_ALL			0xFFFF	/* Any portal */
+
+/* Map layouts */
+#define MAP_DENSE			1	/* One cell per element, row major */
+#define MAP_PLANES			2	/* One bitplane per flag */
+#define MAP_TILED			3	/* Square tiles of cells, row major in a tile */
+#define MAP_SPARSE			4	/* Tiles allocated on first write */
+
+/* Map merge operations, see RLFL_merge_map() */
+#define MERGE_AND			1	/* Keep flags set in both maps */
+#define MERGE_OR			2	/* Add flags of the source map */
+#define MERGE_XOR			3	/* Flip flags set in the source map */
+#define MERGE_ANDNOT		4	/* Remove flags set in the source map */
+
+/* Number of bitplanes, one per flag bit */
+#define RLFL_PLANES			16
+
+/* Tile edge of MAP_TILED maps, RLFL_TILE * RLFL_TILE cells per tile */
+#define RLFL_TILE_SHIFT		4
+#define RLFL_TILE			(1 << RLFL_TILE_SHIFT)
 
 /* helpers */
 #define ABS(a) ((a)<0?-(a):(a))
@@ -0,0 +1,46 @@
+/*
+	RLFL field of view algorithms.
+
+	The algorithms behind RLFL_fov() and RLFL_fov_batch(), on a
+	view the caller checked, with the origin on the map and the
+	radius below RLFL_MAX_RADIUS.
+
+    Copyright (C) 2011
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+    <jtm@robot.is>
+*/
+extern unsigned int fov_radius(const map_view_t *v, unsigned int ox, unsigned int oy, unsigned int radius);
+extern err fov_run(RLFL_ctx_t *ctx, const map_view_t *v, unsigned int ox, unsigned int oy,
+				   unsigned int radius, unsigned int algorithm, bool light_walls);
+extern void fov_finish(const map_view_t *v, int x0, int y0, int x1, int y1, int dx, int dy);
+extern err fov_circular_raycasting(const map_view_t *v, unsigned int ox, unsigned int oy,
+								   unsigned int radius, bool light_walls);
+extern err fov_diamond_raycasting(RLFL_ctx_t *ctx, const map_view_t *v, unsigned int ox,
+								  unsigned int oy, unsigned int radius, bool light_walls);
+extern err fov_recursive_shadowcasting(const map_view_t *v, unsigned int ox, unsigned int oy,
+									   int radius, bool light_walls);
+extern err fov_digital(const map_view_t *v, unsigned int ox, unsigned int oy, int radius,
+					   bool light_walls);
+extern err fov_permissive(RLFL_ctx_t *ctx, const map_view_t *v, unsigned int ox, unsigned int oy,
+						  unsigned int radius, bool light_walls);
+extern err fov_restrictive_shadowcasting(const map_view_t *v, unsigned int ox, unsigned int oy,
+										 int radius, bool light_walls);
+extern err fov_iterative_shadowcasting(const map_view_t *v, unsigned int ox, unsigned int oy,
+										int radius, bool light_walls);
+extern err fov_symmetric_shadowcasting(const map_view_t *v, unsigned int ox, unsigned int oy,
+										int radius, bool light_walls);
+extern err fov_view_table(const map_view_t *v, unsigned int ox, unsigned int oy, unsigned int radius,
+						  bool light_walls);
@@ -0,0 +1,541 @@
+/*
+	RLFL map storage.
+
+	Cell accessors for all map layouts. None of these validate the
+	map or the location, callers must do that.
+
+    Copyright (C) 2011
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+    <jtm@robot.is>
+*/
+/* Plane of flag bit `b` */
+#define PLANE(map, b) ((map)->planes + ((b) * (map)->words))
+#define PLANE_WORD(i) ((i) >> 6)
+#define PLANE_BIT(i) (1ULL << ((i) & 63))
+
+/* Cells per tile */
+#define TILE_CELLS (RLFL_TILE * RLFL_TILE)
+#define TILE_MASK (RLFL_TILE - 1)
+
+/* Tile storage, `cells` is what map->tiles points to. A tile is
+   shared copy-on-write by `refs` maps, which lock apart, so `refs`
+   is only changed and read atomically. */
+typedef struct {
+	unsigned int refs;
+	RLFL_cell_t cells[];
+} map_tile_t;
+#define TILE_HEAD(tile) ((map_tile_t *)((char *)(tile) - offsetof(map_tile_t, cells)))
+
+/* Squares of change tracking, RLFL_TILE cells wide */
+#define DIRTY_W(map) (((map)->width + TILE_MASK) >> RLFL_TILE_SHIFT)
+#define DIRTY_H(map) (((map)->height + TILE_MASK) >> RLFL_TILE_SHIFT)
+
+/* Packed query results, bit i of byte i / 8 */
+#define PACKED_SIZE(n) (((n) + 7) >> 3)
+#define PACKED_SET(bits, i) ((bits)[(i) >> 3] |= (uint8_t)(1 << ((i) & 7)))
+
+/* Read cell, (Map not validated) */
+#define CELL(m, x, y) cell_get(RLFL_MAP(m), (x), (y))
+
+/* A map checked once where an algorithm starts, see view_open().
+   The view_* accessors check nothing, not the map, the cell or the
+   flag. A FOV on a view with `seen` marks bit i of `seen`, cell
+   i of the seen_w * seen_h rectangle at seen_x, seen_y, and leaves
+   the map alone, see RLFL_fov_batch(). */
+typedef struct {
+	RLFL_map_t *map;
+	unsigned int width, height;
+	uint8_t *seen;
+	unsigned int seen_x, seen_y, seen_w, seen_h;
+} map_view_t;
+
+/* Connected regions, see region.c */
+typedef struct map_regions {
+	unsigned int *parent;	/* Union-find parent of each cell */
+	uint8_t *rank;
+	uint8_t *seen;			/* Cells stamped by the walk of a split */
+	uint8_t stamp;
+	unsigned int *queue;	/* Walk queue, room for `queue_size` cells */
+	unsigned int queue_size;
+	unsigned int count;		/* Number of regions */
+} map_regions_t;
+
+/* Journal, see journal.c */
+typedef struct {
+	unsigned int cell;		/* x + (y * width) */
+	RLFL_cell_t old;		/* Value before the change */
+} journal_entry_t;
+
+typedef struct map_journal {
+	journal_entry_t *ring;
+	unsigned int size;		/* Entries the ring holds */
+	unsigned int head;		/* Entries written, the next checkpoint */
+	unsigned int count;		/* Entries held, at most `size` */
+	RLFL_cell_t *before;	/* Cells before a bulk change, see journal_begin() */
+	unsigned int before_size;
+	unsigned int x, y, w, h;
+} map_journal_t;
+
+/* Cells marked by a FOV, see RLFL_fov() */
+typedef struct map_fov {
+	unsigned int *cells;	/* x + (y * width) */
+	unsigned int count, size;
+	unsigned long flag;		/* Flags the running FOV sets, 0 when none runs */
+	bool valid;				/* No other cell has CELL_SEEN or CELL_LIT */
+} map_fov_t;
+
+extern err map_alloc_cells(RLFL_map_t *map);
+extern void map_free_cells(RLFL_map_t *map);
+extern err map_clear_flag(RLFL_map_t *map, unsigned long flag);
+extern err map_fill_flag(RLFL_map_t *map, unsigned long flag);
+extern void map_read_cells(RLFL_map_t *map, RLFL_cell_t *dst);
+extern err map_write_cells(RLFL_map_t *map, const RLFL_cell_t *src);
+extern err map_rect_flag(RLFL_map_t *map, unsigned int x, unsigned int y, unsigned int w,
+						 unsigned int h, unsigned long flag, bool set);
+extern unsigned int map_rect_has(RLFL_map_t *map, unsigned int x, unsigned int y, unsigned int w,
+								 unsigned int h, unsigned long flag, uint8_t *bits);
+extern unsigned int map_count_flag(RLFL_map_t *map, unsigned int x, unsigned int y, unsigned int w,
+								   unsigned int h, unsigned long flag);
+extern void map_histogram(RLFL_map_t *map, unsigned int x, unsigned int y, unsigned int w,
+						  unsigned int h, unsigned int *counts);
+extern err map_mask_flag(RLFL_map_t *map, RLFL_map_t *mask, unsigned long mflag,
+						 unsigned long flag, bool set);
+extern unsigned int map_mask_has(RLFL_map_t *map, RLFL_map_t *mask, unsigned long mflag,
+								 unsigned long flag, uint8_t *bits);
+extern err map_merge(RLFL_map_t *map, RLFL_map_t *src, unsigned int op, unsigned long flag,
+					 unsigned int x, unsigned int y, unsigned int w, unsigned int h);
+extern err map_clone_cells(RLFL_map_t *map, RLFL_map_t *src);
+extern err map_file_write(RLFL_map_t *map, const char *path);
+extern err map_file_open(RLFL_map_t *map, const char *path);
+extern void map_unmap_file(RLFL_map_t *map);
+extern err map_shm_create(RLFL_map_t *map, RLFL_map_t *src, const char *name);
+extern err map_shm_attach(RLFL_map_t *map, const char *name, bool private_pages);
+extern unsigned int map_shm_generation(RLFL_map_t *map);
+extern unsigned int map_shm_publish(RLFL_map_t *map);
+extern err map_shm_unlink(const char *name);
+extern err map_own_tile(RLFL_map_t *map, unsigned int t);
+extern err map_track(RLFL_map_t *map, unsigned long flag);
+extern void map_mark_dirty(RLFL_map_t *map, unsigned int x, unsigned int y, unsigned int w,
+						   unsigned int h);
+extern int map_dirty_rects(RLFL_map_t *map, unsigned int since, unsigned int *rects,
+						   unsigned int max);
+extern err region_track(RLFL_map_t *map, unsigned long flag);
+extern void region_free(RLFL_map_t *map);
+extern err region_build(RLFL_map_t *map);
+extern err region_cell(RLFL_map_t *map, unsigned int x, unsigned int y, unsigned long flag,
+					   bool set);
+extern err region_sync(RLFL_map_t *map, unsigned int x, unsigned int y, unsigned int w,
+					   unsigned int h);
+extern unsigned int region_label(RLFL_map_t *map, unsigned int x, unsigned int y);
+extern err journal_start(RLFL_map_t *map, unsigned int size);
+extern void journal_free(RLFL_map_t *map);
+extern void journal_cell(RLFL_map_t *map, unsigned int x, unsigned int y, unsigned long flag,
+						 bool set);
+extern err journal_begin(RLFL_map_t *map, unsigned int x, unsigned int y, unsigned int w,
+						 unsigned int h);
+extern void journal_end(RLFL_map_t *map);
+extern err journal_rollback(RLFL_map_t *map, unsigned int mark);
+extern void map_fov_add(RLFL_map_t *map, unsigned int cell);
+extern void map_fov_free(RLFL_map_t *map);
+/*
+ +-----------------------------------------------------------+
+ * @desc	True if `p` points into the file of a loaded map,
+ * 			such storage is not freed
+ +-----------------------------------------------------------+
+ */
+static inline bool
+map_in_file(RLFL_map_t *map, const void *p)
+{
+	return (map->file && (const char *)p >= (const char *)map->file
+			&& (const char *)p < (const char *)map->file + map->file_size);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	map_mark_dirty() for one cell
+ +-----------------------------------------------------------+
+ */
+static inline void
+mark_cell(RLFL_map_t *map, unsigned int x, unsigned int y)
+{
+	map->dirty[(x >> RLFL_TILE_SHIFT) + ((y >> RLFL_TILE_SHIFT) * DIRTY_W(map))] = map->version;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	True if changes to `flag` are tracked, a new version
+ * 			is started for the caller to mark
+ +-----------------------------------------------------------+
+ */
+static inline bool
+tracked(RLFL_map_t *map, unsigned long flag)
+{
+	if(map->dirty == NULL || !(flag & map->track))
+		return false;
+
+	map->version++;
+	return true;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	True if changes to `flag` may open or close cells
+ * 			of a region, see region_cell() and region_sync()
+ +-----------------------------------------------------------+
+ */
+static inline bool
+regioned(RLFL_map_t *map, unsigned long flag)
+{
+	return (map->regions && (flag & map->region_flag));
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Setting `flag` may mark cells the last FOV did not,
+ * 			the next one clears the whole map
+ +-----------------------------------------------------------+
+ */
+static inline void
+fov_forget(RLFL_map_t *map, unsigned long flag)
+{
+	if(map->fov && (flag & (CELL_SEEN|CELL_LIT)))
+		map->fov->valid = false;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Tile of a cell, MAP_TILED and MAP_SPARSE
+ +-----------------------------------------------------------+
+ */
+static inline unsigned int
+tile_index(RLFL_map_t *map, unsigned int x, unsigned int y)
+{
+	return (x >> RLFL_TILE_SHIFT) + ((y >> RLFL_TILE_SHIFT) * map->tiles_w);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Cell in a tile
+ +-----------------------------------------------------------+
+ */
+static inline RLFL_cell_t *
+tile_cell(RLFL_map_t *map, unsigned int x, unsigned int y)
+{
+	RLFL_cell_t *tile = map->tiles[tile_index(map, x, y)];
+	return tile + ((x & TILE_MASK) + ((y & TILE_MASK) << RLFL_TILE_SHIFT));
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	True if tile `t` must be copied before a write, it
+ * 			is the fill tile or shared with a clone
+ +-----------------------------------------------------------+
+ */
+static inline bool
+tile_shared(RLFL_map_t *map, unsigned int t)
+{
+	return (map->tiles[t] == map->fill
+			|| __atomic_load_n(&TILE_HEAD(map->tiles[t])->refs, __ATOMIC_ACQUIRE) > 1);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Write `value` to a cell in a tile. A shared tile is
+ * 			only copied when the value changes.
+ +-----------------------------------------------------------+
+ */
+static inline err
+tile_write(RLFL_map_t *map, unsigned int x, unsigned int y, RLFL_cell_t value)
+{
+	RLFL_cell_t *cell = tile_cell(map, x, y);
+	if(*cell == value)
+		return RLFL_SUCCESS;
+
+	unsigned int t = tile_index(map, x, y);
+	if(tile_shared(map, t))
+	{
+		if(map_own_tile(map, t))
+			return RLFL_ERR_GENERIC;
+		cell = tile_cell(map, x, y);
+	}
+	*cell = value;
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	All flags of a cell
+ +-----------------------------------------------------------+
+ */
+static inline RLFL_cell_t
+cell_get(RLFL_map_t *map, unsigned int x, unsigned int y)
+{
+	if(map->layout == MAP_PLANES)
+	{
+		unsigned int i = x + (y * map->width);
+		RLFL_cell_t value = 0;
+		int b;
+		for(b=0; b<RLFL_PLANES; b++)
+		{
+			if(PLANE(map, b)[PLANE_WORD(i)] & PLANE_BIT(i))
+				value |= (1 << b);
+		}
+		return value;
+	}
+	if(map->tiles)
+		return *tile_cell(map, x, y);
+
+	return map->cells[x + (y * map->width)];
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	True if any of `flag` is set on cell
+ +-----------------------------------------------------------+
+ */
+static inline bool
+cell_has(RLFL_map_t *map, unsigned int x, unsigned int y, unsigned long flag)
+{
+	if(map->layout == MAP_PLANES)
+	{
+		/* Only the planes asked for are read */
+		unsigned int i = x + (y * map->width);
+		while(flag)
+		{
+			int b = __builtin_ctzl(flag);
+			if(PLANE(map, b)[PLANE_WORD(i)] & PLANE_BIT(i))
+				return true;
+			flag &= (flag - 1);
+		}
+		return false;
+	}
+	return (cell_get(map, x, y) & flag) != 0;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Set `flag` on cell
+ +-----------------------------------------------------------+
+ */
+static inline err
+cell_set(RLFL_map_t *map, unsigned int x, unsigned int y, unsigned long flag)
+{
+	if(map->layout == MAP_PLANES)
+	{
+		unsigned int i = x + (y * map->width);
+		while(flag)
+		{
+			PLANE(map, __builtin_ctzl(flag))[PLANE_WORD(i)] |= PLANE_BIT(i);
+			flag &= (flag - 1);
+		}
+		return RLFL_SUCCESS;
+	}
+	if(map->tiles)
+		return tile_write(map, x, y, *tile_cell(map, x, y) | flag);
+
+	map->cells[x + (y * map->width)] |= flag;
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Clear `flag` from cell
+ +-----------------------------------------------------------+
+ */
+static inline err
+cell_clear(RLFL_map_t *map, unsigned int x, unsigned int y, unsigned long flag)
+{
+	if(map->layout == MAP_PLANES)
+	{
+		unsigned int i = x + (y * map->width);
+		while(flag)
+		{
+			PLANE(map, __builtin_ctzl(flag))[PLANE_WORD(i)] &= ~PLANE_BIT(i);
+			flag &= (flag - 1);
+		}
+		return RLFL_SUCCESS;
+	}
+	if(map->tiles)
+		return tile_write(map, x, y, *tile_cell(map, x, y) & ~flag);
+
+	map->cells[x + (y * map->width)] &= ~flag;
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Open a view of map `m`, the one check an algorithm
+ * 			makes of the map
+ +-----------------------------------------------------------+
+ */
+static inline err
+view_open(map_view_t *v, unsigned int m)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	v->map = RLFL_MAP(m);
+	v->width = v->map->width;
+	v->height = v->map->height;
+	v->seen = NULL;
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	True if x, y is on the map
+ +-----------------------------------------------------------+
+ */
+static inline bool
+view_in(const map_view_t *v, int x, int y)
+{
+	return ((unsigned int)x < v->width && (unsigned int)y < v->height);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	True if any of `flag` is set on cell
+ +-----------------------------------------------------------+
+ */
+static inline bool
+view_has(const map_view_t *v, unsigned int x, unsigned int y, unsigned long flag)
+{
+	if(v->map->layout == MAP_DENSE)
+		return (v->map->cells[x + (y * v->width)] & flag) != 0;
+
+	return cell_has(v->map, x, y, flag);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	All flags of a cell
+ +-----------------------------------------------------------+
+ */
+static inline RLFL_cell_t
+view_get(const map_view_t *v, unsigned int x, unsigned int y)
+{
+	if(v->map->layout == MAP_DENSE)
+		return v->map->cells[x + (y * v->width)];
+
+	return cell_get(v->map, x, y);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Set `flag` on cell, as RLFL_set_flag() but for
+ * 			the FOV record
+ +-----------------------------------------------------------+
+ */
+static inline err
+view_write(const map_view_t *v, unsigned int x, unsigned int y, unsigned long flag)
+{
+	if(tracked(v->map, flag))
+		mark_cell(v->map, x, y);
+
+	if(v->map->journal)
+		journal_cell(v->map, x, y, flag, true);
+
+	if(regioned(v->map, flag))
+		return region_cell(v->map, x, y, flag, true);
+
+	if(v->map->layout == MAP_DENSE)
+	{
+		v->map->cells[x + (y * v->width)] |= flag;
+		return RLFL_SUCCESS;
+	}
+	return cell_set(v->map, x, y, flag);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Set `flag` on cell, as RLFL_set_flag()
+ +-----------------------------------------------------------+
+ */
+static inline err
+view_set(const map_view_t *v, unsigned int x, unsigned int y, unsigned long flag)
+{
+	fov_forget(v->map, flag);
+	return view_write(v, x, y, flag);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Mark cell in FOV. Under RLFL_fov() the cell is
+ * 			recorded and lit along with it, see map_fov_t.
+ +-----------------------------------------------------------+
+ */
+static inline err
+view_fov(const map_view_t *v, unsigned int x, unsigned int y)
+{
+	if(v->seen)
+	{
+		unsigned int sx = x - v->seen_x, sy = y - v->seen_y;
+		if(sx < v->seen_w && sy < v->seen_h)
+			PACKED_SET(v->seen, sx + (sy * v->seen_w));
+		return RLFL_SUCCESS;
+	}
+
+	map_fov_t *f = v->map->fov;
+	if(f == NULL || !f->flag)
+		return view_set(v, x, y, CELL_FOV);
+
+	if(!view_has(v, x, y, CELL_SEEN|CELL_LIT))
+		map_fov_add(v->map, x + (y * v->width));
+	return view_write(v, x, y, f->flag);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Clear `flag` from cell, as RLFL_clear_flag()
+ +-----------------------------------------------------------+
+ */
+static inline err
+view_clear(const map_view_t *v, unsigned int x, unsigned int y, unsigned long flag)
+{
+	if(tracked(v->map, flag))
+		mark_cell(v->map, x, y);
+
+	if(v->map->journal)
+		journal_cell(v->map, x, y, flag, false);
+
+	if(regioned(v->map, flag))
+		return region_cell(v->map, x, y, flag, false);
+
+	if(v->map->layout == MAP_DENSE)
+	{
+		v->map->cells[x + (y * v->width)] &= ~flag;
+		return RLFL_SUCCESS;
+	}
+	return cell_clear(v->map, x, y, flag);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	True if cell is in FOV, see view_fov()
+ +-----------------------------------------------------------+
+ */
+static inline bool
+view_seen(const map_view_t *v, unsigned int x, unsigned int y)
+{
+	if(v->seen)
+	{
+		unsigned int sx = x - v->seen_x, sy = y - v->seen_y;
+		if(sx >= v->seen_w || sy >= v->seen_h)
+			return false;
+		unsigned int i = sx + (sy * v->seen_w);
+		return (v->seen[i >> 3] >> (i & 7)) & 1;
+	}
+	return view_has(v, x, y, CELL_SEEN);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Take cell out of FOV, see view_fov()
+ +-----------------------------------------------------------+
+ */
+static inline err
+view_unsee(const map_view_t *v, unsigned int x, unsigned int y)
+{
+	if(v->seen)
+	{
+		unsigned int sx = x - v->seen_x, sy = y - v->seen_y;
+		if(sx < v->seen_w && sy < v->seen_h)
+		{
+			unsigned int i = sx + (sy * v->seen_w);
+			v->seen[i >> 3] &= (uint8_t)~(1 << (i & 7));
+		}
+		return RLFL_SUCCESS;
+	}
+	return view_clear(v, x, y, CELL_SEEN|CELL_LIT);
+}
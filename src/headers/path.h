@@ -30,11 +30,16 @@ typedef struct path_element {
 
 /* Dijkstra grid */
 typedef struct {
-	/* Stack of unprocessed nodes */
+	/* Context the open stack is scratch of */
+	RLFL_ctx_t *ctx;
+
+	/* Stack of unprocessed nodes, room for `size` */
 	path_element ** open;
+	int size;
 
-	/* map of all nodes */
-	path_element * nodes;
+	/* Nodes, in blocks of RLFL_TILE * RLFL_TILE allocated on first use */
+	path_element ** blocks;
+	unsigned int blocks_w, blocks_h;
 
 	/* */
 	int top;
@@ -47,10 +52,11 @@ typedef struct {
 
 	unsigned int cx, cy;
 } path_int_t;
-path_int_t* PATH;
+
+/* Store `path` in a free slot of RLFL_path_store, see rlfl.c */
+extern int path_store_put(RLFL_path_t *path);
 
 #define STATE_EMPTY		0
 #define STATE_OPEN		1
 #define STATE_CLOSED	2
 
-extern void delete_path(void);
@@ -22,8 +22,11 @@
 #include <stdio.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>	// memcpy
+#include <stddef.h>	// offsetof
 #include <time.h>
+#include <pthread.h>
 
 // includes
 #include "list_t.h"
@@ -31,13 +34,73 @@
 
 // types
 typedef int err;
+typedef RLFL_CELL_TYPE RLFL_cell_t;
 typedef struct {
 	unsigned int width;
 	unsigned int height;
 	unsigned int cellcnt;
 	unsigned int mnum;
-	unsigned long *cells;
-	int * path_map[RLFL_MAX_MAPS];
+
+	/* Cell layout, MAP_* */
+	unsigned int layout;
+
+	/* MAP_DENSE */
+	RLFL_cell_t *cells;
+
+	/* MAP_PLANES, RLFL_PLANES planes of `words` words */
+	uint64_t *planes;
+	unsigned int words;
+
+	/* MAP_TILED and MAP_SPARSE, tiles_w * tiles_h tiles in row major order */
+	RLFL_cell_t **tiles;
+	unsigned int tiles_w, tiles_h;
+
+	/* MAP_SPARSE, tile shared by all unwritten tiles, and tiles allocated.
+	   Other tiles may be shared with clones, see RLFL_clone_map() */
+	RLFL_cell_t *fill;
+	unsigned int owned;
+
+	/* Outstanding RLFL_map_pin() calls, a pinned map is not wiped */
+	unsigned int pins;
+
+	/* Shared by threads reading the map, held by one writing it, see
+	   RLFL_map_lock() */
+	pthread_rwlock_t lock;
+
+	/* Change tracking, see RLFL_map_track(). Changes to `track` flags
+	   bump `version`, `dirty` holds the version of the last change to
+	   each RLFL_TILE square, (NULL when not tracking) */
+	unsigned int *dirty;
+	unsigned long track;
+	unsigned int version;
+
+	/* Connected regions of cells with any of `region_flag`, see
+	   RLFL_region_track(), (NULL when not kept) */
+	struct map_regions *regions;
+	unsigned long region_flag;
+
+	/* Old values of changed cells, see RLFL_map_journal(), (NULL when
+	   not journaled) */
+	struct map_journal *journal;
+
+	/* Cells the last RLFL_fov() marked, the next one clears only
+	   those, (NULL before the first). Not trusted while `cells_out`
+	   arrays from RLFL_map_cells() are not released. */
+	struct map_fov *fov;
+	unsigned int cells_out;
+
+	/* Mapping of the file of a loaded map, see RLFL_map_load(), or of
+	   the segment of a shared map, see RLFL_map_share() */
+	void *file;
+	size_t file_size;
+
+	/* Shared mapping of the first page of the segment of a shared map,
+	   (NULL otherwise). Only the map that created the segment, the
+	   `shm_writer`, publishes. */
+	void *shm;
+	bool shm_writer;
+
+	int * path_map[RLFL_MAX_PATHS];
 } RLFL_map_t;
 
 typedef struct {
@@ -68,15 +131,55 @@ typedef struct {
 	unsigned int map;
 } RLFL_path_t;
 
-/* Map */
-extern RLFL_map_t * RLFL_map_store[];
+/* Random state and scratch of the algorithms, see ctx.c */
+typedef struct RLFL_ctx RLFL_ctx_t;
+
+/* One FOV of a batch, see RLFL_fov_batch() */
+typedef struct {
+	unsigned int x, y, radius, algorithm;
+
+	/* Bit i is set if cell i of the rectangle RLFL_fov_window()
+	   gives is seen, PACKED_SIZE(w * h) bytes */
+	uint8_t *bits;
+} RLFL_viewer_t;
+
+/* Map, indexed by slot, see RLFL_MAP() */
+extern RLFL_map_t ** RLFL_map_store;
+
+/* Map of a handle, (Handle not validated) */
+#define MAP_SLOT(m) ((m) & (RLFL_MAP_SLOTS - 1))
+#define RLFL_MAP(m) (RLFL_map_store[MAP_SLOT(m)])
+
 extern int RLFL_new_map(unsigned int w, unsigned int h);
+extern int RLFL_new_map_layout(unsigned int w, unsigned int h, unsigned int layout);
+extern int RLFL_clone_map(unsigned int m);
+extern int RLFL_map_layout(unsigned int m);
+extern err RLFL_map_tiles(unsigned int m, unsigned int *used, unsigned int *total);
 extern err RLFL_wipe_map(unsigned int m);
 extern void RLFL_wipe_all(void);
 extern bool RLFL_cell_valid(unsigned int m, unsigned int x, unsigned int y);
 extern bool RLFL_map_valid(unsigned int m);
 extern err RLFL_map_size(unsigned int m, unsigned int *w, unsigned int *h);
 extern err RLFL_translate_xy(unsigned int m, int i, unsigned int *x, unsigned int *y);
+extern err RLFL_set_max_maps(unsigned int limit);
+extern unsigned int RLFL_max_maps(void);
+extern unsigned int RLFL_map_count(void);
+
+/* Cell arrays */
+extern err RLFL_map_cells(unsigned int m, RLFL_cell_t **cells);
+extern err RLFL_map_cells_release(unsigned int m);
+extern err RLFL_map_pin(unsigned int m);
+extern err RLFL_map_unpin(unsigned int m);
+
+/* Locking, any number of readers or one writer on a map. None of the
+   other functions lock, callers sharing a map between threads do. */
+extern err RLFL_map_lock(unsigned int m);
+extern err RLFL_map_trylock(unsigned int m);
+extern err RLFL_map_rdlock(unsigned int m);
+extern err RLFL_map_tryrdlock(unsigned int m);
+extern err RLFL_map_unlock(unsigned int m);
+extern err RLFL_map_read(unsigned int m, RLFL_cell_t *dst);
+extern err RLFL_map_write(unsigned int m, const RLFL_cell_t *src);
 
 /* Flags */
 extern err RLFL_set_flag(unsigned int m, unsigned int x, unsigned int y, unsigned long flag);
@@ -86,10 +189,81 @@ extern err RLFL_clear_map(unsigned int m, unsigned long flag);
 extern err RLFL_fill_map(unsigned int m, unsigned long flag);
 extern int RLFL_get_flags(unsigned int m, unsigned int x, unsigned int y);
 
+/* Bulk flags, query results are packed, one bit per cell */
+extern err RLFL_set_flag_rect(unsigned int m, unsigned int x, unsigned int y, unsigned int w,
+							  unsigned int h, unsigned long flag);
+extern err RLFL_clear_flag_rect(unsigned int m, unsigned int x, unsigned int y, unsigned int w,
+								unsigned int h, unsigned long flag);
+extern int RLFL_has_flag_rect(unsigned int m, unsigned int x, unsigned int y, unsigned int w,
+							  unsigned int h, unsigned long flag, uint8_t *bits);
+extern err RLFL_set_flag_list(unsigned int m, const unsigned int *xy, unsigned int n, unsigned long flag);
+extern err RLFL_clear_flag_list(unsigned int m, const unsigned int *xy, unsigned int n, unsigned long flag);
+extern int RLFL_has_flag_list(unsigned int m, const unsigned int *xy, unsigned int n, unsigned long flag,
+							  uint8_t *bits);
+extern err RLFL_set_flag_mask(unsigned int m, unsigned int mask, unsigned long mflag, unsigned long flag);
+extern err RLFL_clear_flag_mask(unsigned int m, unsigned int mask, unsigned long mflag, unsigned long flag);
+extern int RLFL_has_flag_mask(unsigned int m, unsigned int mask, unsigned long mflag, unsigned long flag,
+							  uint8_t *bits);
+
+/* Map statistics */
+extern int RLFL_count_flags(unsigned int m, unsigned long flag);
+extern int RLFL_count_flags_rect(unsigned int m, unsigned int x, unsigned int y, unsigned int w,
+								 unsigned int h, unsigned long flag);
+extern err RLFL_flag_histogram(unsigned int m, unsigned int *counts);
+extern err RLFL_flag_histogram_rect(unsigned int m, unsigned int x, unsigned int y, unsigned int w,
+									unsigned int h, unsigned int *counts);
+
+/* Change tracking */
+extern err RLFL_map_track(unsigned int m, unsigned long flag);
+extern err RLFL_map_version(unsigned int m, unsigned int *version);
+extern int RLFL_map_dirty(unsigned int m, unsigned int since, unsigned int *rects, unsigned int max);
+
+/* Connected regions */
+extern err RLFL_region_track(unsigned int m, unsigned long flag);
+extern int RLFL_region(unsigned int m, unsigned int x, unsigned int y);
+extern int RLFL_region_connected(unsigned int m, unsigned int x1, unsigned int y1, unsigned int x2,
+								 unsigned int y2);
+extern int RLFL_region_count(unsigned int m);
+extern err RLFL_region_labels(unsigned int m, unsigned int *labels);
+
+/* Journal */
+extern err RLFL_map_journal(unsigned int m, unsigned int size);
+extern err RLFL_map_checkpoint(unsigned int m, unsigned int *mark);
+extern err RLFL_map_rollback(unsigned int m, unsigned int mark);
+
+/* Map files */
+extern err RLFL_map_save(unsigned int m, const char *path);
+extern int RLFL_map_load(const char *path);
+
+/* Shared maps */
+extern int RLFL_map_share(unsigned int m, const char *name);
+extern int RLFL_map_attach(const char *name, bool private_pages);
+extern err RLFL_map_unlink(const char *name);
+extern err RLFL_map_publish(unsigned int m, unsigned int *generation);
+extern err RLFL_map_generation(unsigned int m, unsigned int *generation);
+
+/* Merge maps */
+extern err RLFL_merge_map(unsigned int m, unsigned int src, unsigned int op, unsigned long flag);
+extern err RLFL_merge_map_rect(unsigned int m, unsigned int src, unsigned int op, unsigned long flag,
+							   unsigned int x, unsigned int y, unsigned int w, unsigned int h);
+
+/* Contexts, one per thread. Functions taking a context, (`_ctx`), may run
+   at once on different maps with different contexts. The others use a
+   shared default context, or keep no state at all. Paths may be created
+   from any thread, maps and projections are created and deleted from
+   one thread. */
+extern RLFL_ctx_t * RLFL_ctx_new(void);
+extern void RLFL_ctx_delete(RLFL_ctx_t *ctx);
+extern void RLFL_ctx_seed(RLFL_ctx_t *ctx, unsigned long seed);
+extern void RLFL_seed(unsigned long seed);
+
 /* Random */
 extern int RLFL_randint(int limit);
 extern int RLFL_randrange(int min, int max);
 extern int RLFL_randspread(int origin, int range);
+extern int RLFL_randint_ctx(RLFL_ctx_t *ctx, int limit);
+extern int RLFL_randrange_ctx(RLFL_ctx_t *ctx, int min, int max);
+extern int RLFL_randspread_ctx(RLFL_ctx_t *ctx, int origin, int range);
 
 /* LOS */
 extern err RLFL_los(unsigned int map, unsigned int y1, unsigned int x1, unsigned int y2, unsigned int x2);
@@ -105,6 +279,13 @@ extern err RLFL_path_basic(unsigned int m, unsigned int ox, unsigned int oy, uns
 						  int range, unsigned long flags);
 extern err RLFL_path_astar(unsigned int m, unsigned int ox, unsigned int oy, unsigned int dx, unsigned int dy,
 						  int range, unsigned long flags, float dcost);
+extern err RLFL_path_create_ctx(RLFL_ctx_t *ctx, unsigned int m, unsigned int ox, unsigned int oy,
+								unsigned int dx, unsigned int dy, unsigned int algorithm, int range,
+								unsigned long flags, float dcost);
+extern err RLFL_path_basic_ctx(RLFL_ctx_t *ctx, unsigned int m, unsigned int ox, unsigned int oy,
+							   unsigned int dx, unsigned int dy, int range, unsigned long flags);
+extern err RLFL_path_astar_ctx(RLFL_ctx_t *ctx, unsigned int m, unsigned int ox, unsigned int oy,
+							   unsigned int dx, unsigned int dy, int range, unsigned long flags, float dcost);
 
 /* Path map */
 extern err RLFL_path_fill_map(unsigned int m, unsigned int x, unsigned int y, float dcost, bool safety);
@@ -115,10 +296,35 @@ extern err RLFL_path_wipe_all_maps(unsigned int m);
 extern err RLFL_path_step_map(unsigned int m, unsigned int p, unsigned int ox, unsigned int oy,
 							  unsigned int *x, unsigned int *y);
 
+/* Map stacks, levels joined by portals */
+extern int RLFL_stack_new(void);
+extern err RLFL_stack_delete(unsigned int s);
+extern int RLFL_stack_add(unsigned int s, unsigned int m);
+extern int RLFL_stack_size(unsigned int s);
+extern int RLFL_stack_level(unsigned int s, unsigned int l);
+extern err RLFL_stack_link(unsigned int s, unsigned int l1, unsigned int x1, unsigned int y1, unsigned int l2,
+						   unsigned int x2, unsigned int y2, unsigned int type, float cost);
+extern int RLFL_stack_unlink(unsigned int s, unsigned int l, unsigned int x, unsigned int y);
+extern int RLFL_stack_path(unsigned int s, unsigned int l1, unsigned int x1, unsigned int y1, unsigned int l2,
+						   unsigned int x2, unsigned int y2, unsigned int types, float dcost, unsigned int *steps,
+						   unsigned int max);
+extern int RLFL_stack_path_ctx(RLFL_ctx_t *ctx, unsigned int s, unsigned int l1, unsigned int x1,
+							   unsigned int y1, unsigned int l2, unsigned int x2, unsigned int y2,
+							   unsigned int types, float dcost, unsigned int *steps, unsigned int max);
+extern int RLFL_stack_fill_map(unsigned int s, unsigned int l, unsigned int x, unsigned int y,
+							   unsigned int types, float dcost);
+extern int RLFL_stack_fill_map_ctx(RLFL_ctx_t *ctx, unsigned int s, unsigned int l, unsigned int x,
+								   unsigned int y, unsigned int types, float dcost);
+extern err RLFL_stack_step_map(unsigned int s, unsigned int p, unsigned int l, unsigned int x, unsigned int y,
+							   unsigned int types, unsigned int *nl, unsigned int *nx, unsigned int *ny);
+extern err RLFL_stack_wipe_map(unsigned int s, unsigned int p);
+
 /* Utility */
 extern int RLFL_distance(unsigned int x1, unsigned int y1, unsigned int x2, unsigned int y2);
 extern err RLFL_scatter(unsigned int m, unsigned int ox, unsigned int oy, unsigned int *dx, unsigned int *dy,
 					    int range, unsigned long flag, bool need_los);
+extern err RLFL_scatter_ctx(RLFL_ctx_t *ctx, unsigned int m, unsigned int ox, unsigned int oy, unsigned int *dx,
+							unsigned int *dy, int range, unsigned long flag, bool need_los);
 
 /* FOV */
 extern err RLFL_fov(unsigned int m, unsigned int ox, unsigned int oy, unsigned int radius,
@@ -135,6 +341,24 @@ extern err RLFL_fov_permissive(unsigned int m, unsigned int ox, unsigned int oy,
 							  bool light_walls);
 extern err RLFL_fov_restrictive_shadowcasting(unsigned int m, unsigned int ox, unsigned int oy, int radius,
 							  bool light_walls);
+extern err RLFL_fov_iterative_shadowcasting(unsigned int m, unsigned int ox, unsigned int oy, int radius,
+											bool light_walls);
+extern err RLFL_fov_symmetric_shadowcasting(unsigned int m, unsigned int ox, unsigned int oy, int radius,
+											bool light_walls);
+extern err RLFL_fov_view_table(unsigned int m, unsigned int ox, unsigned int oy, unsigned int radius,
+							   bool light_walls);
+extern err RLFL_fov_ctx(RLFL_ctx_t *ctx, unsigned int m, unsigned int ox, unsigned int oy, unsigned int radius,
+						unsigned int algorithm, bool lit, bool light_walls);
+extern err RLFL_fov_diamond_raycasting_ctx(RLFL_ctx_t *ctx, unsigned int m, unsigned int ox, unsigned int oy,
+										   unsigned int radius, bool light_walls);
+extern err RLFL_fov_permissive_ctx(RLFL_ctx_t *ctx, unsigned int m, unsigned int ox, unsigned int oy,
+								   unsigned int radius, bool light_walls);
+extern err RLFL_fov_window(unsigned int m, unsigned int ox, unsigned int oy, unsigned int radius,
+						   unsigned int *rect);
+extern err RLFL_fov_batch(unsigned int m, RLFL_viewer_t *viewers, unsigned int n, bool light_walls,
+						  unsigned int threads);
+extern err RLFL_fov_batch_ctx(RLFL_ctx_t *ctx, unsigned int m, RLFL_viewer_t *viewers, unsigned int n,
+							  bool light_walls, unsigned int threads);
 
 /* Project */
 extern RLFL_list_t * RLFL_project_store[];
@@ -155,6 +379,18 @@ extern err RLFL_project_cone(unsigned int m, unsigned int x1, unsigned int y1, u
 							 unsigned int rad, int range, unsigned long flags);
 extern err RLFL_project_cloud(unsigned int m, unsigned int x1, unsigned int y1, unsigned int rad,
 							  unsigned long flags);
+extern err RLFL_project_ctx(RLFL_ctx_t *ctx, unsigned int m, unsigned int ox, unsigned int oy, unsigned int tx,
+							unsigned int ty, int rad, int range, unsigned short flg);
+extern err RLFL_project_ball_ctx(RLFL_ctx_t *ctx, unsigned int m, unsigned int x1, unsigned int y1,
+								 unsigned int x2, unsigned int y2, unsigned int rad, int range, unsigned long flags);
+extern err RLFL_project_beam_ctx(RLFL_ctx_t *ctx, unsigned int m, unsigned int x1, unsigned int y1,
+								 unsigned int x2, unsigned int y2, int range, unsigned long flags);
+extern err RLFL_project_wave_ctx(RLFL_ctx_t *ctx, unsigned int m, unsigned int x1, unsigned int y1,
+								 unsigned int rad, int range, unsigned long flags);
+extern err RLFL_project_cone_ctx(RLFL_ctx_t *ctx, unsigned int m, unsigned int x1, unsigned int y1,
+								 unsigned int x2, unsigned int y2, unsigned int rad, int range, unsigned long flags);
+extern err RLFL_project_cloud_ctx(RLFL_ctx_t *ctx, unsigned int m, unsigned int x1, unsigned int y1,
+								  unsigned int rad, unsigned long flags);
 
 /* DEBUG */
 extern void RLFL_DEBUG_print_path_map(unsigned int m, unsigned int p);
@@ -0,0 +1,217 @@
+/*
+	RLFL map journal.
+
+	A journaled map records the old value of every cell a flag
+	function changes, in a ring of `size` entries. A checkpoint is
+	the number of entries written so far, rolling back to it undoes
+	the entries after it, newest first. Both cost time in the number
+	of changes, not the size of the map. Once the ring wraps, the
+	oldest entries are lost and checkpoints before them can no
+	longer be rolled back to.
+
+    Copyright (C) 2011
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+    <jtm@robot.is>
+*/
+#include "headers/rlfl.h"
+#include "headers/map.h"
+
+static inline void append(map_journal_t *j, unsigned int cell, RLFL_cell_t old);
+static err restore_cell(RLFL_map_t *map, unsigned int x, unsigned int y, RLFL_cell_t old);
+/*
+ +-----------------------------------------------------------+
+ * @desc	Journal changes in a ring of `size` entries, or stop
+ * 			if `size` is 0. A new size starts an empty journal.
+ +-----------------------------------------------------------+
+ */
+err
+journal_start(RLFL_map_t *map, unsigned int size)
+{
+	journal_free(map);
+	if(!size)
+		return RLFL_SUCCESS;
+
+	map_journal_t *j = (map_journal_t *)calloc(1, sizeof(map_journal_t));
+	if(j == NULL)
+		return RLFL_ERR_GENERIC;
+
+	j->ring = (journal_entry_t *)malloc(sizeof(journal_entry_t) * size);
+	if(j->ring == NULL)
+	{
+		free(j);
+		return RLFL_ERR_GENERIC;
+	}
+	j->size = size;
+	map->journal = j;
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Free journal
+ +-----------------------------------------------------------+
+ */
+void
+journal_free(RLFL_map_t *map)
+{
+	map_journal_t *j = map->journal;
+	if(j == NULL)
+		return;
+
+	free(j->ring);
+	free(j->before);
+	free(j);
+	map->journal = NULL;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Record cell before `flag` is set, or cleared, if
+ * 			that changes it
+ +-----------------------------------------------------------+
+ */
+void
+journal_cell(RLFL_map_t *map, unsigned int x, unsigned int y, unsigned long flag, bool set)
+{
+	RLFL_cell_t old = cell_get(map, x, y);
+	RLFL_cell_t f = flag;
+	if(set ? ((old & f) == f) : !(old & f))
+		return;
+
+	append(map->journal, x + (y * map->width), old);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Keep the cells of a w * h rectangle at x, y before
+ * 			a bulk change, journal_end() records the ones the
+ * 			change touched
+ +-----------------------------------------------------------+
+ */
+err
+journal_begin(RLFL_map_t *map, unsigned int x, unsigned int y, unsigned int w, unsigned int h)
+{
+	map_journal_t *j = map->journal;
+	unsigned int n = w * h, cx, cy;
+	if(n > j->before_size)
+	{
+		RLFL_cell_t *before = (RLFL_cell_t *)realloc(j->before, sizeof(RLFL_cell_t) * n);
+		if(before == NULL)
+			return RLFL_ERR_GENERIC;
+		j->before = before;
+		j->before_size = n;
+	}
+	j->x = x;
+	j->y = y;
+	j->w = w;
+	j->h = h;
+
+	RLFL_cell_t *b = j->before;
+	for(cy=y; cy<y+h; cy++)
+	{
+		if(map->layout == MAP_DENSE)
+		{
+			memcpy(b, map->cells + x + (cy * map->width), sizeof(RLFL_cell_t) * w);
+			b += w;
+			continue;
+		}
+		for(cx=x; cx<x+w; cx++)
+			*b++ = cell_get(map, cx, cy);
+	}
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Record the cells a bulk change touched, see
+ * 			journal_begin()
+ +-----------------------------------------------------------+
+ */
+void
+journal_end(RLFL_map_t *map)
+{
+	map_journal_t *j = map->journal;
+	const RLFL_cell_t *b = j->before;
+	unsigned int cx, cy;
+	for(cy=j->y; cy<j->y+j->h; cy++)
+	{
+		unsigned int i = j->x + (cy * map->width);
+		for(cx=j->x; cx<j->x+j->w; cx++, i++, b++)
+		{
+			RLFL_cell_t now = (map->layout == MAP_DENSE) ? map->cells[i] : cell_get(map, cx, cy);
+			if(now != *b)
+				append(j, i, *b);
+		}
+	}
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Undo the changes made after checkpoint `mark`
+ +-----------------------------------------------------------+
+ */
+err
+journal_rollback(RLFL_map_t *map, unsigned int mark)
+{
+	map_journal_t *j = map->journal;
+	unsigned int n = j->head - mark;
+	if(n > j->count)
+		return RLFL_ERR_OUT_OF_BOUNDS;
+
+	err e = RLFL_SUCCESS;
+	while(n--)
+	{
+		const journal_entry_t *entry = &j->ring[--j->head % j->size];
+		j->count--;
+		e |= restore_cell(map, entry->cell % map->width, entry->cell / map->width, entry->old);
+	}
+	return e ? RLFL_ERR_GENERIC : RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Append an entry, over the oldest if the ring is full
+ +-----------------------------------------------------------+
+ */
+static inline void
+append(map_journal_t *j, unsigned int cell, RLFL_cell_t old)
+{
+	journal_entry_t *entry = &j->ring[j->head++ % j->size];
+	entry->cell = cell;
+	entry->old = old;
+	if(j->count < j->size)
+		j->count++;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Put back the old value of a cell, as the flag
+ * 			functions would, so tracking and regions follow
+ +-----------------------------------------------------------+
+ */
+static err
+restore_cell(RLFL_map_t *map, unsigned int x, unsigned int y, RLFL_cell_t old)
+{
+	RLFL_cell_t now = cell_get(map, x, y);
+	unsigned long clear = now & ~old, set = old & ~now;
+	err e = RLFL_SUCCESS;
+	if(clear)
+	{
+		if(tracked(map, clear))
+			mark_cell(map, x, y);
+		e |= regioned(map, clear) ? region_cell(map, x, y, clear, false) : cell_clear(map, x, y, clear);
+	}
+	if(set)
+	{
+		if(tracked(map, set))
+			mark_cell(map, x, y);
+		e |= regioned(map, set) ? region_cell(map, x, y, set, true) : cell_set(map, x, y, set);
+	}
+	return e;
+}
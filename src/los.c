@@ -47,14 +47,16 @@
     <jtm@robot.is>
 */
 #include "headers/rlfl.h"
+#include "headers/map.h"
 
 err
 RLFL_los(unsigned int map, unsigned int x1, unsigned int y1, unsigned int x2, unsigned int y2)
 {
-	if(!RLFL_map_valid(map))
+	map_view_t v;
+	if(view_open(&v, map))
 		return RLFL_ERR_NO_MAP;
 
-	if(!(RLFL_cell_valid(map, x1, y1) && RLFL_cell_valid(map, x2, y2)))
+	if(!(view_in(&v, x1, y1) && view_in(&v, x2, y2)))
 		return RLFL_ERR_OUT_OF_BOUNDS;
 
 	/* Delta */
@@ -100,7 +102,7 @@ RLFL_los(unsigned int map, unsigned int x1, unsigned int y1, unsigned int x2, un
 		{
 			for (ty = y1 + 1; ty < y2; ty++)
 			{
-				if (!RLFL_has_flag(map, x1, ty, CELL_SEEN))
+				if (!view_has(&v, x1, ty, CELL_SEEN))
 					return false;
 			}
 		}
@@ -110,7 +112,7 @@ RLFL_los(unsigned int map, unsigned int x1, unsigned int y1, unsigned int x2, un
 		{
 			for (ty = y1 - 1; ty > y2; ty--)
 			{
-				if (!RLFL_has_flag(map, x1, ty, CELL_SEEN))
+				if (!view_has(&v, x1, ty, CELL_SEEN))
 					return false;
 			}
 		}
@@ -127,7 +129,7 @@ RLFL_los(unsigned int map, unsigned int x1, unsigned int y1, unsigned int x2, un
 		{
 			for (tx = x1 + 1; tx < x2; tx++)
 			{
-				if (!RLFL_has_flag(map, tx, y1, CELL_SEEN))
+				if (!view_has(&v, tx, y1, CELL_SEEN))
 					return false;
 			}
 		}
@@ -137,7 +139,7 @@ RLFL_los(unsigned int map, unsigned int x1, unsigned int y1, unsigned int x2, un
 		{
 			for (tx = x1 - 1; tx > x2; tx--)
 			{
-				if (!RLFL_has_flag(map, tx, y1, CELL_SEEN))
+				if (!view_has(&v, tx, y1, CELL_SEEN))
 					return false;
 			}
 		}
@@ -157,7 +159,7 @@ RLFL_los(unsigned int map, unsigned int x1, unsigned int y1, unsigned int x2, un
 	{
 		if (ay == 2)
 		{
-			if (RLFL_has_flag(map, x1, y1 + sy, CELL_SEEN))
+			if (view_has(&v, x1, y1 + sy, CELL_SEEN))
 				return true;
 		}
 	}
@@ -167,7 +169,7 @@ RLFL_los(unsigned int map, unsigned int x1, unsigned int y1, unsigned int x2, un
 	{
 		if (ax == 2)
 		{
-			if (RLFL_has_flag(map, x1 + sx, y1, CELL_SEEN))
+			if (view_has(&v, x1 + sx, y1, CELL_SEEN))
 				return true;
 		}
 	}
@@ -204,7 +206,7 @@ RLFL_los(unsigned int map, unsigned int x1, unsigned int y1, unsigned int x2, un
 		/* the LOS exactly meets the corner of a tile. */
 		while (x2 - tx)
 		{
-			if (!RLFL_has_flag(map, tx, ty, CELL_SEEN))
+			if (!view_has(&v, tx, ty, CELL_SEEN))
 				return false;
 
 			qy += m;
@@ -216,7 +218,7 @@ RLFL_los(unsigned int map, unsigned int x1, unsigned int y1, unsigned int x2, un
 			else if (qy > f2)
 			{
 				ty += sy;
-				if (!RLFL_has_flag(map, tx, ty, CELL_SEEN))
+				if (!view_has(&v, tx, ty, CELL_SEEN))
 					return false;
 				qy -= f1;
 				tx += sx;
@@ -253,7 +255,7 @@ RLFL_los(unsigned int map, unsigned int x1, unsigned int y1, unsigned int x2, un
 		/* the LOS exactly meets the corner of a tile. */
 		while (y2 - ty)
 		{
-			if (!RLFL_has_flag(map, tx, ty, CELL_SEEN))
+			if (!view_has(&v, tx, ty, CELL_SEEN))
 				return false;
 
 			qx += m;
@@ -265,7 +267,7 @@ RLFL_los(unsigned int map, unsigned int x1, unsigned int y1, unsigned int x2, un
 			else if (qx > f2)
 			{
 				tx += sx;
-				if (!RLFL_has_flag(map, tx, ty, CELL_SEEN))
+				if (!view_has(&v, tx, ty, CELL_SEEN))
 					return false;
 				qx -= f1;
 				ty += sy;
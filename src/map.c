@@ -0,0 +1,1379 @@
+/*
+	RLFL map storage.
+
+	Allocation and map wide operations for each cell layout.
+
+	MAP_DENSE stores one RLFL_cell_t per cell in row major order.
+
+	MAP_PLANES stores one bit per cell for each flag, in RLFL_PLANES
+	planes of row major bits. Map wide operations on a flag then
+	work on 64 cells at a time.
+
+	MAP_TILED stores RLFL_TILE * RLFL_TILE cells per tile, so cells
+	that are close in 2D are close in memory. Tiles on the right and
+	bottom edges are padded, padding cells never have flags set.
+
+	MAP_SPARSE is MAP_TILED where every tile starts out as the map's
+	shared fill tile. A tile gets storage of its own the first time a
+	write changes one of its cells. Map wide operations touch the fill
+	tile once, plus the tiles with storage. Edge tiles hold the outer
+	border and always have storage, so the fill tile has no padding.
+
+	Tiles of MAP_TILED and MAP_SPARSE maps are reference counted, a
+	clone shares every tile of its source until either map writes to
+	it. Writers check tile_shared() and take a copy first.
+
+    Copyright (C) 2011
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+    <jtm@robot.is>
+*/
+#include "headers/rlfl.h"
+#include "headers/map.h"
+
+/* Planes are counted with the popcount instruction when the CPU has
+   one, the baseline x86-64 build does not assume it */
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__)
+#define POPCOUNT_CLONES __attribute__((target_clones("popcnt", "default")))
+#else
+#define POPCOUNT_CLONES
+#endif
+
+/* Cells counted by map_count_flag() */
+typedef struct {
+	RLFL_cell_t flag;
+	unsigned int count;
+} count_t;
+
+/* Per flag counts of up to 255 cells, one byte per flag, flushed to
+   `counts`, see map_histogram() */
+typedef struct {
+	uint64_t acc[RLFL_PLANES / 8];
+	unsigned int n;
+	uint64_t spread[256];
+	unsigned int *counts;
+} histogram_t;
+
+static inline uint64_t tail_mask(RLFL_map_t *map);
+static inline void plane_range(uint64_t *plane, unsigned int i0, unsigned int i1, bool set);
+static unsigned int plane_count(uint64_t **planes, int np, unsigned int i0, unsigned int i1);
+static void each_run(RLFL_map_t *map, unsigned int x, unsigned int y, unsigned int w, unsigned int h,
+					 void (*fn)(const RLFL_cell_t *cells, unsigned int n, void *arg), void *arg);
+static err alloc_tiles(RLFL_map_t *map);
+static RLFL_cell_t *tile_alloc(void);
+static void tile_release(RLFL_cell_t *tile);
+static RLFL_cell_t *tile_begin(RLFL_map_t *map, unsigned int t, RLFL_cell_t *scratch);
+static err tile_end(RLFL_map_t *map, unsigned int t, RLFL_cell_t *tile, RLFL_cell_t *scratch);
+static void free_tiles(RLFL_map_t *map);
+/*
+ +-----------------------------------------------------------+
+ * @desc	Allocate cell storage for map->layout
+ +-----------------------------------------------------------+
+ */
+err
+map_alloc_cells(RLFL_map_t *map)
+{
+	switch(map->layout)
+	{
+		case MAP_DENSE :
+			map->cells = (RLFL_cell_t *)calloc(sizeof(RLFL_cell_t), map->cellcnt);
+			if(map->cells == NULL)
+				return RLFL_ERR_GENERIC;
+			break;
+		case MAP_PLANES :
+			map->words = (map->cellcnt + 63) / 64;
+			map->planes = (uint64_t *)calloc(sizeof(uint64_t), map->words * RLFL_PLANES);
+			if(map->planes == NULL)
+				return RLFL_ERR_GENERIC;
+			break;
+		case MAP_TILED :
+		case MAP_SPARSE :
+			return alloc_tiles(map);
+		default :
+			return RLFL_ERR_GENERIC;
+	}
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Free cell storage
+ +-----------------------------------------------------------+
+ */
+void
+map_free_cells(RLFL_map_t *map)
+{
+	free_tiles(map);
+	if(!map_in_file(map, map->cells))
+		free(map->cells);
+	free(map->planes);
+	free(map->dirty);
+	region_free(map);
+	journal_free(map);
+	map_fov_free(map);
+	map->cells = NULL;
+	map->planes = NULL;
+	map->dirty = NULL;
+	map_unmap_file(map);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Clear `flag` from every cell
+ +-----------------------------------------------------------+
+ */
+err
+map_clear_flag(RLFL_map_t *map, unsigned long flag)
+{
+	unsigned int i;
+	if(map->layout == MAP_PLANES)
+	{
+		while(flag)
+		{
+			memset(PLANE(map, __builtin_ctzl(flag)), 0, map->words * sizeof(uint64_t));
+			flag &= (flag - 1);
+		}
+		return RLFL_SUCCESS;
+	}
+
+	RLFL_cell_t keep = ~flag;
+	if(map->tiles)
+	{
+		RLFL_cell_t scratch[TILE_CELLS];
+		unsigned int t, tiles = (map->tiles_w * map->tiles_h);
+		for(t=0; t<tiles; t++)
+		{
+			if(map->tiles[t] == map->fill)
+				continue;
+			RLFL_cell_t *tile = tile_begin(map, t, scratch);
+			for(i=0; i<TILE_CELLS; i++)
+				tile[i] &= keep;
+			if(tile_end(map, t, tile, scratch))
+				return RLFL_ERR_GENERIC;
+		}
+		if(map->fill)
+		{
+			for(i=0; i<TILE_CELLS; i++)
+				map->fill[i] &= keep;
+		}
+		return RLFL_SUCCESS;
+	}
+
+	RLFL_cell_t *cells = map->cells;
+	for(i=0; i<map->cellcnt; i++)
+	{
+		cells[i] &= keep;
+	}
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Set `flag` on every cell
+ +-----------------------------------------------------------+
+ */
+err
+map_fill_flag(RLFL_map_t *map, unsigned long flag)
+{
+	unsigned int i;
+	if(map->layout == MAP_PLANES)
+	{
+		while(flag)
+		{
+			uint64_t *plane = PLANE(map, __builtin_ctzl(flag));
+			memset(plane, 0xFF, map->words * sizeof(uint64_t));
+
+			/* Bits past the last cell stay clear */
+			plane[map->words - 1] &= tail_mask(map);
+			flag &= (flag - 1);
+		}
+		return RLFL_SUCCESS;
+	}
+
+	RLFL_cell_t set = flag;
+	if(map->tiles)
+	{
+		RLFL_cell_t scratch[TILE_CELLS];
+		unsigned int tx, ty, x, y;
+		for(ty=0; ty<map->tiles_h; ty++)
+		{
+			/* Only the part of the tile inside the map */
+			unsigned int h = MIN(RLFL_TILE, map->height - (ty << RLFL_TILE_SHIFT));
+			for(tx=0; tx<map->tiles_w; tx++)
+			{
+				unsigned int w = MIN(RLFL_TILE, map->width - (tx << RLFL_TILE_SHIFT));
+				unsigned int t = tx + (ty * map->tiles_w);
+				if(map->tiles[t] == map->fill)
+					continue;
+				RLFL_cell_t *tile = tile_begin(map, t, scratch);
+				for(y=0; y<h; y++)
+					for(x=0; x<w; x++)
+						tile[x + (y << RLFL_TILE_SHIFT)] |= set;
+				if(tile_end(map, t, tile, scratch))
+					return RLFL_ERR_GENERIC;
+			}
+		}
+		if(map->fill)
+		{
+			for(i=0; i<TILE_CELLS; i++)
+				map->fill[i] |= set;
+		}
+		return RLFL_SUCCESS;
+	}
+
+	RLFL_cell_t *cells = map->cells;
+	for(i=0; i<map->cellcnt; i++)
+	{
+		cells[i] |= set;
+	}
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Copy every cell to `dst`, row major
+ +-----------------------------------------------------------+
+ */
+void
+map_read_cells(RLFL_map_t *map, RLFL_cell_t *dst)
+{
+	unsigned int i, y;
+	if(map->layout == MAP_PLANES)
+	{
+		memset(dst, 0, map->cellcnt * sizeof(RLFL_cell_t));
+		int b;
+		for(b=0; b<RLFL_PLANES; b++)
+		{
+			uint64_t *plane = PLANE(map, b);
+			RLFL_cell_t bit = (1 << b);
+			for(i=0; i<map->words; i++)
+			{
+				uint64_t word = plane[i];
+				for(; word; word &= (word - 1))
+					dst[(i << 6) + __builtin_ctzll(word)] |= bit;
+			}
+		}
+		return;
+	}
+
+	if(map->tiles)
+	{
+		for(y=0; y<map->height; y++)
+		{
+			unsigned int x;
+			for(x=0; x<map->width; x+=RLFL_TILE)
+			{
+				unsigned int w = MIN(RLFL_TILE, map->width - x);
+				memcpy(dst + x + (y * map->width), tile_cell(map, x, y), w * sizeof(RLFL_cell_t));
+			}
+		}
+		return;
+	}
+
+	memcpy(dst, map->cells, map->cellcnt * sizeof(RLFL_cell_t));
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Replace every cell with `src`, row major. Shared
+ * 			tiles are only copied when a cell in them changes.
+ +-----------------------------------------------------------+
+ */
+err
+map_write_cells(RLFL_map_t *map, const RLFL_cell_t *src)
+{
+	unsigned int i, y;
+	if(map->layout == MAP_PLANES)
+	{
+		memset(map->planes, 0, map->words * RLFL_PLANES * sizeof(uint64_t));
+		for(i=0; i<map->cellcnt; i++)
+		{
+			unsigned long value = src[i];
+			for(; value; value &= (value - 1))
+				PLANE(map, __builtin_ctzl(value))[PLANE_WORD(i)] |= PLANE_BIT(i);
+		}
+		return RLFL_SUCCESS;
+	}
+
+	if(map->tiles)
+	{
+		unsigned int tx, ty;
+		for(ty=0; ty<map->tiles_h; ty++)
+		{
+			unsigned int y0 = (ty << RLFL_TILE_SHIFT);
+			unsigned int h = MIN(RLFL_TILE, map->height - y0);
+			for(tx=0; tx<map->tiles_w; tx++)
+			{
+				unsigned int x0 = (tx << RLFL_TILE_SHIFT);
+				unsigned int w = MIN(RLFL_TILE, map->width - x0);
+				unsigned int t = tx + (ty * map->tiles_w);
+				size_t row = w * sizeof(RLFL_cell_t);
+				const RLFL_cell_t *from = src + x0 + (y0 * map->width);
+
+				if(tile_shared(map, t))
+				{
+					for(y=0; y<h; y++)
+					{
+						if(memcmp(map->tiles[t] + (y << RLFL_TILE_SHIFT), from + (y * map->width), row))
+							break;
+					}
+					if(y == h)
+						continue;
+					if(map_own_tile(map, t))
+						return RLFL_ERR_GENERIC;
+				}
+				for(y=0; y<h; y++)
+					memcpy(map->tiles[t] + (y << RLFL_TILE_SHIFT), from + (y * map->width), row);
+			}
+		}
+		return RLFL_SUCCESS;
+	}
+
+	memcpy(map->cells, src, map->cellcnt * sizeof(RLFL_cell_t));
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Set or clear `flag` on every cell of a rectangle
+ +-----------------------------------------------------------+
+ */
+err
+map_rect_flag(RLFL_map_t *map, unsigned int x, unsigned int y, unsigned int w,
+			  unsigned int h, unsigned long flag, bool set)
+{
+	unsigned int r, k;
+	if(!w || !h)
+		return RLFL_SUCCESS;
+
+	if(map->layout == MAP_PLANES)
+	{
+		for(; flag; flag &= (flag - 1))
+		{
+			uint64_t *plane = PLANE(map, __builtin_ctzl(flag));
+			for(r=0; r<h; r++)
+			{
+				unsigned int i = x + ((y + r) * map->width);
+				plane_range(plane, i, i + w, set);
+			}
+		}
+		return RLFL_SUCCESS;
+	}
+
+	RLFL_cell_t f = flag, keep = ~flag;
+	if(map->tiles)
+	{
+		for(r=y; r<y+h; r++)
+		{
+			unsigned int cx = x;
+			while(cx < x + w)
+			{
+				/* Part of the row in this tile */
+				unsigned int n = MIN(RLFL_TILE - (cx & TILE_MASK), x + w - cx);
+				unsigned int t = tile_index(map, cx, r);
+				if(tile_shared(map, t))
+				{
+					RLFL_cell_t *c = tile_cell(map, cx, r);
+					for(k=0; k<n; k++)
+					{
+						if(set ? ((c[k] & f) != f) : (c[k] & f))
+							break;
+					}
+					if(k < n && map_own_tile(map, t))
+						return RLFL_ERR_GENERIC;
+					if(k == n)
+					{
+						cx += n;
+						continue;
+					}
+				}
+				RLFL_cell_t *c = tile_cell(map, cx, r);
+				if(set)
+					for(k=0; k<n; k++) c[k] |= f;
+				else
+					for(k=0; k<n; k++) c[k] &= keep;
+				cx += n;
+			}
+		}
+		return RLFL_SUCCESS;
+	}
+
+	for(r=y; r<y+h; r++)
+	{
+		RLFL_cell_t *c = map->cells + x + (r * map->width);
+		if(set)
+			for(k=0; k<w; k++) c[k] |= f;
+		else
+			for(k=0; k<w; k++) c[k] &= keep;
+	}
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Query a rectangle for `flag`, bit i of `bits` is set
+ * 			for the i:th cell in row major order. `bits` may be
+ * 			NULL.
+ * @return	Number of cells with any of `flag`
+ +-----------------------------------------------------------+
+ */
+unsigned int
+map_rect_has(RLFL_map_t *map, unsigned int x, unsigned int y, unsigned int w,
+			 unsigned int h, unsigned long flag, uint8_t *bits)
+{
+	unsigned int r, k, i = 0, count = 0;
+	if(bits)
+		memset(bits, 0, PACKED_SIZE(w * h));
+
+	if(map->layout == MAP_PLANES)
+	{
+		uint64_t *planes[RLFL_PLANES];
+		int np = 0, b;
+		for(; flag; flag &= (flag - 1))
+			planes[np++] = PLANE(map, __builtin_ctzl(flag));
+
+		for(r=y; r<y+h; r++)
+		{
+			unsigned int c = x + (r * map->width), word = ~0U;
+			uint64_t any = 0;
+			for(k=0; k<w; k++, c++, i++)
+			{
+				if(PLANE_WORD(c) != word)
+				{
+					word = PLANE_WORD(c);
+					for(any=0, b=0; b<np; b++)
+						any |= planes[b][word];
+				}
+				if(any & PLANE_BIT(c))
+				{
+					if(bits) PACKED_SET(bits, i);
+					count++;
+				}
+			}
+		}
+		return count;
+	}
+
+	RLFL_cell_t f = flag;
+	for(r=y; r<y+h; r++)
+	{
+		for(k=0; k<w; k++, i++)
+		{
+			RLFL_cell_t value = map->tiles ? *tile_cell(map, x + k, r)
+										   : map->cells[x + k + (r * map->width)];
+			if(value & f)
+			{
+				if(bits) PACKED_SET(bits, i);
+				count++;
+			}
+		}
+	}
+	return count;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Set or clear `flag` on every cell where `mask` has
+ * 			any of `mflag`. Maps are the same size.
+ +-----------------------------------------------------------+
+ */
+err
+map_mask_flag(RLFL_map_t *map, RLFL_map_t *mask, unsigned long mflag,
+			  unsigned long flag, bool set)
+{
+	unsigned int i, x, y;
+	if(map->layout == MAP_PLANES && mask->layout == MAP_PLANES)
+	{
+		uint64_t *from[RLFL_PLANES], *to[RLFL_PLANES];
+		int nf = 0, nt = 0, b;
+		for(; mflag; mflag &= (mflag - 1))
+			from[nf++] = PLANE(mask, __builtin_ctzl(mflag));
+		for(; flag; flag &= (flag - 1))
+			to[nt++] = PLANE(map, __builtin_ctzl(flag));
+
+		for(i=0; i<map->words; i++)
+		{
+			uint64_t word = 0;
+			for(b=0; b<nf; b++)
+				word |= from[b][i];
+			for(b=0; b<nt; b++)
+				to[b][i] = set ? (to[b][i] | word) : (to[b][i] & ~word);
+		}
+		return RLFL_SUCCESS;
+	}
+
+	RLFL_cell_t mf = mflag, f = flag;
+	if(map->layout == MAP_DENSE && mask->layout == MAP_DENSE)
+	{
+		/* Branch free, so it vectorizes */
+		RLFL_cell_t *c = map->cells, *mc = mask->cells;
+		for(i=0; i<map->cellcnt; i++)
+		{
+			RLFL_cell_t hit = (RLFL_cell_t)-((mc[i] & mf) != 0);
+			c[i] = set ? (c[i] | (hit & f)) : (c[i] & ~(hit & f));
+		}
+		return RLFL_SUCCESS;
+	}
+
+	for(y=0; y<map->height; y++)
+	{
+		for(x=0; x<map->width; x++)
+		{
+			if(!cell_has(mask, x, y, mflag))
+				continue;
+			if(set ? cell_set(map, x, y, flag) : cell_clear(map, x, y, flag))
+				return RLFL_ERR_GENERIC;
+		}
+	}
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Query `flag` on every cell where `mask` has any of
+ * 			`mflag`. Bit i of `bits` is the i:th cell of the
+ * 			map in row major order. `bits` may be NULL.
+ * @return	Number of cells
+ +-----------------------------------------------------------+
+ */
+unsigned int
+map_mask_has(RLFL_map_t *map, RLFL_map_t *mask, unsigned long mflag,
+			 unsigned long flag, uint8_t *bits)
+{
+	unsigned int i, x, y, count = 0;
+	if(bits)
+		memset(bits, 0, PACKED_SIZE(map->cellcnt));
+
+	if(map->layout == MAP_PLANES && mask->layout == MAP_PLANES)
+	{
+		uint64_t *from[RLFL_PLANES], *to[RLFL_PLANES];
+		int nf = 0, nt = 0, b;
+		for(; mflag; mflag &= (mflag - 1))
+			from[nf++] = PLANE(mask, __builtin_ctzl(mflag));
+		for(; flag; flag &= (flag - 1))
+			to[nt++] = PLANE(map, __builtin_ctzl(flag));
+
+		unsigned int bytes = PACKED_SIZE(map->cellcnt);
+		for(i=0; i<map->words; i++)
+		{
+			uint64_t hit = 0, any = 0;
+			for(b=0; b<nf; b++)
+				hit |= from[b][i];
+			for(b=0; b<nt; b++)
+				any |= to[b][i];
+			hit &= any;
+			if(!hit)
+				continue;
+			count += __builtin_popcountll(hit);
+			if(bits)
+			{
+				for(b=0; b<8 && (i * 8) + b < bytes; b++)
+					bits[(i * 8) + b] = (uint8_t)(hit >> (b * 8));
+			}
+		}
+		return count;
+	}
+
+	for(i=0, y=0; y<map->height; y++)
+	{
+		for(x=0; x<map->width; x++, i++)
+		{
+			if(cell_has(mask, x, y, mflag) && cell_has(map, x, y, flag))
+			{
+				if(bits) PACKED_SET(bits, i);
+				count++;
+			}
+		}
+	}
+	return count;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Count `n` cells with any of the flags, one loop so
+ * 			it vectorizes
+ +-----------------------------------------------------------+
+ */
+static void
+count_run(const RLFL_cell_t *cells, unsigned int n, void *arg)
+{
+	count_t *c = (count_t *)arg;
+	unsigned int i, count = 0;
+	for(i=0; i<n; i++)
+		count += ((cells[i] & c->flag) != 0);
+	c->count += count;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Count cells with any of `flag` in a w * h rectangle
+ * 			at x, y. Planes are counted 64 cells at a time.
+ +-----------------------------------------------------------+
+ */
+unsigned int
+map_count_flag(RLFL_map_t *map, unsigned int x, unsigned int y, unsigned int w,
+			   unsigned int h, unsigned long flag)
+{
+	unsigned int r, count = 0;
+	if(!w || !h)
+		return 0;
+
+	if(map->layout == MAP_PLANES)
+	{
+		uint64_t *planes[RLFL_PLANES];
+		int np = 0;
+		for(; flag; flag &= (flag - 1))
+			planes[np++] = PLANE(map, __builtin_ctzl(flag));
+
+		/* Whole rows are one run of bits */
+		if(w == map->width)
+			return plane_count(planes, np, y * w, (y + h) * w);
+
+		for(r=y; r<y+h; r++)
+			count += plane_count(planes, np, x + (r * map->width), x + w + (r * map->width));
+		return count;
+	}
+
+	count_t c = { flag, 0 };
+	each_run(map, x, y, w, h, count_run, &c);
+	return c.count;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Add `n` cells to a histogram, flushed to `counts`
+ * 			before a byte can overflow
+ +-----------------------------------------------------------+
+ */
+static void
+histogram_run(const RLFL_cell_t *cells, unsigned int n, void *arg)
+{
+	histogram_t *hist = (histogram_t *)arg;
+	unsigned int i, k, b;
+	while(n)
+	{
+		unsigned int take = MIN(n, 255 - hist->n);
+		for(i=0; i<take; i++)
+		{
+			for(k=0; k<(RLFL_PLANES / 8); k++)
+				hist->acc[k] += hist->spread[(cells[i] >> (k * 8)) & 0xff];
+		}
+		cells += take;
+		n -= take;
+		hist->n += take;
+		if(hist->n < 255)
+			continue;
+
+		for(k=0; k<(RLFL_PLANES / 8); k++)
+		{
+			for(b=0; b<8; b++)
+				hist->counts[(k * 8) + b] += (hist->acc[k] >> (b * 8)) & 0xff;
+			hist->acc[k] = 0;
+		}
+		hist->n = 0;
+	}
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Count the cells with each flag in a w * h rectangle
+ * 			at x, y, in one pass. counts[b] is the number of
+ * 			cells with flag 1 << b, RLFL_PLANES counts.
+ +-----------------------------------------------------------+
+ */
+void
+map_histogram(RLFL_map_t *map, unsigned int x, unsigned int y, unsigned int w,
+			  unsigned int h, unsigned int *counts)
+{
+	unsigned int n, b;
+	memset(counts, 0, sizeof(unsigned int) * RLFL_PLANES);
+	if(!w || !h)
+		return;
+
+	if(map->layout == MAP_PLANES)
+	{
+		for(b=0; b<RLFL_PLANES; b++)
+			counts[b] = map_count_flag(map, x, y, w, h, 1UL << b);
+		return;
+	}
+
+	/* Byte j of spread[v] is bit j of v, adding spreads counts
+	   eight flags at once */
+	histogram_t hist;
+	memset(&hist, 0, sizeof(hist));
+	hist.counts = counts;
+	for(n=0; n<256; n++)
+	{
+		for(b=0; b<8; b++)
+			hist.spread[n] |= (uint64_t)((n >> b) & 1) << (b * 8);
+	}
+
+	each_run(map, x, y, w, h, histogram_run, &hist);
+	/* The last cells not flushed */
+	for(n=0; n<(RLFL_PLANES / 8); n++)
+	{
+		for(b=0; b<8; b++)
+			counts[(n * 8) + b] += (hist.acc[n] >> (b * 8)) & 0xff;
+	}
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Merge `flag` of `n` cells from `s` into `d`. One
+ * 			loop per operation so each vectorizes.
+ +-----------------------------------------------------------+
+ */
+static inline void
+merge_cells(RLFL_cell_t *d, const RLFL_cell_t *s, unsigned int n, unsigned int op, RLFL_cell_t f)
+{
+	unsigned int k;
+	switch(op)
+	{
+		case MERGE_AND :
+			for(k=0; k<n; k++) d[k] &= (s[k] | ~f);
+			break;
+		case MERGE_OR :
+			for(k=0; k<n; k++) d[k] |= (s[k] & f);
+			break;
+		case MERGE_XOR :
+			for(k=0; k<n; k++) d[k] ^= (s[k] & f);
+			break;
+		case MERGE_ANDNOT :
+			for(k=0; k<n; k++) d[k] &= ~(s[k] & f);
+			break;
+	}
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Merged value of one cell
+ +-----------------------------------------------------------+
+ */
+static inline RLFL_cell_t
+merge_value(RLFL_cell_t d, RLFL_cell_t s, unsigned int op, RLFL_cell_t f)
+{
+	merge_cells(&d, &s, 1, op, f);
+	return d;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Merge bits [i0, i1) of plane `s` into plane `d`
+ +-----------------------------------------------------------+
+ */
+static inline void
+merge_plane(uint64_t *d, const uint64_t *s, unsigned int i0, unsigned int i1, unsigned int op)
+{
+	unsigned int w0 = PLANE_WORD(i0), w1 = PLANE_WORD(i1 - 1), i;
+	uint64_t first = (~0ULL << (i0 & 63));
+	uint64_t last = (~0ULL >> (63 - ((i1 - 1) & 63)));
+	uint64_t keep0 = d[w0], keep1 = d[w1];
+
+	switch(op)
+	{
+		case MERGE_AND :
+			for(i=w0; i<=w1; i++) d[i] &= s[i];
+			break;
+		case MERGE_OR :
+			for(i=w0; i<=w1; i++) d[i] |= s[i];
+			break;
+		case MERGE_XOR :
+			for(i=w0; i<=w1; i++) d[i] ^= s[i];
+			break;
+		case MERGE_ANDNOT :
+			for(i=w0; i<=w1; i++) d[i] &= ~s[i];
+			break;
+	}
+
+	/* Bits outside the range keep their value */
+	if(w0 == w1)
+	{
+		first &= last;
+		d[w0] = (keep0 & ~first) | (d[w0] & first);
+		return;
+	}
+	d[w0] = (keep0 & ~first) | (d[w0] & first);
+	d[w1] = (keep1 & ~last) | (d[w1] & last);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Merge `flag` of a rectangle of `src` into `map`
+ * 			with MERGE_*. Maps are the same size.
+ +-----------------------------------------------------------+
+ */
+err
+map_merge(RLFL_map_t *map, RLFL_map_t *src, unsigned int op, unsigned long flag,
+		  unsigned int x, unsigned int y, unsigned int w, unsigned int h)
+{
+	unsigned int r, k;
+	if(!w || !h || !flag)
+		return RLFL_SUCCESS;
+
+	/* Full rows are one run of cells */
+	unsigned int rows = h, run = w;
+	if(x == 0 && w == map->width)
+	{
+		rows = 1;
+		run = w * h;
+	}
+
+	if(map->layout == MAP_PLANES && src->layout == MAP_PLANES)
+	{
+		for(; flag; flag &= (flag - 1))
+		{
+			int b = __builtin_ctzl(flag);
+			for(r=0; r<rows; r++)
+			{
+				unsigned int i = x + ((y + r) * map->width);
+				merge_plane(PLANE(map, b), PLANE(src, b), i, i + run, op);
+			}
+		}
+		return RLFL_SUCCESS;
+	}
+
+	RLFL_cell_t f = flag;
+	if(map->layout == MAP_DENSE && src->layout == MAP_DENSE)
+	{
+		for(r=0; r<rows; r++)
+		{
+			unsigned int i = x + ((y + r) * map->width);
+			merge_cells(map->cells + i, src->cells + i, run, op, f);
+		}
+		return RLFL_SUCCESS;
+	}
+
+	if(map->tiles && src->tiles)
+	{
+		/* Same size, so the same tile grid. Tile by tile, rows
+		   spanning the whole tile are one run of cells. */
+		unsigned int tx, ty;
+		for(ty=(y >> RLFL_TILE_SHIFT); ty<=((y + h - 1) >> RLFL_TILE_SHIFT); ty++)
+		{
+			unsigned int y0 = MAX(y, ty << RLFL_TILE_SHIFT);
+			unsigned int y1 = MIN(y + h, (ty + 1) << RLFL_TILE_SHIFT);
+			for(tx=(x >> RLFL_TILE_SHIFT); tx<=((x + w - 1) >> RLFL_TILE_SHIFT); tx++)
+			{
+				unsigned int x0 = MAX(x, tx << RLFL_TILE_SHIFT);
+				unsigned int x1 = MIN(x + w, (tx + 1) << RLFL_TILE_SHIFT);
+				unsigned int t = tile_index(map, x0, y0);
+				unsigned int n = x1 - x0, nrows = y1 - y0;
+				if(n == RLFL_TILE)
+				{
+					n *= nrows;
+					nrows = 1;
+				}
+
+				if(tile_shared(map, t))
+				{
+					/* Only take the tile if a cell changes */
+					for(r=0; r<nrows; r++)
+					{
+						RLFL_cell_t *c = tile_cell(map, x0, y0 + r), *s = tile_cell(src, x0, y0 + r);
+						for(k=0; k<n; k++)
+						{
+							if(merge_value(c[k], s[k], op, f) != c[k])
+								break;
+						}
+						if(k < n)
+							break;
+					}
+					if(r == nrows)
+						continue;
+					if(map_own_tile(map, t))
+						return RLFL_ERR_GENERIC;
+				}
+				for(r=0; r<nrows; r++)
+					merge_cells(tile_cell(map, x0, y0 + r), tile_cell(src, x0, y0 + r), n, op, f);
+			}
+		}
+		return RLFL_SUCCESS;
+	}
+
+	/* Mixed layouts */
+	for(r=y; r<y+h; r++)
+	{
+		for(k=x; k<x+w; k++)
+		{
+			RLFL_cell_t d = cell_get(map, k, r);
+			RLFL_cell_t v = merge_value(d, cell_get(src, k, r), op, f);
+			if(v == d)
+				continue;
+			if(cell_set(map, k, r, v & ~d) || cell_clear(map, k, r, d & ~v))
+				return RLFL_ERR_GENERIC;
+		}
+	}
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Share the cells of `src` with `map`, a new map of
+ * 			the same size and layout. Tiles are shared until
+ * 			written, other layouts are copied.
+ +-----------------------------------------------------------+
+ */
+err
+map_clone_cells(RLFL_map_t *map, RLFL_map_t *src)
+{
+	switch(map->layout)
+	{
+		case MAP_DENSE :
+			map->cells = (RLFL_cell_t *)malloc(sizeof(RLFL_cell_t) * map->cellcnt);
+			if(map->cells == NULL)
+				return RLFL_ERR_GENERIC;
+			memcpy(map->cells, src->cells, sizeof(RLFL_cell_t) * map->cellcnt);
+			return RLFL_SUCCESS;
+		case MAP_PLANES :
+			map->words = src->words;
+			map->planes = (uint64_t *)malloc(sizeof(uint64_t) * map->words * RLFL_PLANES);
+			if(map->planes == NULL)
+				return RLFL_ERR_GENERIC;
+			memcpy(map->planes, src->planes, sizeof(uint64_t) * map->words * RLFL_PLANES);
+			return RLFL_SUCCESS;
+	}
+
+	map->tiles_w = src->tiles_w;
+	map->tiles_h = src->tiles_h;
+
+	unsigned int t, tiles = (map->tiles_w * map->tiles_h);
+	map->tiles = (RLFL_cell_t **)calloc(sizeof(RLFL_cell_t *), tiles);
+	if(map->tiles == NULL)
+		return RLFL_ERR_GENERIC;
+
+	/* The fill tile is written in place, so it is never shared */
+	if(src->fill)
+	{
+		map->fill = tile_alloc();
+		if(map->fill == NULL)
+		{
+			free_tiles(map);
+			return RLFL_ERR_GENERIC;
+		}
+		memcpy(map->fill, src->fill, sizeof(RLFL_cell_t) * TILE_CELLS);
+	}
+
+	for(t=0; t<tiles; t++)
+	{
+		if(src->tiles[t] == src->fill)
+		{
+			map->tiles[t] = map->fill;
+			continue;
+		}
+		map->tiles[t] = src->tiles[t];
+		__atomic_fetch_add(&TILE_HEAD(map->tiles[t])->refs, 1, __ATOMIC_ACQ_REL);
+	}
+	map->owned = src->owned;
+
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Give tile `t` storage of its own, a copy of the
+ * 			fill tile or of the tile shared with a clone
+ +-----------------------------------------------------------+
+ */
+err
+map_own_tile(RLFL_map_t *map, unsigned int t)
+{
+	RLFL_cell_t *tile = tile_alloc();
+	if(tile == NULL)
+		return RLFL_ERR_GENERIC;
+
+	RLFL_cell_t *old = map->tiles[t];
+	memcpy(tile, old, sizeof(RLFL_cell_t) * TILE_CELLS);
+	map->tiles[t] = tile;
+	if(old == map->fill)
+		map->owned++;
+	else
+		tile_release(old);
+
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Track changes to `flag`, or stop tracking if `flag`
+ * 			is 0. Starting marks the whole map, changes made
+ * 			while not tracking are unknown.
+ +-----------------------------------------------------------+
+ */
+err
+map_track(RLFL_map_t *map, unsigned long flag)
+{
+	if(!flag)
+	{
+		free(map->dirty);
+		map->dirty = NULL;
+		map->track = 0;
+		return RLFL_SUCCESS;
+	}
+
+	if(map->dirty == NULL)
+	{
+		map->dirty = (unsigned int *)malloc(sizeof(unsigned int) * DIRTY_W(map) * DIRTY_H(map));
+		if(map->dirty == NULL)
+			return RLFL_ERR_GENERIC;
+		map->version++;
+		map_mark_dirty(map, 0, 0, map->width, map->height);
+	}
+	map->track = flag;
+
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Stamp the squares under a w * h rectangle at x, y
+ * 			with the current version
+ +-----------------------------------------------------------+
+ */
+void
+map_mark_dirty(RLFL_map_t *map, unsigned int x, unsigned int y, unsigned int w,
+			   unsigned int h)
+{
+	if(!w || !h)
+		return;
+
+	unsigned int dw = DIRTY_W(map);
+	unsigned int x0 = (x >> RLFL_TILE_SHIFT), x1 = ((x + w - 1) >> RLFL_TILE_SHIFT);
+	unsigned int y0 = (y >> RLFL_TILE_SHIFT), y1 = ((y + h - 1) >> RLFL_TILE_SHIFT);
+	unsigned int tx, ty;
+	for(ty=y0; ty<=y1; ty++)
+	{
+		unsigned int *row = map->dirty + (ty * dw);
+		for(tx=x0; tx<=x1; tx++)
+			row[tx] = map->version;
+	}
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Rectangles covering the squares changed after
+ * 			version `since`, as x, y, w, h in cells. Runs of
+ * 			squares in a row are joined, and joined to a run of
+ * 			the same columns in the row above. Only the first
+ * 			`max` are stored in `rects`.
+ * @return	Number of rectangles
+ +-----------------------------------------------------------+
+ */
+int
+map_dirty_rects(RLFL_map_t *map, unsigned int since, unsigned int *rects, unsigned int max)
+{
+	unsigned int dw = DIRTY_W(map), dh = DIRTY_H(map);
+
+	/* Rectangle with a run starting at each column, its width
+	   in squares and the last row it reaches */
+	unsigned int *open = (unsigned int *)malloc(sizeof(unsigned int) * dw * 3);
+	if(open == NULL)
+		return RLFL_ERR_GENERIC;
+	unsigned int *open_w = open + dw, *open_row = open + (dw * 2);
+	memset(open_w, 0, sizeof(unsigned int) * dw);
+
+	unsigned int tx, ty, n = 0;
+	for(ty=0; ty<dh; ty++)
+	{
+		unsigned int *row = map->dirty + (ty * dw);
+		unsigned int y = (ty << RLFL_TILE_SHIFT);
+		unsigned int h = MIN(RLFL_TILE, map->height - y);
+		for(tx=0; tx<dw; tx++)
+		{
+			if(row[tx] <= since)
+				continue;
+
+			unsigned int tx0 = tx;
+			while(tx < dw && row[tx] > since)
+				tx++;
+
+			if(open_w[tx0] == (tx - tx0) && open_row[tx0] + 1 == ty)
+			{
+				if(open[tx0] < max)
+					rects[(open[tx0] * 4) + 3] += h;
+				open_row[tx0] = ty;
+				continue;
+			}
+
+			if(n < max)
+			{
+				unsigned int *r = rects + (n * 4);
+				r[0] = (tx0 << RLFL_TILE_SHIFT);
+				r[1] = y;
+				r[2] = MIN(tx << RLFL_TILE_SHIFT, map->width) - r[0];
+				r[3] = h;
+			}
+			open[tx0] = n++;
+			open_w[tx0] = (tx - tx0);
+			open_row[tx0] = ty;
+		}
+	}
+	free(open);
+	return n;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Tile `t` to change in place, or `scratch` holding a
+ * 			copy of it if it is shared
+ +-----------------------------------------------------------+
+ */
+static RLFL_cell_t *
+tile_begin(RLFL_map_t *map, unsigned int t, RLFL_cell_t *scratch)
+{
+	if(!tile_shared(map, t))
+		return map->tiles[t];
+
+	memcpy(scratch, map->tiles[t], sizeof(RLFL_cell_t) * TILE_CELLS);
+	return scratch;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Finish a tile_begin(), a changed scratch copy gets
+ * 			storage of its own
+ +-----------------------------------------------------------+
+ */
+static err
+tile_end(RLFL_map_t *map, unsigned int t, RLFL_cell_t *tile, RLFL_cell_t *scratch)
+{
+	if(tile != scratch)
+		return RLFL_SUCCESS;
+
+	if(!memcmp(scratch, map->tiles[t], sizeof(RLFL_cell_t) * TILE_CELLS))
+		return RLFL_SUCCESS;
+
+	if(map_own_tile(map, t))
+		return RLFL_ERR_GENERIC;
+
+	memcpy(map->tiles[t], scratch, sizeof(RLFL_cell_t) * TILE_CELLS);
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	New tile with one reference, cells not cleared
+ +-----------------------------------------------------------+
+ */
+static RLFL_cell_t *
+tile_alloc(void)
+{
+	map_tile_t *head = (map_tile_t *)malloc(sizeof(map_tile_t) + (sizeof(RLFL_cell_t) * TILE_CELLS));
+	if(head == NULL)
+		return NULL;
+
+	head->refs = 1;
+	return head->cells;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Drop a reference to a tile, free it on the last
+ +-----------------------------------------------------------+
+ */
+static void
+tile_release(RLFL_cell_t *tile)
+{
+	if(tile == NULL)
+		return;
+
+	map_tile_t *head = TILE_HEAD(tile);
+	if(__atomic_sub_fetch(&head->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		free(head);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Valid bits of the last plane word
+ +-----------------------------------------------------------+
+ */
+static inline uint64_t
+tail_mask(RLFL_map_t *map)
+{
+	unsigned int rest = (map->cellcnt & 63);
+	return rest ? (PLANE_BIT(rest) - 1) : ~0ULL;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Set or clear bits [i0, i1) of a plane
+ +-----------------------------------------------------------+
+ */
+static inline void
+plane_range(uint64_t *plane, unsigned int i0, unsigned int i1, bool set)
+{
+	unsigned int w0 = PLANE_WORD(i0), w1 = PLANE_WORD(i1 - 1), i;
+	uint64_t first = (~0ULL << (i0 & 63));
+	uint64_t last = (~0ULL >> (63 - ((i1 - 1) & 63)));
+	if(w0 == w1)
+		first &= last;
+
+	plane[w0] = set ? (plane[w0] | first) : (plane[w0] & ~first);
+	if(w0 == w1)
+		return;
+	for(i=w0+1; i<w1; i++)
+		plane[i] = set ? ~0ULL : 0;
+	plane[w1] = set ? (plane[w1] | last) : (plane[w1] & ~last);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Count bits [i0, i1) set in any of `np` planes
+ +-----------------------------------------------------------+
+ */
+POPCOUNT_CLONES static unsigned int
+plane_count(uint64_t **planes, int np, unsigned int i0, unsigned int i1)
+{
+	unsigned int w0 = PLANE_WORD(i0), w1 = PLANE_WORD(i1 - 1), i, count = 0;
+	uint64_t first = (~0ULL << (i0 & 63));
+	uint64_t last = (~0ULL >> (63 - ((i1 - 1) & 63)));
+	int b;
+	for(i=w0; i<=w1; i++)
+	{
+		uint64_t word = 0;
+		for(b=0; b<np; b++)
+			word |= planes[b][i];
+		if(i == w0)
+			word &= first;
+		if(i == w1)
+			word &= last;
+		count += __builtin_popcountll(word);
+	}
+	return count;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Call `fn` on the cells of a w * h rectangle at x, y,
+ * 			as runs next to each other in memory, in no
+ * 			particular order. A tile inside the rectangle is
+ * 			one run. MAP_DENSE, MAP_TILED and MAP_SPARSE.
+ +-----------------------------------------------------------+
+ */
+static void
+each_run(RLFL_map_t *map, unsigned int x, unsigned int y, unsigned int w, unsigned int h,
+		 void (*fn)(const RLFL_cell_t *cells, unsigned int n, void *arg), void *arg)
+{
+	unsigned int r;
+	if(map->tiles == NULL)
+	{
+		if(w == map->width)
+		{
+			fn(map->cells + (y * w), w * h, arg);
+			return;
+		}
+		for(r=y; r<y+h; r++)
+			fn(map->cells + x + (r * map->width), w, arg);
+		return;
+	}
+
+	unsigned int tx, ty;
+	for(ty=(y >> RLFL_TILE_SHIFT); ty<=((y + h - 1) >> RLFL_TILE_SHIFT); ty++)
+	{
+		unsigned int y0 = MAX(y, ty << RLFL_TILE_SHIFT);
+		unsigned int y1 = MIN(y + h, (ty + 1) << RLFL_TILE_SHIFT);
+		for(tx=(x >> RLFL_TILE_SHIFT); tx<=((x + w - 1) >> RLFL_TILE_SHIFT); tx++)
+		{
+			unsigned int x0 = MAX(x, tx << RLFL_TILE_SHIFT);
+			unsigned int x1 = MIN(x + w, (tx + 1) << RLFL_TILE_SHIFT);
+			const RLFL_cell_t *tile = map->tiles[tx + (ty * map->tiles_w)];
+			if(x1 - x0 == RLFL_TILE && y1 - y0 == RLFL_TILE)
+			{
+				fn(tile, TILE_CELLS, arg);
+				continue;
+			}
+			for(r=y0; r<y1; r++)
+				fn(tile + (x0 & TILE_MASK) + ((r & TILE_MASK) << RLFL_TILE_SHIFT), x1 - x0, arg);
+		}
+	}
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Allocate the tiles of a MAP_TILED or MAP_SPARSE map
+ +-----------------------------------------------------------+
+ */
+static err
+alloc_tiles(RLFL_map_t *map)
+{
+	map->tiles_w = ((map->width + TILE_MASK) >> RLFL_TILE_SHIFT);
+	map->tiles_h = ((map->height + TILE_MASK) >> RLFL_TILE_SHIFT);
+
+	unsigned int t, tiles = (map->tiles_w * map->tiles_h);
+	map->tiles = (RLFL_cell_t **)calloc(sizeof(RLFL_cell_t *), tiles);
+	if(map->tiles == NULL)
+		return RLFL_ERR_GENERIC;
+
+	if(map->layout == MAP_SPARSE)
+	{
+		/* Every tile reads from the fill tile until written */
+		map->fill = tile_alloc();
+		if(map->fill == NULL)
+		{
+			free_tiles(map);
+			return RLFL_ERR_GENERIC;
+		}
+		memset(map->fill, 0, sizeof(RLFL_cell_t) * TILE_CELLS);
+		for(t=0; t<tiles; t++)
+			map->tiles[t] = map->fill;
+
+		return RLFL_SUCCESS;
+	}
+
+	for(t=0; t<tiles; t++)
+	{
+		map->tiles[t] = tile_alloc();
+		if(map->tiles[t] == NULL)
+		{
+			free_tiles(map);
+			return RLFL_ERR_GENERIC;
+		}
+		memset(map->tiles[t], 0, sizeof(RLFL_cell_t) * TILE_CELLS);
+		map->owned++;
+	}
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Free the tiles of a MAP_TILED or MAP_SPARSE map,
+ * 			tiles shared with a clone are left to the clone
+ +-----------------------------------------------------------+
+ */
+static void
+free_tiles(RLFL_map_t *map)
+{
+	if(map->tiles == NULL)
+		return;
+
+	unsigned int t, tiles = (map->tiles_w * map->tiles_h);
+	for(t=0; t<tiles; t++)
+	{
+		if(map->tiles[t] != map->fill)
+			tile_release(map->tiles[t]);
+	}
+
+	free(map->tiles);
+	tile_release(map->fill);
+	map->tiles = NULL;
+	map->fill = NULL;
+	map->owned = 0;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Record a cell the running FOV marks. Out of memory
+ * 			the record is no longer valid.
+ +-----------------------------------------------------------+
+ */
+void
+map_fov_add(RLFL_map_t *map, unsigned int cell)
+{
+	map_fov_t *f = map->fov;
+	if(f->count == f->size)
+	{
+		unsigned int size = f->size ? f->size * 2 : 256;
+		unsigned int *cells = (unsigned int *)realloc(f->cells, sizeof(unsigned int) * size);
+		if(cells == NULL)
+		{
+			f->valid = false;
+			return;
+		}
+		f->cells = cells;
+		f->size = size;
+	}
+	f->cells[f->count++] = cell;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Free the FOV record
+ +-----------------------------------------------------------+
+ */
+void
+map_fov_free(RLFL_map_t *map)
+{
+	if(map->fov == NULL)
+		return;
+
+	free(map->fov->cells);
+	free(map->fov);
+	map->fov = NULL;
+}
@@ -0,0 +1,429 @@
+/*
+	RLFL map files.
+
+	A map file holds the cells of a map and its path maps, laid out
+	so a loaded map can use the file in place:
+
+		header		64 bytes, see map_file_t
+		cells		width * height cells, row major
+		path maps	width * height ints each, in path map order,
+					one for each bit set in header.paths
+
+	Sections start on 8 byte boundaries. Files are in host byte order,
+	the header records the order and the cell size and files from
+	other hosts or builds are refused.
+
+	Loading maps the file privately, a loaded map is MAP_DENSE and
+	reads straight from the page cache. Pages are copied on the first
+	write, the file itself never changes.
+
+	Shared maps keep the same image, without path maps, in a named
+	POSIX shared memory segment. Processes attached to the segment
+	share its cells. The header's generation is bumped by the writer,
+	the map that created the segment, with RLFL_map_publish() and is always read through a shared
+	mapping of the first page, also by processes that attached
+	privately.
+
+    Copyright (C) 2011
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+    <jtm@robot.is>
+*/
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "headers/rlfl.h"
+#include "headers/map.h"
+
+#define FILE_MAGIC		"RLFL"
+#define FILE_VERSION	1
+#define FILE_ORDER		0x01020304
+#define FILE_ALIGN(n)	(((n) + 7) & ~(uint64_t)7)
+
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	uint32_t order;
+	uint32_t cell_bits;
+	uint32_t width;
+	uint32_t height;
+	uint64_t paths;		/* Bit p set if path map p is saved */
+	uint64_t cells;		/* Offset of cells */
+	uint64_t path_maps;	/* Offset of first path map */
+	uint64_t size;		/* Size of the file */
+	uint32_t generation;	/* Shared maps, see RLFL_map_publish() */
+	uint8_t reserved[4];
+} map_file_t;
+
+/* The header is part of the format */
+typedef char map_file_check[(sizeof(map_file_t) == 64) ? 1 : -1];
+typedef char map_paths_check[(RLFL_MAX_PATHS <= 64) ? 1 : -1];
+
+static err write_all(int fd, const void *data, size_t size);
+static err map_image(RLFL_map_t *map, void *base, size_t size);
+static err map_shm_head(RLFL_map_t *map, int fd);
+/*
+ +-----------------------------------------------------------+
+ * @desc	Write map to `path`. The file is written next to
+ * 			`path` and renamed over it when complete.
+ +-----------------------------------------------------------+
+ */
+err
+map_file_write(RLFL_map_t *map, const char *path)
+{
+	/* Loaded maps are dense, sparse maps past the dense limits
+	   could not be loaded */
+	if(map->width >= RLFL_MAX_WIDTH || map->height >= RLFL_MAX_HEIGHT)
+		return RLFL_ERR_SIZE;
+
+	map_file_t head;
+	memset(&head, 0, sizeof(head));
+	memcpy(head.magic, FILE_MAGIC, 4);
+	head.version = FILE_VERSION;
+	head.order = FILE_ORDER;
+	head.cell_bits = sizeof(RLFL_cell_t) * 8;
+	head.width = map->width;
+	head.height = map->height;
+
+	unsigned int p, layers = 0;
+	for(p=0; p<RLFL_MAX_PATHS; p++)
+	{
+		if(map->path_map[p])
+		{
+			head.paths |= (1ULL << p);
+			layers++;
+		}
+	}
+	uint64_t cell_bytes = (uint64_t)map->cellcnt * sizeof(RLFL_cell_t);
+	uint64_t layer_bytes = FILE_ALIGN((uint64_t)map->cellcnt * sizeof(int));
+	head.cells = sizeof(head);
+	head.path_maps = FILE_ALIGN(head.cells + cell_bytes);
+	head.size = head.path_maps + (layers * layer_bytes);
+
+	/* Other layouts are written as dense cells */
+	RLFL_cell_t *cells = map->cells;
+	if(map->layout != MAP_DENSE)
+	{
+		cells = (RLFL_cell_t *)malloc(cell_bytes ? cell_bytes : 1);
+		if(cells == NULL)
+			return RLFL_ERR_GENERIC;
+		map_read_cells(map, cells);
+	}
+
+	size_t len = strlen(path);
+	char *temp = (char *)malloc(len + 5);
+	if(temp == NULL)
+	{
+		if(cells != map->cells) free(cells);
+		return RLFL_ERR_GENERIC;
+	}
+	memcpy(temp, path, len);
+	memcpy(temp + len, ".tmp", 5);
+
+	err e = RLFL_ERR_FILE;
+	int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd >= 0)
+	{
+		static const char zero[8];
+		e = write_all(fd, &head, sizeof(head));
+		e |= write_all(fd, cells, cell_bytes);
+		e |= write_all(fd, zero, head.path_maps - (head.cells + cell_bytes));
+		for(p=0; p<RLFL_MAX_PATHS; p++)
+		{
+			if(!map->path_map[p])
+				continue;
+			uint64_t bytes = (uint64_t)map->cellcnt * sizeof(int);
+			e |= write_all(fd, map->path_map[p], bytes);
+			e |= write_all(fd, zero, layer_bytes - bytes);
+		}
+		/* On disk before it replaces `path` */
+		if(e == RLFL_SUCCESS && fsync(fd))
+			e = RLFL_ERR_FILE;
+		if(close(fd))
+			e = RLFL_ERR_FILE;
+		if(e == RLFL_SUCCESS && rename(temp, path))
+			e = RLFL_ERR_FILE;
+		if(e)
+		{
+			e = RLFL_ERR_FILE;
+			unlink(temp);
+		}
+	}
+
+	free(temp);
+	if(cells != map->cells)
+		free(cells);
+	return e;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Set up `map`, zeroed, from the file at `path`.
+ * 			The file is mapped privately, writes to the map
+ * 			never reach it.
+ +-----------------------------------------------------------+
+ */
+err
+map_file_open(RLFL_map_t *map, const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if(fd < 0)
+		return RLFL_ERR_FILE;
+
+	struct stat st;
+	if(fstat(fd, &st) || st.st_size < (off_t)sizeof(map_file_t))
+	{
+		close(fd);
+		return RLFL_ERR_FILE;
+	}
+
+	size_t size = st.st_size;
+	void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(base == MAP_FAILED)
+		return RLFL_ERR_FILE;
+
+	err e = map_image(map, base, size);
+	if(e)
+		munmap(base, size);
+	return e;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Create the shared memory segment `name` holding the
+ * 			cells of `src`, and set up `map`, zeroed, on it.
+ * 			Fails if the segment exists.
+ +-----------------------------------------------------------+
+ */
+err
+map_shm_create(RLFL_map_t *map, RLFL_map_t *src, const char *name)
+{
+	if(src->width >= RLFL_MAX_WIDTH || src->height >= RLFL_MAX_HEIGHT)
+		return RLFL_ERR_SIZE;
+
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if(fd < 0)
+		return RLFL_ERR_FILE;
+
+	uint64_t cell_bytes = (uint64_t)src->cellcnt * sizeof(RLFL_cell_t);
+	size_t size = FILE_ALIGN(sizeof(map_file_t) + cell_bytes);
+	void *base = MAP_FAILED;
+	if(ftruncate(fd, size) == 0)
+		base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(base == MAP_FAILED)
+	{
+		close(fd);
+		shm_unlink(name);
+		return RLFL_ERR_FILE;
+	}
+
+	map_file_t *head = (map_file_t *)base;
+	memcpy(head->magic, FILE_MAGIC, 4);
+	head->version = FILE_VERSION;
+	head->order = FILE_ORDER;
+	head->cell_bits = sizeof(RLFL_cell_t) * 8;
+	head->width = src->width;
+	head->height = src->height;
+	head->cells = sizeof(map_file_t);
+	head->path_maps = size;
+	head->size = size;
+	map_read_cells(src, (RLFL_cell_t *)((char *)base + head->cells));
+
+	err e = map_image(map, base, size);
+	if(e)
+		munmap(base, size);
+	else if((e = map_shm_head(map, fd)))
+		map_unmap_file(map);
+	close(fd);
+	if(e)
+		shm_unlink(name);
+	else
+		map->shm_writer = true;
+	return e;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Set up `map`, zeroed, on the shared memory segment
+ * 			`name`. A private map copies pages on the first
+ * 			write, its writes are its own and it stops seeing
+ * 			changes to pages it wrote.
+ +-----------------------------------------------------------+
+ */
+err
+map_shm_attach(RLFL_map_t *map, const char *name, bool private_pages)
+{
+	int fd = shm_open(name, O_RDWR, 0);
+	if(fd < 0)
+		return RLFL_ERR_FILE;
+
+	struct stat st;
+	if(fstat(fd, &st) || st.st_size < (off_t)sizeof(map_file_t))
+	{
+		close(fd);
+		return RLFL_ERR_FILE;
+	}
+
+	size_t size = st.st_size;
+	void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, private_pages ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+	if(base == MAP_FAILED)
+	{
+		close(fd);
+		return RLFL_ERR_FILE;
+	}
+
+	err e = map_image(map, base, size);
+	if(e)
+		munmap(base, size);
+	else if((e = map_shm_head(map, fd)))
+		map_unmap_file(map);
+	close(fd);
+	return e;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Generation of a shared map, the writer's stores to
+ * 			cells before RLFL_map_publish() are seen by a
+ * 			reader that loads the new generation
+ +-----------------------------------------------------------+
+ */
+unsigned int
+map_shm_generation(RLFL_map_t *map)
+{
+	return __atomic_load_n(&((map_file_t *)map->shm)->generation, __ATOMIC_ACQUIRE);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Bump the generation of a shared map
+ +-----------------------------------------------------------+
+ */
+unsigned int
+map_shm_publish(RLFL_map_t *map)
+{
+	return __atomic_add_fetch(&((map_file_t *)map->shm)->generation, 1, __ATOMIC_RELEASE);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Remove shared segment `name`
+ +-----------------------------------------------------------+
+ */
+err
+map_shm_unlink(const char *name)
+{
+	return shm_unlink(name) ? RLFL_ERR_FILE : RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Check a map image of `size` bytes at `base`, from a
+ * 			file or a shared segment, and set up `map` on it
+ +-----------------------------------------------------------+
+ */
+static err
+map_image(RLFL_map_t *map, void *base, size_t size)
+{
+	/* Check everything before any of it is used */
+	map_file_t *head = (map_file_t *)base;
+	uint64_t cellcnt = (uint64_t)head->width * head->height;
+	uint64_t layer_bytes = FILE_ALIGN(cellcnt * sizeof(int));
+	uint64_t layers = __builtin_popcountll(head->paths);
+	err e = RLFL_SUCCESS;
+	if(memcmp(head->magic, FILE_MAGIC, 4) || head->version != FILE_VERSION
+	   || head->order != FILE_ORDER || head->cell_bits != sizeof(RLFL_cell_t) * 8)
+		e = RLFL_ERR_FILE;
+	else if(!head->width || !head->height
+			|| head->width >= RLFL_MAX_WIDTH || head->height >= RLFL_MAX_HEIGHT)
+		e = RLFL_ERR_SIZE;
+	else if(head->size != size || head->cells != sizeof(map_file_t)
+			|| head->path_maps != FILE_ALIGN(head->cells + (cellcnt * sizeof(RLFL_cell_t)))
+			|| head->path_maps + (layers * layer_bytes) != size
+			|| (RLFL_MAX_PATHS < 64 && (head->paths >> RLFL_MAX_PATHS)))
+		e = RLFL_ERR_FILE;
+	if(e)
+		return e;
+
+	map->width = head->width;
+	map->height = head->height;
+	map->cellcnt = cellcnt;
+	map->layout = MAP_DENSE;
+	map->cells = (RLFL_cell_t *)((char *)base + head->cells);
+	map->file = base;
+	map->file_size = size;
+
+	unsigned int p;
+	char *layer = (char *)base + head->path_maps;
+	for(p=0; p<RLFL_MAX_PATHS; p++)
+	{
+		if(head->paths & (1ULL << p))
+		{
+			map->path_map[p] = (int *)layer;
+			layer += layer_bytes;
+		}
+	}
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Unmap the file of a loaded map, once nothing points
+ * 			into it
+ +-----------------------------------------------------------+
+ */
+void
+map_unmap_file(RLFL_map_t *map)
+{
+	if(map->file == NULL)
+		return;
+
+	munmap(map->file, map->file_size);
+	map->file = NULL;
+	map->file_size = 0;
+	if(map->shm)
+		munmap(map->shm, sysconf(_SC_PAGESIZE));
+	map->shm = NULL;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Map the first page of a shared segment, shared, for
+ * 			the generation
+ +-----------------------------------------------------------+
+ */
+static err
+map_shm_head(RLFL_map_t *map, int fd)
+{
+	void *head = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(head == MAP_FAILED)
+		return RLFL_ERR_FILE;
+
+	map->shm = head;
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Write all of `data`
+ +-----------------------------------------------------------+
+ */
+static err
+write_all(int fd, const void *data, size_t size)
+{
+	const char *p = (const char *)data;
+	while(size)
+	{
+		ssize_t n = write(fd, p, size);
+		if(n < 0)
+			return RLFL_ERR_FILE;
+		p += n;
+		size -= n;
+	}
+	return RLFL_SUCCESS;
+}
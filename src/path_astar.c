@@ -45,22 +45,26 @@ Then if
 */
 #include "headers/rlfl.h"
 #include "headers/path.h"
+#include "headers/map.h"
+#include "headers/ctx.h"
 
 static int dirx[]	={ 0,-1, 1, 0,-1, 1,-1, 1};
 static int diry[]	={-1, 0, 0, 1,-1,-1, 1, 1};
 
 /* Private functions */
-static err init_path(unsigned int m, float dcost);
-static err find_path(unsigned int m, unsigned int ox, unsigned int oy, unsigned int dx, unsigned int dy);
-static int path_map(unsigned int m, int x, int y);
-static path_element * path_element_map(unsigned int m, int x, int y);
-static void path_push_open(path_element * element, int dx, int dy );
-static path_element * path_pop_open(void);
-static int path_cost(path_element* element, int dx, int dy );
-static void path_check(unsigned int m, path_element* parent, int ox, int oy, int dx, int dy);
+static err init_path(RLFL_ctx_t *ctx, path_int_t *p, const map_view_t *v, float dcost);
+static void delete_path(path_int_t *p);
+static err find_path(path_int_t *p, const map_view_t *v, unsigned int ox, unsigned int oy, unsigned int dx,
+					 unsigned int dy);
+static path_element * path_element_map(path_int_t *p, const map_view_t *v, int x, int y);
+static void path_push_open(path_int_t *p, path_element * element, int dx, int dy );
+static path_element * path_pop_open(path_int_t *p);
+static int path_cost(path_int_t *p, path_element* element, int dx, int dy );
+static void path_check(path_int_t *p, const map_view_t *v, path_element* parent, int ox, int oy, int dx, int dy);
 static inline void path_update_cost( path_element* parent, path_element* pos);
-static void path_remove(path_element* element);
-static err store_path(unsigned int i, unsigned int m, unsigned int ox, unsigned int oy, unsigned int dx, unsigned int dy, bool valid);
+static void path_remove(path_int_t *p, path_element* element);
+static int store_path(path_int_t *p, const map_view_t *v, unsigned int ox, unsigned int oy,
+					  unsigned int dx, unsigned int dy, bool valid);
 
 /*
  +-----------------------------------------------------------+
@@ -70,24 +74,38 @@ static err store_path(unsigned int i, unsigned int m, unsigned int ox, unsigned
 err
 RLFL_path_astar(unsigned int m, unsigned int ox, unsigned int oy, unsigned int dx, unsigned int dy,
 			   int range, unsigned long flags, float dcost)
+{
+	return RLFL_path_astar_ctx(&RLFL_default_ctx, m, ox, oy, dx, dy, range, flags, dcost);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	RLFL_path_astar() with the scratch of `ctx`
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_path_astar_ctx(RLFL_ctx_t *ctx, unsigned int m, unsigned int ox, unsigned int oy,
+					unsigned int dx, unsigned int dy, int range, unsigned long flags, float dcost)
 {
 	/* assert map */
-	if(!RLFL_map_valid(m))
+	map_view_t v;
+	if(view_open(&v, m))
 		return RLFL_ERR_NO_MAP;
 
-	if(!(RLFL_cell_valid(m, ox, oy) && RLFL_cell_valid(m, dx, dy)))
+	if(!(view_in(&v, ox, oy) && view_in(&v, dx, dy)))
 		return RLFL_ERR_OUT_OF_BOUNDS;
 
 	unsigned int i;
 	for(i=0; i<RLFL_MAX_PATHS; i++){
 		if(!RLFL_path_store[i]) break;
 	}
-	/* assert path */
+	/* assert path, the slot is taken when the path is stored */
 	if(i >= RLFL_MAX_PATHS)
 		return RLFL_ERR_FLAG;
 
 	/* prepare */
-	init_path(m, dcost);
+	path_int_t p;
+	if(init_path(ctx, &p, &v, dcost))
+		return RLFL_ERR_GENERIC;
 
 	/* assume valid path */
 	bool valid = true;
@@ -96,24 +114,25 @@ RLFL_path_astar(unsigned int m, unsigned int ox, unsigned int oy, unsigned int d
 	if(range < 0) range = RLFL_MAX_RANGE;
 
 	/* plot */
-	err res = find_path(m, ox, oy, dx, dy);
+	err res = find_path(&p, &v, ox, oy, dx, dy);
 
 	/* Store it */
-	if(res == RLFL_SUCCESS) store_path(i, m, ox, oy, dx, dy, valid);
+	if(res == RLFL_SUCCESS) res = store_path(&p, &v, ox, oy, dx, dy, valid);
 
 	/* Cleanup */
-	delete_path();
+	delete_path(&p);
 
 	/* We have a path */
-	return (res == RLFL_SUCCESS) ? i : RLFL_ERR_GENERIC;
+	return (res >= 0) ? res : RLFL_ERR_GENERIC;
 }
 /*
  +-----------------------------------------------------------+
  * @desc	Create a path in path_store
+ * @return	Path number
  +-----------------------------------------------------------+
  */
-static err
-store_path(unsigned int i, unsigned int m, unsigned int ox, unsigned int oy,
+static int
+store_path(path_int_t *p, const map_view_t *v, unsigned int ox, unsigned int oy,
 		   unsigned int dx, unsigned int dy, bool valid) {
 	RLFL_path_t *path = (RLFL_path_t *)calloc(sizeof(RLFL_path_t), 1);
 	if(path == NULL) return RLFL_ERR_GENERIC;
@@ -122,13 +141,13 @@ store_path(unsigned int i, unsigned int m, unsigned int ox, unsigned int oy,
 	path->oy = oy;
 	path->dx = dx;
 	path->dy = dy;
-	path->map = m;
+	path->map = v->map->mnum;
 	path->size = 0;
 	path->valid = valid;
-	RLFL_clear_map(m, CELL_PATH);
+	RLFL_clear_map(v->map->mnum, CELL_PATH);
 
 	/* Trace from destination to origin */
-	path_element* pos = path_element_map(m, dx, dy);
+	path_element* pos = path_element_map(p, v, dx, dy);
 	while(true) {
 		RLFL_step_t *step = (RLFL_step_t *)calloc(sizeof(RLFL_step_t), 1);
 		if(step == NULL) return RLFL_ERR_GENERIC;
@@ -136,54 +155,50 @@ store_path(unsigned int i, unsigned int m, unsigned int ox, unsigned int oy,
 		step->Y = pos->y;
 		RLFL_list_append(path->path, step);
 		path->size++;
-		RLFL_set_flag(m, step->X, step->Y, CELL_PATH);
+		view_set(v, step->X, step->Y, CELL_PATH);
 		if(!pos->parent) break;
-		pos = path_element_map(m, pos->parent->x, pos->parent->y);
+		pos = path_element_map(p, v, pos->parent->x, pos->parent->y);
 	}
 
 	/* Store it */
-	RLFL_path_store[i] = path;
-	return RLFL_SUCCESS;
+	int i = path_store_put(path);
+	if(i < 0)
+	{
+		RLFL_list_delete(path->path);
+		free(path);
+	}
+	return i;
 }
 /*
  +-----------------------------------------------------------+
- * @desc	Create new path-finding structure
+ * @desc	Set up path-finding structure `p`, the open stack
+ * 			is scratch of `ctx`
  +-----------------------------------------------------------+
  */
 static err
-init_path(unsigned int m, float dcost) {
-	int i, j, k;
-	if(!RLFL_map_store[m]) return RLFL_ERR_NO_MAP;
-	RLFL_map_t *map = RLFL_map_store[m];
-
-	/* PATH exists */
-	if(PATH) return RLFL_ERR_FLAG;
-
-	path_int_t *p;
-   	p = (path_int_t*) calloc(sizeof(path_int_t), 1);
-   	if(p == NULL) return RLFL_ERR_GENERIC;
-
-	p->nodes = (path_element *)calloc(sizeof(path_element), map->width * map->height);
-	if(p->nodes == NULL) return RLFL_ERR_GENERIC;
-	p->open = (path_element **)calloc(sizeof(path_element*), map->width * map->height);
-	if(p->open == NULL) return RLFL_ERR_GENERIC;
-
-	memset(p->nodes, 0, (map->height * map->width) * sizeof( path_element ));
-	memset(p->open, 0, (map->height * map->width) * sizeof( path_element* ));
+init_path(RLFL_ctx_t *ctx, path_int_t *p, const map_view_t *v, float dcost) {
+	memset(p, 0, sizeof(path_int_t));
+	p->ctx = ctx;
+
+	/* Nodes are only allocated where the search goes */
+	p->blocks_w = ((v->width + TILE_MASK) >> RLFL_TILE_SHIFT);
+	p->blocks_h = ((v->height + TILE_MASK) >> RLFL_TILE_SHIFT);
+	p->blocks = (path_element **)calloc(sizeof(path_element*), p->blocks_w * p->blocks_h);
+	if(p->blocks == NULL)
+		return RLFL_ERR_GENERIC;
+
+	p->size = TILE_CELLS;
+	p->open = (path_element **)ctx_scratch(ctx, SCRATCH_OPEN, sizeof(path_element*) * p->size);
+	if(p->open == NULL)
+	{
+		free(p->blocks);
+		return RLFL_ERR_GENERIC;
+	}
 
 	p->top = 0;
 	p->dcost = dcost;
 	p->astar = true;
-	PATH = p;
-
-	k = 0;
-	for (j = 0; j < map->height; j++) {
-		for (i = 0; i < map->width; i++) {
-	     	PATH->nodes[k].x = i;
-	     	PATH->nodes[k].y = j;
-	      	k++;
-	  	}
-	}
+
 	return RLFL_SUCCESS;
 }
 /*
@@ -191,14 +206,13 @@ init_path(unsigned int m, float dcost) {
  * @desc	Free resources
  +-----------------------------------------------------------+
  */
-void
-delete_path(void) {
-	if(PATH) {
-		free(PATH->nodes);
-		free(PATH->open);
-		free(PATH);
-		PATH = NULL;
-	}
+static void
+delete_path(path_int_t *p) {
+	unsigned int i;
+	for(i=0; i<(p->blocks_w * p->blocks_h); i++)
+		free(p->blocks[i]);
+	free(p->blocks);
+	p->blocks = NULL;
 }
 /*
  +-----------------------------------------------------------+
@@ -206,23 +220,22 @@ delete_path(void) {
  +-----------------------------------------------------------+
  */
 static err
-find_path(unsigned int m, unsigned int ox, unsigned int oy, unsigned int dx, unsigned int dy)
+find_path(path_int_t *p, const map_view_t *v, unsigned int ox, unsigned int oy, unsigned int dx,
+		  unsigned int dy)
 {
-	if(!PATH)
-		return RLFL_ERR_NO_MAP;
-	path_element* pos = path_element_map(m, ox, oy);
-	path_element* goal = path_element_map(m, dx, dy);
+	path_element* pos = path_element_map(p, v, ox, oy);
+	path_element* goal = path_element_map(p, v, dx, dy);
 	path_element* current = NULL;
 	int dir;
 
 	if (pos && goal) {
 		/* Bootstrap */
 		pos->state = STATE_EMPTY;
-		path_push_open(pos, dx, dy);
+		path_push_open(p, pos, dx, dy);
 
-		while(PATH->top)
+		while(p->top)
 		{
-			 current = path_pop_open();
+			 current = path_pop_open(p);
 
 			 /* Are we there yet */
 			 if(current->x == dx && current->y == dy)
@@ -236,22 +249,12 @@ find_path(unsigned int m, unsigned int ox, unsigned int oy, unsigned int dx, uns
 			 /* Generate positions reachable from current position. */
 			 for(dir=0; dir<8; dir++)
 			 {
-				path_check(m, current, current->x + dirx[dir], current->y + diry[dir], dx, dy);
+				path_check(p, v, current, current->x + dirx[dir], current->y + diry[dir], dx, dy);
 			 }
 		}
 	}
 	return RLFL_ERR_GENERIC;
 }
-/*
- +-----------------------------------------------------------+
- * @desc	Maps coordinates to one dimensional array indices
- +-----------------------------------------------------------+
- */
-static int
-path_map(unsigned int m, int x, int y) {
-	RLFL_map_t *map = RLFL_map_store[m];
-    return x + (map->width * y);
-}
 /*
  +-----------------------------------------------------------+
  * @desc	Returns pointer to path element structure or NULL
@@ -259,14 +262,29 @@ path_map(unsigned int m, int x, int y) {
  +-----------------------------------------------------------+
  */
 static path_element*
-path_element_map(unsigned int m, int x, int y) {
-    path_element* result = NULL;
-    RLFL_map_t *map = RLFL_map_store[m];
-    if ( ( x >= 0 && x < map->width ) &&
-         ( y >= 0 && y < map->height ) ) {
-        result = &PATH->nodes[path_map(m, x, y )];
+path_element_map(path_int_t *p, const map_view_t *v, int x, int y) {
+    if (!view_in(v, x, y)) {
+        return NULL;
 	}
-    return result;
+
+	unsigned int b = (x >> RLFL_TILE_SHIFT) + ((y >> RLFL_TILE_SHIFT) * p->blocks_w);
+	path_element *block = p->blocks[b];
+	if(block == NULL)
+	{
+		/* First visit to this block */
+		block = (path_element *)calloc(sizeof(path_element), TILE_CELLS);
+		if(block == NULL)
+			return NULL;
+
+		int i;
+		for(i=0; i<TILE_CELLS; i++)
+		{
+			block[i].x = ((x & ~TILE_MASK) + (i & TILE_MASK));
+			block[i].y = ((y & ~TILE_MASK) + (i >> RLFL_TILE_SHIFT));
+		}
+		p->blocks[b] = block;
+	}
+    return &block[(x & TILE_MASK) + ((y & TILE_MASK) << RLFL_TILE_SHIFT)];
 }
 /*
  +-----------------------------------------------------------+
@@ -274,25 +292,34 @@ path_element_map(unsigned int m, int x, int y) {
  +-----------------------------------------------------------+
  */
 static void
-path_push_open(path_element* element, int dx, int dy ) {
-	PATH->open[PATH->top] = element;
+path_push_open(path_int_t *p, path_element* element, int dx, int dy ) {
+	if(p->top == p->size)
+	{
+		path_element **open = (path_element **)ctx_scratch(p->ctx, SCRATCH_OPEN,
+														   sizeof(path_element*) * p->size * 2);
+		if(open == NULL)
+			return;
+		p->open = open;
+		p->size *= 2;
+	}
+	p->open[p->top] = element;
 
 	int i, ntotal, ctotal;
-	for(i=PATH->top; i >= 1; i--)
+	for(i=p->top; i >= 1; i--)
 	{
-		path_element* current = PATH->open[i];
-		path_element* next = PATH->open[i - 1];
+		path_element* current = p->open[i];
+		path_element* next = p->open[i - 1];
 
-		ntotal = path_cost(next, dx, dy);
-		ctotal = path_cost(current, dx, dy);
+		ntotal = path_cost(p, next, dx, dy);
+		ctotal = path_cost(p, current, dx, dy);
 
 		if (ntotal < ctotal)
 		{
-			PATH->open[i] = next;
-			PATH->open[i - 1] = current;
+			p->open[i] = next;
+			p->open[i - 1] = current;
 		}
 	}
-	PATH->top++;
+	p->top++;
 }
 /*
  +-----------------------------------------------------------+
@@ -300,10 +327,10 @@ path_push_open(path_element* element, int dx, int dy ) {
  +-----------------------------------------------------------+
  */
 static path_element *
-path_pop_open(void) {
-	PATH->top--;
-    path_element* result = PATH->open[PATH->top];
-    PATH->open[PATH->top] = NULL;
+path_pop_open(path_int_t *p) {
+	p->top--;
+    path_element* result = p->open[p->top];
+    p->open[p->top] = NULL;
     return result;
 }
 /*
@@ -312,14 +339,14 @@ path_pop_open(void) {
  +-----------------------------------------------------------+
  */
 static void
-path_check(unsigned int m, path_element* parent, int ox, int oy, int dx, int dy) {
+path_check(path_int_t *p, const map_view_t *v, path_element* parent, int ox, int oy, int dx, int dy) {
 
-	path_element* pos = path_element_map(m, ox, oy);
+	path_element* pos = path_element_map(p, v, ox, oy);
 
 	if (pos)
 	{
 		/* We can ignore blocked positions (consider that cost is infinite).*/
-		if (RLFL_has_flag(m, ox, oy, (CELL_OPEN | CELL_WALK)))
+		if (view_has(v, ox, oy, (CELL_OPEN | CELL_WALK)))
 		{
 			if(pos->state == STATE_EMPTY)
 			{
@@ -327,17 +354,17 @@ path_check(unsigned int m, path_element* parent, int ox, int oy, int dx, int dy)
 				pos->state = STATE_OPEN;
 				pos->parent = parent;
 				path_update_cost(parent, pos);
-				path_push_open(pos, dx, dy);
+				path_push_open(p, pos, dx, dy);
 			}
 			else
 			{
 				/* Now element is either in open or closed set. */
-				const int oc = path_cost(pos, dx, dy);
+				const int oc = path_cost(p, pos, dx, dy);
 				path_element tmp = *pos;
 				path_update_cost(parent, &tmp);
 
-//				printf("oc: %d, pc: %d\n", oc, path_cost(&tmp, dx, dy));
-				if(oc > path_cost(&tmp, dx, dy))
+//				printf("oc: %d, pc: %d\n", oc, path_cost(p, &tmp, dx, dy));
+				if(oc > path_cost(p, &tmp, dx, dy))
 				{
 					/* New path is better than old. */
 					bool was_open = (pos->state == STATE_OPEN);
@@ -346,9 +373,9 @@ path_check(unsigned int m, path_element* parent, int ox, int oy, int dx, int dy)
 					pos->parent = parent;
 					pos->state = STATE_OPEN;
 					if(was_open) {
-						path_remove(pos);
+						path_remove(p, pos);
 					}
-					path_push_open(pos, dx, dy);
+					path_push_open(p, pos, dx, dy);
 				}
 			}
 		}
@@ -369,21 +396,21 @@ path_update_cost( path_element* parent, path_element* pos) {
  +-----------------------------------------------------------+
  */
 static void
-path_remove(path_element* element) {
+path_remove(path_int_t *p, path_element* element) {
     int i;
-    for (i = 0; i < PATH->top; i++) {
-        if(element == PATH->open[i]) {
+    for (i = 0; i < p->top; i++) {
+        if(element == p->open[i]) {
             break;
       	}
    	}
 
-    if (i != PATH->top) {
+    if (i != p->top) {
         /* Element was found. */
-    	PATH->open[i] = NULL;
-        for(; i < (PATH->top - 1); i++) {
-        	PATH->open[i] = PATH->open[i + 1];
+    	p->open[i] = NULL;
+        for(; i < (p->top - 1); i++) {
+        	p->open[i] = p->open[i + 1];
        	}
-        PATH->top--;
+        p->top--;
  	}
 }
 /*
@@ -392,7 +419,7 @@ path_remove(path_element* element) {
  +-----------------------------------------------------------+
  */
 static int
-path_cost(path_element* element, int dx, int dy ) {
+path_cost(path_int_t *p, path_element* element, int dx, int dy ) {
 	int ox = element->x - dx;
 	int oy = element->y - dy;
 	int cost = 0;
@@ -403,7 +430,7 @@ path_cost(path_element* element, int dx, int dy ) {
 	if(ox && oy)
 	{
 		// Diagonal move
-		cost += PATH->dcost;
+		cost += p->dcost;
 	}
 	return (element->cost + element->estimate + cost);
 }
@@ -37,41 +37,51 @@
 */
 #include "headers/rlfl.h"
 #include "headers/path.h"
+#include "headers/map.h"
+#include "headers/ctx.h"
 
-static err add_step(unsigned int m, int x, int y);
-static err test_step(unsigned int m, unsigned int x, unsigned int y, unsigned int dx, unsigned int dy, int range, unsigned int flg);
-
-static RLFL_path_t* path;
+static err add_step(RLFL_path_t *path, const map_view_t *v, int x, int y);
+static err test_step(RLFL_path_t *path, const map_view_t *v, unsigned int x, unsigned int y, unsigned int dx,
+					 unsigned int dy, int range, unsigned int flg);
+static bool open_at(const map_view_t *v, int x, int y);
 
 err
 RLFL_path_basic(unsigned int map, unsigned int x1, unsigned int y1, unsigned int x2, unsigned int y2,
 			   int range, unsigned long flags)
+{
+	return RLFL_path_basic_ctx(&RLFL_default_ctx, map, x1, y1, x2, y2, range, flags);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	RLFL_path_basic() with the random state of `ctx`
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_path_basic_ctx(RLFL_ctx_t *ctx, unsigned int map, unsigned int x1, unsigned int y1,
+					unsigned int x2, unsigned int y2, int range, unsigned long flags)
 {
 	/* assert map */
-	if(!RLFL_map_valid(map))
+	map_view_t v;
+	if(view_open(&v, map))
 		return RLFL_ERR_NO_MAP;
 
-	if(!(RLFL_cell_valid(map, x1, y1) && RLFL_cell_valid(map, x2, y2)))
+	if(!(view_in(&v, x1, y1) && view_in(&v, x2, y2)))
 		return RLFL_ERR_OUT_OF_BOUNDS;
 
 	unsigned int path_n;
 	for(path_n=0; path_n<RLFL_MAX_PATHS; path_n++){
 		if(!RLFL_path_store[path_n]) break;
 	}
-	/* assert path */
+	/* assert path, the slot is taken when the path is stored */
 	if(path_n >= RLFL_MAX_PATHS) return RLFL_ERR_FLAG;
 
-	/* assert cells */
-	if(!RLFL_cell_valid(map, x1, y1)) return RLFL_ERR_GENERIC;
-	if(!RLFL_cell_valid(map, x2, y2)) return RLFL_ERR_GENERIC;
-
 	/* No path necessary (or allowed) */
 	if ((x1 == x2) && (y1 == y2)) return RLFL_ERR_GENERIC;
 
 	if(range < 0) range = RLFL_MAX_RANGE;
 
 	/* init path */
-	path = (RLFL_path_t *)calloc(sizeof(RLFL_path_t), 1);
+	RLFL_path_t *path = (RLFL_path_t *)calloc(sizeof(RLFL_path_t), 1);
 	if(path == NULL) return RLFL_ERR_GENERIC;
 	path->path = RLFL_list_create();
 	path->ox = x1;
@@ -174,7 +184,7 @@ RLFL_path_basic(unsigned int map, unsigned int x1, unsigned int y1, unsigned int
 			if ((n + (k >> 1)) >= range) break;
 
 			/* Test step */
-			int test = test_step(map, x, y, x2, y2, range, flags);
+			int test = test_step(path, &v, x, y, x2, y2, range, flags);
 			if(test)
 			{
 				if(test == 1)
@@ -252,7 +262,7 @@ RLFL_path_basic(unsigned int map, unsigned int x1, unsigned int y1, unsigned int
 			if ((n + (k >> 1)) >= range) break;
 
 			/* Test step */
-			int test = test_step(map, x, y, x2, y2, range, flags);
+			int test = test_step(path, &v, x, y, x2, y2, range, flags);
 			if(test)
 			{
 				if(test == 1)
@@ -312,21 +322,21 @@ RLFL_path_basic(unsigned int map, unsigned int x1, unsigned int y1, unsigned int
 			if ((n + (n >> 1)) >= range) break;
 
 			/* Test step */
-			int test = test_step(map, x, y, x2, y2, range, flags);
+			int test = test_step(path, &v, x, y, x2, y2, range, flags);
 			if(test)
 			{
 				if(test == 1)
 				{
 					// Analyze wall placements
-					int a = RLFL_has_flag(map, x-1, y, CELL_OPEN);
-					int b = RLFL_has_flag(map, x+1, y, CELL_OPEN);
-					int c = RLFL_has_flag(map, x, y-1, CELL_OPEN);
-					int d = RLFL_has_flag(map, x, y+1, CELL_OPEN);
+					int a = open_at(&v, x-1, y);
+					int b = open_at(&v, x+1, y);
+					int c = open_at(&v, x, y-1);
+					int d = open_at(&v, x, y+1);
 //					printf("%d, %d, %d, %d\n", a, b, c, d);
 					if((a+b) == (c+d))
 					{
 						// Random fun
-						if(RLFL_randint(10) < 5)
+						if(RLFL_randint_ctx(ctx, 10) < 5)
 						{
 							sy = -sy;
 						}
@@ -358,43 +368,47 @@ RLFL_path_basic(unsigned int map, unsigned int x1, unsigned int y1, unsigned int
 		}
 	}
 	/* Store it */
-	RLFL_path_store[path_n] = path;
-	path = NULL;
+	int stored = path_store_put(path);
+	if(stored < 0)
+	{
+		RLFL_list_delete(path->path);
+		free(path);
+	}
 
 	/* OK */
-	return path_n;
+	return stored;
 }
 /*
  * Test the current step for sanity and special effects
  *
  * */
 static err
-test_step(unsigned int m, unsigned int x, unsigned int y, unsigned int dx, unsigned int dy,
-		  int range, unsigned int flg)
+test_step(RLFL_path_t *path, const map_view_t *v, unsigned int x, unsigned int y, unsigned int dx,
+		  unsigned int dy, int range, unsigned int flg)
 {
 	/* Stay sane */
-	if (!RLFL_cell_valid(m, x, y)) {
+	if (!view_in(v, x, y)) {
 		return RLFL_ERR_GENERIC;
 	}
 
 	/* Save grid */
-	add_step(m, x, y);
+	add_step(path, v, x, y);
 
-	if(flg & (PROJECT_REFL) && RLFL_has_flag(m, x, y, CELL_REFL)) {
+	if(flg & (PROJECT_REFL) && view_has(v, x, y, CELL_REFL)) {
 		return 1;
 	}
 
 	if (flg & (PROJECT_THRU))
 	{
 		/* Tunnel through features */
-		if(RLFL_has_flag(m, x, y, CELL_PERM)) {
+		if(view_has(v, x, y, CELL_PERM)) {
 			return RLFL_ERR_GENERIC;
 		}
 	}
 	else
 	{
 		/* Always stop at non-initial wall grids */
-		if(!RLFL_has_flag(m, x, y, (CELL_OPEN | CELL_WALK))) {
+		if(!view_has(v, x, y, (CELL_OPEN | CELL_WALK))) {
 			return RLFL_ERR_GENERIC;
 		}
 	}
@@ -402,7 +416,7 @@ test_step(unsigned int m, unsigned int x, unsigned int y, unsigned int dx, unsig
 	if (flg & (PROJECT_STOP))
 	{
 		/* Stop at non-initial monsters/players */
-		if(RLFL_has_flag(m, x, y, CELL_OCUP)) {
+		if(view_has(v, x, y, CELL_OCUP)) {
 			return RLFL_ERR_GENERIC;
 		}
 	}
@@ -415,13 +429,24 @@ test_step(unsigned int m, unsigned int x, unsigned int y, unsigned int dx, unsig
  *
  */
 static err
-add_step(unsigned int m, int x, int y) {
+add_step(RLFL_path_t *path, const map_view_t *v, int x, int y) {
 	RLFL_step_t *step = (RLFL_step_t *)calloc(sizeof(RLFL_step_t), 1);
 	if(step == NULL) return RLFL_ERR_GENERIC;
 	step->X = x;
 	step->Y = y;
 	RLFL_list_append(path->path, step);
 	path->size++;
-	RLFL_set_flag(m, x, y, CELL_PATH);
+	view_set(v, x, y, CELL_PATH);
 	return RLFL_SUCCESS;
 }
+/*
+ +-----------------------------------------------------------+
+ * @desc	True if x, y is on the map and open, off the map
+ * 			counts as wall
+ +-----------------------------------------------------------+
+ */
+static bool
+open_at(const map_view_t *v, int x, int y)
+{
+	return (view_in(v, x, y) && view_has(v, x, y, CELL_OPEN));
+}
@@ -22,21 +22,35 @@
     <jtm@robot.is>
 */
 #include "headers/rlfl.h"
+#include "headers/map.h"
+#include "headers/ctx.h"
 
 static err add_step(int p, int x, int y);
-static void breath_shape(unsigned short m, unsigned short path_n, int dist, int *pgrids,
+static void breath_shape(const map_view_t *v, unsigned short path_n, int dist, int *pgrids,
 						 unsigned short *gm, int *pgm_rad, int rad, int y1, int x1, int y2,
 						 int x2, bool disint_ball, bool real_breath);
-static err ball_shape(unsigned short m, unsigned short project_n, int dist, int bx, int by, int rad, unsigned short flg);
+static err ball_shape(const map_view_t *v, unsigned short project_n, int dist, int bx, int by, int rad, unsigned short flg);
 /*
  *
  * */
 err
 RLFL_project(unsigned int m, unsigned int ox, unsigned int oy, unsigned int tx, unsigned int ty,
 			 int rad, int range, unsigned short flg)
+{
+	return RLFL_project_ctx(&RLFL_default_ctx, m, ox, oy, tx, ty, rad, range, flg);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	RLFL_project() with the random state of `ctx`
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_project_ctx(RLFL_ctx_t *ctx, unsigned int m, unsigned int ox, unsigned int oy, unsigned int tx,
+				 unsigned int ty, int rad, int range, unsigned short flg)
 {
 //	printf("(%d, %d)(%d, %d), %d, %d, %d\n", ox, oy, tx, ty, rad, range, flg);
-	if(!RLFL_map_valid(m))
+	map_view_t v;
+	if(view_open(&v, m))
 		return RLFL_ERR_NO_MAP;
 
 	int i = 0, dist, project_n, path_size;
@@ -48,8 +62,8 @@ RLFL_project(unsigned int m, unsigned int ox, unsigned int oy, unsigned int tx,
 		return RLFL_ERR_FLAG;
 
 	/* assert cells */
-	if(!RLFL_cell_valid(m, ox, oy)) return RLFL_ERR_OUT_OF_BOUNDS;
-	if(!RLFL_cell_valid(m, tx, ty)) return RLFL_ERR_OUT_OF_BOUNDS;
+	if(!view_in(&v, ox, oy)) return RLFL_ERR_OUT_OF_BOUNDS;
+	if(!view_in(&v, tx, ty)) return RLFL_ERR_OUT_OF_BOUNDS;
 
 	/* prepare */
 	RLFL_list_t * projection = RLFL_list_create();
@@ -112,7 +126,7 @@ RLFL_project(unsigned int m, unsigned int ox, unsigned int oy, unsigned int tx,
 	}
 
 	/* Calculate the projection path */
-	path_n = RLFL_path_create(m, x1, y1, x2, y2, PATH_BASIC, range, flg, 0);
+	path_n = RLFL_path_create_ctx(ctx, m, x1, y1, x2, y2, PATH_BASIC, range, flg, 0);
 	if(path_n >= 0) {
 		path_size = RLFL_path_size(path_n);
 
@@ -123,11 +137,11 @@ RLFL_project(unsigned int m, unsigned int ox, unsigned int oy, unsigned int tx,
 			RLFL_path_step(path_n, i, &nx, &ny);
 
 			/* Handle PROJECT_THRU */
-			if (flg & PROJECT_REFL && RLFL_has_flag(m, nx, ny, CELL_REFL))
+			if (flg & PROJECT_REFL && view_has(&v, nx, ny, CELL_REFL))
 			{
 				// pass
 			}
-			else if (!RLFL_has_flag(m, nx, ny, CELL_OPEN) && (!(flg & PROJECT_THRU)))
+			else if (!view_has(&v, nx, ny, CELL_OPEN) && (!(flg & PROJECT_THRU)))
 			{
 				break;
 			}
@@ -182,13 +196,13 @@ RLFL_project(unsigned int m, unsigned int ox, unsigned int oy, unsigned int tx,
 		 */
 		if (breath && dist > rad)
 		{
-			breath_shape(m, path_n, dist, &grids, gm, &gm_rad,
+			breath_shape(&v, path_n, dist, &grids, gm, &gm_rad,
 						 rad, y1, x1, by, bx, (bool)(flg & PROJECT_THRU), true);
 		}
 		else
 		{
 			dist = (flg & PROJECT_SHEL) ? rad : 0;
-			if(ball_shape(m, project_n, dist, bx, by, rad, flg))
+			if(ball_shape(&v, project_n, dist, bx, by, rad, flg))
 				return RLFL_ERR_GENERIC;
 		}
 	}
@@ -278,7 +292,7 @@ RLFL_project(unsigned int m, unsigned int ox, unsigned int oy, unsigned int tx,
   *
   */
 static err
-ball_shape(unsigned short m, unsigned short project_n, int dist, int bx, int by,
+ball_shape(const map_view_t *v, unsigned short project_n, int dist, int bx, int by,
 		   int rad, unsigned short flg) {
 	int x, y;
 	/* Determine the blast area, work from the inside out */
@@ -290,7 +304,7 @@ ball_shape(unsigned short m, unsigned short project_n, int dist, int bx, int by,
 			for (x = bx - dist; x <= bx + dist; x++)
 			{
 				/* Ignore "illegal" locations */
-				if (!RLFL_cell_valid(m, x, y))
+				if (!view_in(v, x, y))
 					continue;
 
 				if(flg & PROJECT_SQUARE)
@@ -323,7 +337,7 @@ ball_shape(unsigned short m, unsigned short project_n, int dist, int bx, int by,
 				}
 
 				/* The blast is sometimes stopped by walls */
-				if(!(flg & PROJECT_THRU) && !RLFL_has_flag(m, x, y, CELL_OPEN))
+				if(!(flg & PROJECT_THRU) && !view_has(v, x, y, CELL_OPEN))
 					continue;
 
 				/* Save this grid */
@@ -340,7 +354,7 @@ ball_shape(unsigned short m, unsigned short project_n, int dist, int bx, int by,
  * breath shape
  */
 static void
-breath_shape(unsigned short m, unsigned short path_n, int dist, int *pgrids,
+breath_shape(const map_view_t *v, unsigned short path_n, int dist, int *pgrids,
  			 unsigned short *gm, int *pgm_rad, int rad, int y1, int x1, int y2,
  			 int x2, bool disint_ball, bool real_breath)
 {
@@ -381,7 +395,7 @@ breath_shape(unsigned short m, unsigned short path_n, int dist, int *pgrids,
 				for (x = bx - cdis; x <= bx + cdis; x++)
 				{
 					/* Ignore "illegal" locations */
-					if (!RLFL_cell_valid(m, x, y))
+					if (!view_in(v, x, y))
 						continue;
 
 					/* Enforce a circular "ripple" */
@@ -393,7 +407,7 @@ breath_shape(unsigned short m, unsigned short path_n, int dist, int *pgrids,
 						continue;
 
 					/* The blast is sometimes stopped by walls */
-					if (!disint_ball && !RLFL_has_flag(m, x, y, CELL_OPEN))
+					if (!disint_ball && !view_has(v, x, y, CELL_OPEN))
 						continue;
 
 					/* Save this grid */
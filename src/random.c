@@ -2,8 +2,9 @@
    A C-program for MT19937, with initialization improved 2002/1/26.
    Coded by Takuji Nishimura and Makoto Matsumoto.
 
-   Before using, initialize the state by using init_genrand(seed)
-   or init_by_array(init_key, key_length).
+   Before using, initialize the state by using ctx_seed(ctx, seed).
+   Adapted to keep the state in a RLFL context, init_by_array() and
+   the real number generators are not used and were dropped.
 
    Copyright (C) 1997 - 2002, Makoto Matsumoto and Takuji Nishimura,
    All rights reserved.
@@ -41,19 +42,23 @@
    email: m-mat @ math.sci.hiroshima-u.ac.jp (remove space)
 */
 #include "headers/rlfl.h"
+#include "headers/ctx.h"
+
 /* Period parameters */
-#define N 624
+#define N RLFL_MT_N
 #define M 397
 #define MATRIX_A 0x9908b0dfUL   /* constant vector a */
 #define UPPER_MASK 0x80000000UL /* most significant w-r bits */
 #define LOWER_MASK 0x7fffffffUL /* least significant r bits */
 
-static unsigned long mt[N]; /* the array for the state vector  */
-static int mti=N+1; /* mti==N+1 means mt[N] is not initialized */
+/* The state vector and position are in the context,
+   ctx->mti==N+1 means ctx->mt[N] is not initialized */
 
 /* initializes mt[N] with a seed */
-void init_genrand(unsigned long s)
+void ctx_seed(RLFL_ctx_t *ctx, unsigned long s)
 {
+    unsigned long *mt = ctx->mt;
+    int mti;
     mt[0]= s & 0xffffffffUL;
     for (mti=1; mti<N; mti++) {
         mt[mti] =
@@ -65,50 +70,23 @@ void init_genrand(unsigned long s)
         mt[mti] &= 0xffffffffUL;
         /* for >32 bit machines */
     }
-}
-
-/* initialize by an array with array-length */
-/* init_key is the array for initializing keys */
-/* key_length is its length */
-/* slight change for C++, 2004/2/26 */
-void init_by_array(unsigned long init_key[], int key_length)
-{
-    int i, j, k;
-    init_genrand(19650218UL);
-    i=1; j=0;
-    k = (N>key_length ? N : key_length);
-    for (; k; k--) {
-        mt[i] = (mt[i] ^ ((mt[i-1] ^ (mt[i-1] >> 30)) * 1664525UL))
-          + init_key[j] + j; /* non linear */
-        mt[i] &= 0xffffffffUL; /* for WORDSIZE > 32 machines */
-        i++; j++;
-        if (i>=N) { mt[0] = mt[N-1]; i=1; }
-        if (j>=key_length) j=0;
-    }
-    for (k=N-1; k; k--) {
-        mt[i] = (mt[i] ^ ((mt[i-1] ^ (mt[i-1] >> 30)) * 1566083941UL))
-          - i; /* non linear */
-        mt[i] &= 0xffffffffUL; /* for WORDSIZE > 32 machines */
-        i++;
-        if (i>=N) { mt[0] = mt[N-1]; i=1; }
-    }
-
-    mt[0] = 0x80000000UL; /* MSB is 1; assuring non-zero initial array */
+    ctx->mti = mti;
 }
 
 /* generates a random number on [0,0xffffffff]-interval */
-unsigned long genrand_int32(void)
+unsigned long ctx_rand32(RLFL_ctx_t *ctx)
 {
     unsigned long y;
-    static unsigned long mag01[2]={0x0UL, MATRIX_A};
+    static const unsigned long mag01[2]={0x0UL, MATRIX_A};
     /* mag01[x] = x * MATRIX_A  for x=0,1 */
+    unsigned long *mt = ctx->mt;
 
-    if (mti >= N) { /* generate N words at one time */
+    if (ctx->mti >= N) { /* generate N words at one time */
         int kk;
 
-        if (mti == N+1)   /* if init_genrand() has not been called, */
+        if (ctx->mti == N+1)   /* if ctx_seed() has not been called, */
         	/* Default to time seed */
-            init_genrand(time(NULL));
+            ctx_seed(ctx, time(NULL) ^ (unsigned long)(uintptr_t)ctx);
 
         for (kk=0;kk<N-M;kk++) {
             y = (mt[kk]&UPPER_MASK)|(mt[kk+1]&LOWER_MASK);
@@ -121,10 +99,10 @@ unsigned long genrand_int32(void)
         y = (mt[N-1]&UPPER_MASK)|(mt[0]&LOWER_MASK);
         mt[N-1] = mt[M-1] ^ (y >> 1) ^ mag01[y & 0x1UL];
 
-        mti = 0;
+        ctx->mti = 0;
     }
 
-    y = mt[mti++];
+    y = mt[ctx->mti++];
 
     /* Tempering */
     y ^= (y >> 11);
@@ -134,40 +112,6 @@ unsigned long genrand_int32(void)
 
     return y;
 }
-
-/* generates a random number on [0,0x7fffffff]-interval */
-long genrand_int31(void)
-{
-    return (long)(genrand_int32()>>1);
-}
-
-/* generates a random number on [0,1]-real-interval */
-double genrand_real1(void)
-{
-    return genrand_int32()*(1.0/4294967295.0);
-    /* divided by 2^32-1 */
-}
-
-/* generates a random number on [0,1)-real-interval */
-double genrand_real2(void)
-{
-    return genrand_int32()*(1.0/4294967296.0);
-    /* divided by 2^32 */
-}
-
-/* generates a random number on (0,1)-real-interval */
-double genrand_real3(void)
-{
-    return (((double)genrand_int32()) + 0.5)*(1.0/4294967296.0);
-    /* divided by 2^32 */
-}
-
-/* generates a random number on [0,1) with 53-bit resolution*/
-double genrand_res53(void)
-{
-    unsigned long a=genrand_int32()>>5, b=genrand_int32()>>6;
-    return(a*67108864.0+b)*(1.0/9007199254740992.0);
-}
 /*
  * Extract a "random" number from 0 to m-1, via "division"
  *
@@ -184,6 +128,15 @@ double genrand_res53(void)
  */
 int
 RLFL_randint(int limit) {
+	return RLFL_randint_ctx(&RLFL_default_ctx, limit);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	RLFL_randint() with the random state of `ctx`
+ +-----------------------------------------------------------+
+ */
+int
+RLFL_randint_ctx(RLFL_ctx_t *ctx, int limit) {
 	unsigned int n, r;
 
 	/* Hack -- simple case */
@@ -198,7 +151,7 @@ RLFL_randint(int limit) {
 	while (1)
 	{
 		/* Cycle the generator */
-		r = genrand_int32();
+		r = ctx_rand32(ctx);
 
 		/* Mutate a 28-bit "random" number */
 		r = (r >> 4) / n;
@@ -218,7 +171,10 @@ RLFL_randint(int limit) {
  +-----------------------------------------------------------+
  */
 int RLFL_randrange(int min, int max) {
-	return RLFL_randint(min + 1 + (max - min));
+	return RLFL_randrange_ctx(&RLFL_default_ctx, min, max);
+}
+int RLFL_randrange_ctx(RLFL_ctx_t *ctx, int min, int max) {
+	return RLFL_randint_ctx(ctx, min + 1 + (max - min));
 }
 /*
  +-----------------------------------------------------------+
@@ -226,5 +182,8 @@ int RLFL_randrange(int min, int max) {
  +-----------------------------------------------------------+
  */
 int RLFL_randspread(int origin, int range) {
-	return RLFL_randrange(origin - range, origin + range + 1);
+	return RLFL_randspread_ctx(&RLFL_default_ctx, origin, range);
+}
+int RLFL_randspread_ctx(RLFL_ctx_t *ctx, int origin, int range) {
+	return RLFL_randrange_ctx(ctx, origin - range, origin + range + 1);
 }
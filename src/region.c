@@ -0,0 +1,385 @@
+/*
+	RLFL connected regions.
+
+	Cells with any of the region flags are joined to their four
+	neighbours with a union-find forest, one parent per cell. A
+	region is a tree of the forest, its root labels it.
+
+	Opening a cell joins it to its open neighbours. Closing a cell
+	may split its region, the region is walked again from each of
+	the closed cell's neighbours and every part gets a flat tree.
+	Other regions are not touched.
+
+	Finds halve the path they walk. Queries hold only the read lock
+	of the map, the parent words are loaded and stored atomically
+	and a halving store only points a cell further up its own tree.
+
+    Copyright (C) 2011
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+    <jtm@robot.is>
+*/
+#include "headers/rlfl.h"
+#include "headers/map.h"
+
+/* Parent of cells in no region */
+#define REGION_NONE 0xFFFFFFFFu
+
+static err region_alloc(RLFL_map_t *map);
+static unsigned int find(unsigned int *parent, unsigned int i);
+static void unite(map_regions_t *r, unsigned int a, unsigned int b);
+static err open_cell(RLFL_map_t *map, unsigned int x, unsigned int y);
+static err close_cell(RLFL_map_t *map, unsigned int x, unsigned int y);
+static err push(map_regions_t *r, unsigned int *n, unsigned int i);
+/*
+ +-----------------------------------------------------------+
+ * @desc	Keep regions of cells with any of `flag`, or stop
+ * 			if `flag` is 0. Starting builds every region.
+ +-----------------------------------------------------------+
+ */
+err
+region_track(RLFL_map_t *map, unsigned long flag)
+{
+	if(!flag)
+	{
+		region_free(map);
+		return RLFL_SUCCESS;
+	}
+
+	if(map->regions == NULL && region_alloc(map))
+		return RLFL_ERR_GENERIC;
+
+	map->region_flag = flag;
+	return region_build(map);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Free regions
+ +-----------------------------------------------------------+
+ */
+void
+region_free(RLFL_map_t *map)
+{
+	map_regions_t *r = map->regions;
+	if(r == NULL)
+		return;
+
+	free(r->parent);
+	free(r->rank);
+	free(r->seen);
+	free(r->queue);
+	free(r);
+	map->regions = NULL;
+	map->region_flag = 0;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Build every region, a single pass joining each
+ * 			open cell to the open cells left of and above it
+ +-----------------------------------------------------------+
+ */
+err
+region_build(RLFL_map_t *map)
+{
+	map_regions_t *r = map->regions;
+	unsigned int x, y, i = 0;
+	r->count = 0;
+	for(y=0; y<map->height; y++)
+	{
+		for(x=0; x<map->width; x++, i++)
+		{
+			if(!cell_has(map, x, y, map->region_flag))
+			{
+				r->parent[i] = REGION_NONE;
+				continue;
+			}
+			r->parent[i] = i;
+			r->rank[i] = 0;
+			r->count++;
+			if(x && r->parent[i - 1] != REGION_NONE)
+				unite(r, i - 1, i);
+			if(y && r->parent[i - map->width] != REGION_NONE)
+				unite(r, i - map->width, i);
+		}
+	}
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Set, or clear, `flag` on cell and keep its region.
+ * 			The region only changes if the cell opened or
+ * 			closed.
+ +-----------------------------------------------------------+
+ */
+err
+region_cell(RLFL_map_t *map, unsigned int x, unsigned int y, unsigned long flag, bool set)
+{
+	bool was = cell_has(map, x, y, map->region_flag);
+	err e = set ? cell_set(map, x, y, flag) : cell_clear(map, x, y, flag);
+	if(e)
+		return e;
+
+	bool open = cell_has(map, x, y, map->region_flag);
+	if(open == was)
+		return RLFL_SUCCESS;
+
+	return open ? open_cell(map, x, y) : close_cell(map, x, y);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Bring regions up to date after a change to a w * h
+ * 			rectangle at x, y. Opened cells are joined, a
+ * 			closed cell rebuilds every region.
+ +-----------------------------------------------------------+
+ */
+err
+region_sync(RLFL_map_t *map, unsigned int x, unsigned int y, unsigned int w, unsigned int h)
+{
+	unsigned int *parent = map->regions->parent;
+	unsigned int cx, cy;
+	bool opened = false;
+	for(cy=y; cy<y+h; cy++)
+	{
+		unsigned int *row = parent + (cy * map->width);
+		for(cx=x; cx<x+w; cx++)
+		{
+			bool open = cell_has(map, cx, cy, map->region_flag);
+			if(!open && row[cx] != REGION_NONE)
+				return region_build(map);
+			if(open && row[cx] == REGION_NONE)
+				opened = true;
+		}
+	}
+	if(!opened)
+		return RLFL_SUCCESS;
+
+	for(cy=y; cy<y+h; cy++)
+	{
+		for(cx=x; cx<x+w; cx++)
+		{
+			if(parent[cx + (cy * map->width)] == REGION_NONE
+			   && cell_has(map, cx, cy, map->region_flag))
+				open_cell(map, cx, cy);
+		}
+	}
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Label of cell, its root + 1, or 0 if the cell is in
+ * 			no region
+ +-----------------------------------------------------------+
+ */
+unsigned int
+region_label(RLFL_map_t *map, unsigned int x, unsigned int y)
+{
+	unsigned int *parent = map->regions->parent;
+	unsigned int i = x + (y * map->width);
+	if(__atomic_load_n(&parent[i], __ATOMIC_RELAXED) == REGION_NONE)
+		return 0;
+
+	return find(parent, i) + 1;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Allocate regions
+ +-----------------------------------------------------------+
+ */
+static err
+region_alloc(RLFL_map_t *map)
+{
+	map_regions_t *r = (map_regions_t *)calloc(1, sizeof(map_regions_t));
+	if(r == NULL)
+		return RLFL_ERR_GENERIC;
+
+	r->parent = (unsigned int *)malloc(sizeof(unsigned int) * map->cellcnt);
+	r->rank = (uint8_t *)malloc(map->cellcnt);
+	r->seen = (uint8_t *)calloc(map->cellcnt, 1);
+	map->regions = r;
+	if(r->parent == NULL || r->rank == NULL || r->seen == NULL)
+	{
+		region_free(map);
+		return RLFL_ERR_GENERIC;
+	}
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Root of cell `i`, halving the path on the way
+ +-----------------------------------------------------------+
+ */
+static unsigned int
+find(unsigned int *parent, unsigned int i)
+{
+	unsigned int p;
+	while((p = __atomic_load_n(&parent[i], __ATOMIC_RELAXED)) != i)
+	{
+		unsigned int g = __atomic_load_n(&parent[p], __ATOMIC_RELAXED);
+		__atomic_store_n(&parent[i], g, __ATOMIC_RELAXED);
+		i = g;
+	}
+	return i;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Join the regions of cells `a` and `b`, by rank
+ +-----------------------------------------------------------+
+ */
+static void
+unite(map_regions_t *r, unsigned int a, unsigned int b)
+{
+	a = find(r->parent, a);
+	b = find(r->parent, b);
+	if(a == b)
+		return;
+
+	if(r->rank[a] < r->rank[b])
+	{
+		unsigned int t = a;
+		a = b;
+		b = t;
+	}
+	r->parent[b] = a;
+	if(r->rank[a] == r->rank[b])
+		r->rank[a]++;
+	r->count--;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Cell opened, it starts a region and joins its open
+ * 			neighbours
+ +-----------------------------------------------------------+
+ */
+static err
+open_cell(RLFL_map_t *map, unsigned int x, unsigned int y)
+{
+	map_regions_t *r = map->regions;
+	unsigned int i = x + (y * map->width);
+	r->parent[i] = i;
+	r->rank[i] = 0;
+	r->count++;
+
+	if(x && r->parent[i - 1] != REGION_NONE)
+		unite(r, i - 1, i);
+	if(x + 1 < map->width && r->parent[i + 1] != REGION_NONE)
+		unite(r, i + 1, i);
+	if(y && r->parent[i - map->width] != REGION_NONE)
+		unite(r, i - map->width, i);
+	if(y + 1 < map->height && r->parent[i + map->width] != REGION_NONE)
+		unite(r, i + map->width, i);
+
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Cell closed, its region is walked again from each
+ * 			open neighbour. Every part found is a new region
+ * 			rooted at the neighbour it was found from.
+ +-----------------------------------------------------------+
+ */
+static err
+close_cell(RLFL_map_t *map, unsigned int x, unsigned int y)
+{
+	map_regions_t *r = map->regions;
+	unsigned int *parent = r->parent;
+	unsigned int w = map->width, i = x + (y * w);
+	unsigned int start[4], starts = 0, k;
+
+	if(x && parent[i - 1] != REGION_NONE)
+		start[starts++] = i - 1;
+	if(x + 1 < w && parent[i + 1] != REGION_NONE)
+		start[starts++] = i + 1;
+	if(y && parent[i - w] != REGION_NONE)
+		start[starts++] = i - w;
+	if(y + 1 < map->height && parent[i + w] != REGION_NONE)
+		start[starts++] = i + w;
+
+	parent[i] = REGION_NONE;
+	r->count--;
+	if(!starts)
+		return RLFL_SUCCESS;
+
+	/* Stamps of an earlier walk are stale after 255 walks */
+	if(++r->stamp == 0)
+	{
+		memset(r->seen, 0, map->cellcnt);
+		r->stamp = 1;
+	}
+
+	for(k=0; k<starts; k++)
+	{
+		unsigned int root = start[k], n = 0, q = 0;
+		if(r->seen[root] == r->stamp)
+			continue;
+
+		r->seen[root] = r->stamp;
+		parent[root] = root;
+		r->rank[root] = 0;
+		r->count++;
+		if(push(r, &n, root))
+			goto fail;
+
+		/* Breadth first, regions never touch so the walk stays
+		   in the old region */
+		while(q < n)
+		{
+			unsigned int c = r->queue[q++];
+			unsigned int cx = c % w, cy = c / w;
+			unsigned int next[4], nn = 0, j;
+			if(cx) next[nn++] = c - 1;
+			if(cx + 1 < w) next[nn++] = c + 1;
+			if(cy) next[nn++] = c - w;
+			if(cy + 1 < map->height) next[nn++] = c + w;
+			for(j=0; j<nn; j++)
+			{
+				unsigned int t = next[j];
+				if(parent[t] == REGION_NONE || r->seen[t] == r->stamp)
+					continue;
+				r->seen[t] = r->stamp;
+				parent[t] = root;
+				if(push(r, &n, t))
+					goto fail;
+			}
+		}
+		if(n > 1)
+			r->rank[root] = 1;
+	}
+	return RLFL_SUCCESS;
+
+fail:
+	/* Half walked regions are wrong, stop keeping any */
+	region_free(map);
+	return RLFL_ERR_GENERIC;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Append cell `i` to the walk queue, `n` long
+ +-----------------------------------------------------------+
+ */
+static err
+push(map_regions_t *r, unsigned int *n, unsigned int i)
+{
+	if(*n == r->queue_size)
+	{
+		unsigned int size = r->queue_size ? r->queue_size * 2 : 256;
+		unsigned int *queue = (unsigned int *)realloc(r->queue, sizeof(unsigned int) * size);
+		if(queue == NULL)
+			return RLFL_ERR_GENERIC;
+		r->queue = queue;
+		r->queue_size = size;
+	}
+	r->queue[(*n)++] = i;
+	return RLFL_SUCCESS;
+}
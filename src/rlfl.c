@@ -19,19 +19,61 @@
     <jtm@robot.is>
 */
 #include "headers/rlfl.h"
+#include "headers/map.h"
+#include "headers/ctx.h"
+#include "headers/path.h"
+#include "headers/fov.h"
 
-/* Storage for maps */
-RLFL_map_t * RLFL_map_store[RLFL_MAX_MAPS];
+/* Storage for maps, indexed by slot */
+RLFL_map_t ** RLFL_map_store = NULL;
 
-/* Storage for paths */
+/* Map registry */
+static struct {
+	/* Generation of each slot, and next free slot */
+	unsigned int *gen;
+	int *next;
+
+	/* Allocated slots, slots in use or on the free list */
+	unsigned int size, top;
+
+	/* Head of the free list, -1 when empty */
+	int free;
+
+	/* Live maps, and the most allowed */
+	unsigned int count, limit;
+
+	/* Stores replaced by a larger one. Threads holding a map may
+	   still read them, they are never freed. The store doubles from
+	   16 slots, so there are at most RLFL_MAP_SLOT_BITS. */
+	RLFL_map_t **retired[RLFL_MAP_SLOT_BITS];
+	unsigned int retired_cnt;
+} registry = { NULL, NULL, 0, 0, -1, 0, RLFL_MAX_MAPS, { NULL }, 0 };
+
+/* Storage for paths, slots are taken under path_lock */
 RLFL_path_t * RLFL_path_store[RLFL_MAX_PATHS];
+static pthread_mutex_t path_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /* Storage for projections */
 RLFL_list_t * RLFL_project_store[RLFL_MAX_PROJECTS];
 
+/* Cells must be wide enough for all flags */
+typedef char RLFL_cell_check[(sizeof(RLFL_cell_t) * 8 >= 16) ? 1 : -1];
+
 // Private
-static int alloc_map(unsigned int m, unsigned int w, unsigned int h);
+static err alloc_map(unsigned int slot, unsigned int w, unsigned int h, unsigned int layout);
+static int take_slot(void);
+static void untake_slot(unsigned int slot);
+static void release_slot(unsigned int slot);
+static err grow_registry(void);
 static inline bool flag_valid(unsigned long flag);
+static inline bool layout_valid(unsigned int layout);
+static err rect_valid(unsigned int m, unsigned int x, unsigned int y, unsigned int w,
+					 unsigned int h, unsigned long flag);
+static err list_valid(unsigned int m, const unsigned int *xy, unsigned int n, unsigned long flag);
+static err mask_valid(unsigned int m, unsigned int mask, unsigned long mflag, unsigned long flag);
+static void init_lock(RLFL_map_t *map);
+static int shm_map(RLFL_map_t *src, const char *name, bool private_pages);
+static err fov_begin(RLFL_map_t *map, bool lit);
 /*
  +-----------------------------------------------------------+
  * @desc	Create new map, destroy old if exists
@@ -40,22 +82,212 @@ static inline bool flag_valid(unsigned long flag);
 int
 RLFL_new_map(unsigned int w, unsigned int h)
 {
-	unsigned int i;
-	for(i=0; i<RLFL_MAX_MAPS; i++)
+	return RLFL_new_map_layout(w, h, MAP_DENSE);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Create new map with the given cell layout
+ * @return	Map handle
+ +-----------------------------------------------------------+
+ */
+int
+RLFL_new_map_layout(unsigned int w, unsigned int h, unsigned int layout)
+{
+	if(!layout_valid(layout))
+		return RLFL_ERR_FLAG;
+
+	int slot = take_slot();
+	if(slot < 0)
+		return slot;
+
+	int e = alloc_map(slot, w, h, layout);
+	if(e)
+	{
+		untake_slot(slot);
+		return e;
+	}
+	registry.count++;
+
+	return RLFL_map_store[slot]->mnum;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	New map with the cells of map `m`. Tiles of
+ * 			MAP_TILED and MAP_SPARSE maps are shared until
+ * 			either map writes to them, other layouts are
+ * 			copied. Path maps are not cloned.
+ * @return	Map handle
+ +-----------------------------------------------------------+
+ */
+int
+RLFL_clone_map(unsigned int m)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	int slot = take_slot();
+	if(slot < 0)
+		return slot;
+
+	RLFL_map_t *src = RLFL_MAP(m), *map;
+	map = (RLFL_map_t*) calloc(sizeof(RLFL_map_t), 1);
+	if(map == NULL)
 	{
-		if(!RLFL_map_store[i]) break;
+		untake_slot(slot);
+		return RLFL_ERR_GENERIC;
 	}
 
-	if(i >= RLFL_MAX_MAPS)
+	map->width = src->width;
+	map->height = src->height;
+	map->cellcnt = src->cellcnt;
+	map->layout = src->layout;
+	map->mnum = ((registry.gen[slot] << RLFL_MAP_SLOT_BITS) | slot);
+	if(map_clone_cells(map, src))
 	{
+		map_free_cells(map);
+		free(map);
+		untake_slot(slot);
+		return RLFL_ERR_GENERIC;
+	}
+	init_lock(map);
+	RLFL_map_store[slot] = map;
+	registry.count++;
+
+	return map->mnum;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Save map with its path maps to `path`
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_map_save(unsigned int m, const char *path)
+{
+	if(!RLFL_map_valid(m))
 		return RLFL_ERR_NO_MAP;
+
+	return map_file_write(RLFL_MAP(m), path);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Load a map saved with RLFL_map_save(). The map is
+ * 			MAP_DENSE and uses the file in place, pages are
+ * 			copied when first written.
+ * @return	Map handle
+ +-----------------------------------------------------------+
+ */
+int
+RLFL_map_load(const char *path)
+{
+	int slot = take_slot();
+	if(slot < 0)
+		return slot;
+
+	RLFL_map_t *map = (RLFL_map_t*) calloc(sizeof(RLFL_map_t), 1);
+	if(map == NULL)
+	{
+		untake_slot(slot);
+		return RLFL_ERR_GENERIC;
+	}
+
+	err e = map_file_open(map, path);
+	if(e)
+	{
+		free(map);
+		untake_slot(slot);
+		return e;
 	}
+	map->mnum = ((registry.gen[slot] << RLFL_MAP_SLOT_BITS) | slot);
+	init_lock(map);
+	RLFL_map_store[slot] = map;
+	registry.count++;
+
+	return map->mnum;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	New map with the cells of map `m` in the new shared
+ * 			memory segment `name`, such as "/level-1". The map
+ * 			is MAP_DENSE, its writes are seen by every process
+ * 			attached to the segment. Path maps are not shared.
+ * @return	Map handle
+ +-----------------------------------------------------------+
+ */
+int
+RLFL_map_share(unsigned int m, const char *name)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	return shm_map(RLFL_MAP(m), name, false);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Attach to the shared memory segment `name` of a map
+ * 			shared by this or another process. Writes to the
+ * 			map are shared, unless `private_pages`: then pages
+ * 			are copied when first written, like a loaded map,
+ * 			and the generation is still shared.
+ * @return	Map handle
+ +-----------------------------------------------------------+
+ */
+int
+RLFL_map_attach(const char *name, bool private_pages)
+{
+	return shm_map(NULL, name, private_pages);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Remove the shared memory segment `name`, attached
+ * 			maps keep it until they are wiped
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_map_unlink(const char *name)
+{
+	return map_shm_unlink(name);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Bump the generation of a shared map, once the
+ * 			writer is done changing it. Readers that see the
+ * 			new generation see the changes made before it.
+ * 			Only the map from RLFL_map_share() publishes,
+ * 			attached maps do not.
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_map_publish(unsigned int m, unsigned int *generation)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	RLFL_map_t *map = RLFL_MAP(m);
+	if(map->shm == NULL || !map->shm_writer)
+		return RLFL_ERR_FLAG;
 
-	int e = alloc_map(i, w, h);
+	unsigned int g = map_shm_publish(map);
+	if(generation)
+		*generation = g;
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Generation of a shared map
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_map_generation(unsigned int m, unsigned int *generation)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
 
-	if(e) return e;
+	RLFL_map_t *map = RLFL_MAP(m);
+	if(map->shm == NULL)
+		return RLFL_ERR_FLAG;
 
-	return i;
+	*generation = map_shm_generation(map);
+	return RLFL_SUCCESS;
 }
 /*
  +-----------------------------------------------------------+
@@ -67,15 +299,21 @@ RLFL_wipe_map(unsigned int m)
 {
 	if(RLFL_map_valid(m))
 	{
-		/* Wipe cells */
-		free(RLFL_map_store[m]->cells);
+		/* Cells are still borrowed */
+		if(RLFL_MAP(m)->pins)
+			return RLFL_ERR_BUSY;
 
-		/* Wipe any path maps */
+		/* Wipe any path maps, before cells they may share a file with */
 		RLFL_path_wipe_all_maps(m);
 
+		/* Wipe cells */
+		map_free_cells(RLFL_MAP(m));
+
 		/* Wipe map */
-		free(RLFL_map_store[m]);
-		RLFL_map_store[m] = NULL;
+		pthread_rwlock_destroy(&RLFL_MAP(m)->lock);
+		free(RLFL_MAP(m));
+		RLFL_MAP(m) = NULL;
+		release_slot(MAP_SLOT(m));
 
 		/* OK */
 		return RLFL_SUCCESS;
@@ -84,16 +322,150 @@ RLFL_wipe_map(unsigned int m)
 }
 /*
  +-----------------------------------------------------------+
- * @desc	Wipe all maps
+ * @desc	Wipe all maps, pinned maps are kept
  +-----------------------------------------------------------+
  */
 void
 RLFL_wipe_all()
 {
+	/* Backwards, so the lowest slots are reused first */
+	unsigned int i = registry.top;
+	while(i--) {
+		if(RLFL_map_store[i])
+			RLFL_wipe_map(RLFL_map_store[i]->mnum);
+	}
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Set the most maps that can be alive at once
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_set_max_maps(unsigned int limit)
+{
+	if(limit < 1 || limit > RLFL_MAP_SLOTS)
+		return RLFL_ERR_GENERIC;
+
+	registry.limit = limit;
+
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Most maps that can be alive at once
+ +-----------------------------------------------------------+
+ */
+unsigned int
+RLFL_max_maps(void)
+{
+	return registry.limit;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Number of live maps
+ +-----------------------------------------------------------+
+ */
+unsigned int
+RLFL_map_count(void)
+{
+	return registry.count;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Take a free slot, growing the registry if needed
+ +-----------------------------------------------------------+
+ */
+static int
+take_slot(void)
+{
+	if(registry.count >= registry.limit)
+		return RLFL_ERR_NO_MAP;
+
+	int slot = registry.free;
+	if(slot >= 0)
+	{
+		registry.free = registry.next[slot];
+		return slot;
+	}
+
+	if(registry.top == registry.size)
+	{
+		err e = grow_registry();
+		if(e) return e;
+	}
+
+	return registry.top++;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Return a slot that was never handed out, so the
+ * 			generation stays
+ +-----------------------------------------------------------+
+ */
+static void
+untake_slot(unsigned int slot)
+{
+	registry.next[slot] = registry.free;
+	registry.free = slot;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Return slot of a wiped map, handles to it go stale
+ +-----------------------------------------------------------+
+ */
+static void
+release_slot(unsigned int slot)
+{
+	registry.gen[slot] = ((registry.gen[slot] + 1) & RLFL_MAP_GEN_MASK);
+	registry.next[slot] = registry.free;
+	registry.free = slot;
+	registry.count--;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Double the number of slots
+ +-----------------------------------------------------------+
+ */
+static err
+grow_registry(void)
+{
+	unsigned int size = registry.size ? (registry.size * 2) : 16;
+	size = MIN(size, RLFL_MAP_SLOTS);
+	if(size <= registry.size)
+		return RLFL_ERR_NO_MAP;
+
+	unsigned int *gen = (unsigned int *)realloc(registry.gen, size * sizeof(unsigned int));
+	if(gen == NULL)
+		return RLFL_ERR_GENERIC;
+	registry.gen = gen;
+
+	int *next = (int *)realloc(registry.next, size * sizeof(int));
+	if(next == NULL)
+		return RLFL_ERR_GENERIC;
+	registry.next = next;
+
+	/* Not realloc(), a thread working on a map may be reading the
+	   old store */
+	RLFL_map_t **store = (RLFL_map_t **)malloc(size * sizeof(RLFL_map_t *));
+	if(store == NULL)
+		return RLFL_ERR_GENERIC;
+
 	unsigned int i;
-	for(i=0; i<RLFL_MAX_MAPS; i++) {
-		RLFL_wipe_map(i);
+	for(i=registry.size; i<size; i++)
+	{
+		store[i] = NULL;
+		registry.gen[i] = 0;
+		registry.next[i] = -1;
+	}
+	if(RLFL_map_store)
+	{
+		memcpy(store, RLFL_map_store, registry.size * sizeof(RLFL_map_t *));
+		registry.retired[registry.retired_cnt++] = RLFL_map_store;
 	}
+	__atomic_store_n(&RLFL_map_store, store, __ATOMIC_RELEASE);
+	registry.size = size;
+
+	return RLFL_SUCCESS;
 }
 /*
  +-----------------------------------------------------------+
@@ -101,48 +473,91 @@ RLFL_wipe_all()
  +-----------------------------------------------------------+
  */
 static err
-alloc_map(unsigned int m, unsigned int w, unsigned int h)
+alloc_map(unsigned int slot, unsigned int w, unsigned int h, unsigned int layout)
 {
-	if((m < RLFL_MAX_MAPS) && !RLFL_map_store[m])
+	if(layout == MAP_SPARSE)
 	{
-		if(w >= RLFL_MAX_WIDTH || h >= RLFL_MAX_HEIGHT)
-		{
+		if(w >= RLFL_MAX_SPARSE_WIDTH || h >= RLFL_MAX_SPARSE_HEIGHT)
 			return RLFL_ERR_SIZE;
-		}
+	}
+	else if(w >= RLFL_MAX_WIDTH || h >= RLFL_MAX_HEIGHT)
+	{
+		return RLFL_ERR_SIZE;
+	}
 
-		RLFL_map_t *map;
-		map = (RLFL_map_t*) calloc(sizeof(RLFL_map_t), 1);
-		if(map == NULL)
-			return RLFL_ERR_GENERIC;
+	RLFL_map_t *map;
+	map = (RLFL_map_t*) calloc(sizeof(RLFL_map_t), 1);
+	if(map == NULL)
+		return RLFL_ERR_GENERIC;
 
-		map->height = h;
-		map->width = w;
-		map->cells = (unsigned long *)calloc(sizeof(unsigned long), w * h);
-		map->mnum = m;
-		map->cellcnt = (h * w);
-		int i;
-		for(i=0; i<RLFL_MAX_MAPS; i++)
-		{
-			map->path_map[i] = NULL;
-		}
+	map->height = h;
+	map->width = w;
+	map->mnum = ((registry.gen[slot] << RLFL_MAP_SLOT_BITS) | slot);
+	map->cellcnt = (h * w);
+	map->layout = layout;
+	if(map_alloc_cells(map))
+	{
+		free(map);
+		return RLFL_ERR_GENERIC;
+	}
 
-		/* Outer borders */
-		for(i=0; i<w; i++)
-		{
-			map->cells[i] |= CELL_PERM;
-			map->cells[i + ((h-1) * w)] |= CELL_PERM;
-		}
-		for(i=0; i<h; i++)
-		{
-			map->cells[0 + (i * w)] |= CELL_PERM;
-			map->cells[(w-1) + (i * w)] |= CELL_PERM;
-		}
-		RLFL_map_store[m] = map;
+	/* Outer borders */
+	int i, e = RLFL_SUCCESS;
+	for(i=0; i<w; i++)
+	{
+		e |= cell_set(map, i, 0, CELL_PERM);
+		e |= cell_set(map, i, h-1, CELL_PERM);
+	}
+	for(i=0; i<h; i++)
+	{
+		e |= cell_set(map, 0, i, CELL_PERM);
+		e |= cell_set(map, w-1, i, CELL_PERM);
+	}
+	if(e)
+	{
+		map_free_cells(map);
+		free(map);
+		return RLFL_ERR_GENERIC;
+	}
+	init_lock(map);
+	RLFL_map_store[slot] = map;
 
-		/* OK */
-		return RLFL_SUCCESS;
+	/* OK */
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Register a map on a shared memory segment, a new
+ * 			one with the cells of `src` or `name` attached to
+ +-----------------------------------------------------------+
+ */
+static int
+shm_map(RLFL_map_t *src, const char *name, bool private_pages)
+{
+	int slot = take_slot();
+	if(slot < 0)
+		return slot;
+
+	RLFL_map_t *map = (RLFL_map_t*) calloc(sizeof(RLFL_map_t), 1);
+	if(map == NULL)
+	{
+		untake_slot(slot);
+		return RLFL_ERR_GENERIC;
+	}
+
+	err e = src ? map_shm_create(map, src, name) : map_shm_attach(map, name, private_pages);
+	if(e)
+	{
+		free(map);
+		untake_slot(slot);
+		return e;
 	}
-	return RLFL_ERR_NO_MAP;
+	map->mnum = ((registry.gen[slot] << RLFL_MAP_SLOT_BITS) | slot);
+	init_lock(map);
+	RLFL_map_store[slot] = map;
+	registry.count++;
+
+	return map->mnum;
 }
 /*
  +-----------------------------------------------------------+
@@ -158,150 +573,1067 @@ RLFL_cell_valid(unsigned int m, unsigned int x, unsigned int y)
 	if(((int)x < 0) || ((int)y < 0))
 		return false;
 
-	RLFL_map_t *map = RLFL_map_store[m];
+	RLFL_map_t *map = RLFL_MAP(m);
 	if(x >= map->width || y >= map->height)
 		return false;
 
-	return true;
+	return true;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Translate from 1-dimensional index to (x, y)
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_translate_xy(unsigned int m, int index, unsigned int *x, unsigned int *y)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	RLFL_map_t* map = RLFL_MAP(m);
+
+	(*x) = (index % map->width);
+	(*y) = abs(index / map->width);
+
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Check map sanity
+ +-----------------------------------------------------------+
+ */
+bool
+RLFL_map_valid(unsigned int m)
+{
+	/* Stale handles have an old generation */
+	if((MAP_SLOT(m) >= registry.top) || !RLFL_MAP(m))
+		return false;
+
+	return (RLFL_MAP(m)->mnum == m);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Map size
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_map_size(unsigned int m, unsigned int *w, unsigned int *h)
+{
+	if(!RLFL_map_valid(m)) {
+		return RLFL_ERR_NO_MAP;
+	}
+
+	RLFL_map_t *map = RLFL_MAP(m);
+	(*w) = map->width;
+	(*h) = map->height;
+
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Map cell layout
+ +-----------------------------------------------------------+
+ */
+int
+RLFL_map_layout(unsigned int m)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	return RLFL_MAP(m)->layout;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Tiles with storage of their own, and all tiles
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_map_tiles(unsigned int m, unsigned int *used, unsigned int *total)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	RLFL_map_t *map = RLFL_MAP(m);
+	if(!map->tiles)
+		return RLFL_ERR_FLAG;
+
+	(*used) = map->owned;
+	(*total) = (map->tiles_w * map->tiles_h);
+
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Cell array of a MAP_DENSE map, width * height cells
+ * 			in row major order. Pin the map while the array is
+ * 			in use, and release it with RLFL_map_cells_release().
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_map_cells(unsigned int m, RLFL_cell_t **cells)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	RLFL_map_t *map = RLFL_MAP(m);
+	if(map->layout != MAP_DENSE)
+		return RLFL_ERR_FLAG;
+
+	/* Writes to the array are not seen, FOV clears the whole map
+	   until it is released */
+	fov_forget(map, CELL_MASK);
+	map->cells_out++;
+	(*cells) = map->cells;
+
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Undo RLFL_map_cells(), FOV clears only the cells it
+ * 			marked again once every array is released
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_map_cells_release(unsigned int m)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	RLFL_map_t *map = RLFL_MAP(m);
+	if(!map->cells_out)
+		return RLFL_ERR_GENERIC;
+
+	map->cells_out--;
+
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Keep a map from being wiped
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_map_pin(unsigned int m)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	RLFL_MAP(m)->pins++;
+
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Undo RLFL_map_pin()
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_map_unpin(unsigned int m)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	RLFL_map_t *map = RLFL_MAP(m);
+	if(!map->pins)
+		return RLFL_ERR_GENERIC;
+
+	map->pins--;
+
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Wait for and take a map to write. Pin the map
+ * 			first if another thread may wipe it meanwhile.
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_map_lock(unsigned int m)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	pthread_rwlock_wrlock(&RLFL_MAP(m)->lock);
+
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Take a map to write if no thread holds it
+ * @return	RLFL_ERR_BUSY if another thread holds it
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_map_trylock(unsigned int m)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	if(pthread_rwlock_trywrlock(&RLFL_MAP(m)->lock))
+		return RLFL_ERR_BUSY;
+
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Wait for and take a map to read, other readers
+ * 			may hold it too
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_map_rdlock(unsigned int m)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	pthread_rwlock_rdlock(&RLFL_MAP(m)->lock);
+
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Take a map to read unless a writer holds it, or
+ * 			waits for it
+ * @return	RLFL_ERR_BUSY if a writer holds it
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_map_tryrdlock(unsigned int m)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	if(pthread_rwlock_tryrdlock(&RLFL_MAP(m)->lock))
+		return RLFL_ERR_BUSY;
+
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Undo RLFL_map_lock() or RLFL_map_rdlock()
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_map_unlock(unsigned int m)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	pthread_rwlock_unlock(&RLFL_MAP(m)->lock);
+
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Set up the lock of a new map. Writers go before
+ * 			new readers where supported, a steady stream of
+ * 			queries does not hold off a change for ever.
+ +-----------------------------------------------------------+
+ */
+static void
+init_lock(RLFL_map_t *map)
+{
+	pthread_rwlockattr_t attr;
+	pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+	pthread_rwlock_init(&map->lock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Copy all cells to `dst`, width * height cells in
+ * 			row major order
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_map_read(unsigned int m, RLFL_cell_t *dst)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	map_read_cells(RLFL_MAP(m), dst);
+
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Replace all cells with `src`, width * height cells
+ * 			in row major order. Cells are not checked, the
+ * 			border keeps CELL_PERM only if `src` has it.
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_map_write(unsigned int m, const RLFL_cell_t *src)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	RLFL_map_t *map = RLFL_MAP(m);
+	if(map->journal && journal_begin(map, 0, 0, map->width, map->height))
+		return RLFL_ERR_GENERIC;
+	fov_forget(map, CELL_MASK);
+	err e = map_write_cells(map, src);
+	if(map->journal)
+		journal_end(map);
+	if(tracked(map, CELL_MASK))
+		map_mark_dirty(map, 0, 0, map->width, map->height);
+	if(e == RLFL_SUCCESS && map->regions)
+		e = region_build(map);
+
+	return e;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Track changes to `flag` made through the flag
+ * 			functions, 0 to stop. Starting marks the whole map
+ * 			changed.
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_map_track(unsigned int m, unsigned long flag)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	if(flag && !flag_valid(flag))
+		return RLFL_ERR_FLAG;
+
+	return map_track(RLFL_MAP(m), flag);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Version of the last tracked change
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_map_version(unsigned int m, unsigned int *version)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	(*version) = RLFL_MAP(m)->version;
+
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Rectangles changed after version `since`, x, y, w,
+ * 			h in cells. Only the first `max` are stored in
+ * 			`rects`, (4 * max unsigned ints).
+ * @return	Number of rectangles
+ +-----------------------------------------------------------+
+ */
+int
+RLFL_map_dirty(unsigned int m, unsigned int since, unsigned int *rects, unsigned int max)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	RLFL_map_t *map = RLFL_MAP(m);
+	if(map->dirty == NULL)
+		return RLFL_ERR_FLAG;
+
+	return map_dirty_rects(map, since, rects, max);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Keep connected regions of cells with any of `flag`,
+ * 			0 to stop. Cells join their four neighbours, the
+ * 			moves dijkstra makes without cutting corners.
+ * 			Regions follow changes made through the flag
+ * 			functions and the algorithms.
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_region_track(unsigned int m, unsigned long flag)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	if(flag && !flag_valid(flag))
+		return RLFL_ERR_FLAG;
+
+	return region_track(RLFL_MAP(m), flag);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Region of cell
+ * @return	Label of the region, 0 if the cell is in none.
+ * 			Labels last until the regions change.
+ +-----------------------------------------------------------+
+ */
+int
+RLFL_region(unsigned int m, unsigned int x, unsigned int y)
+{
+	map_view_t v;
+	if(view_open(&v, m))
+		return RLFL_ERR_NO_MAP;
+
+	if(!view_in(&v, x, y))
+		return RLFL_ERR_OUT_OF_BOUNDS;
+
+	if(v.map->regions == NULL)
+		return RLFL_ERR_FLAG;
+
+	return (int)region_label(v.map, x, y);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	True if both cells are in the same region
+ +-----------------------------------------------------------+
+ */
+int
+RLFL_region_connected(unsigned int m, unsigned int x1, unsigned int y1, unsigned int x2,
+					  unsigned int y2)
+{
+	map_view_t v;
+	if(view_open(&v, m))
+		return RLFL_ERR_NO_MAP;
+
+	if(!view_in(&v, x1, y1) || !view_in(&v, x2, y2))
+		return RLFL_ERR_OUT_OF_BOUNDS;
+
+	if(v.map->regions == NULL)
+		return RLFL_ERR_FLAG;
+
+	unsigned int a = region_label(v.map, x1, y1);
+	return (a && a == region_label(v.map, x2, y2));
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Number of regions
+ +-----------------------------------------------------------+
+ */
+int
+RLFL_region_count(unsigned int m)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	RLFL_map_t *map = RLFL_MAP(m);
+	if(map->regions == NULL)
+		return RLFL_ERR_FLAG;
+
+	return (int)map->regions->count;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Copy the label of every cell to `labels`, width *
+ * 			height labels in row major order
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_region_labels(unsigned int m, unsigned int *labels)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	RLFL_map_t *map = RLFL_MAP(m);
+	if(map->regions == NULL)
+		return RLFL_ERR_FLAG;
+
+	unsigned int x, y;
+	for(y=0; y<map->height; y++)
+	{
+		for(x=0; x<map->width; x++)
+			*labels++ = region_label(map, x, y);
+	}
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Journal the old values of cells changed through the
+ * 			flag functions and the algorithms, in a ring of
+ * 			`size` changes. 0 stops. Starting empties the
+ * 			journal.
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_map_journal(unsigned int m, unsigned int size)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	return journal_start(RLFL_MAP(m), size);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Checkpoint of a journaled map, the changes made
+ * 			after it can be rolled back
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_map_checkpoint(unsigned int m, unsigned int *mark)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	RLFL_map_t *map = RLFL_MAP(m);
+	if(map->journal == NULL)
+		return RLFL_ERR_FLAG;
+
+	*mark = map->journal->head;
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Undo the changes made after checkpoint `mark`,
+ * 			later checkpoints are gone. Fails with
+ * 			RLFL_ERR_OUT_OF_BOUNDS if the journal no longer
+ * 			holds them.
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_map_rollback(unsigned int m, unsigned int mark)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	RLFL_map_t *map = RLFL_MAP(m);
+	if(map->journal == NULL)
+		return RLFL_ERR_FLAG;
+
+	fov_forget(map, CELL_MASK);
+	return journal_rollback(map, mark);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Set flag
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_set_flag(unsigned int m, unsigned int x, unsigned int y, unsigned long flag)
+{
+	map_view_t v;
+	if(view_open(&v, m))
+		return RLFL_ERR_NO_MAP;
+
+	if(!view_in(&v, x, y))
+		return RLFL_ERR_OUT_OF_BOUNDS;
+
+	if(!flag_valid(flag))
+		return RLFL_ERR_FLAG;
+
+	return view_set(&v, x, y, flag);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Query cell for flag
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_has_flag(unsigned int m, unsigned int x, unsigned int y, unsigned long flag)
+{
+	map_view_t v;
+	if(view_open(&v, m))
+		return RLFL_ERR_NO_MAP;
+
+	if(!view_in(&v, x, y))
+		return RLFL_ERR_OUT_OF_BOUNDS;
+
+	if(!flag_valid(flag))
+		return RLFL_ERR_FLAG;
+
+	if(view_has(&v, x, y, flag))
+		return true;
+
+	return false;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Clear cell flag
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_clear_flag(unsigned int m, unsigned int x, unsigned int y, unsigned long flag)
+{
+	map_view_t v;
+	if(view_open(&v, m))
+		return RLFL_ERR_NO_MAP;
+
+	if(!view_in(&v, x, y))
+		return RLFL_ERR_OUT_OF_BOUNDS;
+
+	if(!flag_valid(flag))
+		return RLFL_ERR_FLAG;
+
+	return view_clear(&v, x, y, flag);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Set flag on a w * h rectangle at x, y
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_set_flag_rect(unsigned int m, unsigned int x, unsigned int y, unsigned int w,
+				   unsigned int h, unsigned long flag)
+{
+	err e = rect_valid(m, x, y, w, h, flag);
+	if(e)
+		return e;
+
+	RLFL_map_t *map = RLFL_MAP(m);
+	if(map->journal && journal_begin(map, x, y, w, h))
+		return RLFL_ERR_GENERIC;
+	fov_forget(map, flag);
+	if(tracked(map, flag))
+		map_mark_dirty(map, x, y, w, h);
+
+	e = map_rect_flag(map, x, y, w, h, flag, true);
+	if(map->journal)
+		journal_end(map);
+	if(e == RLFL_SUCCESS && regioned(map, flag))
+		e = region_sync(map, x, y, w, h);
+
+	return e;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Clear flag on a w * h rectangle at x, y
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_clear_flag_rect(unsigned int m, unsigned int x, unsigned int y, unsigned int w,
+					 unsigned int h, unsigned long flag)
+{
+	err e = rect_valid(m, x, y, w, h, flag);
+	if(e)
+		return e;
+
+	RLFL_map_t *map = RLFL_MAP(m);
+	if(map->journal && journal_begin(map, x, y, w, h))
+		return RLFL_ERR_GENERIC;
+	if(tracked(map, flag))
+		map_mark_dirty(map, x, y, w, h);
+
+	e = map_rect_flag(map, x, y, w, h, flag, false);
+	if(map->journal)
+		journal_end(map);
+	if(e == RLFL_SUCCESS && regioned(map, flag))
+		e = region_sync(map, x, y, w, h);
+
+	return e;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Query a w * h rectangle at x, y for flag. Bit i of
+ * 			`bits`, (PACKED_SIZE(w * h) bytes), is set if the
+ * 			i:th cell in row major order has the flag. `bits`
+ * 			may be NULL.
+ * @return	Number of cells with the flag
+ +-----------------------------------------------------------+
+ */
+int
+RLFL_has_flag_rect(unsigned int m, unsigned int x, unsigned int y, unsigned int w,
+				   unsigned int h, unsigned long flag, uint8_t *bits)
+{
+	err e = rect_valid(m, x, y, w, h, flag);
+	if(e)
+		return e;
+
+	return map_rect_has(RLFL_MAP(m), x, y, w, h, flag, bits);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Set flag on `n` cells, `xy` holds x, y pairs
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_set_flag_list(unsigned int m, const unsigned int *xy, unsigned int n, unsigned long flag)
+{
+	err e = list_valid(m, xy, n, flag);
+	if(e)
+		return e;
+
+	RLFL_map_t *map = RLFL_MAP(m);
+	unsigned int i;
+	fov_forget(map, flag);
+	if(tracked(map, flag))
+	{
+		for(i=0; i<n; i++)
+			mark_cell(map, xy[i * 2], xy[(i * 2) + 1]);
+	}
+	bool regions = regioned(map, flag);
+	for(i=0; i<n; i++)
+	{
+		unsigned int x = xy[i * 2], y = xy[(i * 2) + 1];
+		if(map->journal)
+			journal_cell(map, x, y, flag, true);
+		if(regions ? region_cell(map, x, y, flag, true) : cell_set(map, x, y, flag))
+			return RLFL_ERR_GENERIC;
+	}
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Clear flag on `n` cells, `xy` holds x, y pairs
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_clear_flag_list(unsigned int m, const unsigned int *xy, unsigned int n, unsigned long flag)
+{
+	err e = list_valid(m, xy, n, flag);
+	if(e)
+		return e;
+
+	RLFL_map_t *map = RLFL_MAP(m);
+	unsigned int i;
+	if(tracked(map, flag))
+	{
+		for(i=0; i<n; i++)
+			mark_cell(map, xy[i * 2], xy[(i * 2) + 1]);
+	}
+	bool regions = regioned(map, flag);
+	for(i=0; i<n; i++)
+	{
+		unsigned int x = xy[i * 2], y = xy[(i * 2) + 1];
+		if(map->journal)
+			journal_cell(map, x, y, flag, false);
+		if(regions ? region_cell(map, x, y, flag, false) : cell_clear(map, x, y, flag))
+			return RLFL_ERR_GENERIC;
+	}
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Query `n` cells for flag, `xy` holds x, y pairs.
+ * 			Bit i of `bits`, (PACKED_SIZE(n) bytes), is set if
+ * 			the i:th cell has the flag. `bits` may be NULL.
+ * @return	Number of cells with the flag
+ +-----------------------------------------------------------+
+ */
+int
+RLFL_has_flag_list(unsigned int m, const unsigned int *xy, unsigned int n, unsigned long flag,
+				   uint8_t *bits)
+{
+	err e = list_valid(m, xy, n, flag);
+	if(e)
+		return e;
+
+	if(bits)
+		memset(bits, 0, PACKED_SIZE(n));
+
+	RLFL_map_t *map = RLFL_MAP(m);
+	unsigned int i;
+	int count = 0;
+	for(i=0; i<n; i++)
+	{
+		if(cell_has(map, xy[i * 2], xy[(i * 2) + 1], flag))
+		{
+			if(bits) PACKED_SET(bits, i);
+			count++;
+		}
+	}
+	return count;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Set flag on every cell where map `mask` has any of
+ * 			`mflag`. Both maps must be the same size.
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_set_flag_mask(unsigned int m, unsigned int mask, unsigned long mflag, unsigned long flag)
+{
+	err e = mask_valid(m, mask, mflag, flag);
+	if(e)
+		return e;
+
+	RLFL_map_t *map = RLFL_MAP(m);
+	if(map->journal && journal_begin(map, 0, 0, map->width, map->height))
+		return RLFL_ERR_GENERIC;
+	fov_forget(map, flag);
+	if(tracked(map, flag))
+		map_mark_dirty(map, 0, 0, map->width, map->height);
+
+	e = map_mask_flag(map, RLFL_MAP(mask), mflag, flag, true);
+	if(map->journal)
+		journal_end(map);
+	if(e == RLFL_SUCCESS && regioned(map, flag))
+		e = region_sync(map, 0, 0, map->width, map->height);
+
+	return e;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Clear flag on every cell where map `mask` has any
+ * 			of `mflag`. Both maps must be the same size.
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_clear_flag_mask(unsigned int m, unsigned int mask, unsigned long mflag, unsigned long flag)
+{
+	err e = mask_valid(m, mask, mflag, flag);
+	if(e)
+		return e;
+
+	RLFL_map_t *map = RLFL_MAP(m);
+	if(map->journal && journal_begin(map, 0, 0, map->width, map->height))
+		return RLFL_ERR_GENERIC;
+	if(tracked(map, flag))
+		map_mark_dirty(map, 0, 0, map->width, map->height);
+
+	e = map_mask_flag(map, RLFL_MAP(mask), mflag, flag, false);
+	if(map->journal)
+		journal_end(map);
+	if(e == RLFL_SUCCESS && regioned(map, flag))
+		e = region_sync(map, 0, 0, map->width, map->height);
+
+	return e;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Query flag on every cell where map `mask` has any
+ * 			of `mflag`. Bit i of `bits`, (PACKED_SIZE(w * h)
+ * 			bytes), is the i:th cell of the map in row major
+ * 			order. `bits` may be NULL.
+ * @return	Number of cells with the flag inside the mask
+ +-----------------------------------------------------------+
+ */
+int
+RLFL_has_flag_mask(unsigned int m, unsigned int mask, unsigned long mflag, unsigned long flag,
+				   uint8_t *bits)
+{
+	err e = mask_valid(m, mask, mflag, flag);
+	if(e)
+		return e;
+
+	return map_mask_has(RLFL_MAP(m), RLFL_MAP(mask), mflag, flag, bits);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Count cells with any of `flag`
+ +-----------------------------------------------------------+
+ */
+int
+RLFL_count_flags(unsigned int m, unsigned long flag)
+{
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	return RLFL_count_flags_rect(m, 0, 0, RLFL_MAP(m)->width, RLFL_MAP(m)->height, flag);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Count cells with any of `flag` in a w * h rectangle
+ * 			at x, y
+ +-----------------------------------------------------------+
+ */
+int
+RLFL_count_flags_rect(unsigned int m, unsigned int x, unsigned int y, unsigned int w,
+					  unsigned int h, unsigned long flag)
+{
+	err e = rect_valid(m, x, y, w, h, flag);
+	if(e)
+		return e;
+
+	return (int)map_count_flag(RLFL_MAP(m), x, y, w, h, flag);
 }
 /*
  +-----------------------------------------------------------+
- * @desc	Translate from 1-dimensional index to (x, y)
+ * @desc	Count the cells with each flag in one pass,
+ * 			counts[b] is the number of cells with flag 1 << b.
+ * 			`counts` holds RLFL_PLANES counts.
  +-----------------------------------------------------------+
  */
 err
-RLFL_translate_xy(unsigned int m, int index, unsigned int *x, unsigned int *y)
+RLFL_flag_histogram(unsigned int m, unsigned int *counts)
 {
 	if(!RLFL_map_valid(m))
 		return RLFL_ERR_NO_MAP;
 
-	RLFL_map_t* map = RLFL_map_store[m];
-
-	(*x) = (index % map->width);
-	(*y) = abs(index / map->width);
+	return RLFL_flag_histogram_rect(m, 0, 0, RLFL_MAP(m)->width, RLFL_MAP(m)->height, counts);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	RLFL_flag_histogram() of a w * h rectangle at x, y
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_flag_histogram_rect(unsigned int m, unsigned int x, unsigned int y, unsigned int w,
+						 unsigned int h, unsigned int *counts)
+{
+	err e = rect_valid(m, x, y, w, h, CELL_NONE);
+	if(e)
+		return e;
 
+	map_histogram(RLFL_MAP(m), x, y, w, h, counts);
 	return RLFL_SUCCESS;
 }
 /*
  +-----------------------------------------------------------+
- * @desc	Check map sanity
+ * @desc	Merge `flag` of map `src` into map `m` with op,
+ * 			MERGE_AND, MERGE_OR, MERGE_XOR or MERGE_ANDNOT.
+ * 			Flags not in `flag` are left alone. Both maps must
+ * 			be the same size, layouts may differ.
  +-----------------------------------------------------------+
  */
-bool
-RLFL_map_valid(unsigned int m)
+err
+RLFL_merge_map(unsigned int m, unsigned int src, unsigned int op, unsigned long flag)
 {
-	if((m >= RLFL_MAX_MAPS) || !RLFL_map_store[m])
-		return false;
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
 
-	return true;
+	return RLFL_merge_map_rect(m, src, op, flag, 0, 0, RLFL_MAP(m)->width, RLFL_MAP(m)->height);
 }
 /*
  +-----------------------------------------------------------+
- * @desc	Map size
+ * @desc	RLFL_merge_map() on a w * h rectangle at x, y
  +-----------------------------------------------------------+
  */
 err
-RLFL_map_size(unsigned int m, unsigned int *w, unsigned int *h)
+RLFL_merge_map_rect(unsigned int m, unsigned int src, unsigned int op, unsigned long flag,
+					unsigned int x, unsigned int y, unsigned int w, unsigned int h)
 {
-	if(!RLFL_map_valid(m)) {
+	err e = rect_valid(m, x, y, w, h, flag);
+	if(e)
+		return e;
+
+	if(!RLFL_map_valid(src))
 		return RLFL_ERR_NO_MAP;
-	}
 
-	RLFL_map_t *map = RLFL_map_store[m];
-	(*w) = map->width;
-	(*h) = map->height;
+	RLFL_map_t *map = RLFL_MAP(m), *from = RLFL_MAP(src);
+	if(map->width != from->width || map->height != from->height)
+		return RLFL_ERR_SIZE;
 
-	return RLFL_SUCCESS;
+	if(op < MERGE_AND || op > MERGE_ANDNOT)
+		return RLFL_ERR_GENERIC;
+
+	if(map->journal && journal_begin(map, x, y, w, h))
+		return RLFL_ERR_GENERIC;
+	fov_forget(map, flag);
+	if(tracked(map, flag))
+		map_mark_dirty(map, x, y, w, h);
+
+	e = map_merge(map, from, op, flag, x, y, w, h);
+	if(map->journal)
+		journal_end(map);
+	if(e == RLFL_SUCCESS && regioned(map, flag))
+		e = region_sync(map, x, y, w, h);
+
+	return e;
 }
 /*
  +-----------------------------------------------------------+
- * @desc	Set flag
+ * @desc	Query cell for flags
+ * @param	unsigned int 	map number
+ * @param	X
+ * @param	Y
  +-----------------------------------------------------------+
  */
-err
-RLFL_set_flag(unsigned int m, unsigned int x, unsigned int y, unsigned long flag)
+int
+RLFL_get_flags(unsigned int m, unsigned int x, unsigned int y)
 {
-	if(!RLFL_map_valid(m))
+	map_view_t v;
+	if(view_open(&v, m))
 		return RLFL_ERR_NO_MAP;
 
-	if(!RLFL_cell_valid(m, x, y))
+	if(!view_in(&v, x, y))
 		return RLFL_ERR_OUT_OF_BOUNDS;
 
-	if(!flag_valid(flag))
-		return RLFL_ERR_FLAG;
-
-	CELL(m, x, y) |= flag;
-
-	return RLFL_SUCCESS;
+	return (int)view_get(&v, x, y);
 }
 /*
  +-----------------------------------------------------------+
- * @desc	Query cell for flag
+ * @desc	Clear `flag` from entire map
  +-----------------------------------------------------------+
  */
 err
-RLFL_has_flag(unsigned int m, unsigned int x, unsigned int y, unsigned long flag)
+RLFL_clear_map(unsigned int m, unsigned long flag)
 {
 	if(!RLFL_map_valid(m))
 		return RLFL_ERR_NO_MAP;
 
-	if(!RLFL_cell_valid(m, x, y))
-		return RLFL_ERR_OUT_OF_BOUNDS;
-
 	if(!flag_valid(flag))
 		return RLFL_ERR_FLAG;
 
-	if(CELL(m, x, y) & flag)
-		return true;
+	RLFL_map_t *map = RLFL_MAP(m);
+	if(map->journal && journal_begin(map, 0, 0, map->width, map->height))
+		return RLFL_ERR_GENERIC;
+	if(tracked(map, flag))
+		map_mark_dirty(map, 0, 0, map->width, map->height);
 
-	return false;
+	err e = map_clear_flag(map, flag);
+	if(map->journal)
+		journal_end(map);
+	if(e == RLFL_SUCCESS && regioned(map, flag))
+		e = region_sync(map, 0, 0, map->width, map->height);
+
+	return e;
 }
 /*
  +-----------------------------------------------------------+
- * @desc	Clear cell flag
+ * @desc	Set flag on entire map
  +-----------------------------------------------------------+
  */
 err
-RLFL_clear_flag(unsigned int m, unsigned int x, unsigned int y, unsigned long flag)
+RLFL_fill_map(unsigned int m, unsigned long flag)
 {
 	if(!RLFL_map_valid(m))
 		return RLFL_ERR_NO_MAP;
 
-	if(!RLFL_cell_valid(m, x, y))
-		return RLFL_ERR_OUT_OF_BOUNDS;
-
 	if(!flag_valid(flag))
 		return RLFL_ERR_FLAG;
 
-	CELL(m, x, y) &= ~flag;
-	return RLFL_SUCCESS;
+	RLFL_map_t *map = RLFL_MAP(m);
+	if(map->journal && journal_begin(map, 0, 0, map->width, map->height))
+		return RLFL_ERR_GENERIC;
+	fov_forget(map, flag);
+	if(tracked(map, flag))
+		map_mark_dirty(map, 0, 0, map->width, map->height);
+
+	err e = map_fill_flag(map, flag);
+	if(map->journal)
+		journal_end(map);
+	if(e == RLFL_SUCCESS && regioned(map, flag))
+		e = region_sync(map, 0, 0, map->width, map->height);
+
+	return e;
 }
 /*
  +-----------------------------------------------------------+
- * @desc	Query cell for flags
- * @param	unsigned int 	map number
- * @param	X
- * @param	Y
+ * @desc	Check if flag is valid
  +-----------------------------------------------------------+
  */
-int
-RLFL_get_flags(unsigned int m, unsigned int x, unsigned int y)
+static inline bool
+flag_valid(unsigned long flag)
+{
+	if(flag < CELL_NONE || flag > CELL_MASK)
+	{
+		return false;
+	}
+	return true;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Check map, rectangle and flag of a rectangle op
+ +-----------------------------------------------------------+
+ */
+static err
+rect_valid(unsigned int m, unsigned int x, unsigned int y, unsigned int w,
+		   unsigned int h, unsigned long flag)
 {
 	if(!RLFL_map_valid(m))
 		return RLFL_ERR_NO_MAP;
 
-	if(!RLFL_cell_valid(m, x, y))
+	RLFL_map_t *map = RLFL_MAP(m);
+	if(x > map->width || w > map->width - x || y > map->height || h > map->height - y)
 		return RLFL_ERR_OUT_OF_BOUNDS;
 
-	return CELL(m, x, y);
+	if(!flag_valid(flag))
+		return RLFL_ERR_FLAG;
+
+	return RLFL_SUCCESS;
 }
 /*
  +-----------------------------------------------------------+
- * @desc	Clear `flag` from entire map
+ * @desc	Check map, cells and flag of a list op
  +-----------------------------------------------------------+
  */
-err
-RLFL_clear_map(unsigned int m, unsigned long flag)
+static err
+list_valid(unsigned int m, const unsigned int *xy, unsigned int n, unsigned long flag)
 {
 	if(!RLFL_map_valid(m))
 		return RLFL_ERR_NO_MAP;
@@ -309,49 +1641,52 @@ RLFL_clear_map(unsigned int m, unsigned long flag)
 	if(!flag_valid(flag))
 		return RLFL_ERR_FLAG;
 
-	int i;
-	for(i=0; i<(RLFL_map_store[m]->width * RLFL_map_store[m]->height); i++)
+	RLFL_map_t *map = RLFL_MAP(m);
+	unsigned int i;
+	for(i=0; i<n; i++)
 	{
-		RLFL_map_store[m]->cells[i] &= ~flag;
+		if(xy[i * 2] >= map->width || xy[(i * 2) + 1] >= map->height)
+			return RLFL_ERR_OUT_OF_BOUNDS;
 	}
-
 	return RLFL_SUCCESS;
 }
 /*
  +-----------------------------------------------------------+
- * @desc	Set flag on entire map
+ * @desc	Check maps and flags of a mask op
  +-----------------------------------------------------------+
  */
-err
-RLFL_fill_map(unsigned int m, unsigned long flag)
+static err
+mask_valid(unsigned int m, unsigned int mask, unsigned long mflag, unsigned long flag)
 {
-	if(!RLFL_map_valid(m))
+	if(!RLFL_map_valid(m) || !RLFL_map_valid(mask))
 		return RLFL_ERR_NO_MAP;
 
-	if(!flag_valid(flag))
-		return RLFL_ERR_FLAG;
+	if(RLFL_MAP(m)->width != RLFL_MAP(mask)->width
+	   || RLFL_MAP(m)->height != RLFL_MAP(mask)->height)
+		return RLFL_ERR_SIZE;
 
-	int i;
-	for(i=0; i<(RLFL_map_store[m]->width * RLFL_map_store[m]->height); i++)
-	{
-		RLFL_map_store[m]->cells[i] |= flag;
-	}
+	if(!flag_valid(flag) || !flag_valid(mflag))
+		return RLFL_ERR_FLAG;
 
 	return RLFL_SUCCESS;
 }
 /*
  +-----------------------------------------------------------+
- * @desc	Check if flag is valid
+ * @desc	Check if map layout is valid
  +-----------------------------------------------------------+
  */
 static inline bool
-flag_valid(unsigned long flag)
+layout_valid(unsigned int layout)
 {
-	if(flag < CELL_NONE || flag > CELL_MASK)
+	switch(layout)
 	{
-		return false;
+		case MAP_DENSE :
+		case MAP_PLANES :
+		case MAP_TILED :
+		case MAP_SPARSE :
+			return true;
 	}
-	return true;
+	return false;
 }
 /*
 * Approximate Distance between two points.
@@ -388,10 +1723,22 @@ err
 RLFL_scatter(unsigned int m, unsigned int ox, unsigned int oy, unsigned int *dx, unsigned int *dy,
 			 int range, unsigned long flag, bool need_los)
 {
-	if(!RLFL_map_valid(m))
-			return RLFL_ERR_NO_MAP;
+	return RLFL_scatter_ctx(&RLFL_default_ctx, m, ox, oy, dx, dy, range, flag, need_los);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	RLFL_scatter() with the random state of `ctx`
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_scatter_ctx(RLFL_ctx_t *ctx, unsigned int m, unsigned int ox, unsigned int oy, unsigned int *dx,
+				 unsigned int *dy, int range, unsigned long flag, bool need_los)
+{
+	map_view_t v;
+	if(view_open(&v, m))
+		return RLFL_ERR_NO_MAP;
 
-	if(!RLFL_cell_valid(m, ox, oy))
+	if(!view_in(&v, ox, oy))
 		return RLFL_ERR_OUT_OF_BOUNDS;
 
 	if(!flag_valid(flag))
@@ -405,11 +1752,11 @@ RLFL_scatter(unsigned int m, unsigned int ox, unsigned int oy, unsigned int *dx,
 	while(true)
 	{
 		/* Pick a new location */
-		ny = RLFL_randspread(oy, range);
-		nx = RLFL_randspread(ox, range);
+		ny = RLFL_randspread_ctx(ctx, oy, range);
+		nx = RLFL_randspread_ctx(ctx, ox, range);
 
 		/* Ignore annoying locations */
-		if(!RLFL_cell_valid(m, nx, ny))
+		if(!view_in(&v, nx, ny))
 			continue;
 
 		/* Ignore "excessively distant" locations */
@@ -419,7 +1766,7 @@ RLFL_scatter(unsigned int m, unsigned int ox, unsigned int oy, unsigned int *dx,
 		/* Require "line of sight" */
 		if(!need_los || RLFL_los(m, ox, oy, nx, ny))
 		{
-			if(flag && !RLFL_has_flag(m, nx, ny, flag))
+			if(flag && !view_has(&v, nx, ny, flag))
 				continue;
 
 			/* Found */
@@ -449,6 +1796,18 @@ RLFL_scatter(unsigned int m, unsigned int ox, unsigned int oy, unsigned int *dx,
 err
 RLFL_path_create(unsigned int m, unsigned int ox, unsigned int oy, unsigned int dx, unsigned int dy,
 				 unsigned int algorithm, int range, unsigned long flags, float dcost)
+{
+	return RLFL_path_create_ctx(&RLFL_default_ctx, m, ox, oy, dx, dy, algorithm, range, flags, dcost);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	RLFL_path_create() with the scratch of `ctx`
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_path_create_ctx(RLFL_ctx_t *ctx, unsigned int m, unsigned int ox, unsigned int oy,
+					 unsigned int dx, unsigned int dy, unsigned int algorithm, int range,
+					 unsigned long flags, float dcost)
 {
 	if(!RLFL_map_valid(m))
 		return RLFL_ERR_NO_MAP;
@@ -458,13 +1817,38 @@ RLFL_path_create(unsigned int m, unsigned int ox, unsigned int oy, unsigned int
 
 	switch(algorithm) {
 		case PATH_BASIC :
-			return RLFL_path_basic(m, ox, oy, dx, dy, range, flags);
+			return RLFL_path_basic_ctx(ctx, m, ox, oy, dx, dy, range, flags);
 		case PATH_ASTAR :
-			return RLFL_path_astar(m, ox, oy, dx, dy, range, flags, dcost);
+			return RLFL_path_astar_ctx(ctx, m, ox, oy, dx, dy, range, flags, dcost);
 	}
 
 	return RLFL_ERR_GENERIC;
 }
+/*
+ +-----------------------------------------------------------+
+ * @desc	Store `path` in a free slot, paths may be stored
+ * 			from several threads at once
+ * @return	Path number
+ +-----------------------------------------------------------+
+ */
+int
+path_store_put(RLFL_path_t *path)
+{
+	pthread_mutex_lock(&path_lock);
+
+	int p;
+	for(p=0; p<RLFL_MAX_PATHS; p++)
+	{
+		if(!RLFL_path_store[p])
+		{
+			RLFL_path_store[p] = path;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&path_lock);
+
+	return (p < RLFL_MAX_PATHS) ? p : RLFL_ERR_FLAG;
+}
 /*
  +-----------------------------------------------------------+
  * @desc	Path size
@@ -489,9 +1873,13 @@ RLFL_path_delete(unsigned int p)
 	if((p >= RLFL_MAX_PATHS) || !RLFL_path_store[p])
 		return RLFL_ERR_NO_PATH;
 
-	RLFL_list_delete(RLFL_path_store[p]->path);
-	free(RLFL_path_store[p]);
+	RLFL_path_t *path = RLFL_path_store[p];
+	pthread_mutex_lock(&path_lock);
 	RLFL_path_store[p] = NULL;
+	pthread_mutex_unlock(&path_lock);
+
+	RLFL_list_delete(path->path);
+	free(path);
 
 	return RLFL_SUCCESS;
 }
@@ -529,63 +1917,129 @@ err
 RLFL_fov(unsigned int m, unsigned int ox, unsigned int oy, unsigned int radius,
 		unsigned int algorithm, bool lit, bool light_walls)
 {
-	if(!RLFL_map_valid(m))
+	return RLFL_fov_ctx(&RLFL_default_ctx, m, ox, oy, radius, algorithm, lit, light_walls);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	RLFL_fov() with the scratch of `ctx`
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_fov_ctx(RLFL_ctx_t *ctx, unsigned int m, unsigned int ox, unsigned int oy, unsigned int radius,
+			 unsigned int algorithm, bool lit, bool light_walls)
+{
+	map_view_t v;
+	if(view_open(&v, m))
 		return RLFL_ERR_NO_MAP;
 
-	if(!RLFL_cell_valid(m, ox, oy))
+	if(!view_in(&v, ox, oy))
 		return RLFL_ERR_OUT_OF_BOUNDS;
 
 	if(radius >= RLFL_MAX_RADIUS)
 		return RLFL_ERR_GENERIC;
 
-	RLFL_map_t *map = RLFL_map_store[m];
-	if(radius == 0)
-	{
-		int max_radius_x = map->width - ox;
-		int max_radius_y = map->height - oy;
-		max_radius_x = MAX(max_radius_x, ox);
-		max_radius_y = MAX(max_radius_y, oy);
-		radius = (int)(sqrt(max_radius_x * max_radius_x + max_radius_y * max_radius_y)) + 1;
-	}
-
 	err res;
-	RLFL_clear_map(m, CELL_SEEN|CELL_LIT);
+	if((res = fov_begin(v.map, lit)))
+		return res;
+	res = fov_run(ctx, &v, ox, oy, fov_radius(&v, ox, oy, radius), algorithm, light_walls);
+	v.map->fov->flag = 0;
+
+	return res;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Radius of a FOV, 0 is far enough to reach every
+ * 			cell
+ +-----------------------------------------------------------+
+ */
+unsigned int
+fov_radius(const map_view_t *v, unsigned int ox, unsigned int oy, unsigned int radius)
+{
+	if(radius)
+		return radius;
+
+	int max_radius_x = v->width - ox;
+	int max_radius_y = v->height - oy;
+	max_radius_x = MAX(max_radius_x, ox);
+	max_radius_y = MAX(max_radius_y, oy);
+	return (int)(sqrt(max_radius_x * max_radius_x + max_radius_y * max_radius_y)) + 1;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Run FOV `algorithm` on a checked view
+ +-----------------------------------------------------------+
+ */
+err
+fov_run(RLFL_ctx_t *ctx, const map_view_t *v, unsigned int ox, unsigned int oy, unsigned int radius,
+		unsigned int algorithm, bool light_walls)
+{
+	if(radius >= RLFL_MAX_RADIUS)
+		return RLFL_ERR_GENERIC;
+
 	switch(algorithm)
 	{
 		case FOV_CIRCULAR :
-			res = RLFL_fov_circular_raycasting(m, ox, oy, radius, light_walls);
-			break;
+			return fov_circular_raycasting(v, ox, oy, radius, light_walls);
 		case FOV_DIAMOND :
-			res = RLFL_fov_diamond_raycasting(m, ox, oy, radius, light_walls);
-			break;
+			return fov_diamond_raycasting(ctx, v, ox, oy, radius, light_walls);
 		case FOV_SHADOW :
-			res = RLFL_fov_recursive_shadowcasting(m, ox, oy, radius, light_walls);
-			break;
+			return fov_recursive_shadowcasting(v, ox, oy, radius, light_walls);
 		case FOV_PERMISSIVE :
-			res = RLFL_fov_permissive(m, ox, oy, radius, light_walls);
-			break;
+			return fov_permissive(ctx, v, ox, oy, radius, light_walls);
 		case FOV_DIGITAL :
-			res = RLFL_fov_digital(m, ox, oy, radius, light_walls);
-			break;
+			return fov_digital(v, ox, oy, radius, light_walls);
 		case FOV_RESTRICTIVE:
-			res = RLFL_fov_restrictive_shadowcasting(m, ox, oy, radius, light_walls);
-			break;
-		default:
-			return RLFL_ERR_OUT_OF_BOUNDS;
+			return fov_restrictive_shadowcasting(v, ox, oy, radius, light_walls);
+		case FOV_TABLE :
+			return fov_view_table(v, ox, oy, radius, light_walls);
+		case FOV_SHADOW_ITER :
+			return fov_iterative_shadowcasting(v, ox, oy, radius, light_walls);
+		case FOV_SYMMETRIC :
+			return fov_symmetric_shadowcasting(v, ox, oy, radius, light_walls);
+	}
+	return RLFL_ERR_OUT_OF_BOUNDS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Clear CELL_SEEN and CELL_LIT before a FOV. Only the
+ * 			cells the last FOV recorded are cleared, or the
+ * 			whole map if it may have others. The algorithms
+ * 			then record the cells they mark, and light them
+ * 			if `lit`, see view_fov().
+ +-----------------------------------------------------------+
+ */
+static err
+fov_begin(RLFL_map_t *map, bool lit)
+{
+	if(map->fov == NULL)
+	{
+		map->fov = (map_fov_t *)calloc(1, sizeof(map_fov_t));
+		if(map->fov == NULL)
+			return RLFL_ERR_GENERIC;
 	}
-	if(lit)
+
+	map_fov_t *f = map->fov;
+	if(f->valid)
 	{
-		int i;
-		for(i=0; i<(RLFL_map_store[m]->width * RLFL_map_store[m]->height); i++)
+		map_view_t v = { map, map->width, map->height };
+		unsigned int i;
+		for(i=0; i<f->count; i++)
 		{
-			if(RLFL_map_store[m]->cells[i] & CELL_SEEN)
-			{
-				RLFL_map_store[m]->cells[i] |= CELL_LIT;
-			}
+			if(view_clear(&v, f->cells[i] % map->width, f->cells[i] / map->width, CELL_SEEN|CELL_LIT))
+				return RLFL_ERR_GENERIC;
 		}
 	}
-
-	return res;
+	else
+	{
+		err e = RLFL_clear_map(map->mnum, CELL_SEEN|CELL_LIT);
+		if(e)
+			return e;
+	}
+	/* Other processes write the cells of a shared map */
+	f->count = 0;
+	f->valid = (map->shm == NULL && !map->cells_out);
+	f->flag = CELL_FOV | (lit ? CELL_LIT : 0);
+	return RLFL_SUCCESS;
 }
 /*
  +-----------------------------------------------------------+
@@ -595,13 +2049,22 @@ RLFL_fov(unsigned int m, unsigned int ox, unsigned int oy, unsigned int radius,
 err
 RLFL_fov_finish(unsigned int m, int x0, int y0, int x1, int y1, int dx, int dy)
 {
-	if((m >= RLFL_MAX_MAPS) || !RLFL_map_store[m])
+	map_view_t v;
+	if(view_open(&v, m))
 		return RLFL_ERR_NO_MAP;
 
-	RLFL_map_t *map = RLFL_map_store[m];
+	fov_finish(&v, x0, y0, x1, y1, dx, dy);
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	RLFL_fov_finish() on a checked view
+ +-----------------------------------------------------------+
+ */
+void
+fov_finish(const map_view_t *v, int x0, int y0, int x1, int y1, int dx, int dy)
+{
 	int cx, cy, x2, y2;
-	int nc = (map->width * map->height);
-	unsigned int offset, offset2;
 
 	for(cx=x0; cx <= x1; cx++)
 	{
@@ -609,37 +2072,32 @@ RLFL_fov_finish(unsigned int m, int x0, int y0, int x1, int y1, int dx, int dy)
 		{
 			x2 = cx + dx;
 			y2 = cy + dy;
-			offset = cx + (cy * map->width);
-			if (offset < (unsigned)nc && RLFL_has_flag(m, cx, cy, CELL_SEEN) && RLFL_has_flag(m, cx, cy, CELL_OPEN))
+			if (view_in(v, cx, cy) && view_seen(v, cx, cy) && view_has(v, cx, cy, CELL_OPEN))
 			{
 				if (x2 >= x0 && x2 <= x1)
 				{
-					offset2 = x2 + (cy * map->width);
-					if (offset2 < (unsigned)nc && !RLFL_has_flag(m, cx, cy, CELL_OPEN))
+					if (view_in(v, x2, cy) && !view_has(v, cx, cy, CELL_OPEN))
 					{
-						RLFL_set_flag(m, cx, cy, CELL_FOV);
+						view_fov(v, cx, cy);
 					}
 				}
 				if ( y2 >= y0 && y2 <= y1 )
 				{
-					offset2 = cx + (y2 * map->width);
-					if (offset2 < (unsigned)nc && !RLFL_has_flag(m, cx, cy, CELL_OPEN))
+					if (view_in(v, cx, y2) && !view_has(v, cx, cy, CELL_OPEN))
 					{
-						RLFL_set_flag(m, cx, cy, CELL_FOV);
+						view_fov(v, cx, cy);
 					}
 				}
 				if ( x2 >= x0 && x2 <= x1 && y2 >= y0 && y2 <= y1 )
 				{
-					offset2 = x2 + (y2 * map->width);
-					if (offset2 < (unsigned)nc && !RLFL_has_flag(m, cx, cy, CELL_OPEN))
+					if (view_in(v, x2, y2) && !view_has(v, cx, cy, CELL_OPEN))
 					{
-						RLFL_set_flag(m, cx, cy, CELL_FOV);
+						view_fov(v, cx, cy);
 					}
 				}
 			}
 		}
 	}
-	return RLFL_SUCCESS;
 }
 /*
  +-----------------------------------------------------------+
@@ -650,10 +2108,21 @@ err
 RLFL_project_ball(unsigned int m, unsigned int x1, unsigned int y1, unsigned int x2,
 			     unsigned int y2, unsigned int rad, int range, unsigned long flags)
 {
-	if((m >= RLFL_MAX_MAPS) || !RLFL_map_store[m])
+	return RLFL_project_ball_ctx(&RLFL_default_ctx, m, x1, y1, x2, y2, rad, range, flags);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	RLFL_project_ball() with the random state of `ctx`
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_project_ball_ctx(RLFL_ctx_t *ctx, unsigned int m, unsigned int x1, unsigned int y1,
+				  unsigned int x2, unsigned int y2, unsigned int rad, int range, unsigned long flags)
+{
+	if(!RLFL_map_valid(m))
 		return RLFL_ERR_NO_MAP;
 
-	return RLFL_project(m, x1, y1, x2, y2, rad, range, flags | PROJECT_JUMP);
+	return RLFL_project_ctx(ctx, m, x1, y1, x2, y2, rad, range, flags | PROJECT_JUMP);
 }
 /*
  +-----------------------------------------------------------+
@@ -664,10 +2133,21 @@ err
 RLFL_project_beam(unsigned int m, unsigned int x1, unsigned int y1, unsigned int x2,
 				 unsigned int y2, int range, unsigned long flags)
 {
-	if((m >= RLFL_MAX_MAPS) || !RLFL_map_store[m])
+	return RLFL_project_beam_ctx(&RLFL_default_ctx, m, x1, y1, x2, y2, range, flags);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	RLFL_project_beam() with the random state of `ctx`
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_project_beam_ctx(RLFL_ctx_t *ctx, unsigned int m, unsigned int x1, unsigned int y1,
+				  unsigned int x2, unsigned int y2, int range, unsigned long flags)
+{
+	if(!RLFL_map_valid(m))
 		return RLFL_ERR_NO_MAP;
 
-	return RLFL_project(m, x1, y1, x2, y2, 0, range, flags);
+	return RLFL_project_ctx(ctx, m, x1, y1, x2, y2, 0, range, flags);
 }
 /*
  +-----------------------------------------------------------+
@@ -678,10 +2158,21 @@ err
 RLFL_project_wave(unsigned int m, unsigned int x1, unsigned int y1, unsigned int rad,
 				  int range, unsigned long flags)
 {
-	if((m >= RLFL_MAX_MAPS) || !RLFL_map_store[m])
+	return RLFL_project_wave_ctx(&RLFL_default_ctx, m, x1, y1, rad, range, flags);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	RLFL_project_wave() with the random state of `ctx`
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_project_wave_ctx(RLFL_ctx_t *ctx, unsigned int m, unsigned int x1, unsigned int y1,
+				  unsigned int rad, int range, unsigned long flags)
+{
+	if(!RLFL_map_valid(m))
 		return RLFL_ERR_NO_MAP;
 
-	return RLFL_project(m, x1, y1, -1, -1, rad, range, PROJECT_WAVE|flags);
+	return RLFL_project_ctx(ctx, m, x1, y1, -1, -1, rad, range, PROJECT_WAVE|flags);
 }
 /*
  +-----------------------------------------------------------+
@@ -692,10 +2183,21 @@ err
 RLFL_project_cone(unsigned int m, unsigned int x1, unsigned int y1, unsigned int x2, unsigned int y2,
 				 unsigned int rad, int range, unsigned long flags)
 {
-	if((m >= RLFL_MAX_MAPS) || !RLFL_map_store[m])
+	return RLFL_project_cone_ctx(&RLFL_default_ctx, m, x1, y1, x2, y2, rad, range, flags);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	RLFL_project_cone() with the random state of `ctx`
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_project_cone_ctx(RLFL_ctx_t *ctx, unsigned int m, unsigned int x1, unsigned int y1,
+				  unsigned int x2, unsigned int y2, unsigned int rad, int range, unsigned long flags)
+{
+	if(!RLFL_map_valid(m))
 		return RLFL_ERR_NO_MAP;
 
-	return RLFL_project(m, x1, y1, x2, y2, rad, range, PROJECT_CONE|flags);
+	return RLFL_project_ctx(ctx, m, x1, y1, x2, y2, rad, range, PROJECT_CONE|flags);
 }
 /*
  +-----------------------------------------------------------+
@@ -705,8 +2207,19 @@ RLFL_project_cone(unsigned int m, unsigned int x1, unsigned int y1, unsigned int
 err
 RLFL_project_cloud(unsigned int m, unsigned int x1, unsigned int y1, unsigned int rad, unsigned long flags)
 {
-	if((m >= RLFL_MAX_MAPS) || !RLFL_map_store[m])
+	return RLFL_project_cloud_ctx(&RLFL_default_ctx, m, x1, y1, rad, flags);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	RLFL_project_cloud() with the random state of `ctx`
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_project_cloud_ctx(RLFL_ctx_t *ctx, unsigned int m, unsigned int x1, unsigned int y1,
+				   unsigned int rad, unsigned long flags)
+{
+	if(!RLFL_map_valid(m))
 		return RLFL_ERR_NO_MAP;
 
-	return RLFL_project(m, x1, y1, -1, -1, rad, -1, flags);
+	return RLFL_project_ctx(ctx, m, x1, y1, -1, -1, rad, -1, flags);
 }
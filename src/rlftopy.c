@@ -19,6 +19,7 @@
     <jtm@robot.is>
 */
 #include <Python.h>
+#include <pthread.h>
 #include "headers/rlfl.h"
 
 struct module_state {
@@ -34,6 +35,52 @@ static struct module_state _state;
 
 static PyObject *RLFLError;
 static void* RLFL_handle_error(err code, const char* generic);
+
+/* Maps are pinned and locked around every call on them, calls that
+   may run long let go of the GIL. Calls only reading a map share it
+   with other readers. See hold_map(). */
+#define MAP_READ	true
+#define MAP_WRITE	false
+#define WITH_MAP(m, read, call) ({ \
+	int _r = hold_map(m, read); \
+	if(_r == RLFL_SUCCESS) { \
+		_r = (call); \
+		release_map(m); \
+	} \
+	_r; })
+#define WITHOUT_GIL(m, read, call) ({ \
+	int _r = hold_map(m, read); \
+	if(_r == RLFL_SUCCESS) { \
+		Py_BEGIN_ALLOW_THREADS \
+		_r = (call); \
+		Py_END_ALLOW_THREADS \
+		release_map(m); \
+	} \
+	_r; })
+#define WITH_MAPS(a, aread, b, bread, call) ({ \
+	int _r = hold_maps(a, aread, b, bread); \
+	if(_r == RLFL_SUCCESS) { \
+		_r = (call); \
+		release_maps(a, b); \
+	} \
+	_r; })
+static err hold_map(unsigned int m, bool read);
+static void release_map(unsigned int m);
+static err hold_maps(unsigned int a, bool aread, unsigned int b, bool bread);
+static void release_maps(unsigned int a, unsigned int b);
+static int hold_stack(unsigned int s, bool read, unsigned int **held);
+static void release_stack(unsigned int *held, int n);
+static int compare_slots(const void *a, const void *b);
+static RLFL_ctx_t *thread_ctx(void);
+
+/* Buffer exporter for the cells of a MAP_DENSE map, see map_cells() */
+typedef struct {
+	PyObject_HEAD
+	unsigned int map;
+	Py_ssize_t shape[2];
+	Py_ssize_t strides[2];
+} RLFL_cells_t;
+static PyTypeObject RLFL_cells_type;
 /*
  +-----------------------------------------------------------+
  * @desc	Create new map
@@ -44,12 +91,13 @@ static PyObject*
 create_map(PyObject *self, PyObject* args)
 {
 	int w, h;
-	if(!PyArg_ParseTuple(args, "ii", &w, &h)) {
+	unsigned int layout = MAP_DENSE;
+	if(!PyArg_ParseTuple(args, "ii|i", &w, &h, &layout)) {
 		return NULL;
 	}
 
 	/* Create map */
-	int m = RLFL_new_map(w, h);
+	int m = RLFL_new_map_layout(w, h, layout);
 
 	if(m < 0) {
 		if(m == RLFL_ERR_SIZE)
@@ -60,6 +108,10 @@ create_map(PyObject *self, PyObject* args)
 		{
 			return RLFL_handle_error(m, "Too many maps");
 		}
+		else if (m == RLFL_ERR_FLAG)
+		{
+			return RLFL_handle_error(m, "Invalid map layout");
+		}
 		else
 		{
 			return RLFL_handle_error(m, NULL);
@@ -69,6 +121,183 @@ create_map(PyObject *self, PyObject* args)
 	/* Success */
 	return Py_BuildValue("i", m);
 }
+/*
+ +-----------------------------------------------------------+
+ * @desc	Clone map, tiles are shared until written
+ * @return 	Map number
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+clone_map(PyObject *self, PyObject* args)
+{
+	unsigned int m;
+	if(!PyArg_ParseTuple(args, "i", &m)) {
+		return NULL;
+	}
+
+	int c = WITH_MAP(m, MAP_WRITE, RLFL_clone_map(m));
+	if(c < 0) {
+		if(c == RLFL_ERR_NO_MAP && RLFL_map_valid(m))
+			return RLFL_handle_error(c, "Too many maps");
+		return RLFL_handle_error(c, NULL);
+	}
+	return Py_BuildValue("i", c);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Save map and its path maps to a file
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+save_map(PyObject *self, PyObject* args)
+{
+	unsigned int m;
+	const char *path;
+	if(!PyArg_ParseTuple(args, "is", &m, &path)) {
+		return NULL;
+	}
+
+	err e = WITHOUT_GIL(m, MAP_READ, RLFL_map_save(m, path));
+	if(e < 0) {
+		return RLFL_handle_error(e, NULL);
+	}
+	Py_RETURN_NONE;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Load map saved with save_map, the file is mapped
+ * 			copy-on-write
+ * @return 	Map number
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+load_map(PyObject *self, PyObject* args)
+{
+	const char *path;
+	if(!PyArg_ParseTuple(args, "s", &path)) {
+		return NULL;
+	}
+
+	int m = RLFL_map_load(path);
+	if(m < 0) {
+		if(m == RLFL_ERR_NO_MAP)
+			return RLFL_handle_error(m, "Too many maps");
+		return RLFL_handle_error(m, NULL);
+	}
+	return Py_BuildValue("i", m);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Copy map into a new shared memory segment
+ * @return 	Map number
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+share_map(PyObject *self, PyObject* args)
+{
+	unsigned int m;
+	const char *name;
+	if(!PyArg_ParseTuple(args, "is", &m, &name)) {
+		return NULL;
+	}
+
+	/* Takes a map slot, the GIL serializes the map registry */
+	int s = WITH_MAP(m, MAP_READ, RLFL_map_share(m, name));
+	if(s < 0) {
+		if(s == RLFL_ERR_FILE)
+			return RLFL_handle_error(s, "Cannot create shared map");
+		return RLFL_handle_error(s, NULL);
+	}
+	return Py_BuildValue("i", s);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Attach to a map shared with share_map, writes are
+ * 			shared unless `private` is set
+ * @return 	Map number
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+attach_map(PyObject *self, PyObject* args)
+{
+	const char *name;
+	int private_pages = 0;
+	if(!PyArg_ParseTuple(args, "s|i", &name, &private_pages)) {
+		return NULL;
+	}
+
+	int m = RLFL_map_attach(name, private_pages);
+	if(m < 0) {
+		if(m == RLFL_ERR_NO_MAP)
+			return RLFL_handle_error(m, "Too many maps");
+		if(m == RLFL_ERR_FILE)
+			return RLFL_handle_error(m, "Invalid shared map");
+		return RLFL_handle_error(m, NULL);
+	}
+	return Py_BuildValue("i", m);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Remove a shared memory segment
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+unlink_map(PyObject *self, PyObject* args)
+{
+	const char *name;
+	if(!PyArg_ParseTuple(args, "s", &name)) {
+		return NULL;
+	}
+
+	err e = RLFL_map_unlink(name);
+	if(e < 0) {
+		return RLFL_handle_error(e, "No such shared map");
+	}
+	Py_RETURN_NONE;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Publish the changes to a shared map
+ * @return 	New generation
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+publish_map(PyObject *self, PyObject* args)
+{
+	unsigned int m, g = 0;
+	if(!PyArg_ParseTuple(args, "i", &m)) {
+		return NULL;
+	}
+
+	err e = WITH_MAP(m, MAP_WRITE, RLFL_map_publish(m, &g));
+	if(e < 0) {
+		if(e == RLFL_ERR_FLAG)
+			return RLFL_handle_error(e, "Map is not the writer of a shared map");
+		return RLFL_handle_error(e, NULL);
+	}
+	return Py_BuildValue("I", g);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Generation of a shared map
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+map_generation(PyObject *self, PyObject* args)
+{
+	unsigned int m, g = 0;
+	if(!PyArg_ParseTuple(args, "i", &m)) {
+		return NULL;
+	}
+
+	err e = WITH_MAP(m, MAP_READ, RLFL_map_generation(m, &g));
+	if(e < 0) {
+		if(e == RLFL_ERR_FLAG)
+			return RLFL_handle_error(e, "Map is not shared");
+		return RLFL_handle_error(e, NULL);
+	}
+	return Py_BuildValue("I", g);
+}
 /*
  +-----------------------------------------------------------+
  * @desc	Get map width
@@ -92,153 +321,1264 @@ map_size(PyObject *self, PyObject* args)
 }
 /*
  +-----------------------------------------------------------+
- * @desc	Destroy all maps
+ * @desc	Get map layout
  +-----------------------------------------------------------+
  */
 static PyObject*
-delete_all_maps(PyObject *self, PyObject* args) {
-	RLFL_wipe_all();
+map_layout(PyObject *self, PyObject* args)
+{
+	unsigned int m;
+	if(!PyArg_ParseTuple(args, "i", &m)) {
+		return NULL;
+	}
+
+	int layout = RLFL_map_layout(m);
+	if(layout < 0) {
+		return RLFL_handle_error(layout, NULL);
+	}
+
+	return Py_BuildValue("i", layout);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Get (allocated, total) tiles of a tiled map
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+map_tiles(PyObject *self, PyObject* args)
+{
+	unsigned int m;
+	if(!PyArg_ParseTuple(args, "i", &m)) {
+		return NULL;
+	}
+
+	unsigned int used, total;
+	int e = WITH_MAP(m, MAP_READ, RLFL_map_tiles(m, &used, &total));
+	if(e < 0) {
+		if(e == RLFL_ERR_FLAG)
+			return RLFL_handle_error(e, "Map is not tiled");
+		return RLFL_handle_error(e, NULL);
+	}
+
+	return Py_BuildValue("(ii)", used, total);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Track changes to flags, 0 to stop
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+track_map(PyObject *self, PyObject* args)
+{
+	unsigned int m;
+	unsigned long flag;
+	if(!PyArg_ParseTuple(args, "il", &m, &flag)) {
+		return NULL;
+	}
+
+	err e = WITH_MAP(m, MAP_WRITE, RLFL_map_track(m, flag));
+	if(e < 0) {
+		return RLFL_handle_error(e, NULL);
+	}
 	Py_RETURN_NONE;
 }
 /*
  +-----------------------------------------------------------+
- * @desc	Destroy map
- * @param	int
- * @return  Bool
+ * @desc	Version of the last tracked change
  +-----------------------------------------------------------+
  */
 static PyObject*
-delete_map(PyObject *self, PyObject* args) {
-	unsigned int n;
-	if(!PyArg_ParseTuple(args, "i", &n)) {
+map_version(PyObject *self, PyObject* args)
+{
+	unsigned int m, version;
+	if(!PyArg_ParseTuple(args, "i", &m)) {
+		return NULL;
+	}
+
+	err e = WITH_MAP(m, MAP_READ, RLFL_map_version(m, &version));
+	if(e < 0) {
+		return RLFL_handle_error(e, NULL);
+	}
+	return Py_BuildValue("I", version);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Rectangles changed after a version
+ * @return	List of ((x, y), (w, h)) tuples
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+map_dirty(PyObject *self, PyObject* args)
+{
+	unsigned int m, since = 0;
+	if(!PyArg_ParseTuple(args, "i|I", &m, &since)) {
+		return NULL;
+	}
+
+	int n = WITH_MAP(m, MAP_READ, RLFL_map_dirty(m, since, NULL, 0));
+	if(n < 0) {
+		if(n == RLFL_ERR_FLAG)
+			return RLFL_handle_error(n, "Map is not tracked");
+		return RLFL_handle_error(n, NULL);
+	}
+
+	unsigned int *rects = (unsigned int *)PyMem_Malloc(sizeof(unsigned int) * 4 * (n ? n : 1));
+	if(rects == NULL) {
+		return PyErr_NoMemory();
+	}
+	n = WITH_MAP(m, MAP_READ, RLFL_map_dirty(m, since, rects, n));
+	if(n < 0) {
+		PyMem_Free(rects);
+		return RLFL_handle_error(n, NULL);
+	}
+	PyObject *list = PyList_New(0);
+	int i;
+	for(i=0; list && i<n; i++) {
+		unsigned int *r = rects + (i * 4);
+		PyObject *rect = Py_BuildValue("((II)(II))", r[0], r[1], r[2], r[3]);
+		if(rect == NULL || PyList_Append(list, rect)) {
+			Py_XDECREF(rect);
+			Py_CLEAR(list);
+			break;
+		}
+		Py_DECREF(rect);
+	}
+	PyMem_Free(rects);
+	return list;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Keep connected regions of cells with flags, 0 to
+ * 			stop
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+track_regions(PyObject *self, PyObject* args)
+{
+	unsigned int m;
+	unsigned long flag = CELL_WALK | CELL_OPEN;
+	if(!PyArg_ParseTuple(args, "i|l", &m, &flag)) {
+		return NULL;
+	}
+
+	err e = WITHOUT_GIL(m, MAP_WRITE, RLFL_region_track(m, flag));
+	if(e < 0) {
+		return RLFL_handle_error(e, NULL);
+	}
+	Py_RETURN_NONE;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Region label of cell, 0 if in no region
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+region(PyObject *self, PyObject* args)
+{
+	unsigned int m, x, y;
+	if(!PyArg_ParseTuple(args, "i(ii)", &m, &x, &y)) {
+		return NULL;
+	}
+
+	int label = WITH_MAP(m, MAP_READ, RLFL_region(m, x, y));
+	if(label < 0) {
+		if(label == RLFL_ERR_FLAG)
+			return RLFL_handle_error(label, "Regions are not kept");
+		return RLFL_handle_error(label, NULL);
+	}
+	return Py_BuildValue("i", label);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	True if both cells are in the same region
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+same_region(PyObject *self, PyObject* args)
+{
+	unsigned int m, x1, y1, x2, y2;
+	if(!PyArg_ParseTuple(args, "i(ii)(ii)", &m, &x1, &y1, &x2, &y2)) {
 		return NULL;
 	}
 
-	if(RLFL_wipe_map(n) > -1) {
+	int e = WITH_MAP(m, MAP_READ, RLFL_region_connected(m, x1, y1, x2, y2));
+	if(e < 0) {
+		if(e == RLFL_ERR_FLAG)
+			return RLFL_handle_error(e, "Regions are not kept");
+		return RLFL_handle_error(e, NULL);
+	}
+	if(e) {
 		Py_RETURN_TRUE;
 	}
-	Py_RETURN_FALSE;
+	Py_RETURN_FALSE;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Number of regions
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+region_count(PyObject *self, PyObject* args)
+{
+	unsigned int m;
+	if(!PyArg_ParseTuple(args, "i", &m)) {
+		return NULL;
+	}
+
+	int n = WITH_MAP(m, MAP_READ, RLFL_region_count(m));
+	if(n < 0) {
+		if(n == RLFL_ERR_FLAG)
+			return RLFL_handle_error(n, "Regions are not kept");
+		return RLFL_handle_error(n, NULL);
+	}
+	return Py_BuildValue("i", n);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Region label of every cell, a memoryview of
+ * 			unsigned ints, shape (height, width)
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+region_labels(PyObject *self, PyObject* args)
+{
+	unsigned int m;
+	if(!PyArg_ParseTuple(args, "i", &m)) {
+		return NULL;
+	}
+
+	unsigned int w, h;
+	int e = RLFL_map_size(m, &w, &h);
+	if(e < 0) {
+		return RLFL_handle_error(e, NULL);
+	}
+
+	PyObject *data = PyByteArray_FromStringAndSize(NULL, (Py_ssize_t)w * h * sizeof(unsigned int));
+	if(data == NULL) {
+		return NULL;
+	}
+	e = WITHOUT_GIL(m, MAP_READ, RLFL_region_labels(m, (unsigned int *)PyByteArray_AS_STRING(data)));
+	if(e < 0) {
+		Py_DECREF(data);
+		if(e == RLFL_ERR_FLAG)
+			return RLFL_handle_error(e, "Regions are not kept");
+		return RLFL_handle_error(e, NULL);
+	}
+
+	PyObject *view = PyMemoryView_FromObject(data);
+	Py_DECREF(data);
+	if(view == NULL) {
+		return NULL;
+	}
+	PyObject *labels = PyObject_CallMethod(view, "cast", "s(II)", "I", h, w);
+	Py_DECREF(view);
+	return labels;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Journal changes in a ring of size changes, 0 to stop
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+journal_map(PyObject *self, PyObject* args)
+{
+	unsigned int m, size;
+	if(!PyArg_ParseTuple(args, "iI", &m, &size)) {
+		return NULL;
+	}
+
+	err e = WITH_MAP(m, MAP_WRITE, RLFL_map_journal(m, size));
+	if(e < 0) {
+		return RLFL_handle_error(e, NULL);
+	}
+	Py_RETURN_NONE;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Checkpoint of a journaled map
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+checkpoint(PyObject *self, PyObject* args)
+{
+	unsigned int m, mark;
+	if(!PyArg_ParseTuple(args, "i", &m)) {
+		return NULL;
+	}
+
+	err e = WITH_MAP(m, MAP_READ, RLFL_map_checkpoint(m, &mark));
+	if(e < 0) {
+		if(e == RLFL_ERR_FLAG)
+			return RLFL_handle_error(e, "Map is not journaled");
+		return RLFL_handle_error(e, NULL);
+	}
+	return Py_BuildValue("I", mark);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Undo the changes made after a checkpoint
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+rollback(PyObject *self, PyObject* args)
+{
+	unsigned int m, mark;
+	if(!PyArg_ParseTuple(args, "iI", &m, &mark)) {
+		return NULL;
+	}
+
+	err e = WITHOUT_GIL(m, MAP_WRITE, RLFL_map_rollback(m, mark));
+	if(e < 0) {
+		if(e == RLFL_ERR_FLAG)
+			return RLFL_handle_error(e, "Map is not journaled");
+		if(e == RLFL_ERR_OUT_OF_BOUNDS)
+			return RLFL_handle_error(e, "Checkpoint is no longer in the journal");
+		return RLFL_handle_error(e, NULL);
+	}
+	Py_RETURN_NONE;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Writable memoryview of the cells of a MAP_DENSE
+ * 			map, shape (height, width). The map can not be
+ * 			deleted while the view, or anything made from it,
+ * 			is alive.
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+map_cells(PyObject *self, PyObject* args)
+{
+	unsigned int m;
+	if(!PyArg_ParseTuple(args, "i", &m)) {
+		return NULL;
+	}
+
+	RLFL_cell_t *cells;
+	int e = RLFL_map_cells(m, &cells);
+	if(e < 0) {
+		if(e == RLFL_ERR_FLAG)
+			return RLFL_handle_error(e, "Map is not dense");
+		return RLFL_handle_error(e, NULL);
+	}
+
+	unsigned int w, h;
+	RLFL_map_size(m, &w, &h);
+
+	RLFL_cells_t *exporter = PyObject_New(RLFL_cells_t, &RLFL_cells_type);
+	if(exporter == NULL) {
+		return NULL;
+	}
+	exporter->map = m;
+	exporter->shape[0] = h;
+	exporter->shape[1] = w;
+	exporter->strides[0] = w * sizeof(RLFL_cell_t);
+	exporter->strides[1] = sizeof(RLFL_cell_t);
+
+	/* The view keeps the exporter alive, and holds the cells itself */
+	PyObject *view = PyMemoryView_FromObject((PyObject *)exporter);
+	Py_DECREF(exporter);
+	RLFL_map_cells_release(m);
+	return view;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Copy of all cells, row major, any layout
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+read_cells(PyObject *self, PyObject* args)
+{
+	unsigned int m;
+	if(!PyArg_ParseTuple(args, "i", &m)) {
+		return NULL;
+	}
+
+	unsigned int w, h;
+	int e = RLFL_map_size(m, &w, &h);
+	if(e < 0) {
+		return RLFL_handle_error(e, NULL);
+	}
+
+	PyObject *data = PyByteArray_FromStringAndSize(NULL, (Py_ssize_t)w * h * sizeof(RLFL_cell_t));
+	if(data == NULL) {
+		return NULL;
+	}
+	WITHOUT_GIL(m, MAP_READ, RLFL_map_read(m, (RLFL_cell_t *)PyByteArray_AS_STRING(data)));
+
+	return data;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Replace all cells from a buffer of width * height
+ * 			cells, row major, any layout
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+write_cells(PyObject *self, PyObject* args)
+{
+	unsigned int m;
+	PyObject *source;
+	if(!PyArg_ParseTuple(args, "iO", &m, &source)) {
+		return NULL;
+	}
+
+	unsigned int w, h;
+	int e = RLFL_map_size(m, &w, &h);
+	if(e < 0) {
+		return RLFL_handle_error(e, NULL);
+	}
+
+	Py_buffer data;
+	if(PyObject_GetBuffer(source, &data, PyBUF_C_CONTIGUOUS) < 0) {
+		return NULL;
+	}
+	if(data.len != (Py_ssize_t)((size_t)w * h * sizeof(RLFL_cell_t))) {
+		PyBuffer_Release(&data);
+		return RLFL_handle_error(RLFL_ERR_SIZE, "Invalid buffer size");
+	}
+
+	e = WITH_MAP(m, MAP_WRITE, RLFL_map_write(m, (const RLFL_cell_t *)data.buf));
+	PyBuffer_Release(&data);
+	if(e < 0) {
+		return RLFL_handle_error(e, NULL);
+	}
+	Py_RETURN_NONE;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Export the cells of a map, pins the map
+ +-----------------------------------------------------------+
+ */
+static int
+cells_getbuffer(PyObject *obj, Py_buffer *view, int flags)
+{
+	RLFL_cells_t *exporter = (RLFL_cells_t *)obj;
+	RLFL_cell_t *cells;
+	int e = RLFL_map_cells(exporter->map, &cells);
+	if(e < 0) {
+		view->obj = NULL;
+		RLFL_handle_error(e, NULL);
+		return -1;
+	}
+
+	RLFL_map_pin(exporter->map);
+	Py_INCREF(obj);
+	view->obj = obj;
+	view->buf = cells;
+	view->len = exporter->shape[0] * exporter->strides[0];
+	view->readonly = 0;
+	view->itemsize = sizeof(RLFL_cell_t);
+	view->format = NULL;
+	if(flags & PyBUF_FORMAT) {
+		view->format = (sizeof(RLFL_cell_t) == 2) ? "H" : (sizeof(RLFL_cell_t) == 4) ? "I" : "Q";
+	}
+	view->ndim = 2;
+	view->shape = (flags & PyBUF_ND) ? exporter->shape : NULL;
+	view->strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? exporter->strides : NULL;
+	view->suboffsets = NULL;
+	view->internal = NULL;
+	return 0;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Release an export, unpins the map
+ +-----------------------------------------------------------+
+ */
+static void
+cells_releasebuffer(PyObject *obj, Py_buffer *view)
+{
+	RLFL_map_cells_release(((RLFL_cells_t *)obj)->map);
+	RLFL_map_unpin(((RLFL_cells_t *)obj)->map);
+}
+
+static PyBufferProcs RLFL_cells_buffer = {
+	.bf_getbuffer = cells_getbuffer,
+	.bf_releasebuffer = cells_releasebuffer,
+};
+
+static PyTypeObject RLFL_cells_type = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "rlfl.MapCells",
+	.tp_basicsize = sizeof(RLFL_cells_t),
+	.tp_as_buffer = &RLFL_cells_buffer,
+#if PY_MAJOR_VERSION >= 3
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+#else
+	.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER,
+#endif
+	.tp_doc = "Cells of a dense map",
+};
+/*
+ +-----------------------------------------------------------+
+ * @desc	Set the most maps alive at once
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+set_max_maps(PyObject *self, PyObject* args)
+{
+	int limit;
+	if(!PyArg_ParseTuple(args, "i", &limit)) {
+		return NULL;
+	}
+
+	if(limit < 1 || RLFL_set_max_maps(limit) < 0) {
+		return RLFL_handle_error(RLFL_ERR_GENERIC, "Invalid map limit");
+	}
+	Py_RETURN_NONE;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Get the most maps alive at once
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+max_maps(PyObject *self, PyObject* args)
+{
+	return Py_BuildValue("i", RLFL_max_maps());
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Get number of live maps
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+map_count(PyObject *self, PyObject* args)
+{
+	return Py_BuildValue("i", RLFL_map_count());
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Destroy all maps
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+delete_all_maps(PyObject *self, PyObject* args) {
+	RLFL_wipe_all();
+	Py_RETURN_NONE;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Destroy map
+ * @param	int
+ * @return  Bool
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+delete_map(PyObject *self, PyObject* args) {
+	unsigned int n;
+	if(!PyArg_ParseTuple(args, "i", &n)) {
+		return NULL;
+	}
+
+	err e = RLFL_wipe_map(n);
+	if(e == RLFL_ERR_BUSY) {
+		return RLFL_handle_error(e, NULL);
+	}
+	if(e > -1) {
+		Py_RETURN_TRUE;
+	}
+	Py_RETURN_FALSE;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Compute path map
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+path_fill_map(PyObject *self, PyObject* args) {
+	unsigned int m, x, y, s=0;
+	float f = 0.0;
+	if(!PyArg_ParseTuple(args, "i(ii)|fi", &m, &x, &y, &f, &s)) {
+		return NULL;
+	}
+	int e = WITHOUT_GIL(m, MAP_WRITE, RLFL_path_fill_map(m, x, y, f, s));
+	if(e < 0) {
+		if(e == RLFL_ERR_NO_PATH)
+			return RLFL_handle_error(e, "Unable to create pathmap: Too many maps");
+		return RLFL_handle_error(e, NULL);
+	}
+
+	return Py_BuildValue("i", e);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Compute safety map
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+path_fill_safety_map(PyObject *self, PyObject* args) {
+	unsigned int m, x, y;
+	float f = 0.0;
+	if(!PyArg_ParseTuple(args, "i(ii)|f", &m, &x, &y, &f)) {
+		return NULL;
+	}
+	int e = WITHOUT_GIL(m, MAP_WRITE, RLFL_path_fill_map(m, x, y, f, true));
+	if(e < 0) {
+		if(e == RLFL_ERR_NO_PATH)
+			return RLFL_handle_error(e, "Unable to create pathmap: Too many maps");
+		return RLFL_handle_error(e, NULL);
+	}
+
+	return Py_BuildValue("i", e);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Compute autoexplore map
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+path_fill_autoexplore_map(PyObject *self, PyObject* args) {
+	unsigned int m;
+	unsigned long flg = 0;
+	float f = 0.0;
+	if(!PyArg_ParseTuple(args, "i|lf", &m, &flg, &f)) {
+		return NULL;
+	}
+	int e = WITHOUT_GIL(m, MAP_WRITE, RLFL_path_fill_autoexplore_map(m, flg, f));
+	if(e < 0) {
+		if(e == RLFL_ERR_NO_PATH)
+			return RLFL_handle_error(e, "Unable to create pathmap: Too many maps");
+		return RLFL_handle_error(e, NULL);
+	}
+
+	return Py_BuildValue("i", e);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Compute custom map
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+path_fill_custom_map(PyObject *self, PyObject* args) {
+	unsigned int m;
+	unsigned long flg = 0;
+	float f = 0.0;
+	if(!PyArg_ParseTuple(args, "i|lf", &m, &f, &flg)) {
+		return NULL;
+	}
+	int e = WITHOUT_GIL(m, MAP_WRITE, RLFL_path_fill_custom_map(m, flg, f));
+	if(e < 0) {
+		if(e == RLFL_ERR_NO_PATH)
+			return RLFL_handle_error(e, "Unable to create pathmap: Too many maps");
+		return RLFL_handle_error(e, NULL);
+	}
+
+	return Py_BuildValue("i", e);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Compute path map
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+path_step_map(PyObject *self, PyObject* args) {
+	unsigned int m, p, x, y;
+	if(!PyArg_ParseTuple(args, "ii(ii)", &m, &p, &x, &y)) {
+		return NULL;
+	}
+	unsigned int nx, ny;
+	int e = WITH_MAP(m, MAP_READ, RLFL_path_step_map(m, p, x, y, &nx, &ny));
+	if(e < 0) {
+		if(e == RLFL_ERR_NO_PATH)
+			return RLFL_handle_error(e, "Uninitialized pathmap used");
+		if(e == RLFL_ERR_GENERIC)
+			return RLFL_handle_error(e, "Found no path");
+		return RLFL_handle_error(e, NULL);
+	}
+	return Py_BuildValue("(ii)", nx, ny);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Wipe path map
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+path_clear_map(PyObject *self, PyObject* args) {
+	unsigned int m, p;
+	if(!PyArg_ParseTuple(args, "ii", &m, &p)) {
+		return NULL;
+	}
+	int e = WITH_MAP(m, MAP_WRITE, RLFL_path_wipe_map(m, p));
+	if(e < 0) {
+		return RLFL_handle_error(e, NULL);
+	}
+	Py_RETURN_NONE;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Wipe all path maps
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+path_clear_all_maps(PyObject *self, PyObject* args) {
+	unsigned int m;
+	if(!PyArg_ParseTuple(args, "i", &m)) {
+		return NULL;
+	}
+	int e = WITH_MAP(m, MAP_WRITE, RLFL_path_wipe_all_maps(m));
+	if(e < 0) {
+		return RLFL_handle_error(e, NULL);
+	}
+	Py_RETURN_NONE;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	New map stack, of the maps of a sequence
+ * @return 	Stack number
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+create_stack(PyObject *self, PyObject* args) {
+	PyObject *maps = NULL;
+	if(!PyArg_ParseTuple(args, "|O", &maps)) {
+		return NULL;
+	}
+	int s = RLFL_stack_new();
+	if(s < 0) {
+		if(s == RLFL_ERR_FLAG)
+			return RLFL_handle_error(s, "Too many stacks");
+		return RLFL_handle_error(s, NULL);
+	}
+	if(maps == NULL) {
+		return Py_BuildValue("i", s);
+	}
+
+	PyObject *seq = PySequence_Fast(maps, "Expected a sequence of maps");
+	if(seq == NULL) {
+		RLFL_stack_delete(s);
+		return NULL;
+	}
+	Py_ssize_t i, size = PySequence_Fast_GET_SIZE(seq);
+	for(i=0; i<size; i++) {
+		long m = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+		int e = (m == -1 && PyErr_Occurred()) ? RLFL_ERR_GENERIC : RLFL_stack_add(s, m);
+		if(e < 0) {
+			Py_DECREF(seq);
+			RLFL_stack_delete(s);
+			if(PyErr_Occurred())
+				return NULL;
+			if(e == RLFL_ERR_FLAG)
+				return RLFL_handle_error(e, "Map is already a level");
+			return RLFL_handle_error(e, NULL);
+		}
+	}
+	Py_DECREF(seq);
+	return Py_BuildValue("i", s);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Delete map stack, the maps are kept
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+delete_stack(PyObject *self, PyObject* args) {
+	unsigned int s;
+	if(!PyArg_ParseTuple(args, "i", &s)) {
+		return NULL;
+	}
+	err e = RLFL_stack_delete(s);
+	if(e < 0) {
+		return RLFL_handle_error(e, NULL);
+	}
+	Py_RETURN_NONE;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Add a map as the next level of a stack
+ * @return 	Level number
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+stack_add(PyObject *self, PyObject* args) {
+	unsigned int s, m;
+	if(!PyArg_ParseTuple(args, "ii", &s, &m)) {
+		return NULL;
+	}
+	int l = RLFL_stack_add(s, m);
+	if(l < 0) {
+		if(l == RLFL_ERR_FLAG)
+			return RLFL_handle_error(l, "Map is already a level");
+		return RLFL_handle_error(l, NULL);
+	}
+	return Py_BuildValue("i", l);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Maps of the levels of a stack
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+stack_levels(PyObject *self, PyObject* args) {
+	unsigned int s;
+	if(!PyArg_ParseTuple(args, "i", &s)) {
+		return NULL;
+	}
+	int i, n = RLFL_stack_size(s);
+	if(n < 0) {
+		return RLFL_handle_error(n, NULL);
+	}
+	PyObject *result = PyTuple_New(n);
+	if(result == NULL) {
+		return NULL;
+	}
+	for(i=0; i<n; i++) {
+		PyTuple_SetItem(result, i, Py_BuildValue("i", RLFL_stack_level(s, i)));
+	}
+	return result;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Portal between cells of two levels, both ways
+ * 			unless `both` is False
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+link_levels(PyObject *self, PyObject* args) {
+	unsigned int s, l1, x1, y1, l2, x2, y2, type = PORTAL_STAIRS;
+	float cost = 1.0;
+	int both = true;
+	if(!PyArg_ParseTuple(args, "i(iii)(iii)|ifi", &s, &l1, &x1, &y1, &l2, &x2, &y2, &type, &cost, &both)) {
+		return NULL;
+	}
+	err e = RLFL_stack_link(s, l1, x1, y1, l2, x2, y2, type, cost);
+	if(e == RLFL_SUCCESS && both) {
+		e = RLFL_stack_link(s, l2, x2, y2, l1, x1, y1, type, cost);
+		if(e < 0)
+			RLFL_stack_unlink(s, l1, x1, y1);
+	}
+	if(e < 0) {
+		if(e == RLFL_ERR_FLAG)
+			return RLFL_handle_error(e, "Invalid portal type");
+		if(e == RLFL_ERR_GENERIC)
+			return RLFL_handle_error(e, "Invalid portal cost");
+		return RLFL_handle_error(e, NULL);
+	}
+	Py_RETURN_NONE;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Remove the portals from and to a cell of a level
+ * @return 	Number removed
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+unlink_levels(PyObject *self, PyObject* args) {
+	unsigned int s, l, x, y;
+	if(!PyArg_ParseTuple(args, "i(iii)", &s, &l, &x, &y)) {
+		return NULL;
+	}
+	int n = RLFL_stack_unlink(s, l, x, y);
+	if(n < 0) {
+		return RLFL_handle_error(n, NULL);
+	}
+	return Py_BuildValue("i", n);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Shortest path across the levels of a stack, as
+ * 			(level, x, y) steps, or False
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+stack_path(PyObject *self, PyObject* args) {
+	unsigned int s, l1, x1, y1, l2, x2, y2, types = PORTAL_ALL;
+	float d = 0.0;
+	if(!PyArg_ParseTuple(args, "i(iii)(iii)|if", &s, &l1, &x1, &y1, &l2, &x2, &y2, &types, &d)) {
+		return NULL;
+	}
+	RLFL_ctx_t *ctx = thread_ctx();
+	if(ctx == NULL) {
+		return PyErr_NoMemory();
+	}
+
+	/* Most paths fit, longer ones are searched again */
+	unsigned int *held, max = 1024, *steps = NULL;
+	int i, n;
+	do {
+		PyMem_Free(steps);
+		steps = (unsigned int *)PyMem_Malloc(sizeof(unsigned int) * 3 * max);
+		if(steps == NULL) {
+			return PyErr_NoMemory();
+		}
+		int h = hold_stack(s, MAP_READ, &held);
+		if(h < 0) {
+			PyMem_Free(steps);
+			return RLFL_handle_error(h, NULL);
+		}
+		n = RLFL_stack_path_ctx(ctx, s, l1, x1, y1, l2, x2, y2, types, d, steps, max);
+		release_stack(held, h);
+		if(n <= (int)max)
+			break;
+		max = n;
+	} while(true);
+
+	if(n < 0) {
+		PyMem_Free(steps);
+		if(n == RLFL_ERR_NO_PATH)
+			Py_RETURN_FALSE;
+		return RLFL_handle_error(n, NULL);
+	}
+	PyObject *result = PyTuple_New(n);
+	for(i=0; result && i<n; i++) {
+		PyTuple_SetItem(result, i, Py_BuildValue("(iii)", steps[i * 3], steps[(i * 3) + 1], steps[(i * 3) + 2]));
+	}
+	PyMem_Free(steps);
+	return result;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Path map to a cell of a stack, on every level
+ * @return 	Path map number
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+stack_fill_map(PyObject *self, PyObject* args) {
+	unsigned int s, l, x, y, types = PORTAL_ALL;
+	float d = 0.0;
+	if(!PyArg_ParseTuple(args, "i(iii)|if", &s, &l, &x, &y, &types, &d)) {
+		return NULL;
+	}
+	RLFL_ctx_t *ctx = thread_ctx();
+	if(ctx == NULL) {
+		return PyErr_NoMemory();
+	}
+	unsigned int *held;
+	int h = hold_stack(s, MAP_WRITE, &held);
+	if(h < 0) {
+		return RLFL_handle_error(h, NULL);
+	}
+	int pm = RLFL_stack_fill_map_ctx(ctx, s, l, x, y, types, d);
+	release_stack(held, h);
+	if(pm < 0) {
+		if(pm == RLFL_ERR_NO_PATH)
+			return RLFL_handle_error(pm, "Unable to create pathmap: Too many maps");
+		return RLFL_handle_error(pm, NULL);
+	}
+	return Py_BuildValue("i", pm);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Step on the path map of a stack
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+stack_step_map(PyObject *self, PyObject* args) {
+	unsigned int s, p, l, x, y, types = PORTAL_ALL;
+	if(!PyArg_ParseTuple(args, "ii(iii)|i", &s, &p, &l, &x, &y, &types)) {
+		return NULL;
+	}
+	unsigned int *held, nl, nx, ny;
+	int h = hold_stack(s, MAP_READ, &held);
+	if(h < 0) {
+		return RLFL_handle_error(h, NULL);
+	}
+	err e = RLFL_stack_step_map(s, p, l, x, y, types, &nl, &nx, &ny);
+	release_stack(held, h);
+	if(e < 0) {
+		if(e == RLFL_ERR_NO_PATH)
+			return RLFL_handle_error(e, "Uninitialized pathmap used");
+		if(e == RLFL_ERR_GENERIC)
+			return RLFL_handle_error(e, "Found no path");
+		return RLFL_handle_error(e, NULL);
+	}
+	return Py_BuildValue("(iii)", nl, nx, ny);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Wipe the path map of a stack
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+stack_clear_map(PyObject *self, PyObject* args) {
+	unsigned int s, p;
+	if(!PyArg_ParseTuple(args, "ii", &s, &p)) {
+		return NULL;
+	}
+	unsigned int *held;
+	int h = hold_stack(s, MAP_WRITE, &held);
+	if(h < 0) {
+		return RLFL_handle_error(h, NULL);
+	}
+	err e = RLFL_stack_wipe_map(s, p);
+	release_stack(held, h);
+	if(e < 0) {
+		return RLFL_handle_error(e, NULL);
+	}
+	Py_RETURN_NONE;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Set flag
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+set_flag(PyObject *self, PyObject* args) {
+	unsigned int m, x, y;
+	unsigned long flag;
+	if(!PyArg_ParseTuple(args, "i(ii)l", &m, &x, &y, &flag)) {
+		return NULL;
+	}
+	int e = WITH_MAP(m, MAP_WRITE, RLFL_set_flag(m, x, y, flag));
+	if(e < 0) {
+		return RLFL_handle_error(e, NULL);
+	}
+	Py_RETURN_NONE;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Has flag
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+has_flag(PyObject *self, PyObject* args) {
+	unsigned int n, x, y;
+	unsigned long flag;
+	if(!PyArg_ParseTuple(args, "i(ii)l", &n, &x, &y, &flag)) {
+		return NULL;
+	}
+	err e = WITH_MAP(n, MAP_READ, RLFL_has_flag(n, x, y, flag));
+	if(e < 0) {
+		return RLFL_handle_error(e, NULL);
+	}
+	if(e) {
+		Py_RETURN_TRUE;
+	}
+	Py_RETURN_FALSE;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Clear flag
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+clear_flag(PyObject *self, PyObject* args) {
+	unsigned int n, x, y;
+	unsigned long flag;
+	if(!PyArg_ParseTuple(args, "i(ii)l", &n, &x, &y, &flag)) {
+		return NULL;
+	}
+	err e = WITH_MAP(n, MAP_WRITE, RLFL_clear_flag(n, x, y, flag));
+	if(e < 0) {
+		return RLFL_handle_error(e, NULL);
+	}
+	Py_RETURN_NONE;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Get flags
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+get_flags(PyObject *self, PyObject* args) {
+	unsigned int m, x, y;
+	if(!PyArg_ParseTuple(args, "i(ii)", &m, &x, &y)) {
+		return NULL;
+	}
+	int flag = WITH_MAP(m, MAP_READ, RLFL_get_flags(m, x, y));
+	if(flag < 0) {
+		return RLFL_handle_error(flag, NULL);
+	}
+	return Py_BuildValue("i", flag);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Set flag on rectangle
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+set_flag_rect(PyObject *self, PyObject* args) {
+	unsigned int m, x, y, w, h;
+	unsigned long flag;
+	if(!PyArg_ParseTuple(args, "i(ii)(ii)l", &m, &x, &y, &w, &h, &flag)) {
+		return NULL;
+	}
+	err e = WITH_MAP(m, MAP_WRITE, RLFL_set_flag_rect(m, x, y, w, h, flag));
+	if(e < 0) {
+		return RLFL_handle_error(e, NULL);
+	}
+	Py_RETURN_NONE;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Clear flag on rectangle
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+clear_flag_rect(PyObject *self, PyObject* args) {
+	unsigned int m, x, y, w, h;
+	unsigned long flag;
+	if(!PyArg_ParseTuple(args, "i(ii)(ii)l", &m, &x, &y, &w, &h, &flag)) {
+		return NULL;
+	}
+	err e = WITH_MAP(m, MAP_WRITE, RLFL_clear_flag_rect(m, x, y, w, h, flag));
+	if(e < 0) {
+		return RLFL_handle_error(e, NULL);
+	}
+	Py_RETURN_NONE;
 }
 /*
  +-----------------------------------------------------------+
- * @desc	Compute path map
+ * @desc	Query rectangle, packed bits in row major order
  +-----------------------------------------------------------+
  */
 static PyObject*
-path_fill_map(PyObject *self, PyObject* args) {
-	unsigned int m, x, y, s=0;
-	float f = 0.0;
-	if(!PyArg_ParseTuple(args, "i(ii)|fi", &m, &x, &y, &f, &s)) {
+has_flag_rect(PyObject *self, PyObject* args) {
+	unsigned int m, x, y, w, h;
+	unsigned long flag;
+	if(!PyArg_ParseTuple(args, "i(ii)(ii)l", &m, &x, &y, &w, &h, &flag)) {
 		return NULL;
 	}
-	int e = RLFL_path_fill_map(m, x, y, f, s);
+	int e = WITH_MAP(m, MAP_READ, RLFL_has_flag_rect(m, x, y, w, h, flag, NULL));
 	if(e < 0) {
-		if(e == RLFL_ERR_NO_PATH)
-			return RLFL_handle_error(e, "Unable to create pathmap: Too many maps");
 		return RLFL_handle_error(e, NULL);
 	}
-
-	return Py_BuildValue("i", e);
+	PyObject *bits = PyBytes_FromStringAndSize(NULL, ((Py_ssize_t)w * h + 7) / 8);
+	if(bits == NULL) {
+		return NULL;
+	}
+	WITH_MAP(m, MAP_READ, RLFL_has_flag_rect(m, x, y, w, h, flag, (uint8_t *)PyBytes_AS_STRING(bits)));
+	return bits;
 }
 /*
  +-----------------------------------------------------------+
- * @desc	Compute safety map
+ * @desc	Count cells with flag, in the whole map or a
+ * 			rectangle
  +-----------------------------------------------------------+
  */
 static PyObject*
-path_fill_safety_map(PyObject *self, PyObject* args) {
-	unsigned int m, x, y;
-	float f = 0.0;
-	if(!PyArg_ParseTuple(args, "i(ii)|f", &m, &x, &y, &f)) {
+count_flags(PyObject *self, PyObject* args) {
+	unsigned int m, x = 0, y = 0, w, h;
+	unsigned long flag;
+	if(!PyArg_ParseTuple(args, "il|(ii)(ii)", &m, &flag, &x, &y, &w, &h)) {
 		return NULL;
 	}
-	int e = RLFL_path_fill_map(m, x, y, f, true);
-	if(e < 0) {
-		if(e == RLFL_ERR_NO_PATH)
-			return RLFL_handle_error(e, "Unable to create pathmap: Too many maps");
-		return RLFL_handle_error(e, NULL);
+	if(PyTuple_GET_SIZE(args) == 3) {
+		PyErr_SetString(PyExc_TypeError, "Expected both p and size");
+		return NULL;
 	}
-
-	return Py_BuildValue("i", e);
+	int n = (PyTuple_GET_SIZE(args) > 2)
+		? WITH_MAP(m, MAP_READ, RLFL_count_flags_rect(m, x, y, w, h, flag))
+		: WITH_MAP(m, MAP_READ, RLFL_count_flags(m, flag));
+	if(n < 0) {
+		return RLFL_handle_error(n, NULL);
+	}
+	return Py_BuildValue("i", n);
 }
 /*
  +-----------------------------------------------------------+
- * @desc	Compute autoexplore map
+ * @desc	Cells with each flag, in the whole map or a
+ * 			rectangle
+ * @return	Dict of flag to count
  +-----------------------------------------------------------+
  */
 static PyObject*
-path_fill_autoexplore_map(PyObject *self, PyObject* args) {
-	unsigned int m;
-	unsigned long flg = 0;
-	float f = 0.0;
-	if(!PyArg_ParseTuple(args, "i|lf", &m, &flg, &f)) {
+flag_histogram(PyObject *self, PyObject* args) {
+	unsigned int m, x = 0, y = 0, w, h;
+	unsigned int counts[RLFL_PLANES];
+	if(!PyArg_ParseTuple(args, "i|(ii)(ii)", &m, &x, &y, &w, &h)) {
+		return NULL;
+	}
+	if(PyTuple_GET_SIZE(args) == 2) {
+		PyErr_SetString(PyExc_TypeError, "Expected both p and size");
 		return NULL;
 	}
-	int e = RLFL_path_fill_autoexplore_map(m, flg, f);
+	int e = (PyTuple_GET_SIZE(args) > 1)
+		? WITH_MAP(m, MAP_READ, RLFL_flag_histogram_rect(m, x, y, w, h, counts))
+		: WITH_MAP(m, MAP_READ, RLFL_flag_histogram(m, counts));
 	if(e < 0) {
-		if(e == RLFL_ERR_NO_PATH)
-			return RLFL_handle_error(e, "Unable to create pathmap: Too many maps");
 		return RLFL_handle_error(e, NULL);
 	}
-
-	return Py_BuildValue("i", e);
+	PyObject *hist = PyDict_New();
+	int b;
+	for(b=0; hist && b<RLFL_PLANES; b++) {
+		PyObject *key = PyLong_FromUnsignedLong(1UL << b);
+		PyObject *value = PyLong_FromUnsignedLong(counts[b]);
+		if(key == NULL || value == NULL || PyDict_SetItem(hist, key, value)) {
+			Py_CLEAR(hist);
+		}
+		Py_XDECREF(key);
+		Py_XDECREF(value);
+	}
+	return hist;
 }
 /*
  +-----------------------------------------------------------+
- * @desc	Compute custom map
+ * @desc	Sequence of (x, y) to x, y pairs, free with
+ * 			PyMem_Free()
  +-----------------------------------------------------------+
  */
-static PyObject*
-path_fill_custom_map(PyObject *self, PyObject* args) {
-	unsigned int m;
-	unsigned long flg = 0;
-	float f = 0.0;
-	if(!PyArg_ParseTuple(args, "i|lf", &m, &f, &flg)) {
+static unsigned int*
+parse_coords(PyObject *coords, unsigned int *n)
+{
+	PyObject *seq = PySequence_Fast(coords, "Expected a sequence of (x, y)");
+	if(seq == NULL) {
 		return NULL;
 	}
-	int e = RLFL_path_fill_custom_map(m, flg, f);
-	if(e < 0) {
-		if(e == RLFL_ERR_NO_PATH)
-			return RLFL_handle_error(e, "Unable to create pathmap: Too many maps");
-		return RLFL_handle_error(e, NULL);
-	}
 
-	return Py_BuildValue("i", e);
+	Py_ssize_t i, size = PySequence_Fast_GET_SIZE(seq);
+	unsigned int *xy = (unsigned int *)PyMem_Malloc(sizeof(unsigned int) * 2 * (size ? size : 1));
+	if(xy == NULL) {
+		Py_DECREF(seq);
+		PyErr_NoMemory();
+		return NULL;
+	}
+	for(i=0; i<size; i++) {
+		PyObject *p = PySequence_Fast_GET_ITEM(seq, i);
+		if(!PyTuple_Check(p) || !PyArg_ParseTuple(p, "ii", &xy[i * 2], &xy[(i * 2) + 1])) {
+			if(!PyErr_Occurred())
+				PyErr_SetString(PyExc_TypeError, "Expected a sequence of (x, y)");
+			Py_DECREF(seq);
+			PyMem_Free(xy);
+			return NULL;
+		}
+	}
+	Py_DECREF(seq);
+	(*n) = size;
+	return xy;
 }
 /*
  +-----------------------------------------------------------+
- * @desc	Compute path map
+ * @desc	Set flag on a list of cells
  +-----------------------------------------------------------+
  */
 static PyObject*
-path_step_map(PyObject *self, PyObject* args) {
-	unsigned int m, p, x, y;
-	if(!PyArg_ParseTuple(args, "ii(ii)", &m, &p, &x, &y)) {
+set_flag_list(PyObject *self, PyObject* args) {
+	unsigned int m, n;
+	PyObject *coords;
+	unsigned long flag;
+	if(!PyArg_ParseTuple(args, "iOl", &m, &coords, &flag)) {
 		return NULL;
 	}
-	unsigned int nx, ny;
-	int e = RLFL_path_step_map(m, p, x, y, &nx, &ny);
+	unsigned int *xy = parse_coords(coords, &n);
+	if(xy == NULL) {
+		return NULL;
+	}
+	err e = WITH_MAP(m, MAP_WRITE, RLFL_set_flag_list(m, xy, n, flag));
+	PyMem_Free(xy);
 	if(e < 0) {
-		if(e == RLFL_ERR_NO_PATH)
-			return RLFL_handle_error(e, "Uninitialized pathmap used");
-		if(e == RLFL_ERR_GENERIC)
-			return RLFL_handle_error(e, "Found no path");
 		return RLFL_handle_error(e, NULL);
 	}
-	return Py_BuildValue("(ii)", nx, ny);
+	Py_RETURN_NONE;
 }
 /*
  +-----------------------------------------------------------+
- * @desc	Wipe path map
+ * @desc	Clear flag on a list of cells
  +-----------------------------------------------------------+
  */
 static PyObject*
-path_clear_map(PyObject *self, PyObject* args) {
-	unsigned int m, p;
-	if(!PyArg_ParseTuple(args, "ii", &m, &p)) {
+clear_flag_list(PyObject *self, PyObject* args) {
+	unsigned int m, n;
+	PyObject *coords;
+	unsigned long flag;
+	if(!PyArg_ParseTuple(args, "iOl", &m, &coords, &flag)) {
 		return NULL;
 	}
-	int e = RLFL_path_wipe_map(m, p);
+	unsigned int *xy = parse_coords(coords, &n);
+	if(xy == NULL) {
+		return NULL;
+	}
+	err e = WITH_MAP(m, MAP_WRITE, RLFL_clear_flag_list(m, xy, n, flag));
+	PyMem_Free(xy);
 	if(e < 0) {
 		return RLFL_handle_error(e, NULL);
 	}
@@ -246,94 +1586,141 @@ path_clear_map(PyObject *self, PyObject* args) {
 }
 /*
  +-----------------------------------------------------------+
- * @desc	Wipe all path maps
+ * @desc	Query a list of cells, packed bits in list order
  +-----------------------------------------------------------+
  */
 static PyObject*
-path_clear_all_maps(PyObject *self, PyObject* args) {
-	unsigned int m;
-	if(!PyArg_ParseTuple(args, "i", &m)) {
+has_flag_list(PyObject *self, PyObject* args) {
+	unsigned int m, n;
+	PyObject *coords;
+	unsigned long flag;
+	if(!PyArg_ParseTuple(args, "iOl", &m, &coords, &flag)) {
+		return NULL;
+	}
+	unsigned int *xy = parse_coords(coords, &n);
+	if(xy == NULL) {
+		return NULL;
+	}
+	PyObject *bits = PyBytes_FromStringAndSize(NULL, ((Py_ssize_t)n + 7) / 8);
+	if(bits == NULL) {
+		PyMem_Free(xy);
 		return NULL;
 	}
-	int e = RLFL_path_wipe_all_maps(m);
+	int e = WITH_MAP(m, MAP_READ, RLFL_has_flag_list(m, xy, n, flag, (uint8_t *)PyBytes_AS_STRING(bits)));
+	PyMem_Free(xy);
 	if(e < 0) {
+		Py_DECREF(bits);
 		return RLFL_handle_error(e, NULL);
 	}
-	Py_RETURN_NONE;
+	return bits;
 }
 /*
  +-----------------------------------------------------------+
- * @desc	Set flag
+ * @desc	Set flag where another map has a flag
  +-----------------------------------------------------------+
  */
 static PyObject*
-set_flag(PyObject *self, PyObject* args) {
-	unsigned int m, x, y;
-	unsigned long flag;
-	if(!PyArg_ParseTuple(args, "i(ii)l", &m, &x, &y, &flag)) {
+set_flag_mask(PyObject *self, PyObject* args) {
+	unsigned int m, mask;
+	unsigned long mflag, flag;
+	if(!PyArg_ParseTuple(args, "iill", &m, &mask, &mflag, &flag)) {
 		return NULL;
 	}
-	int e = RLFL_set_flag(m, x, y, flag);
+	err e = WITH_MAPS(m, MAP_WRITE, mask, MAP_READ, RLFL_set_flag_mask(m, mask, mflag, flag));
 	if(e < 0) {
+		if(e == RLFL_ERR_SIZE)
+			return RLFL_handle_error(e, "Map sizes differ");
 		return RLFL_handle_error(e, NULL);
 	}
 	Py_RETURN_NONE;
 }
 /*
  +-----------------------------------------------------------+
- * @desc	Has flag
+ * @desc	Clear flag where another map has a flag
  +-----------------------------------------------------------+
  */
 static PyObject*
-has_flag(PyObject *self, PyObject* args) {
-	unsigned int n, x, y;
-	unsigned long flag;
-	if(!PyArg_ParseTuple(args, "i(ii)l", &n, &x, &y, &flag)) {
+clear_flag_mask(PyObject *self, PyObject* args) {
+	unsigned int m, mask;
+	unsigned long mflag, flag;
+	if(!PyArg_ParseTuple(args, "iill", &m, &mask, &mflag, &flag)) {
 		return NULL;
 	}
-	err e = RLFL_has_flag(n, x, y, flag);
+	err e = WITH_MAPS(m, MAP_WRITE, mask, MAP_READ, RLFL_clear_flag_mask(m, mask, mflag, flag));
 	if(e < 0) {
+		if(e == RLFL_ERR_SIZE)
+			return RLFL_handle_error(e, "Map sizes differ");
 		return RLFL_handle_error(e, NULL);
 	}
-	if(e) {
-		Py_RETURN_TRUE;
-	}
-	Py_RETURN_FALSE;
+	Py_RETURN_NONE;
 }
 /*
  +-----------------------------------------------------------+
- * @desc	Clear flag
+ * @desc	Query flag where another map has a flag, packed
+ * 			bits for every cell in row major order
  +-----------------------------------------------------------+
  */
 static PyObject*
-clear_flag(PyObject *self, PyObject* args) {
-	unsigned int n, x, y;
-	unsigned long flag;
-	if(!PyArg_ParseTuple(args, "i(ii)l", &n, &x, &y, &flag)) {
+has_flag_mask(PyObject *self, PyObject* args) {
+	unsigned int m, mask;
+	unsigned long mflag, flag;
+	if(!PyArg_ParseTuple(args, "iill", &m, &mask, &mflag, &flag)) {
 		return NULL;
 	}
-	err e = RLFL_clear_flag(n, x, y, flag);
+	int e = WITH_MAPS(m, MAP_READ, mask, MAP_READ, RLFL_has_flag_mask(m, mask, mflag, flag, NULL));
 	if(e < 0) {
+		if(e == RLFL_ERR_SIZE)
+			return RLFL_handle_error(e, "Map sizes differ");
 		return RLFL_handle_error(e, NULL);
 	}
-	Py_RETURN_NONE;
+	unsigned int w, h;
+	RLFL_map_size(m, &w, &h);
+	PyObject *bits = PyBytes_FromStringAndSize(NULL, ((Py_ssize_t)w * h + 7) / 8);
+	if(bits == NULL) {
+		return NULL;
+	}
+	WITH_MAPS(m, MAP_READ, mask, MAP_READ, RLFL_has_flag_mask(m, mask, mflag, flag, (uint8_t *)PyBytes_AS_STRING(bits)));
+	return bits;
 }
 /*
  +-----------------------------------------------------------+
- * @desc	Get flags
+ * @desc	Merge flags of one map into another
  +-----------------------------------------------------------+
  */
 static PyObject*
-get_flags(PyObject *self, PyObject* args) {
-	unsigned int m, x, y;
-	if(!PyArg_ParseTuple(args, "i(ii)", &m, &x, &y)) {
+merge_map(PyObject *self, PyObject* args) {
+	unsigned int m, src, op, x = 0, y = 0, w = 0, h = 0;
+	unsigned long flag = CELL_MASK;
+	PyObject *p = NULL;
+	if(!PyArg_ParseTuple(args, "iii|lO(ii)", &m, &src, &op, &flag, &p, &w, &h)) {
 		return NULL;
 	}
-	int flag = RLFL_get_flags(m, x, y);
-	if(flag < 0) {
-		return RLFL_handle_error(flag, NULL);
+
+	/* Whole map unless a rectangle is given */
+	if(p == NULL) {
+		if(RLFL_map_size(m, &w, &h) < 0) {
+			return RLFL_handle_error(RLFL_ERR_NO_MAP, NULL);
+		}
 	}
-	return Py_BuildValue("i", flag);
+	else if(PyTuple_Size(args) < 6) {
+		PyErr_SetString(PyExc_TypeError, "Expected both p and size");
+		return NULL;
+	}
+	else if(!PyTuple_Check(p) || !PyArg_ParseTuple(p, "ii", &x, &y)) {
+		if(!PyErr_Occurred())
+			PyErr_SetString(PyExc_TypeError, "Expected p as (x, y)");
+		return NULL;
+	}
+
+	err e = WITH_MAPS(m, MAP_WRITE, src, MAP_READ, RLFL_merge_map_rect(m, src, op, flag, x, y, w, h));
+	if(e < 0) {
+		if(e == RLFL_ERR_SIZE)
+			return RLFL_handle_error(e, "Map sizes differ");
+		if(e == RLFL_ERR_GENERIC)
+			return RLFL_handle_error(e, "Invalid merge operation");
+		return RLFL_handle_error(e, NULL);
+	}
+	Py_RETURN_NONE;
 }
 /*
  +-----------------------------------------------------------+
@@ -347,7 +1734,7 @@ clear_map(PyObject *self, PyObject* args) {
 	if(!PyArg_ParseTuple(args, "i|l", &n, &f)) {
 		return NULL;
 	}
-	err e = RLFL_clear_map(n, f);
+	err e = WITH_MAP(n, MAP_WRITE, RLFL_clear_map(n, f));
 	if(e < 0) {
 		return RLFL_handle_error(e, NULL);
 	}
@@ -365,7 +1752,7 @@ fill_map(PyObject *self, PyObject* args) {
 	if(!PyArg_ParseTuple(args, "il", &n, &flag)) {
 		return NULL;
 	}
-	err e = RLFL_fill_map(n, flag);
+	err e = WITH_MAP(n, MAP_WRITE, RLFL_fill_map(n, flag));
 	if(e < 0) {
 		return RLFL_handle_error(e, NULL);
 	}
@@ -382,7 +1769,7 @@ los(PyObject *self, PyObject* args) {
 	if(!PyArg_ParseTuple(args, "i(ii)(ii)", &m, &x1, &y1, &x2, &y2)) {
 		return NULL;
 	}
-	err e = RLFL_los(m, x1, y1, x2, y2);
+	err e = WITHOUT_GIL(m, MAP_READ, RLFL_los(m, x1, y1, x2, y2));
 	if(e < 0) {
 		return RLFL_handle_error(e, NULL);
 	}
@@ -399,11 +1786,15 @@ los(PyObject *self, PyObject* args) {
 static PyObject*
 fov(PyObject *self, PyObject* args) {
 	unsigned int m, x, y, r, a;
-	bool lit = true, lw = true;
+	int lit = true, lw = true;
 	if(!PyArg_ParseTuple(args, "i(ii)i|iii", &m, &x, &y, &r, &a, &lit, &lw)) {
 		return NULL;
 	}
-	err e = RLFL_fov(m, x, y, r, a, lit, lw);
+	RLFL_ctx_t *ctx = thread_ctx();
+	if(ctx == NULL) {
+		return PyErr_NoMemory();
+	}
+	err e = WITHOUT_GIL(m, MAP_WRITE, RLFL_fov_ctx(ctx, m, x, y, r, a, lit, lw));
 	if(e < 0) {
 		if(e == RLFL_ERR_GENERIC)
 			return RLFL_handle_error(e, "Illegal radius");
@@ -412,6 +1803,122 @@ fov(PyObject *self, PyObject* args) {
 	}
 	Py_RETURN_NONE;
 }
+/*
+ +-----------------------------------------------------------+
+ * @desc	FOV of many viewers, ((x, y), radius, algorithm)
+ * 			each, into packed bits of their own. The map is
+ * 			not changed.
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+fov_batch(PyObject *self, PyObject* args) {
+	unsigned int m, threads = 0;
+	int lw = true, cells = false;
+	PyObject *viewers;
+	if(!PyArg_ParseTuple(args, "iO|iii", &m, &viewers, &lw, &threads, &cells)) {
+		return NULL;
+	}
+	PyObject *seq = PySequence_Fast(viewers, "Expected a sequence of ((x, y), radius, algorithm)");
+	if(seq == NULL) {
+		return NULL;
+	}
+	Py_ssize_t i, n = PySequence_Fast_GET_SIZE(seq);
+	RLFL_viewer_t *v = (RLFL_viewer_t *)PyMem_Malloc(sizeof(RLFL_viewer_t) * (n ? n : 1));
+	unsigned int *rect = (unsigned int *)PyMem_Malloc(sizeof(unsigned int) * 4 * (n ? n : 1));
+	PyObject *bits = PyTuple_New(n);
+	if(v == NULL || rect == NULL || bits == NULL) {
+		Py_DECREF(seq);
+		Py_XDECREF(bits);
+		PyMem_Free(v);
+		PyMem_Free(rect);
+		return PyErr_NoMemory();
+	}
+	for(i=0; i<n; i++) {
+		PyObject *p = PySequence_Fast_GET_ITEM(seq, i);
+		if(!PyTuple_Check(p) || !PyArg_ParseTuple(p, "(ii)ii", &v[i].x, &v[i].y, &v[i].radius, &v[i].algorithm)) {
+			if(!PyErr_Occurred())
+				PyErr_SetString(PyExc_TypeError, "Expected a sequence of ((x, y), radius, algorithm)");
+			goto fail;
+		}
+	}
+
+	/* The windows need the size of the map, held until the FOVs are done */
+	RLFL_ctx_t *ctx = thread_ctx();
+	if(ctx == NULL) {
+		PyErr_NoMemory();
+		goto fail;
+	}
+	err e = hold_map(m, MAP_READ);
+	if(e == RLFL_SUCCESS) {
+		for(i=0; i<n; i++) {
+			unsigned int *r = &rect[i * 4];
+			if((e = RLFL_fov_window(m, v[i].x, v[i].y, v[i].radius, r)) < 0)
+				break;
+			PyObject *b = PyBytes_FromStringAndSize(NULL, ((Py_ssize_t)r[2] * r[3] + 7) / 8);
+			if(b == NULL) {
+				release_map(m);
+				goto fail;
+			}
+			PyTuple_SET_ITEM(bits, i, b);
+			v[i].bits = (uint8_t *)PyBytes_AS_STRING(b);
+		}
+		if(e == RLFL_SUCCESS) {
+			Py_BEGIN_ALLOW_THREADS
+			e = RLFL_fov_batch_ctx(ctx, m, v, n, lw, threads);
+			Py_END_ALLOW_THREADS
+		}
+		release_map(m);
+	}
+	if(e < 0) {
+		if(e == RLFL_ERR_GENERIC)
+			RLFL_handle_error(e, "Illegal radius");
+		else
+			RLFL_handle_error(e, NULL);
+		goto fail;
+	}
+
+	PyObject *result = PyList_New(n);
+	for(i=0; result != NULL && i<n; i++) {
+		const unsigned int *r = &rect[i * 4];
+		PyObject *b = PyTuple_GET_ITEM(bits, i), *value;
+		if(cells) {
+			/* Seen cells as (x, y) */
+			const uint8_t *s = (const uint8_t *)PyBytes_AS_STRING(b);
+			unsigned int k, size = r[2] * r[3];
+			value = PyList_New(0);
+			for(k=0; value != NULL && k<size; k++) {
+				if(!(s[k >> 3] & (1 << (k & 7))))
+					continue;
+				PyObject *c = Py_BuildValue("(ii)", r[0] + (k % r[2]), r[1] + (k / r[2]));
+				if(c == NULL || PyList_Append(value, c)) {
+					Py_XDECREF(c);
+					Py_CLEAR(value);
+					break;
+				}
+				Py_DECREF(c);
+			}
+		} else {
+			value = Py_BuildValue("((iiii)O)", r[0], r[1], r[2], r[3], b);
+		}
+		if(value == NULL) {
+			Py_CLEAR(result);
+			break;
+		}
+		PyList_SET_ITEM(result, i, value);
+	}
+	Py_DECREF(seq);
+	Py_DECREF(bits);
+	PyMem_Free(v);
+	PyMem_Free(rect);
+	return result;
+
+fail:
+	Py_DECREF(seq);
+	Py_DECREF(bits);
+	PyMem_Free(v);
+	PyMem_Free(rect);
+	return NULL;
+}
 /*
  +-----------------------------------------------------------+
  * @desc	Line of sight
@@ -441,7 +1948,11 @@ create_path(PyObject *self, PyObject* args) {
 		return NULL;
 	}
 
-	int p = RLFL_path_create(m, x1, y1, x2, y2, a, r, f, d);
+	RLFL_ctx_t *ctx = thread_ctx();
+	if(ctx == NULL) {
+		return PyErr_NoMemory();
+	}
+	int p = WITHOUT_GIL(m, MAP_WRITE, RLFL_path_create_ctx(ctx, m, x1, y1, x2, y2, a, r, f, d));
 	if(p < 0) {
 		Py_RETURN_FALSE;
 	}
@@ -510,7 +2021,11 @@ _path(unsigned int m, unsigned int x1, unsigned int y1, unsigned int x2, unsigne
 	  unsigned int a, int r, unsigned long f, float d)
 {
 	unsigned int i, x, y;
-	int path = RLFL_path_create(m, x1, y1, x2, y2, a, r, f, d);
+	RLFL_ctx_t *ctx = thread_ctx();
+	if(ctx == NULL) {
+		return PyErr_NoMemory();
+	}
+	int path = WITHOUT_GIL(m, MAP_WRITE, RLFL_path_create_ctx(ctx, m, x1, y1, x2, y2, a, r, f, d));
 
 	if(path < 0)
 	{
@@ -586,13 +2101,17 @@ static PyObject*
 scatter(PyObject *self, PyObject* args) {
 	unsigned int m, ox, oy;
 	int r = -1;
-	bool los = true;
+	int los = true;
 	unsigned long flag = 0;
 	if(!PyArg_ParseTuple(args, "i(ii)|ili", &m, &ox, &oy, &r, &flag, &los)) {
 		return NULL;
 	}
 	unsigned int dx, dy;
-	err e = RLFL_scatter(m, ox, oy, &dx, &dy, r, flag, los);
+	RLFL_ctx_t *ctx = thread_ctx();
+	if(ctx == NULL) {
+		return PyErr_NoMemory();
+	}
+	err e = WITHOUT_GIL(m, MAP_READ, RLFL_scatter_ctx(ctx, m, ox, oy, &dx, &dy, r, flag, los));
 	if(e < 0) {
 		return RLFL_handle_error(e, NULL);
 	}
@@ -610,7 +2129,11 @@ project_beam(PyObject *self, PyObject* args) {
 	if(!PyArg_ParseTuple(args, "i(ii)(ii)|ii", &m, &ox, &oy, &tx, &ty, &range, &f)) {
 		return NULL;
 	}
-	err projection = RLFL_project_beam(m, ox, oy, tx, ty, range, f);
+	RLFL_ctx_t *ctx = thread_ctx();
+	if(ctx == NULL) {
+		return PyErr_NoMemory();
+	}
+	err projection = WITH_MAP(m, MAP_WRITE, RLFL_project_beam_ctx(ctx, m, ox, oy, tx, ty, range, f));
 	if(projection < 0) {
 		if(projection == RLFL_ERR_OUT_OF_BOUNDS)
 		{
@@ -647,7 +2170,11 @@ project_ball(PyObject *self, PyObject* args) {
 	if(!PyArg_ParseTuple(args, "i(ii)(ii)i|ii", &m, &ox, &oy, &tx, &ty, &r, &range, &f)) {
 		return NULL;
 	}
-	err projection = RLFL_project_ball(m, ox, oy, tx, ty, r, range, f);
+	RLFL_ctx_t *ctx = thread_ctx();
+	if(ctx == NULL) {
+		return PyErr_NoMemory();
+	}
+	err projection = WITH_MAP(m, MAP_WRITE, RLFL_project_ball_ctx(ctx, m, ox, oy, tx, ty, r, range, f));
 	if(projection < 0) {
 		if(projection == RLFL_ERR_OUT_OF_BOUNDS)
 		{
@@ -684,7 +2211,11 @@ project_cone(PyObject *self, PyObject* args) {
 	if(!PyArg_ParseTuple(args, "i(ii)(ii)i|ii", &m, &ox, &oy, &tx, &ty, &r, &range, &f)) {
 		return NULL;
 	}
-	err projection = RLFL_project_cone(m, ox, oy, tx, ty, r, range, f);
+	RLFL_ctx_t *ctx = thread_ctx();
+	if(ctx == NULL) {
+		return PyErr_NoMemory();
+	}
+	err projection = WITH_MAP(m, MAP_WRITE, RLFL_project_cone_ctx(ctx, m, ox, oy, tx, ty, r, range, f));
 	if(projection < 0) {
 		if(projection == RLFL_ERR_OUT_OF_BOUNDS)
 		{
@@ -720,7 +2251,200 @@ randint(PyObject *self, PyObject* args) {
 	if(!PyArg_ParseTuple(args, "i", &max)) {
 		return NULL;
 	}
-	return Py_BuildValue("i", RLFL_randint(max));
+	RLFL_ctx_t *ctx = thread_ctx();
+	if(ctx == NULL) {
+		return PyErr_NoMemory();
+	}
+	return Py_BuildValue("i", RLFL_randint_ctx(ctx, max));
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Seed random numbers of the calling thread
+ +-----------------------------------------------------------+
+ */
+static PyObject*
+seed(PyObject *self, PyObject* args) {
+	unsigned long s;
+	if(!PyArg_ParseTuple(args, "k", &s)) {
+		return NULL;
+	}
+	RLFL_ctx_t *ctx = thread_ctx();
+	if(ctx == NULL) {
+		return PyErr_NoMemory();
+	}
+	RLFL_ctx_seed(ctx, s);
+	Py_RETURN_NONE;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Pin and lock map `m`, to `read` or to write. Pinned
+ * 			it can not be deleted. The GIL is let go while
+ * 			another thread holds it.
+ +-----------------------------------------------------------+
+ */
+static err
+hold_map(unsigned int m, bool read)
+{
+	err e = RLFL_map_pin(m);
+	if(e < 0) {
+		return e;
+	}
+	e = read ? RLFL_map_tryrdlock(m) : RLFL_map_trylock(m);
+	if(e == RLFL_ERR_BUSY) {
+		Py_BEGIN_ALLOW_THREADS
+		if(read)
+			RLFL_map_rdlock(m);
+		else
+			RLFL_map_lock(m);
+		Py_END_ALLOW_THREADS
+	}
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Undo hold_map()
+ +-----------------------------------------------------------+
+ */
+static void
+release_map(unsigned int m)
+{
+	RLFL_map_unlock(m);
+	RLFL_map_unpin(m);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	hold_map() on two maps, lowest slot first so two
+ * 			threads can not each hold one. The same map twice
+ * 			is held once, to write if either writes.
+ +-----------------------------------------------------------+
+ */
+static err
+hold_maps(unsigned int a, bool aread, unsigned int b, bool bread)
+{
+	if(a == b) {
+		return hold_map(a, aread && bread);
+	}
+	if(MAP_SLOT(b) < MAP_SLOT(a)) {
+		unsigned int t = a;
+		bool tread = aread;
+		a = b;
+		aread = bread;
+		b = t;
+		bread = tread;
+	}
+	err e = hold_map(a, aread);
+	if(e < 0) {
+		return e;
+	}
+	e = hold_map(b, bread);
+	if(e < 0) {
+		release_map(a);
+	}
+	return e;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Undo hold_maps()
+ +-----------------------------------------------------------+
+ */
+static void
+release_maps(unsigned int a, unsigned int b)
+{
+	release_map(a);
+	if(a != b) {
+		release_map(b);
+	}
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Order of map handles by slot
+ +-----------------------------------------------------------+
+ */
+static int
+compare_slots(const void *a, const void *b)
+{
+	unsigned int sa = MAP_SLOT(*(const unsigned int *)a), sb = MAP_SLOT(*(const unsigned int *)b);
+	return (sa > sb) - (sa < sb);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	hold_map() on every level of stack `s`, lowest slot
+ * 			first like hold_maps(). The stack itself is only
+ * 			changed with the GIL held, its searches keep it.
+ * @return	Number of maps held, in `held`
+ +-----------------------------------------------------------+
+ */
+static int
+hold_stack(unsigned int s, bool read, unsigned int **held)
+{
+	int n = RLFL_stack_size(s), i;
+	if(n < 0) {
+		return n;
+	}
+	unsigned int *maps = (unsigned int *)malloc(sizeof(unsigned int) * (n + 1));
+	if(maps == NULL) {
+		return RLFL_ERR_GENERIC;
+	}
+	for(i=0; i<n; i++) {
+		maps[i] = RLFL_stack_level(s, i);
+	}
+	qsort(maps, n, sizeof(unsigned int), compare_slots);
+	for(i=0; i<n; i++) {
+		err e = hold_map(maps[i], read);
+		if(e < 0) {
+			release_stack(maps, i);
+			return e;
+		}
+	}
+	(*held) = maps;
+	return n;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Undo hold_stack()
+ +-----------------------------------------------------------+
+ */
+static void
+release_stack(unsigned int *held, int n)
+{
+	while(n--)
+		release_map(held[n]);
+	free(held);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Context of the calling thread, made on first use
+ * 			and deleted when the thread exits
+ +-----------------------------------------------------------+
+ */
+static pthread_key_t ctx_key;
+static pthread_once_t ctx_once = PTHREAD_ONCE_INIT;
+
+static void
+ctx_destroy(void *ctx)
+{
+	RLFL_ctx_delete((RLFL_ctx_t *)ctx);
+}
+
+static void
+ctx_key_create(void)
+{
+	pthread_key_create(&ctx_key, ctx_destroy);
+}
+
+static RLFL_ctx_t *
+thread_ctx(void)
+{
+	pthread_once(&ctx_once, ctx_key_create);
+	RLFL_ctx_t *ctx = (RLFL_ctx_t *)pthread_getspecific(ctx_key);
+	if(ctx == NULL) {
+		ctx = RLFL_ctx_new();
+		if(ctx && pthread_setspecific(ctx_key, ctx)) {
+			RLFL_ctx_delete(ctx);
+			ctx = NULL;
+		}
+	}
+	return ctx;
 }
 /*
  +-----------------------------------------------------------+
@@ -753,6 +2477,15 @@ RLFL_handle_error(err code, const char* custom) {
 			case RLFL_ERR_NO_PATH :
 				PyErr_SetString(RLFLError, "No path found");
 				break;
+			case RLFL_ERR_BUSY :
+				PyErr_SetString(RLFLError, "Map is in use");
+				break;
+			case RLFL_ERR_FILE :
+				PyErr_SetString(RLFLError, "Invalid map file");
+				break;
+			case RLFL_ERR_NO_STACK :
+				PyErr_SetString(RLFLError, "Stack does not exist");
+				break;
 			default :
 				PyErr_SetString(RLFLError, "Generic Error -1");
 				break;
@@ -764,12 +2497,46 @@ RLFL_handle_error(err code, const char* custom) {
 static PyMethodDef RLFLMethods[] =
 {
 	 {"create_map", create_map, METH_VARARGS, "Create new RLF map"},
+	 {"clone_map", clone_map, METH_VARARGS, "Copy-on-write clone of map"},
+	 {"track_map", track_map, METH_VARARGS, "Track changes to flags"},
+	 {"map_version", map_version, METH_VARARGS, "Version of the last tracked change"},
+	 {"map_dirty", map_dirty, METH_VARARGS, "Rectangles changed since a version"},
+	 {"journal_map", journal_map, METH_VARARGS, "Journal changes to map"},
+	 {"checkpoint", checkpoint, METH_VARARGS, "Checkpoint of a journaled map"},
+	 {"rollback", rollback, METH_VARARGS, "Undo changes after a checkpoint"},
+	 {"track_regions", track_regions, METH_VARARGS, "Keep connected regions of flags"},
+	 {"region", region, METH_VARARGS, "Region label of cell"},
+	 {"same_region", same_region, METH_VARARGS, "Query if cells share a region"},
+	 {"region_count", region_count, METH_VARARGS, "Number of regions"},
+	 {"region_labels", region_labels, METH_VARARGS, "Region label of every cell"},
+	 {"save_map", save_map, METH_VARARGS, "Save map to file"},
+	 {"load_map", load_map, METH_VARARGS, "Load map from file"},
+	 {"share_map", share_map, METH_VARARGS, "Copy map into shared memory"},
+	 {"attach_map", attach_map, METH_VARARGS, "Attach to a shared map"},
+	 {"unlink_map", unlink_map, METH_VARARGS, "Remove a shared memory segment"},
+	 {"publish_map", publish_map, METH_VARARGS, "Publish changes to a shared map"},
+	 {"map_generation", map_generation, METH_VARARGS, "Generation of a shared map"},
 	 {"delete_all_maps", delete_all_maps, METH_VARARGS, "Delete all maps"},
 	 {"delete_map", delete_map, METH_VARARGS, "Delete RLE map"},
+	 {"set_max_maps", set_max_maps, METH_VARARGS, "Set most maps alive at once"},
+	 {"max_maps", max_maps, METH_VARARGS, "Get most maps alive at once"},
+	 {"map_count", map_count, METH_VARARGS, "Get number of live maps"},
 	 {"set_flag", set_flag, METH_VARARGS, "Set flag on cell"},
 	 {"has_flag", has_flag, METH_VARARGS, "Query cell"},
 	 {"get_flags", get_flags, METH_VARARGS, "Get flags"},
 	 {"clear_flag", clear_flag, METH_VARARGS, "Clear flag on cell"},
+	 {"set_flag_rect", set_flag_rect, METH_VARARGS, "Set flag on rectangle"},
+	 {"clear_flag_rect", clear_flag_rect, METH_VARARGS, "Clear flag on rectangle"},
+	 {"has_flag_rect", has_flag_rect, METH_VARARGS, "Query rectangle, packed bits"},
+	 {"set_flag_list", set_flag_list, METH_VARARGS, "Set flag on list of cells"},
+	 {"clear_flag_list", clear_flag_list, METH_VARARGS, "Clear flag on list of cells"},
+	 {"has_flag_list", has_flag_list, METH_VARARGS, "Query list of cells, packed bits"},
+	 {"set_flag_mask", set_flag_mask, METH_VARARGS, "Set flag where mask map has flag"},
+	 {"clear_flag_mask", clear_flag_mask, METH_VARARGS, "Clear flag where mask map has flag"},
+	 {"has_flag_mask", has_flag_mask, METH_VARARGS, "Query where mask map has flag, packed bits"},
+	 {"count_flags", count_flags, METH_VARARGS, "Count cells with flag"},
+	 {"flag_histogram", flag_histogram, METH_VARARGS, "Count cells with each flag"},
+	 {"merge_map", merge_map, METH_VARARGS, "Merge flags of one map into another"},
 	 {"clear_map", clear_map, METH_VARARGS, "Clear map"},
 	 {"fill_map", fill_map, METH_VARARGS, "Fill map"},
 	 {"path_fill_map", path_fill_map, METH_VARARGS, "Compute path map"},
@@ -779,8 +2546,19 @@ static PyMethodDef RLFLMethods[] =
 	 {"path_step_map", path_step_map, METH_VARARGS, "Step on the path map"},
 	 {"path_clear_map", path_clear_map, METH_VARARGS, "Clear the path map"},
 	 {"path_clear_all_maps", path_clear_all_maps, METH_VARARGS, "Clear all path maps"},
+	 {"create_stack", create_stack, METH_VARARGS, "New map stack"},
+	 {"delete_stack", delete_stack, METH_VARARGS, "Delete map stack"},
+	 {"stack_add", stack_add, METH_VARARGS, "Add a level to a map stack"},
+	 {"stack_levels", stack_levels, METH_VARARGS, "Maps of the levels of a stack"},
+	 {"link_levels", link_levels, METH_VARARGS, "Portal between cells of levels"},
+	 {"unlink_levels", unlink_levels, METH_VARARGS, "Remove the portals of a cell"},
+	 {"stack_path", stack_path, METH_VARARGS, "Path across the levels of a stack"},
+	 {"stack_fill_map", stack_fill_map, METH_VARARGS, "Path map across a stack"},
+	 {"stack_step_map", stack_step_map, METH_VARARGS, "Step on the path map of a stack"},
+	 {"stack_clear_map", stack_clear_map, METH_VARARGS, "Clear the path map of a stack"},
 	 {"los", los, METH_VARARGS, "Line of sight"},
 	 {"fov", fov, METH_VARARGS, "Field of view"},
+	 {"fov_batch", fov_batch, METH_VARARGS, "Field of view of many viewers, packed bits"},
 	 {"distance", distance, METH_VARARGS, "Distance between two points"},
 	 {"create_path", create_path, METH_VARARGS, "New path"},
 	 {"delete_path", delete_path, METH_VARARGS, "Delete path"},
@@ -790,10 +2568,16 @@ static PyMethodDef RLFLMethods[] =
 	 {"path_away", path_away, METH_VARARGS, "Create and retrive away path"},
 	 {"scatter", scatter, METH_VARARGS, "Random spot in range and view"},
 	 {"randint", randint, METH_VARARGS, "Random integer"},
+	 {"seed", seed, METH_VARARGS, "Seed random numbers of the calling thread"},
 	 {"project_beam", project_beam, METH_VARARGS, "Beam projection"},
 	 {"project_ball", project_ball, METH_VARARGS, "Ball projection"},
 	 {"project_cone", project_cone, METH_VARARGS, "Cone projection"},
 	 {"map_size", map_size, METH_VARARGS, "(Width, Height) of map"},
+	 {"map_layout", map_layout, METH_VARARGS, "Cell layout of map"},
+	 {"map_tiles", map_tiles, METH_VARARGS, "(Allocated, Total) tiles of map"},
+	 {"map_cells", map_cells, METH_VARARGS, "Memoryview of the cells of a dense map"},
+	 {"read_cells", read_cells, METH_VARARGS, "Copy of all cells of map"},
+	 {"write_cells", write_cells, METH_VARARGS, "Replace all cells of map"},
      {NULL, NULL, 0, NULL}
 };
 #if PY_MAJOR_VERSION >= 3
@@ -839,6 +2623,8 @@ initrlfl(void)
 
     if (module == NULL)
         INITERROR;
+    if (PyType_Ready(&RLFL_cells_type) < 0)
+        INITERROR;
     struct module_state *st = GETSTATE(module);
 
     st->error = PyErr_NewException("rlfl.Error", NULL, NULL);
@@ -876,13 +2662,35 @@ initrlfl(void)
     PyModule_AddIntConstant(module, "FOV_DIAMOND", 	FOV_DIAMOND);
     PyModule_AddIntConstant(module, "FOV_SHADOW", 	FOV_SHADOW);
     PyModule_AddIntConstant(module, "FOV_PERMISSIVE", FOV_PERMISSIVE);
+    PyModule_AddIntConstant(module, "FOV_TABLE", FOV_TABLE);
+    PyModule_AddIntConstant(module, "FOV_SHADOW_ITER", FOV_SHADOW_ITER);
+    PyModule_AddIntConstant(module, "FOV_SYMMETRIC", FOV_SYMMETRIC);
     PyModule_AddIntConstant(module, "FOV_DIGITAL", 	FOV_DIGITAL);
     PyModule_AddIntConstant(module, "FOV_RESTRICTIVE", 	FOV_RESTRICTIVE);
 
+    /* Map layouts */
+    PyModule_AddIntConstant(module, "MAP_DENSE", 	MAP_DENSE);
+    PyModule_AddIntConstant(module, "MAP_PLANES", 	MAP_PLANES);
+    PyModule_AddIntConstant(module, "MAP_TILED", 	MAP_TILED);
+    PyModule_AddIntConstant(module, "MAP_SPARSE", 	MAP_SPARSE);
+
+    /* Map merge operations */
+    PyModule_AddIntConstant(module, "MERGE_AND", 	MERGE_AND);
+    PyModule_AddIntConstant(module, "MERGE_OR", 	MERGE_OR);
+    PyModule_AddIntConstant(module, "MERGE_XOR", 	MERGE_XOR);
+    PyModule_AddIntConstant(module, "MERGE_ANDNOT", 	MERGE_ANDNOT);
+
     /* Path algorithims */
     PyModule_AddIntConstant(module, "PATH_ASTAR", 	PATH_ASTAR);
     PyModule_AddIntConstant(module, "PATH_BASIC", 	PATH_BASIC);
 
+    /* Portal types */
+    PyModule_AddIntConstant(module, "PORTAL_STAIRS", 	PORTAL_STAIRS);
+    PyModule_AddIntConstant(module, "PORTAL_LADDER", 	PORTAL_LADDER);
+    PyModule_AddIntConstant(module, "PORTAL_PIT", 	PORTAL_PIT);
+    PyModule_AddIntConstant(module, "PORTAL_GATE", 	PORTAL_GATE);
+    PyModule_AddIntConstant(module, "PORTAL_ALL", 	PORTAL_ALL);
+
     /* Projections */
     PyModule_AddIntConstant(module, "PROJECT_THRU", PROJECT_THRU);
     PyModule_AddIntConstant(module, "PROJECT_STOP", PROJECT_STOP);
@@ -896,10 +2704,15 @@ initrlfl(void)
     PyModule_AddIntConstant(module, "MAX_MAPS", 	RLFL_MAX_MAPS);
     PyModule_AddIntConstant(module, "MAX_PATHS", 	RLFL_MAX_PATHS);
     PyModule_AddIntConstant(module, "MAX_PROJECTS", 	RLFL_MAX_PROJECTS);
+    PyModule_AddIntConstant(module, "MAX_STACKS", 	RLFL_MAX_STACKS);
     PyModule_AddIntConstant(module, "MAX_RANGE", 	RLFL_MAX_RANGE);
     PyModule_AddIntConstant(module, "MAX_RADIUS", 	RLFL_MAX_RADIUS);
+    PyModule_AddIntConstant(module, "MAX_THREADS", 	RLFL_MAX_THREADS);
     PyModule_AddIntConstant(module, "MAX_WIDTH", 	RLFL_MAX_WIDTH);
     PyModule_AddIntConstant(module, "MAX_HEIGHT", 	RLFL_MAX_HEIGHT);
+    PyModule_AddIntConstant(module, "MAX_SPARSE_WIDTH", 	RLFL_MAX_SPARSE_WIDTH);
+    PyModule_AddIntConstant(module, "MAX_SPARSE_HEIGHT", 	RLFL_MAX_SPARSE_HEIGHT);
+    PyModule_AddIntConstant(module, "CELL_BITS", 	sizeof(RLFL_cell_t) * 8);
 
 #if PY_MAJOR_VERSION >= 3
     return module;
@@ -0,0 +1,1110 @@
+/*
+	RLFL map stacks.
+
+	A stack groups maps as the levels of a dungeon, joined by portals:
+	one way links from a cell of a level to a cell of any level, with
+	a type and a cost. A stair is two portals, one each way.
+
+	Searches run over every level at once, a node is a level and a
+	cell. Moves inside a level are those of the path maps, eight ways
+	without cutting corners, diagonals cost 1 + dcost. Taking a portal
+	costs the portal's cost. Nodes are allocated a level at a time,
+	when the search first reaches the level.
+
+	The A* estimate of a cell is the least of the straight distance to
+	the goal, on the goal level, and of the straight distance to each
+	portal leaving the level plus a bound on the cost from the portal
+	to the goal. The bounds come from a search of the portals, where
+	the cost between two portals is their straight distance. Levels
+	with many portals use their least bound alone.
+
+    Copyright (C) 2011
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+    <jtm@robot.is>
+*/
+#include "headers/rlfl.h"
+#include "headers/path.h"
+#include "headers/map.h"
+#include "headers/ctx.h"
+
+static const int stack_dirs[8][2] = {{0,-1},{0,1},{-1,0},{1,0},{-1,-1},{-1,1},{1,-1},{1,1}};
+
+/* Portal from `cell` of `level` to `to_cell` of `to_level` */
+typedef struct {
+	unsigned int level, cell;
+	unsigned int to_level, to_cell;
+	unsigned int type;
+	float cost;
+} portal_t;
+
+/* Portal by the level and cell it leaves from, or leads to */
+typedef struct {
+	uint64_t key;
+	unsigned int portal;
+} portal_key_t;
+
+typedef struct {
+	/* Map of each level */
+	unsigned int *levels;
+	unsigned int size, room;
+
+	/* Portals, and keys in order of the cell they leave from and
+	   of the cell they lead to, sorted again when `sorted` is false */
+	portal_t *portals;
+	portal_key_t *from, *to;
+	unsigned int portal_count, portal_room;
+	bool sorted;
+} map_stack_t;
+
+/* Search node, STATE_*, `estimate` is set once it is not empty */
+typedef struct {
+	float cost, estimate;
+	unsigned int parent_level, parent_cell;
+	unsigned int state;
+} stack_node_t;
+
+/* Portal leaving a level, at x, y, or anywhere if x < 0, and a bound
+   on the cost from it to the goal */
+typedef struct {
+	int x, y;
+	float cost;
+} stack_exit_t;
+
+/* Most exits of a level the estimate looks at */
+#define STACK_EXITS 8
+
+/* Entry of the open heap, by `key` */
+typedef struct {
+	float key;
+	unsigned int level, cell;
+} stack_open_t;
+
+/* State of one search */
+typedef struct {
+	map_stack_t *stack;
+	map_view_t *views;
+	stack_node_t **nodes;
+	unsigned int types;
+	float dcost;
+
+	/* Open heap, scratch of `ctx`, room for `room` */
+	RLFL_ctx_t *ctx;
+	stack_open_t *open;
+	unsigned int top, room;
+
+	/* Searching from the goal, along portals backwards */
+	bool reverse;
+
+	/* A* goal, and exits of each level for the estimates, those of
+	   level `l` from exit_first[l], see bound_exits() */
+	bool astar;
+	unsigned int gl, gx, gy;
+	stack_exit_t *exits;
+	unsigned int *exit_first;
+} stack_search_t;
+
+static map_stack_t *stack_store[RLFL_MAX_STACKS];
+
+static inline map_stack_t *get_stack(unsigned int s);
+static inline uint64_t node_key(unsigned int level, unsigned int cell);
+static int compare_keys(const void *a, const void *b);
+static err sort_portals(map_stack_t *st);
+static unsigned int first_key(const portal_key_t *keys, unsigned int n, uint64_t key);
+static err cell_valid(map_stack_t *st, unsigned int l, unsigned int x, unsigned int y, unsigned int *cell);
+static err search_open(stack_search_t *q, RLFL_ctx_t *ctx, map_stack_t *st, unsigned int types, float dcost);
+static void search_close(stack_search_t *q);
+static stack_node_t *search_node(stack_search_t *q, unsigned int l, unsigned int cell);
+static err bound_exits(stack_search_t *q);
+static inline float straight(const stack_search_t *q, int x1, int y1, int x2, int y2);
+static float estimate(const stack_search_t *q, unsigned int l, unsigned int cell);
+static err relax(stack_search_t *q, unsigned int l, unsigned int cell, float cost,
+				 unsigned int pl, unsigned int pcell);
+static err expand(stack_search_t *q, unsigned int l, unsigned int cell, float cost);
+static err run(stack_search_t *q, unsigned int gcell);
+static err push(stack_search_t *q, float key, unsigned int l, unsigned int cell);
+static stack_open_t pop(stack_search_t *q);
+static inline bool passable(const map_view_t *v, int x, int y);
+/*
+ +-----------------------------------------------------------+
+ * @desc	New empty stack
+ * @return	Stack number
+ +-----------------------------------------------------------+
+ */
+int
+RLFL_stack_new(void)
+{
+	unsigned int s;
+	for(s=0; s<RLFL_MAX_STACKS; s++){
+		if(!stack_store[s]) break;
+	}
+	if(s >= RLFL_MAX_STACKS)
+		return RLFL_ERR_FLAG;
+
+	map_stack_t *st = (map_stack_t *)calloc(1, sizeof(map_stack_t));
+	if(st == NULL)
+		return RLFL_ERR_GENERIC;
+
+	st->sorted = true;
+	stack_store[s] = st;
+	return s;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Delete stack, its maps are kept
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_stack_delete(unsigned int s)
+{
+	map_stack_t *st = get_stack(s);
+	if(st == NULL)
+		return RLFL_ERR_NO_STACK;
+
+	free(st->levels);
+	free(st->portals);
+	free(st->from);
+	free(st->to);
+	free(st);
+	stack_store[s] = NULL;
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Add map `m` as the next level of stack `s`, a map
+ * 			is one level of a stack at most
+ * @return	Level number
+ +-----------------------------------------------------------+
+ */
+int
+RLFL_stack_add(unsigned int s, unsigned int m)
+{
+	map_stack_t *st = get_stack(s);
+	if(st == NULL)
+		return RLFL_ERR_NO_STACK;
+
+	if(!RLFL_map_valid(m))
+		return RLFL_ERR_NO_MAP;
+
+	unsigned int l;
+	for(l=0; l<st->size; l++)
+	{
+		if(MAP_SLOT(st->levels[l]) == MAP_SLOT(m) && RLFL_map_valid(st->levels[l]))
+			return RLFL_ERR_FLAG;
+	}
+
+	if(st->size == st->room)
+	{
+		unsigned int room = st->room ? st->room * 2 : 8;
+		unsigned int *levels = (unsigned int *)realloc(st->levels, sizeof(unsigned int) * room);
+		if(levels == NULL)
+			return RLFL_ERR_GENERIC;
+		st->levels = levels;
+		st->room = room;
+	}
+	st->levels[st->size] = m;
+	return st->size++;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Number of levels of stack
+ +-----------------------------------------------------------+
+ */
+int
+RLFL_stack_size(unsigned int s)
+{
+	map_stack_t *st = get_stack(s);
+	if(st == NULL)
+		return RLFL_ERR_NO_STACK;
+
+	return st->size;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Map of level `l`
+ +-----------------------------------------------------------+
+ */
+int
+RLFL_stack_level(unsigned int s, unsigned int l)
+{
+	map_stack_t *st = get_stack(s);
+	if(st == NULL)
+		return RLFL_ERR_NO_STACK;
+
+	if(l >= st->size)
+		return RLFL_ERR_OUT_OF_BOUNDS;
+
+	return st->levels[l];
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Portal from cell x1, y1 of level l1 to x2, y2 of l2,
+ * 			`type` is a PORTAL_* bit
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_stack_link(unsigned int s, unsigned int l1, unsigned int x1, unsigned int y1, unsigned int l2,
+				unsigned int x2, unsigned int y2, unsigned int type, float cost)
+{
+	map_stack_t *st = get_stack(s);
+	if(st == NULL)
+		return RLFL_ERR_NO_STACK;
+
+	unsigned int c1, c2;
+	err e = cell_valid(st, l1, x1, y1, &c1);
+	if(e == RLFL_SUCCESS)
+		e = cell_valid(st, l2, x2, y2, &c2);
+	if(e)
+		return e;
+
+	if(!type)
+		return RLFL_ERR_FLAG;
+
+	if(!(cost >= 0))
+		return RLFL_ERR_GENERIC;
+
+	if(st->portal_count == st->portal_room)
+	{
+		unsigned int room = st->portal_room ? st->portal_room * 2 : 16;
+		portal_t *portals = (portal_t *)realloc(st->portals, sizeof(portal_t) * room);
+		if(portals == NULL)
+			return RLFL_ERR_GENERIC;
+		st->portals = portals;
+		st->portal_room = room;
+	}
+	portal_t *p = &st->portals[st->portal_count++];
+	p->level = l1;
+	p->cell = c1;
+	p->to_level = l2;
+	p->to_cell = c2;
+	p->type = type;
+	p->cost = cost;
+	st->sorted = false;
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Remove the portals leaving from or leading to cell
+ * 			x, y of level `l`
+ * @return	Number of portals removed
+ +-----------------------------------------------------------+
+ */
+int
+RLFL_stack_unlink(unsigned int s, unsigned int l, unsigned int x, unsigned int y)
+{
+	map_stack_t *st = get_stack(s);
+	if(st == NULL)
+		return RLFL_ERR_NO_STACK;
+
+	unsigned int cell;
+	err e = cell_valid(st, l, x, y, &cell);
+	if(e)
+		return e;
+
+	unsigned int i, n = 0;
+	for(i=0; i<st->portal_count; i++)
+	{
+		const portal_t *p = &st->portals[i];
+		if((p->level == l && p->cell == cell) || (p->to_level == l && p->to_cell == cell))
+			continue;
+		st->portals[n++] = *p;
+	}
+	int removed = st->portal_count - n;
+	st->portal_count = n;
+	if(removed)
+		st->sorted = false;
+	return removed;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Shortest path from x1, y1 of level l1 to x2, y2 of
+ * 			l2 with A*, through portals of `types`. The first
+ * 			`max` steps, origin and destination included, are
+ * 			stored in `steps` as level, x, y.
+ * @return	Number of steps, which may be more than `max`
+ +-----------------------------------------------------------+
+ */
+int
+RLFL_stack_path(unsigned int s, unsigned int l1, unsigned int x1, unsigned int y1, unsigned int l2,
+				unsigned int x2, unsigned int y2, unsigned int types, float dcost, unsigned int *steps,
+				unsigned int max)
+{
+	return RLFL_stack_path_ctx(&RLFL_default_ctx, s, l1, x1, y1, l2, x2, y2, types, dcost, steps, max);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	RLFL_stack_path() with the scratch of `ctx`
+ +-----------------------------------------------------------+
+ */
+int
+RLFL_stack_path_ctx(RLFL_ctx_t *ctx, unsigned int s, unsigned int l1, unsigned int x1, unsigned int y1,
+					unsigned int l2, unsigned int x2, unsigned int y2, unsigned int types, float dcost,
+					unsigned int *steps, unsigned int max)
+{
+	map_stack_t *st = get_stack(s);
+	if(st == NULL)
+		return RLFL_ERR_NO_STACK;
+
+	unsigned int c1, c2;
+	err e = cell_valid(st, l1, x1, y1, &c1);
+	if(e == RLFL_SUCCESS)
+		e = cell_valid(st, l2, x2, y2, &c2);
+	if(e)
+		return e;
+
+	stack_search_t q;
+	if((e = search_open(&q, ctx, st, types, dcost)))
+		return e;
+
+	q.astar = true;
+	q.gl = l2;
+	q.gx = x2;
+	q.gy = y2;
+	if((e = bound_exits(&q)) == RLFL_SUCCESS
+	   && (e = relax(&q, l1, c1, 0, l1, c1)) == RLFL_SUCCESS)
+		e = run(&q, c2);
+
+	/* Count the steps, then store them from the last */
+	int n = 0;
+	if(e == RLFL_SUCCESS)
+	{
+		unsigned int l = l2, c = c2;
+		while(true)
+		{
+			const stack_node_t *node = &q.nodes[l][c];
+			n++;
+			if(l == l1 && c == c1)
+				break;
+			l = node->parent_level;
+			c = node->parent_cell;
+		}
+		unsigned int i = n;
+		l = l2;
+		c = c2;
+		while(i--)
+		{
+			const stack_node_t *node = &q.nodes[l][c];
+			if(i < max)
+			{
+				unsigned int w = q.views[l].width;
+				steps[(i * 3)] = l;
+				steps[(i * 3) + 1] = c % w;
+				steps[(i * 3) + 2] = c / w;
+			}
+			l = node->parent_level;
+			c = node->parent_cell;
+		}
+	}
+	search_close(&q);
+	return e ? e : n;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Path map of the cost from every cell of the stack
+ * 			to x, y of level `l`, through portals of `types`.
+ * 			Every level gets the path map of the same number,
+ * 			see RLFL_stack_step_map().
+ * @return	Path map number
+ +-----------------------------------------------------------+
+ */
+int
+RLFL_stack_fill_map(unsigned int s, unsigned int l, unsigned int x, unsigned int y, unsigned int types,
+					float dcost)
+{
+	return RLFL_stack_fill_map_ctx(&RLFL_default_ctx, s, l, x, y, types, dcost);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	RLFL_stack_fill_map() with the scratch of `ctx`
+ +-----------------------------------------------------------+
+ */
+int
+RLFL_stack_fill_map_ctx(RLFL_ctx_t *ctx, unsigned int s, unsigned int l, unsigned int x, unsigned int y,
+						unsigned int types, float dcost)
+{
+	map_stack_t *st = get_stack(s);
+	if(st == NULL)
+		return RLFL_ERR_NO_STACK;
+
+	unsigned int cell;
+	err e = cell_valid(st, l, x, y, &cell);
+	if(e)
+		return e;
+
+	stack_search_t q;
+	if((e = search_open(&q, ctx, st, types, dcost)))
+		return e;
+
+	/* A path map number free on every level */
+	unsigned int pm, i;
+	for(pm=0; pm<RLFL_MAX_PATHS; pm++)
+	{
+		for(i=0; i<st->size; i++){
+			if(q.views[i].map->path_map[pm]) break;
+		}
+		if(i == st->size) break;
+	}
+	if(pm >= RLFL_MAX_PATHS)
+	{
+		search_close(&q);
+		return RLFL_ERR_NO_PATH;
+	}
+
+	/* Costs to the goal, so portals are taken backwards */
+	q.reverse = true;
+	if((e = relax(&q, l, cell, 0, l, cell)) == RLFL_SUCCESS)
+		e = run(&q, 0);
+
+	for(i=0; i<st->size && e == RLFL_SUCCESS; i++)
+	{
+		RLFL_map_t *map = q.views[i].map;
+		int *costs = (int *)malloc(sizeof(int) * map->cellcnt);
+		if(costs == NULL)
+		{
+			e = RLFL_ERR_GENERIC;
+			break;
+		}
+		const stack_node_t *nodes = q.nodes[i];
+		unsigned int c;
+		for(c=0; c<map->cellcnt; c++)
+		{
+			if(nodes == NULL || nodes[c].state != STATE_CLOSED)
+				costs[c] = PATH_UNKNOWN;
+			else
+				costs[c] = (nodes[c].cost < PATH_UNKNOWN - 1) ? (int)nodes[c].cost : PATH_UNKNOWN - 1;
+		}
+		map->path_map[pm] = costs;
+	}
+	if(e)
+	{
+		/* Levels filled so far */
+		while(i--)
+			RLFL_path_wipe_map(st->levels[i], pm);
+	}
+	search_close(&q);
+	return e ? e : (int)pm;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	One step down path map `p` of a stack from x, y of
+ * 			level `l`, to a neighbour or through a portal of
+ * 			`types`, whichever is cheapest
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_stack_step_map(unsigned int s, unsigned int p, unsigned int l, unsigned int x, unsigned int y,
+					unsigned int types, unsigned int *nl, unsigned int *nx, unsigned int *ny)
+{
+	map_stack_t *st = get_stack(s);
+	if(st == NULL)
+		return RLFL_ERR_NO_STACK;
+
+	unsigned int cell;
+	err e = cell_valid(st, l, x, y, &cell);
+	if(e)
+		return e;
+
+	if(p >= RLFL_MAX_PATHS)
+		return RLFL_ERR_NO_PATH;
+
+	RLFL_map_t *map = RLFL_MAP(st->levels[l]);
+	if(!map->path_map[p])
+		return RLFL_ERR_NO_PATH;
+
+	if(!st->sorted && sort_portals(st))
+		return RLFL_ERR_GENERIC;
+
+	/* Best next cell, by its cost and the cost of getting there. Only
+	   cells below this one count, so steps never go round in circles. */
+	int here = map->path_map[p][cell];
+	float best = INFINITY;
+	bool found = false;
+	unsigned int i;
+	(*nl) = l;
+	(*nx) = x;
+	(*ny) = y;
+	for(i=0; i<8; i++)
+	{
+		int xx = x + stack_dirs[i][0], yy = y + stack_dirs[i][1];
+		if(xx < 0 || yy < 0 || xx >= (int)map->width || yy >= (int)map->height)
+			continue;
+		int c = map->path_map[p][xx + (yy * map->width)];
+		if(c == PATH_UNKNOWN || c >= here || c + 1 >= best)
+			continue;
+		best = c + 1;
+		found = true;
+		(*nx) = xx;
+		(*ny) = yy;
+	}
+
+	uint64_t key = node_key(l, cell);
+	for(i=first_key(st->from, st->portal_count, key); i<st->portal_count && st->from[i].key == key; i++)
+	{
+		const portal_t *portal = &st->portals[st->from[i].portal];
+		if(!(portal->type & types))
+			continue;
+
+		RLFL_map_t *to = RLFL_MAP(st->levels[portal->to_level]);
+		if(!RLFL_map_valid(st->levels[portal->to_level]) || !to->path_map[p])
+			continue;
+		int c = to->path_map[p][portal->to_cell];
+		if(c == PATH_UNKNOWN || c >= here || c + portal->cost >= best)
+			continue;
+		best = c + portal->cost;
+		found = true;
+		(*nl) = portal->to_level;
+		(*nx) = portal->to_cell % to->width;
+		(*ny) = portal->to_cell / to->width;
+	}
+	/* At the goal already */
+	if(!found && here == 0)
+		return RLFL_SUCCESS;
+
+	return found ? RLFL_SUCCESS : RLFL_ERR_GENERIC;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Wipe path map `p` of every level
+ +-----------------------------------------------------------+
+ */
+err
+RLFL_stack_wipe_map(unsigned int s, unsigned int p)
+{
+	map_stack_t *st = get_stack(s);
+	if(st == NULL)
+		return RLFL_ERR_NO_STACK;
+
+	if(p >= RLFL_MAX_PATHS)
+		return RLFL_ERR_NO_PATH;
+
+	unsigned int l;
+	for(l=0; l<st->size; l++)
+		RLFL_path_wipe_map(st->levels[l], p);
+
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Stack of a stack number, or NULL
+ +-----------------------------------------------------------+
+ */
+static inline map_stack_t *
+get_stack(unsigned int s)
+{
+	return (s < RLFL_MAX_STACKS) ? stack_store[s] : NULL;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Key of a cell of a level, in level then cell order
+ +-----------------------------------------------------------+
+ */
+static inline uint64_t
+node_key(unsigned int level, unsigned int cell)
+{
+	return ((uint64_t)level << 32) | cell;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	qsort() order of portal keys
+ +-----------------------------------------------------------+
+ */
+static int
+compare_keys(const void *a, const void *b)
+{
+	uint64_t ka = ((const portal_key_t *)a)->key, kb = ((const portal_key_t *)b)->key;
+	return (ka > kb) - (ka < kb);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Sort the portals by the cells they leave from and
+ * 			lead to
+ +-----------------------------------------------------------+
+ */
+static err
+sort_portals(map_stack_t *st)
+{
+	unsigned int n = st->portal_count, i;
+	portal_key_t *from = (portal_key_t *)realloc(st->from, sizeof(portal_key_t) * (n + 1));
+	if(from == NULL)
+		return RLFL_ERR_GENERIC;
+	st->from = from;
+	portal_key_t *to = (portal_key_t *)realloc(st->to, sizeof(portal_key_t) * (n + 1));
+	if(to == NULL)
+		return RLFL_ERR_GENERIC;
+	st->to = to;
+
+	for(i=0; i<n; i++)
+	{
+		const portal_t *p = &st->portals[i];
+		from[i].key = node_key(p->level, p->cell);
+		from[i].portal = i;
+		to[i].key = node_key(p->to_level, p->to_cell);
+		to[i].portal = i;
+	}
+	qsort(from, n, sizeof(portal_key_t), compare_keys);
+	qsort(to, n, sizeof(portal_key_t), compare_keys);
+	st->sorted = true;
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Index of the first of `n` sorted keys not below `key`
+ +-----------------------------------------------------------+
+ */
+static unsigned int
+first_key(const portal_key_t *keys, unsigned int n, uint64_t key)
+{
+	unsigned int lo = 0, hi = n;
+	while(lo < hi)
+	{
+		unsigned int mid = lo + ((hi - lo) / 2);
+		if(keys[mid].key < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Check level `l` and its cell x, y, and get the cell
+ * 			number
+ +-----------------------------------------------------------+
+ */
+static err
+cell_valid(map_stack_t *st, unsigned int l, unsigned int x, unsigned int y, unsigned int *cell)
+{
+	if(l >= st->size)
+		return RLFL_ERR_OUT_OF_BOUNDS;
+
+	if(!RLFL_map_valid(st->levels[l]))
+		return RLFL_ERR_NO_MAP;
+
+	RLFL_map_t *map = RLFL_MAP(st->levels[l]);
+	if(x >= map->width || y >= map->height)
+		return RLFL_ERR_OUT_OF_BOUNDS;
+
+	*cell = x + (y * map->width);
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Set up search `q` on every level of `st`
+ +-----------------------------------------------------------+
+ */
+static err
+search_open(stack_search_t *q, RLFL_ctx_t *ctx, map_stack_t *st, unsigned int types, float dcost)
+{
+	memset(q, 0, sizeof(stack_search_t));
+	if(!(dcost >= 0))
+		return RLFL_ERR_GENERIC;
+
+	if(!st->sorted && sort_portals(st))
+		return RLFL_ERR_GENERIC;
+
+	q->stack = st;
+	q->types = types;
+	q->dcost = dcost;
+	q->ctx = ctx;
+	q->views = (map_view_t *)malloc(sizeof(map_view_t) * (st->size + 1));
+	q->nodes = (stack_node_t **)calloc(st->size + 1, sizeof(stack_node_t *));
+	if(q->views == NULL || q->nodes == NULL)
+	{
+		search_close(q);
+		return RLFL_ERR_GENERIC;
+	}
+
+	unsigned int l;
+	for(l=0; l<st->size; l++)
+	{
+		if(view_open(&q->views[l], st->levels[l]))
+		{
+			search_close(q);
+			return RLFL_ERR_NO_MAP;
+		}
+	}
+
+	q->room = 256;
+	q->open = (stack_open_t *)ctx_scratch(ctx, SCRATCH_HEAP, sizeof(stack_open_t) * q->room);
+	if(q->open == NULL)
+	{
+		search_close(q);
+		return RLFL_ERR_GENERIC;
+	}
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Free search
+ +-----------------------------------------------------------+
+ */
+static void
+search_close(stack_search_t *q)
+{
+	unsigned int l;
+	if(q->nodes)
+	{
+		for(l=0; l<q->stack->size; l++)
+			free(q->nodes[l]);
+	}
+	free(q->nodes);
+	free(q->views);
+	free(q->exits);
+	free(q->exit_first);
+	q->nodes = NULL;
+	q->views = NULL;
+	q->exits = NULL;
+	q->exit_first = NULL;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Node of a cell, the nodes of its level are made on
+ * 			the first visit to the level
+ +-----------------------------------------------------------+
+ */
+static stack_node_t *
+search_node(stack_search_t *q, unsigned int l, unsigned int cell)
+{
+	if(q->nodes[l] == NULL)
+	{
+		q->nodes[l] = (stack_node_t *)calloc(q->views[l].map->cellcnt, sizeof(stack_node_t));
+		if(q->nodes[l] == NULL)
+			return NULL;
+	}
+	return &q->nodes[l][cell];
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Bound the cost from each portal to the goal, and
+ * 			keep the exits of each level. A portal into level
+ * 			L costs at least its cost, plus the straight
+ * 			distance to the goal on the goal level, or to an
+ * 			exit of L and the bound of the exit. The distance
+ * 			to the exits of levels with too many of them is
+ * 			taken as 0, as in estimate().
+ +-----------------------------------------------------------+
+ */
+static err
+bound_exits(stack_search_t *q)
+{
+	map_stack_t *st = q->stack;
+	unsigned int n = st->portal_count, i, j, l;
+	float *bound = (float *)malloc(sizeof(float) * (n + 1));
+	q->exits = (stack_exit_t *)malloc(sizeof(stack_exit_t) * (n + 1));
+	q->exit_first = (unsigned int *)calloc(st->size + 1, sizeof(unsigned int));
+	if(bound == NULL || q->exits == NULL || q->exit_first == NULL)
+	{
+		free(bound);
+		return RLFL_ERR_GENERIC;
+	}
+
+	/* Exits of each level, in exit_first[l + 1] for now */
+	for(i=0; i<n; i++)
+	{
+		if(st->portals[i].type & q->types)
+			q->exit_first[st->portals[i].level + 1]++;
+	}
+
+	/* Dijkstra on the portals, with the open heap */
+	for(i=0; i<n; i++)
+	{
+		const portal_t *p = &st->portals[i];
+		bound[i] = INFINITY;
+		if(!(p->type & q->types) || p->to_level != q->gl)
+			continue;
+		unsigned int w = q->views[p->to_level].width;
+		bound[i] = p->cost + straight(q, p->to_cell % w, p->to_cell / w, q->gx, q->gy);
+		if(push(q, bound[i], i, 0))
+			goto fail;
+	}
+	while(q->top)
+	{
+		stack_open_t o = pop(q);
+		if(o.key > bound[o.level])
+			continue;
+
+		/* Portals into the level exit `e` leaves */
+		const portal_t *e = &st->portals[o.level];
+		unsigned int w = q->views[e->level].width;
+		int ex = e->cell % w, ey = e->cell / w;
+		bool wide = q->exit_first[e->level + 1] > STACK_EXITS;
+		for(j=first_key(st->to, n, node_key(e->level, 0)); j<n && (st->to[j].key >> 32) == e->level; j++)
+		{
+			unsigned int k = st->to[j].portal;
+			const portal_t *p = &st->portals[k];
+			if(!(p->type & q->types))
+				continue;
+			float c = p->cost + o.key;
+			if(!wide)
+				c += straight(q, p->to_cell % w, p->to_cell / w, ex, ey);
+			if(c < bound[k])
+			{
+				bound[k] = c;
+				if(push(q, c, k, 0))
+					goto fail;
+			}
+		}
+	}
+
+	/* Exits by level, the portals already are in that order */
+	unsigned int count = 0;
+	for(l=0, i=0; l<st->size; l++)
+	{
+		unsigned int start = count;
+		bool wide = q->exit_first[l + 1] > STACK_EXITS;
+		q->exit_first[l] = start;
+		for(; i<n && (st->from[i].key >> 32) == l; i++)
+		{
+			unsigned int k = st->from[i].portal;
+			if(bound[k] == INFINITY)
+				continue;
+			unsigned int w = q->views[l].width;
+			stack_exit_t *x = &q->exits[count++];
+			x->x = st->portals[k].cell % w;
+			x->y = st->portals[k].cell / w;
+			x->cost = bound[k];
+		}
+		if(wide && count > start)
+		{
+			/* Too many to look at for every cell, the least will do */
+			for(j=start+1; j<count; j++)
+				q->exits[start].cost = MIN(q->exits[start].cost, q->exits[j].cost);
+			q->exits[start].x = -1;
+			count = start + 1;
+		}
+	}
+	q->exit_first[st->size] = count;
+	free(bound);
+	return RLFL_SUCCESS;
+
+fail:
+	free(bound);
+	q->top = 0;
+	return RLFL_ERR_GENERIC;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Least cost of moving from x1, y1 to x2, y2 on an
+ * 			open level
+ +-----------------------------------------------------------+
+ */
+static inline float
+straight(const stack_search_t *q, int x1, int y1, int x2, int y2)
+{
+	int dx = ABS(x1 - x2), dy = ABS(y1 - y2);
+	return MAX(dx, dy) + (q->dcost * MIN(dx, dy));
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Estimate of the cost from a cell to the goal
+ +-----------------------------------------------------------+
+ */
+static float
+estimate(const stack_search_t *q, unsigned int l, unsigned int cell)
+{
+	if(!q->astar)
+		return 0;
+
+	unsigned int w = q->views[l].width, i;
+	int x = cell % w, y = cell / w;
+	float h = (l == q->gl) ? straight(q, x, y, q->gx, q->gy) : INFINITY;
+	for(i=q->exit_first[l]; i<q->exit_first[l + 1]; i++)
+	{
+		const stack_exit_t *e = &q->exits[i];
+		float c = e->cost + ((e->x < 0) ? 0 : straight(q, x, y, e->x, e->y));
+		if(c < h)
+			h = c;
+	}
+	return h;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Reach a cell at `cost`, from pl, pcell
+ +-----------------------------------------------------------+
+ */
+static err
+relax(stack_search_t *q, unsigned int l, unsigned int cell, float cost, unsigned int pl, unsigned int pcell)
+{
+	stack_node_t *node = search_node(q, l, cell);
+	if(node == NULL)
+		return RLFL_ERR_GENERIC;
+
+	if(node->state == STATE_CLOSED || (node->state == STATE_OPEN && node->cost <= cost))
+		return RLFL_SUCCESS;
+
+	if(node->state == STATE_EMPTY)
+		node->estimate = estimate(q, l, cell);
+	float h = node->estimate;
+	if(h == INFINITY)
+		return RLFL_SUCCESS;
+
+	node->cost = cost;
+	node->parent_level = pl;
+	node->parent_cell = pcell;
+	node->state = STATE_OPEN;
+	return push(q, cost + h, l, cell);
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Reach the neighbours of a cell and the ends of its
+ * 			portals
+ +-----------------------------------------------------------+
+ */
+static err
+expand(stack_search_t *q, unsigned int l, unsigned int cell, float cost)
+{
+	const map_view_t *v = &q->views[l];
+	int x = cell % v->width, y = cell / v->width, dir;
+
+	/* Cells are entered only if they can be walked, the origin of
+	   a path is the only one that may be a wall */
+	if(q->reverse && !passable(v, x, y))
+		return RLFL_SUCCESS;
+
+	for(dir=0; dir<8; dir++)
+	{
+		int xx = x + stack_dirs[dir][0], yy = y + stack_dirs[dir][1];
+		if(!passable(v, xx, yy))
+			continue;
+
+		float step = 1;
+		if(dir >= 4)
+		{
+			/* No cutting corners */
+			if(!passable(v, xx, y) || !passable(v, x, yy))
+				continue;
+			step += q->dcost;
+		}
+		if(relax(q, l, xx + (yy * v->width), cost + step, l, cell))
+			return RLFL_ERR_GENERIC;
+	}
+
+	map_stack_t *st = q->stack;
+	const portal_key_t *keys = q->reverse ? st->to : st->from;
+	uint64_t key = node_key(l, cell);
+	unsigned int i;
+	for(i=first_key(keys, st->portal_count, key); i<st->portal_count && keys[i].key == key; i++)
+	{
+		const portal_t *p = &st->portals[keys[i].portal];
+		if(!(p->type & q->types))
+			continue;
+
+		unsigned int tl = q->reverse ? p->level : p->to_level;
+		unsigned int tc = q->reverse ? p->cell : p->to_cell;
+		const map_view_t *tv = &q->views[tl];
+		if(!passable(tv, tc % tv->width, tc / tv->width))
+			continue;
+		if(relax(q, tl, tc, cost + p->cost, l, cell))
+			return RLFL_ERR_GENERIC;
+	}
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Search until the open heap is empty, or the goal,
+ * 			cell `gcell` of level gl, is reached by A*
+ +-----------------------------------------------------------+
+ */
+static err
+run(stack_search_t *q, unsigned int gcell)
+{
+	while(q->top)
+	{
+		stack_open_t o = pop(q);
+		stack_node_t *node = &q->nodes[o.level][o.cell];
+
+		/* Reached again at a lower cost since it was pushed */
+		if(node->state == STATE_CLOSED)
+			continue;
+		node->state = STATE_CLOSED;
+
+		if(q->astar && o.level == q->gl && o.cell == gcell)
+			return RLFL_SUCCESS;
+
+		if(expand(q, o.level, o.cell, node->cost))
+			return RLFL_ERR_GENERIC;
+	}
+	return q->astar ? RLFL_ERR_NO_PATH : RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Push onto the open heap
+ +-----------------------------------------------------------+
+ */
+static err
+push(stack_search_t *q, float key, unsigned int l, unsigned int cell)
+{
+	if(q->top == q->room)
+	{
+		stack_open_t *open = (stack_open_t *)ctx_scratch(q->ctx, SCRATCH_HEAP,
+														 sizeof(stack_open_t) * q->room * 2);
+		if(open == NULL)
+			return RLFL_ERR_GENERIC;
+		q->open = open;
+		q->room *= 2;
+	}
+
+	unsigned int i = q->top++;
+	while(i)
+	{
+		unsigned int parent = (i - 1) / 2;
+		if(q->open[parent].key <= key)
+			break;
+		q->open[i] = q->open[parent];
+		i = parent;
+	}
+	q->open[i].key = key;
+	q->open[i].level = l;
+	q->open[i].cell = cell;
+	return RLFL_SUCCESS;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Pop the lowest key off the open heap
+ +-----------------------------------------------------------+
+ */
+static stack_open_t
+pop(stack_search_t *q)
+{
+	stack_open_t top = q->open[0], last = q->open[--q->top];
+	unsigned int i = 0, n = q->top;
+	while(true)
+	{
+		unsigned int child = (i * 2) + 1;
+		if(child >= n)
+			break;
+		if(child + 1 < n && q->open[child + 1].key < q->open[child].key)
+			child++;
+		if(last.key <= q->open[child].key)
+			break;
+		q->open[i] = q->open[child];
+		i = child;
+	}
+	q->open[i] = last;
+	return top;
+}
+/*
+ +-----------------------------------------------------------+
+ * @desc	Cell can be walked, as for the path maps
+ +-----------------------------------------------------------+
+ */
+static inline bool
+passable(const map_view_t *v, int x, int y)
+{
+	if(!view_in(v, x, y))
+		return false;
+
+	return view_has(v, x, y, (CELL_OPEN | CELL_WALK));
+}
@@ -1,6 +1,8 @@
 import unittest
 
 import sys
+import threading
+import random
 sys.path.append('..')
 
 import rlfl
@@ -230,6 +232,98 @@ class TestFov(unittest.TestCase):
         rlfl.fov(self.map, p, 6, rlfl.FOV_PERMISSIVE);
         self.match(exp)
         
+    def test_view_table(self):
+        # Open ground is the disc of the radius, as shadowcasting sees it
+        w, h = len(MAP), len(MAP[0])
+        m = rlfl.create_map(w, h)
+        rlfl.set_flag_rect(m, (0, 0), (w, h), rlfl.CELL_OPEN)
+        c = rlfl.clone_map(m)
+        for r in (1, 4, 8, 12):
+            for p in ((w // 2, h // 2), (1, 1), (w - 2, h - 3)):
+                rlfl.fov(m, p, r, rlfl.FOV_TABLE)
+                rlfl.fov(c, p, r, rlfl.FOV_SHADOW)
+                self.assertEqual(rlfl.read_cells(c), rlfl.read_cells(m))
+
+        # A pillar hides the cells right behind it, but not itself
+        p = (w // 2, h // 2)
+        rlfl.clear_flag(m, (p[0] + 2, p[1]), rlfl.CELL_OPEN)
+        for lw in (True, False):
+            rlfl.fov(m, p, 8, rlfl.FOV_TABLE, False, lw)
+            self.assertEqual(lw, rlfl.has_flag(m, (p[0] + 2, p[1]), rlfl.CELL_SEEN))
+            for d in range(3, 9):
+                self.assertFalse(rlfl.has_flag(m, (p[0] + d, p[1]), rlfl.CELL_SEEN))
+            self.assertTrue(rlfl.has_flag(m, (p[0] - 8, p[1]), rlfl.CELL_SEEN))
+
+        # Never more than shadowcasting sees
+        random.seed(7)
+        for i in range(100):
+            p = (random.randrange(w), random.randrange(h))
+            r = random.choice([4, 8, 12, 20])
+            rlfl.fov(self.map, p, r, rlfl.FOV_TABLE)
+            table = rlfl.has_flag_rect(self.map, (0, 0), (w, h), rlfl.CELL_SEEN)
+            rlfl.fov(self.map, p, r, rlfl.FOV_SHADOW)
+            shadow = rlfl.has_flag_rect(self.map, (0, 0), (w, h), rlfl.CELL_SEEN)
+            self.assertEqual(bytes(a & ~b & 0xff for a, b in zip(table, shadow)), bytes(len(table)))
+
+    def test_shadow_iter(self):
+        # The same cells as recursive shadowcasting, on the test map
+        # and on random caves, up to the edges of the map
+        random.seed(11)
+        w, h = len(MAP), len(MAP[0])
+        c = rlfl.clone_map(self.map)
+        cave = rlfl.create_map(64, 64)
+        for y in range(64):
+            for x in range(64):
+                if random.random() < .8:
+                    rlfl.set_flag(cave, (x, y), rlfl.CELL_OPEN)
+        cave2 = rlfl.clone_map(cave)
+        for m, n, size in ((self.map, c, (w, h)), (cave, cave2, (64, 64))):
+            for i in range(150):
+                args = ((random.randrange(size[0]), random.randrange(size[1])),
+                        random.choice([1, 4, 8, 12, 20, 40]))
+                lw = random.random() < .5
+                rlfl.fov(m, *args, rlfl.FOV_SHADOW_ITER, True, lw)
+                rlfl.fov(n, *args, rlfl.FOV_SHADOW, True, lw)
+                self.assertEqual(rlfl.read_cells(n), rlfl.read_cells(m))
+
+    def test_symmetric(self):
+        # Floor cells see each other or neither does, on the test map
+        # and on a random cave, with or without lit walls
+        random.seed(13)
+        cave = rlfl.create_map(40, 40)
+        for y in range(40):
+            for x in range(40):
+                if random.random() < .75:
+                    rlfl.set_flag(cave, (x, y), rlfl.CELL_OPEN)
+        for m, r in ((self.map, 12), (cave, 8)):
+            w, h = rlfl.map_size(m)
+            floor = [(x, y) for x in range(w) for y in range(h)
+                     if rlfl.has_flag(m, (x, y), rlfl.CELL_OPEN)]
+            for lw in (True, False):
+                sees = {}
+                for p, seen in zip(floor, rlfl.fov_batch(m, [(p, r, rlfl.FOV_SYMMETRIC) for p in floor],
+                                                         lw, 0, True)):
+                    sees[p] = set(seen)
+                for a in floor:
+                    for b in sees[a]:
+                        if b in sees:
+                            self.assertIn(a, sees[b])
+
+        # Open ground is the disc of the radius
+        rlfl.set_flag_rect(cave, (0, 0), (40, 40), rlfl.CELL_OPEN)
+        rlfl.fov(cave, (20, 20), 8, rlfl.FOV_SYMMETRIC)
+        for x in range(40):
+            for y in range(40):
+                d = (x - 20) ** 2 + (y - 20) ** 2
+                self.assertEqual(d <= 64, rlfl.has_flag(cave, (x, y), rlfl.CELL_SEEN))
+
+        # A pillar hides the cell right behind it, not itself if walls are lit
+        rlfl.clear_flag(cave, (22, 20), rlfl.CELL_OPEN)
+        for lw in (True, False):
+            rlfl.fov(cave, (20, 20), 8, rlfl.FOV_SYMMETRIC, False, lw)
+            self.assertEqual(lw, rlfl.has_flag(cave, (22, 20), rlfl.CELL_SEEN))
+            self.assertFalse(rlfl.has_flag(cave, (23, 20), rlfl.CELL_SEEN))
+
     def test_input(self):
         algos = [
            rlfl.FOV_PERMISSIVE,
@@ -275,6 +369,165 @@ class TestFov(unittest.TestCase):
                 else:
                     self.fail('Expected Exception: %s (%d)' % (i['s'], a))
         
+    def test_layouts(self):
+        algos = [
+           rlfl.FOV_RESTRICTIVE,
+           rlfl.FOV_PERMISSIVE,
+           rlfl.FOV_DIGITAL,
+           rlfl.FOV_SHADOW,
+           rlfl.FOV_DIAMOND,
+           rlfl.FOV_CIRCULAR, 
+           rlfl.FOV_TABLE,
+           rlfl.FOV_SHADOW_ITER,
+           rlfl.FOV_SYMMETRIC,
+        ]
+        maps = [self.map]
+        for layout in [rlfl.MAP_PLANES, rlfl.MAP_TILED, rlfl.MAP_SPARSE]:
+            m = rlfl.create_map(len(MAP), len(MAP[0]), layout)
+            self.assertEqual(layout, rlfl.map_layout(m))
+            for row in range(len(MAP)):
+                for col in range(len(MAP[row])):
+                    if MAP[row][col] != '#':
+                        rlfl.set_flag(m, (row, col), rlfl.CELL_SEEN|rlfl.CELL_OPEN) 
+            maps.append(m)
+        for a in algos:
+            for r in (0, 8):
+                for lw in (True, False):
+                    for m in maps:
+                        rlfl.fov(m, ORIGOS[1], r, a, True, lw)
+                    for row in range(len(MAP)):
+                        for col in range(len(MAP[row])):
+                            f = rlfl.get_flags(self.map, (row, col))
+                            for m in maps[1:]:
+                                self.assertEqual(f, rlfl.get_flags(m, (row, col)))
+
+
+    def test_threads(self):
+        # Threads on their own maps, and all on the same one, match
+        # the same work done serially
+        algos = [rlfl.FOV_PERMISSIVE, rlfl.FOV_DIAMOND, rlfl.FOV_CIRCULAR, rlfl.FOV_TABLE]
+        maps = [rlfl.clone_map(self.map) for a in algos]
+        expect = []
+        for m, a in zip(maps, algos):
+            rlfl.fov(m, ORIGOS[1], 20, a)
+            expect.append(bytes(rlfl.read_cells(m)))
+
+        def work(m, a, out):
+            for i in range(20):
+                rlfl.fov(m, ORIGOS[1], 20, a)
+                out.append(bytes(rlfl.read_cells(m)))
+        results = [[] for a in algos]
+        threads = [threading.Thread(target=work, args=(m, a, r))
+                   for m, a, r in zip(maps, algos, results)]
+        threads += [threading.Thread(target=work, args=(self.map, rlfl.FOV_PERMISSIVE, []))
+                    for i in range(3)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        for e, r in zip(expect, results):
+            self.assertEqual([e] * 20, r)
+        
+    def test_incremental(self):
+        # FOV clears only the cells of the last one, the result is
+        # that of a clone cleared whole, whatever else set the flags
+        random.seed(3)
+        w, h = len(MAP), len(MAP[0])
+        algos = [rlfl.FOV_CIRCULAR, rlfl.FOV_DIAMOND, rlfl.FOV_SHADOW, rlfl.FOV_DIGITAL,
+                 rlfl.FOV_RESTRICTIVE, rlfl.FOV_PERMISSIVE, rlfl.FOV_TABLE, rlfl.FOV_SHADOW_ITER,
+                 rlfl.FOV_SYMMETRIC]
+        for layout in [rlfl.MAP_DENSE, rlfl.MAP_PLANES, rlfl.MAP_SPARSE]:
+            m = rlfl.create_map(w, h, layout)
+            rlfl.write_cells(m, rlfl.read_cells(self.map))
+            rlfl.journal_map(m, 10000)
+            for step in range(120):
+                op = step % 8
+                p = (random.randrange(w), random.randrange(h))
+                if op == 1:
+                    rlfl.set_flag(m, p, random.choice([rlfl.CELL_SEEN, rlfl.CELL_LIT]))
+                elif op == 3:
+                    rlfl.set_flag_rect(m, p, (1, 1), rlfl.CELL_LIT)
+                elif op == 5:
+                    mark = rlfl.checkpoint(m)
+                    rlfl.fov(m, p, 8, random.choice(algos), True)
+                    rlfl.rollback(m, mark)
+                elif op == 7 and step > 100 and layout == rlfl.MAP_DENSE:
+                    rlfl.map_cells(m)[p[1], p[0]] |= rlfl.CELL_SEEN
+                c = rlfl.clone_map(m)
+                args = (p, random.choice([4, 8, 12]), random.choice(algos), random.random() < .5,
+                        random.random() < .5)
+                rlfl.fov(c, *args)
+                rlfl.fov(m, *args)
+                self.assertEqual(rlfl.read_cells(m), rlfl.read_cells(c))
+                rlfl.delete_map(c)
+            rlfl.delete_map(m)
+
+    def test_cells_view(self):
+        # Writes through a live map_cells() view are cleared by the
+        # next FOV, other views released or not, and FOV matches a
+        # clone once every view is released
+        m, p, far = self.map, ORIGOS[1], (0, 0)
+        cells = rlfl.map_cells(m)
+        other = rlfl.map_cells(m)
+        del other
+        for i in range(3):
+            rlfl.fov(m, p, 6, rlfl.FOV_SHADOW)
+            cells[far[1], far[0]] |= rlfl.CELL_SEEN
+            rlfl.fov(m, p, 6, rlfl.FOV_SHADOW)
+            self.assertFalse(rlfl.has_flag(m, far, rlfl.CELL_SEEN))
+        del cells
+        for r in [4, 8, 6]:
+            c = rlfl.clone_map(m)
+            rlfl.fov(c, p, r, rlfl.FOV_SHADOW)
+            rlfl.fov(m, p, r, rlfl.FOV_SHADOW)
+            self.assertEqual(rlfl.read_cells(m), rlfl.read_cells(c))
+            rlfl.delete_map(c)
+
+    def test_batch(self):
+        # Each viewer sees what FOV on a clone sees, within its window,
+        # and the map is left as it was
+        random.seed(5)
+        w, h = len(MAP), len(MAP[0])
+        algos = [rlfl.FOV_CIRCULAR, rlfl.FOV_DIAMOND, rlfl.FOV_SHADOW, rlfl.FOV_DIGITAL,
+                 rlfl.FOV_RESTRICTIVE, rlfl.FOV_PERMISSIVE, rlfl.FOV_TABLE, rlfl.FOV_SHADOW_ITER,
+                 rlfl.FOV_SYMMETRIC]
+        viewers = []
+        while len(viewers) < 60:
+            p = (random.randrange(w), random.randrange(h))
+            if rlfl.has_flag(self.map, p, rlfl.CELL_OPEN):
+                viewers.append((p, random.choice([1, 4, 8, 20]), algos[len(viewers) % len(algos)]))
+        before = rlfl.read_cells(self.map)
+        c = rlfl.clone_map(self.map)
+        for lw in (True, False):
+            results = [rlfl.fov_batch(self.map, viewers, lw, threads) for threads in (1, 4, 0)]
+            cells = rlfl.fov_batch(self.map, viewers, lw, 4, True)
+            for i, (p, r, a) in enumerate(viewers):
+                rlfl.fov(c, p, r, a, False, lw)
+                for result in results:
+                    rect, bits = result[i]
+                    self.assertEqual(rlfl.has_flag_rect(c, rect[:2], rect[2:], rlfl.CELL_SEEN), bits)
+                    self.assertEqual(rlfl.count_flags(c, rlfl.CELL_SEEN),
+                                     sum(bin(b).count('1') for b in bits))
+                self.assertEqual(sorted(cells[i]), [(x, y) for x in range(w) for y in range(h)
+                                                    if rlfl.has_flag(c, (x, y), rlfl.CELL_SEEN)])
+        self.assertEqual(before, rlfl.read_cells(self.map))
+
+        # The window is clipped to the map
+        rect, bits = rlfl.fov_batch(self.map, [((0, 0), 4, rlfl.FOV_SHADOW)])[0]
+        self.assertEqual((0, 0, 5, 5), rect)
+        self.assertEqual(4, len(bits))
+        self.assertEqual([], rlfl.fov_batch(self.map, []))
+
+        # A bad viewer fails the batch
+        p = viewers[0][0]
+        self.assertRaises(Exception, rlfl.fov_batch, self.map, [(p, 4, 99)])
+        self.assertRaises(Exception, rlfl.fov_batch, self.map, [((w, 0), 4, rlfl.FOV_SHADOW)])
+        self.assertRaisesRegex(Exception, "Illegal radius", rlfl.fov_batch, self.map,
+                               [(p, rlfl.MAX_RADIUS, rlfl.FOV_SHADOW)])
+        self.assertRaises(TypeError, rlfl.fov_batch, self.map, [(p, 4)])
+        self.assertRaises(TypeError, rlfl.fov_batch, self.map, 4)
+        self.assertRaises(Exception, rlfl.fov_batch, 99, viewers)
+
     def match(self, emap):
        for row in range(len(MAP)):
             for col in range(len(MAP[row])):
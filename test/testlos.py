@@ -1,4 +1,5 @@
 import unittest
+import threading
 
 import sys
 sys.path.append('..')
@@ -42,5 +43,31 @@ class TestLos(unittest.TestCase):
             else:
                 self.fail('Expected Exception: %s' % (i[3]))
 
+    def test_threads(self):
+        # Readers share the map while a writer flips a cell no line
+        # crosses, every read sees the same answers
+        p, p1, p2, p3 = ORIGOS[:4]
+        spare = [(r, c) for r in range(len(MAP)) for c in range(len(MAP[r]))
+                 if MAP[r][c] == '#'][0]
+        expect = [rlfl.los(self.map, p, p1), rlfl.los(self.map, p2, p3)]
+        results = [[] for i in range(4)]
+
+        def read(out):
+            for i in range(200):
+                out.append([rlfl.los(self.map, p, p1), rlfl.los(self.map, p2, p3)])
+
+        def write():
+            for i in range(200):
+                rlfl.set_flag(self.map, spare, rlfl.CELL_LIT)
+                rlfl.clear_flag(self.map, spare, rlfl.CELL_LIT)
+        threads = [threading.Thread(target=read, args=(r,)) for r in results]
+        threads.append(threading.Thread(target=write))
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        for r in results:
+            self.assertEqual([expect] * 200, r)
+
 if __name__ == '__main__':
     unittest.main()
\ No newline at end of file
@@ -1,4 +1,7 @@
 import unittest
+import os
+import shutil
+import tempfile
 
 import sys
 sys.path.append('..')
@@ -12,8 +15,10 @@ class TestMap(unittest.TestCase):
         rlfl.delete_all_maps()
     
     def test_create(self):
-        for m in range(rlfl.MAX_MAPS):
-            self.assertEqual(m, rlfl.create_map(20, 20))
+        self.assertEqual(rlfl.MAX_MAPS, rlfl.max_maps())
+        maps = [rlfl.create_map(20, 20) for m in range(rlfl.MAX_MAPS)]
+        self.assertEqual(rlfl.MAX_MAPS, len(set(maps)))
+        self.assertEqual(rlfl.MAX_MAPS, rlfl.map_count())
         try:
             m = rlfl.create_map(20, 20)
         except Exception as e:
@@ -50,13 +55,51 @@ class TestMap(unittest.TestCase):
         for m in range(rlfl.MAX_MAPS):
             rlfl.create_map(20, 20)
         rlfl.delete_all_maps()
-        self.assertEqual(0, rlfl.create_map(20, 20))
-        self.assertTrue(rlfl.delete_map(0))
-        self.assertEqual(0, rlfl.create_map(20, 20))
-        self.assertTrue(rlfl.delete_map(0))
-        self.assertFalse(rlfl.delete_map(0))
+        self.assertEqual(0, rlfl.map_count())
+        m = rlfl.create_map(20, 20)
+        self.assertTrue(rlfl.delete_map(m))
+        n = rlfl.create_map(20, 20)
+        self.assertNotEqual(m, n)
+        self.assertFalse(rlfl.delete_map(m))
+        self.assertTrue(rlfl.delete_map(n))
+        self.assertFalse(rlfl.delete_map(n))
         self.assertFalse(rlfl.delete_map(-1))
         
+    def test_registry(self):
+        rlfl.set_max_maps(500)
+        try:
+            maps = [rlfl.create_map(10, 10) for i in range(500)]
+            self.assertEqual(500, rlfl.map_count())
+            self.assertEqual(500, len(set(maps)))
+            for m in maps[::2]:
+                rlfl.delete_map(m)
+            # Stale handles are rejected
+            try:
+                rlfl.set_flag(maps[0], (1, 1), rlfl.CELL_OPEN)
+            except Exception as e:
+                self.assertEqual(str(e), 'Map not initialized')
+            else:
+                self.fail('Expected Exception')
+            rlfl.set_flag(maps[1], (1, 1), rlfl.CELL_OPEN)
+            self.assertTrue(rlfl.has_flag(maps[1], (1, 1), rlfl.CELL_OPEN))
+            again = [rlfl.create_map(10, 10) for i in range(250)]
+            self.assertFalse(set(again) & set(maps))
+            try:
+                rlfl.create_map(10, 10)
+            except Exception as e:
+                self.assertEqual(str(e), 'Too many maps')
+            else:
+                self.fail('Expected Exception')
+        finally:
+            rlfl.delete_all_maps()
+            rlfl.set_max_maps(rlfl.MAX_MAPS)
+        try:
+            rlfl.set_max_maps(0)
+        except Exception as e:
+            self.assertEqual(str(e), 'Invalid map limit')
+        else:
+            self.fail('Expected Exception')
+        
     def test_flags(self):
         m = rlfl.create_map(20, 20)
         test = (
@@ -98,6 +141,596 @@ class TestMap(unittest.TestCase):
             else:
                 self.fail('Expected Exception: func: %s, %s' % ('get_flags', i['s']))
         
+    def test_cell_bits(self):
+        self.assertTrue(rlfl.CELL_BITS >= 16)
+        m = rlfl.create_map(20, 20)
+        rlfl.set_flag(m, (10, 10), rlfl.CELL_MASK)
+        self.assertEqual(rlfl.CELL_MASK, rlfl.get_flags(m, (10, 10)))
+        self.assertEqual(rlfl.CELL_PERM, rlfl.get_flags(m, (0, 10)))
+        
+    def test_layouts(self):
+        for layout in (rlfl.MAP_DENSE, rlfl.MAP_PLANES, rlfl.MAP_TILED, rlfl.MAP_SPARSE):
+            m = rlfl.create_map(70, 30, layout)
+            self.assertEqual(layout, rlfl.map_layout(m))
+            self.assertEqual(rlfl.CELL_PERM, rlfl.get_flags(m, (69, 29)))
+            rlfl.set_flag(m, (10, 10), rlfl.CELL_OPEN|rlfl.CELL_MARK)
+            self.assertTrue(rlfl.has_flag(m, (10, 10), rlfl.CELL_MARK))
+            self.assertFalse(rlfl.has_flag(m, (10, 11), rlfl.CELL_MARK))
+            rlfl.clear_flag(m, (10, 10), rlfl.CELL_OPEN)
+            self.assertEqual(rlfl.CELL_MARK, rlfl.get_flags(m, (10, 10)))
+            rlfl.fill_map(m, rlfl.CELL_LIT)
+            self.assertEqual(rlfl.CELL_LIT|rlfl.CELL_PERM, rlfl.get_flags(m, (69, 29)))
+            rlfl.clear_map(m, rlfl.CELL_LIT|rlfl.CELL_MARK)
+            self.assertEqual(0, rlfl.get_flags(m, (10, 10)))
+        try:
+            rlfl.create_map(20, 20, 1000)
+        except Exception as e:
+            self.assertEqual(str(e), 'Invalid map layout')
+        else:
+            self.fail('Expected Exception')
+        
+    def test_sparse(self):
+        w, h = 20000, 20000
+        m = rlfl.create_map(w, h, rlfl.MAP_SPARSE)
+        used, total = rlfl.map_tiles(m)
+        # Only the border tiles have storage
+        self.assertEqual(used, 2 * (w // 16 + h // 16) - 4)
+        self.assertEqual(total, (w // 16) * (h // 16))
+        self.assertEqual(0, rlfl.get_flags(m, (10000, 10000)))
+        self.assertEqual(rlfl.CELL_PERM, rlfl.get_flags(m, (w - 1, h - 1)))
+        # Reads and no-op writes do not allocate
+        rlfl.clear_flag(m, (10000, 10000), rlfl.CELL_OPEN)
+        self.assertEqual(used, rlfl.map_tiles(m)[0])
+        # A room across tile boundaries
+        for x in range(9990, 10030):
+            for y in range(9990, 10030):
+                rlfl.set_flag(m, (x, y), rlfl.CELL_SEEN|rlfl.CELL_OPEN|rlfl.CELL_WALK)
+        self.assertEqual(used + 9, rlfl.map_tiles(m)[0])
+        self.assertTrue(rlfl.los(m, (9991, 9991), (10028, 10028)))
+        self.assertFalse(rlfl.los(m, (9991, 9991), (10040, 10040)))
+        path = rlfl.path(m, (9991, 9991), (10028, 10020), rlfl.PATH_ASTAR)
+        self.assertEqual((10028, 10020), path[0])
+        self.assertEqual((9991, 9991), path[-1])
+        for a in (rlfl.FOV_SHADOW, rlfl.FOV_PERMISSIVE, rlfl.FOV_DIAMOND):
+            rlfl.fov(m, (10000, 10000), 45, a)
+            self.assertTrue(rlfl.has_flag(m, (10015, 10015), rlfl.CELL_SEEN))
+            self.assertTrue(rlfl.has_flag(m, (10029, 10000), rlfl.CELL_SEEN))
+            self.assertFalse(rlfl.has_flag(m, (10031, 10000), rlfl.CELL_SEEN))
+        # The walls FOV lit are in the same tiles as the room
+        self.assertEqual(used + 9, rlfl.map_tiles(m)[0])
+        try:
+            rlfl.create_map(w, h)
+        except Exception as e:
+            self.assertEqual(str(e), 'Invalid map size')
+        else:
+            self.fail('Expected Exception')
+        try:
+            rlfl.map_tiles(rlfl.create_map(20, 20))
+        except Exception as e:
+            self.assertEqual(str(e), 'Map is not tiled')
+        else:
+            self.fail('Expected Exception')
+        
+    def test_cells(self):
+        m = rlfl.create_map(30, 20)
+        cells = rlfl.map_cells(m)
+        self.assertEqual(cells.shape, (20, 30))
+        self.assertEqual(cells.itemsize * 8, rlfl.CELL_BITS)
+        self.assertEqual(cells[0, 0], rlfl.CELL_PERM)
+        
+        # Shared both ways
+        cells[5, 10] = rlfl.CELL_OPEN|rlfl.CELL_WALK
+        self.assertTrue(rlfl.has_flag(m, (10, 5), rlfl.CELL_WALK))
+        rlfl.set_flag(m, (3, 4), rlfl.CELL_LIT)
+        self.assertEqual(cells[4, 3], rlfl.CELL_LIT)
+        
+        # Pinned while the view is alive
+        try:
+            rlfl.delete_map(m)
+        except Exception as e:
+            self.assertEqual(str(e), 'Map is in use')
+        else:
+            self.fail('Expected Exception')
+        cells.release()
+        self.assertTrue(rlfl.delete_map(m))
+        
+        m = rlfl.create_map(30, 20, rlfl.MAP_TILED)
+        try:
+            rlfl.map_cells(m)
+        except Exception as e:
+            self.assertEqual(str(e), 'Map is not dense')
+        else:
+            self.fail('Expected Exception')
+        
+    def test_read_write_cells(self):
+        src = rlfl.create_map(40, 35)
+        for x in range(1, 39):
+            for y in range(1, 34):
+                if (x * 7 + y * 3) % 5:
+                    rlfl.set_flag(src, (x, y), rlfl.CELL_OPEN|rlfl.CELL_WALK)
+                if (x + y) % 11 == 0:
+                    rlfl.set_flag(src, (x, y), rlfl.CELL_MARK)
+        data = rlfl.read_cells(src)
+        self.assertEqual(len(data), 40 * 35 * rlfl.CELL_BITS // 8)
+        self.assertEqual(data, bytearray(rlfl.map_cells(src).tobytes()))
+        for layout in [rlfl.MAP_DENSE, rlfl.MAP_PLANES, rlfl.MAP_TILED, rlfl.MAP_SPARSE]:
+            m = rlfl.create_map(40, 35, layout)
+            rlfl.write_cells(m, data)
+            self.assertEqual(rlfl.read_cells(m), data)
+            for x, y in [(0, 0), (1, 1), (17, 16), (39, 34), (20, 33)]:
+                self.assertEqual(rlfl.get_flags(m, (x, y)), rlfl.get_flags(src, (x, y)))
+            try:
+                rlfl.write_cells(m, data[:-2])
+            except Exception as e:
+                self.assertEqual(str(e), 'Invalid buffer size')
+            else:
+                self.fail('Expected Exception')
+            rlfl.delete_map(m)
+        
+        # Unchanged tiles of a sparse map stay shared
+        m = rlfl.create_map(160, 160, rlfl.MAP_SPARSE)
+        used = rlfl.map_tiles(m)[0]
+        rlfl.write_cells(m, rlfl.read_cells(m))
+        self.assertEqual(rlfl.map_tiles(m)[0], used)
+        
+    def unpack(self, bits, n):
+        return [bool(bytearray(bits)[i >> 3] & (1 << (i & 7))) for i in range(n)]
+        
+    def test_bulk_rect(self):
+        for layout in [rlfl.MAP_DENSE, rlfl.MAP_PLANES, rlfl.MAP_TILED, rlfl.MAP_SPARSE]:
+            m = rlfl.create_map(90, 70, layout)
+            rlfl.set_flag_rect(m, (3, 5), (80, 40), rlfl.CELL_OPEN|rlfl.CELL_WALK)
+            rlfl.clear_flag_rect(m, (10, 10), (7, 33), rlfl.CELL_WALK)
+            rlfl.set_flag_rect(m, (0, 0), (0, 0), rlfl.CELL_LIT)
+            for x in range(90):
+                for y in range(70):
+                    inside = 3 <= x < 83 and 5 <= y < 45
+                    hole = 10 <= x < 17 and 10 <= y < 43
+                    self.assertEqual(rlfl.has_flag(m, (x, y), rlfl.CELL_OPEN), inside)
+                    self.assertEqual(rlfl.has_flag(m, (x, y), rlfl.CELL_WALK), inside and not hole)
+                    self.assertFalse(rlfl.has_flag(m, (x, y), rlfl.CELL_LIT))
+            
+            bits = rlfl.has_flag_rect(m, (5, 8), (20, 9), rlfl.CELL_WALK)
+            self.assertEqual(len(bits), (20 * 9 + 7) // 8)
+            expect = [rlfl.has_flag(m, (5 + i % 20, 8 + i // 20), rlfl.CELL_WALK) for i in range(20 * 9)]
+            self.assertEqual(self.unpack(bits, 20 * 9), expect)
+            
+            for args in [((85, 0), (6, 1)), ((0, 60), (1, 11)), ((91, 0), (0, 0))]:
+                try:
+                    rlfl.set_flag_rect(m, args[0], args[1], rlfl.CELL_LIT)
+                except Exception as e:
+                    self.assertEqual(str(e), 'Location out of bounds')
+                else:
+                    self.fail('Expected Exception')
+            rlfl.delete_map(m)
+        
+        # Ops that change nothing leave sparse tiles shared
+        m = rlfl.create_map(400, 400, rlfl.MAP_SPARSE)
+        used = rlfl.map_tiles(m)[0]
+        rlfl.clear_flag_rect(m, (20, 20), (300, 300), rlfl.CELL_WALK)
+        self.assertEqual(rlfl.map_tiles(m)[0], used)
+        rlfl.set_flag_rect(m, (20, 20), (40, 40), rlfl.CELL_WALK)
+        self.assertEqual(rlfl.map_tiles(m)[0], used + 9)
+            
+    def test_bulk_list(self):
+        for layout in [rlfl.MAP_DENSE, rlfl.MAP_PLANES, rlfl.MAP_TILED, rlfl.MAP_SPARSE]:
+            m = rlfl.create_map(50, 50, layout)
+            cells = [(x, (x * 7) % 50) for x in range(50)]
+            rlfl.set_flag_list(m, cells, rlfl.CELL_MARK|rlfl.CELL_LIT)
+            rlfl.clear_flag_list(m, cells[::2], rlfl.CELL_LIT)
+            query = cells + [(1, 1), (2, 2)]
+            bits = rlfl.has_flag_list(m, query, rlfl.CELL_LIT)
+            self.assertEqual(self.unpack(bits, len(query)),
+                             [i % 2 == 1 and i < 50 for i in range(len(query))])
+            self.assertTrue(all(self.unpack(rlfl.has_flag_list(m, cells, rlfl.CELL_MARK), 50)))
+            self.assertEqual(rlfl.has_flag_list(m, [], rlfl.CELL_MARK), b'')
+            
+            # Validated before anything is changed
+            try:
+                rlfl.set_flag_list(m, [(20, 20), (50, 0)], rlfl.CELL_ROOM)
+            except Exception as e:
+                self.assertEqual(str(e), 'Location out of bounds')
+            else:
+                self.fail('Expected Exception')
+            self.assertFalse(rlfl.has_flag(m, (20, 20), rlfl.CELL_ROOM))
+            try:
+                rlfl.set_flag_list(m, [(1, 2, 3)], rlfl.CELL_ROOM)
+            except TypeError:
+                pass
+            else:
+                self.fail('Expected TypeError')
+            rlfl.delete_map(m)
+            
+    def test_bulk_mask(self):
+        layouts = [rlfl.MAP_DENSE, rlfl.MAP_PLANES, rlfl.MAP_TILED, rlfl.MAP_SPARSE]
+        for mlayout in layouts:
+            mask = rlfl.create_map(40, 30, mlayout)
+            for x in range(40):
+                for y in range(30):
+                    if (x * y) % 3 == 0:
+                        rlfl.set_flag(mask, (x, y), rlfl.CELL_ROOM)
+            for layout in layouts:
+                m = rlfl.create_map(40, 30, layout)
+                rlfl.fill_map(m, rlfl.CELL_LIT)
+                rlfl.set_flag_mask(m, mask, rlfl.CELL_ROOM, rlfl.CELL_GLOW)
+                rlfl.clear_flag_mask(m, mask, rlfl.CELL_ROOM, rlfl.CELL_LIT)
+                for x in range(40):
+                    for y in range(30):
+                        inside = (x * y) % 3 == 0
+                        self.assertEqual(rlfl.has_flag(m, (x, y), rlfl.CELL_GLOW), inside)
+                        self.assertEqual(rlfl.has_flag(m, (x, y), rlfl.CELL_LIT), not inside)
+                rlfl.set_flag_rect(m, (0, 0), (40, 10), rlfl.CELL_MARK)
+                bits = rlfl.has_flag_mask(m, mask, rlfl.CELL_ROOM, rlfl.CELL_MARK)
+                self.assertEqual(self.unpack(bits, 1200),
+                                 [(i % 40) * (i // 40) % 3 == 0 and i < 400 for i in range(1200)])
+                rlfl.delete_map(m)
+            rlfl.delete_map(mask)
+        
+        m = rlfl.create_map(40, 30)
+        other = rlfl.create_map(30, 40)
+        try:
+            rlfl.set_flag_mask(m, other, rlfl.CELL_ROOM, rlfl.CELL_LIT)
+        except Exception as e:
+            self.assertEqual(str(e), 'Map sizes differ')
+        else:
+            self.fail('Expected Exception')
+        
+    def test_count(self):
+        flags = [1 << b for b in range(16)]
+        for layout in [rlfl.MAP_DENSE, rlfl.MAP_PLANES, rlfl.MAP_TILED, rlfl.MAP_SPARSE]:
+            m = rlfl.create_map(90, 70, layout)
+            for i in range(3000):
+                p = ((i * 37) % 90, (i * 53) % 70)
+                rlfl.set_flag(m, p, flags[(i * 7) % 16] | flags[i % 5])
+            cells = [[rlfl.get_flags(m, (x, y)) for x in range(90)] for y in range(70)]
+            
+            for p, size in [((0, 0), (90, 70)), ((3, 5), (80, 40)), ((63, 1), (3, 60)),
+                            ((15, 17), (18, 1)), ((89, 69), (1, 1)), ((40, 40), (0, 0))]:
+                inside = [cells[y][x] for y in range(p[1], p[1] + size[1])
+                                      for x in range(p[0], p[0] + size[0])]
+                for flag in [rlfl.CELL_WALK, rlfl.CELL_OPEN|rlfl.CELL_LIT, rlfl.CELL_MARK, 0]:
+                    expect = len([c for c in inside if c & flag])
+                    self.assertEqual(rlfl.count_flags(m, flag, p, size), expect)
+                hist = rlfl.flag_histogram(m, p, size)
+                self.assertEqual(hist, dict((f, len([c for c in inside if c & f])) for f in flags))
+            
+            self.assertEqual(rlfl.count_flags(m, rlfl.CELL_PERM), rlfl.count_flags(m, rlfl.CELL_PERM, (0, 0), (90, 70)))
+            self.assertEqual(rlfl.flag_histogram(m), rlfl.flag_histogram(m, (0, 0), (90, 70)))
+            self.assertRaises(Exception, rlfl.count_flags, m, rlfl.CELL_WALK, (80, 0), (11, 1))
+            self.assertRaises(Exception, rlfl.flag_histogram, m, (0, 0), (1, 71))
+            self.assertRaises(TypeError, rlfl.count_flags, m, rlfl.CELL_WALK, (0, 0))
+            rlfl.delete_map(m)
+        
+    def test_merge(self):
+        layouts = [rlfl.MAP_DENSE, rlfl.MAP_PLANES, rlfl.MAP_TILED, rlfl.MAP_SPARSE]
+        ops = {
+            rlfl.MERGE_AND: lambda d, s: d & s,
+            rlfl.MERGE_OR: lambda d, s: d | s,
+            rlfl.MERGE_XOR: lambda d, s: d ^ s,
+            rlfl.MERGE_ANDNOT: lambda d, s: d & ~s,
+        }
+        flags = rlfl.CELL_LIT|rlfl.CELL_MEMO|rlfl.CELL_MARK
+        W, H = 100, 37
+        def fill(m, k):
+            for x in range(1, W - 1):
+                for y in range(1, H - 1):
+                    v = [rlfl.CELL_LIT, rlfl.CELL_MEMO, rlfl.CELL_MARK, rlfl.CELL_ROOM]
+                    for i, f in enumerate(v):
+                        if (x * (i + k) + y * (3 + k)) % (i + 2 + k) == 0:
+                            rlfl.set_flag(m, (x, y), f)
+        for dlayout in layouts:
+            for slayout in layouts:
+                for op, fn in ops.items():
+                    for rect in [None, ((3, 2), (70, 30)), ((0, 5), (W, 9))]:
+                        dst = rlfl.create_map(W, H, dlayout)
+                        src = rlfl.create_map(W, H, slayout)
+                        fill(dst, 1)
+                        fill(src, 2)
+                        before = [[rlfl.get_flags(dst, (x, y)) for x in range(W)] for y in range(H)]
+                        if rect:
+                            rlfl.merge_map(dst, src, op, flags, rect[0], rect[1])
+                            (rx, ry), (rw, rh) = rect
+                        else:
+                            rlfl.merge_map(dst, src, op, flags)
+                            rx, ry, rw, rh = 0, 0, W, H
+                        for y in range(H):
+                            for x in range(W):
+                                d = before[y][x]
+                                if rx <= x < rx + rw and ry <= y < ry + rh:
+                                    s = rlfl.get_flags(src, (x, y))
+                                    d = (d & ~flags) | (fn(d, s) & flags)
+                                self.assertEqual(rlfl.get_flags(dst, (x, y)), d,
+                                                 (dlayout, slayout, op, rect, x, y))
+                        rlfl.delete_map(dst)
+                        rlfl.delete_map(src)
+        
+        m = rlfl.create_map(20, 20)
+        rlfl.fill_map(m, rlfl.CELL_LIT)
+        rlfl.merge_map(m, m, rlfl.MERGE_XOR, rlfl.CELL_LIT)
+        self.assertFalse(rlfl.has_flag(m, (5, 5), rlfl.CELL_LIT))
+        self.assertTrue(rlfl.has_flag(m, (0, 0), rlfl.CELL_PERM))
+        for args, msg in [((rlfl.create_map(20, 21), rlfl.MERGE_OR), 'Map sizes differ'),
+                          ((m, 9), 'Invalid merge operation'),
+                          ((m, rlfl.MERGE_OR, rlfl.CELL_LIT, (10, 10), (11, 1)), 'Location out of bounds')]:
+            try:
+                rlfl.merge_map(m, *args)
+            except Exception as e:
+                self.assertEqual(str(e), msg)
+            else:
+                self.fail('Expected Exception')
+        
+        # Merges that change nothing leave sparse tiles shared
+        a = rlfl.create_map(300, 300, rlfl.MAP_SPARSE)
+        b = rlfl.create_map(300, 300, rlfl.MAP_SPARSE)
+        used = rlfl.map_tiles(a)[0]
+        rlfl.merge_map(a, b, rlfl.MERGE_OR)
+        self.assertEqual(rlfl.map_tiles(a)[0], used)
+        
+    def test_clone(self):
+        for layout in [rlfl.MAP_DENSE, rlfl.MAP_PLANES, rlfl.MAP_TILED, rlfl.MAP_SPARSE]:
+            m = rlfl.create_map(200, 150, layout)
+            rlfl.set_flag_rect(m, (10, 10), (60, 40), rlfl.CELL_OPEN|rlfl.CELL_WALK|rlfl.CELL_SEEN)
+            rlfl.set_flag_rect(m, (70, 20), (1, 10), rlfl.CELL_WALK)
+            rlfl.set_flag_rect(m, (71, 10), (40, 40), rlfl.CELL_OPEN|rlfl.CELL_WALK|rlfl.CELL_SEEN)
+            data = rlfl.read_cells(m)
+            
+            c = rlfl.clone_map(m)
+            self.assertNotEqual(c, m)
+            self.assertEqual(rlfl.map_layout(c), layout)
+            self.assertEqual(rlfl.map_size(c), (200, 150))
+            self.assertEqual(rlfl.read_cells(c), data)
+            if layout in [rlfl.MAP_TILED, rlfl.MAP_SPARSE]:
+                self.assertEqual(rlfl.map_tiles(c), rlfl.map_tiles(m))
+            
+            # What if the door were open
+            self.assertFalse(rlfl.los(c, (20, 25), (100, 25)))
+            rlfl.set_flag(c, (70, 25), rlfl.CELL_OPEN|rlfl.CELL_SEEN)
+            self.assertTrue(rlfl.los(c, (20, 25), (100, 25)))
+            self.assertFalse(rlfl.los(m, (20, 25), (100, 25)))
+            rlfl.fov(c, (60, 25), 50, rlfl.FOV_SHADOW, True)
+            self.assertTrue(rlfl.has_flag(c, (90, 25), rlfl.CELL_LIT))
+            p = rlfl.path(c, (20, 25), (100, 25))
+            self.assertTrue((70, 25) in p)
+            rlfl.clear_map(c, rlfl.CELL_WALK)
+            
+            # Source untouched
+            self.assertEqual(rlfl.read_cells(m), data)
+            
+            # Either can go first
+            c2 = rlfl.clone_map(c)
+            rlfl.delete_map(m)
+            self.assertTrue(rlfl.has_flag(c2, (70, 25), rlfl.CELL_OPEN))
+            self.assertFalse(rlfl.has_flag(c2, (20, 25), rlfl.CELL_WALK))
+            rlfl.delete_map(c)
+            self.assertTrue(rlfl.has_flag(c2, (100, 25), rlfl.CELL_LIT))
+            rlfl.delete_map(c2)
+        
+        # Only written tiles get storage of their own
+        m = rlfl.create_map(1600, 1600, rlfl.MAP_TILED)
+        c = rlfl.clone_map(m)
+        rlfl.clear_map(c, rlfl.CELL_SEEN)
+        rlfl.set_flag(c, (800, 800), rlfl.CELL_OPEN)
+        self.assertFalse(rlfl.has_flag(m, (800, 800), rlfl.CELL_OPEN))
+        rlfl.delete_map(c)
+        try:
+            rlfl.clone_map(c)
+        except Exception as e:
+            self.assertEqual(str(e), 'Map not initialized')
+        else:
+            self.fail('Expected Exception')
+        
+    def test_dirty(self):
+        for layout in [rlfl.MAP_DENSE, rlfl.MAP_PLANES, rlfl.MAP_TILED, rlfl.MAP_SPARSE]:
+            m = rlfl.create_map(100, 70, layout)
+            try:
+                rlfl.map_dirty(m)
+            except Exception as e:
+                self.assertEqual(str(e), 'Map is not tracked')
+            else:
+                self.fail('Expected Exception')
+            
+            # Starting marks everything
+            rlfl.track_map(m, rlfl.CELL_OPEN|rlfl.CELL_WALK)
+            v = rlfl.map_version(m)
+            self.assertEqual(rlfl.map_dirty(m, v - 1), [((0, 0), (100, 70))])
+            self.assertEqual(rlfl.map_dirty(m, v), [])
+            
+            # Untracked flags change nothing
+            rlfl.set_flag(m, (50, 50), rlfl.CELL_SEEN)
+            rlfl.fov(m, (50, 50), 10, rlfl.FOV_SHADOW, True)
+            self.assertEqual(rlfl.map_version(m), v)
+            
+            # Door in the fourth square
+            rlfl.set_flag(m, (50, 20), rlfl.CELL_OPEN|rlfl.CELL_SEEN)
+            v1 = rlfl.map_version(m)
+            self.assertEqual(rlfl.map_dirty(m, v), [((48, 16), (16, 16))])
+            
+            # Runs join across rows, the map edge is clipped
+            rlfl.set_flag_rect(m, (80, 40), (20, 30), rlfl.CELL_WALK)
+            self.assertEqual(rlfl.map_dirty(m, v1), [((80, 32), (20, 38))])
+            self.assertEqual(rlfl.map_dirty(m, v), [((48, 16), (16, 16)), ((80, 32), (20, 38))])
+            v2 = rlfl.map_version(m)
+            rlfl.clear_flag_list(m, [(1, 1), (30, 1), (1, 69)], rlfl.CELL_OPEN)
+            rlfl.clear_flag(m, (17, 1), rlfl.CELL_WALK)
+            self.assertEqual(rlfl.map_dirty(m, v2), [((0, 0), (32, 16)), ((0, 64), (16, 6))])
+            
+            v3 = rlfl.map_version(m)
+            rlfl.fill_map(m, rlfl.CELL_WALK)
+            self.assertEqual(rlfl.map_dirty(m, v3), [((0, 0), (100, 70))])
+            
+            v4 = rlfl.map_version(m)
+            c = rlfl.create_map(100, 70)
+            rlfl.merge_map(m, c, rlfl.MERGE_AND, rlfl.CELL_OPEN, (20, 20), (10, 5))
+            self.assertEqual(rlfl.map_dirty(m, v4), [((16, 16), (16, 16))])
+            
+            # Empty rectangles mark nothing, at the map corner too
+            v5 = rlfl.map_version(m)
+            rlfl.set_flag_rect(m, (0, 0), (0, 5), rlfl.CELL_OPEN)
+            rlfl.clear_flag_rect(m, (0, 0), (5, 0), rlfl.CELL_OPEN)
+            rlfl.merge_map(m, c, rlfl.MERGE_OR, rlfl.CELL_OPEN, (0, 0), (0, 0))
+            self.assertEqual(rlfl.map_dirty(m, v5), [])
+            rlfl.write_cells(m, rlfl.read_cells(m))
+            self.assertEqual(rlfl.map_dirty(m, v4), [((0, 0), (100, 70))])
+            
+            rlfl.track_map(m, 0)
+            rlfl.set_flag(m, (1, 1), rlfl.CELL_OPEN)
+            self.assertRaises(Exception, rlfl.map_dirty, m)
+            rlfl.delete_all_maps()
+        
+    def test_journal(self):
+        for layout in [rlfl.MAP_DENSE, rlfl.MAP_PLANES, rlfl.MAP_TILED, rlfl.MAP_SPARSE]:
+            m = rlfl.create_map(60, 50, layout)
+            rlfl.set_flag_rect(m, (1, 1), (58, 48), rlfl.CELL_OPEN|rlfl.CELL_WALK)
+            self.assertRaises(Exception, rlfl.checkpoint, m)
+            rlfl.journal_map(m, 100000)
+            rlfl.track_regions(m)
+            start = rlfl.read_cells(m)
+            mark = rlfl.checkpoint(m)
+            
+            # Every kind of change
+            rlfl.clear_flag_rect(m, (30, 0), (1, 50), rlfl.CELL_OPEN|rlfl.CELL_WALK)
+            rlfl.set_flag(m, (5, 5), rlfl.CELL_MARK)
+            rlfl.set_flag_list(m, [(6, 6), (7, 7)], rlfl.CELL_ROOM)
+            inner = rlfl.read_cells(m)
+            inner_mark = rlfl.checkpoint(m)
+            rlfl.fov(m, (10, 10), 8, rlfl.FOV_SHADOW, True)
+            rlfl.path(m, (2, 2), (20, 20))
+            c = rlfl.create_map(60, 50)
+            rlfl.set_flag_rect(c, (10, 10), (5, 5), rlfl.CELL_ROOM)
+            rlfl.set_flag_mask(m, c, rlfl.CELL_ROOM, rlfl.CELL_OCUP)
+            rlfl.merge_map(m, c, rlfl.MERGE_OR, rlfl.CELL_ROOM)
+            rlfl.clear_flag_rect(m, (0, 25), (30, 1), rlfl.CELL_OPEN|rlfl.CELL_WALK)
+            rlfl.fill_map(m, rlfl.CELL_DARK)
+            self.assertEqual(rlfl.region_count(m), 3)
+            
+            # Back to the inner checkpoint, then the first
+            rlfl.rollback(m, inner_mark)
+            self.assertEqual(rlfl.read_cells(m), inner)
+            self.assertEqual(rlfl.region_count(m), 2)
+            rlfl.rollback(m, mark)
+            self.assertEqual(rlfl.read_cells(m), start)
+            self.assertEqual(rlfl.region_count(m), 1)
+            self.assertEqual(rlfl.checkpoint(m), mark)
+            
+            # A later checkpoint is gone after rolling back
+            self.assertRaises(Exception, rlfl.rollback, m, inner_mark)
+            
+            # Only the last `size` changes are kept
+            rlfl.journal_map(m, 10)
+            mark = rlfl.checkpoint(m)
+            rlfl.set_flag_list(m, [(x, 3) for x in range(1, 10)], rlfl.CELL_MARK)
+            late = rlfl.checkpoint(m)
+            rlfl.set_flag_list(m, [(x, 4) for x in range(1, 10)], rlfl.CELL_MARK)
+            self.assertRaises(Exception, rlfl.rollback, m, mark)
+            rlfl.rollback(m, late)
+            self.assertEqual(rlfl.count_flags(m, rlfl.CELL_MARK, (0, 4), (60, 1)), 0)
+            self.assertEqual(rlfl.count_flags(m, rlfl.CELL_MARK, (0, 3), (60, 1)), 9)
+            
+            rlfl.journal_map(m, 0)
+            self.assertRaises(Exception, rlfl.rollback, m, late)
+            rlfl.delete_all_maps()
+        
+    def test_save_load(self):
+        d = tempfile.mkdtemp()
+        path = os.path.join(d, 'map.rlfl')
+        try:
+            for layout in [rlfl.MAP_DENSE, rlfl.MAP_PLANES, rlfl.MAP_TILED, rlfl.MAP_SPARSE]:
+                m = rlfl.create_map(90, 70, layout)
+                rlfl.set_flag_rect(m, (5, 5), (80, 60), rlfl.CELL_OPEN|rlfl.CELL_WALK|rlfl.CELL_SEEN)
+                rlfl.clear_flag_rect(m, (40, 5), (1, 50), rlfl.CELL_OPEN|rlfl.CELL_WALK|rlfl.CELL_SEEN)
+                rlfl.path_fill_map(m, (10, 10))
+                pm = rlfl.path_fill_map(m, (80, 60))
+                rlfl.save_map(m, path)
+                data = rlfl.read_cells(m)
+                
+                l = rlfl.load_map(path)
+                self.assertEqual(rlfl.map_layout(l), rlfl.MAP_DENSE)
+                self.assertEqual(rlfl.map_size(l), (90, 70))
+                self.assertEqual(rlfl.read_cells(l), data)
+                for p in [(6, 6), (20, 60), (39, 30), (84, 64)]:
+                    self.assertEqual(rlfl.path_step_map(l, pm, p), rlfl.path_step_map(m, pm, p))
+                
+                # Writes stay in memory
+                rlfl.set_flag(l, (40, 30), rlfl.CELL_OPEN|rlfl.CELL_SEEN)
+                rlfl.fov(l, (30, 30), 20, rlfl.FOV_SHADOW, True)
+                self.assertTrue(rlfl.has_flag(l, (45, 30), rlfl.CELL_LIT))
+                self.assertEqual(rlfl.path_fill_map(l, (6, 6)), 2)
+                rlfl.path_clear_map(l, pm)
+                l2 = rlfl.load_map(path)
+                self.assertEqual(rlfl.read_cells(l2), data)
+                rlfl.delete_map(l)
+                self.assertEqual(rlfl.path_step_map(l2, pm, (6, 6)), rlfl.path_step_map(m, pm, (6, 6)))
+                rlfl.delete_all_maps()
+            
+            with open(path, 'r+b') as f:
+                f.write(b'XXXX')
+            try:
+                rlfl.load_map(path)
+            except Exception as e:
+                self.assertEqual(str(e), 'Invalid map file')
+            else:
+                self.fail('Expected Exception')
+            try:
+                rlfl.load_map(os.path.join(d, 'missing'))
+            except Exception as e:
+                self.assertEqual(str(e), 'Invalid map file')
+            else:
+                self.fail('Expected Exception')
+        finally:
+            shutil.rmtree(d)
+        
+    def test_share(self):
+        name = '/rlfl-test-%d' % os.getpid()
+        m = rlfl.create_map(60, 40, rlfl.MAP_PLANES)
+        rlfl.set_flag_rect(m, (1, 1), (58, 38), rlfl.CELL_OPEN|rlfl.CELL_WALK)
+        self.assertRaises(Exception, rlfl.publish_map, m)
+        s = rlfl.share_map(m, name)
+        try:
+            self.assertRaises(Exception, rlfl.share_map, m, name)
+            self.assertEqual(rlfl.map_layout(s), rlfl.MAP_DENSE)
+            self.assertEqual(rlfl.read_cells(s), rlfl.read_cells(m))
+            self.assertEqual(rlfl.map_generation(s), 0)
+            
+            # Shared writes are seen, private ones are not
+            a = rlfl.attach_map(name)
+            p = rlfl.attach_map(name, True)
+            rlfl.clear_flag(s, (30, 20), rlfl.CELL_WALK)
+            self.assertFalse(rlfl.has_flag(a, (30, 20), rlfl.CELL_WALK))
+            rlfl.fov(p, (10, 10), 10, rlfl.FOV_SHADOW)
+            self.assertTrue(rlfl.has_flag(p, (10, 10), rlfl.CELL_SEEN))
+            self.assertFalse(rlfl.has_flag(s, (10, 10), rlfl.CELL_SEEN))
+            self.assertEqual(rlfl.publish_map(s), 1)
+            self.assertEqual(rlfl.map_generation(a), 1)
+            self.assertEqual(rlfl.map_generation(p), 1)
+            
+            # Only the writer publishes
+            for c in [a, p]:
+                self.assertRaisesRegex(Exception, 'Map is not the writer of a shared map',
+                                       rlfl.publish_map, c)
+            self.assertEqual(rlfl.map_generation(a), 1)
+            
+            # Another process writes, the writer publishes
+            pid = os.fork()
+            if pid == 0:
+                c = rlfl.attach_map(name)
+                rlfl.set_flag(c, (5, 5), rlfl.CELL_SEEN)
+                try:
+                    rlfl.publish_map(c)
+                except Exception:
+                    os._exit(0)
+                os._exit(1)
+            self.assertEqual(os.waitpid(pid, 0)[1], 0)
+            self.assertEqual(rlfl.publish_map(s), 2)
+            self.assertEqual(rlfl.map_generation(s), 2)
+            self.assertTrue(rlfl.has_flag(a, (5, 5), rlfl.CELL_SEEN))
+            rlfl.delete_map(s)
+            self.assertTrue(rlfl.has_flag(a, (5, 5), rlfl.CELL_SEEN))
+        finally:
+            rlfl.unlink_map(name)
+        self.assertRaises(Exception, rlfl.attach_map, name)
+        self.assertRaises(Exception, rlfl.unlink_map, name)
+        self.assertTrue(rlfl.has_flag(a, (5, 5), rlfl.CELL_SEEN))
+        
     def test_map(self):
         m = rlfl.create_map(20, 20)
         rlfl.fill_map(m, rlfl.CELL_SEEN)
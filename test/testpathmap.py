@@ -35,6 +35,27 @@ class TestPathMap(unittest.TestCase):
     def test_step(self):
         pass
         
+    def test_layouts(self):
+        maps = [self.map]
+        for layout in (rlfl.MAP_PLANES, rlfl.MAP_TILED, rlfl.MAP_SPARSE):
+            m = rlfl.create_map(len(TMAP), len(TMAP[0]), layout)
+            for row in range(len(TMAP)):
+                for col in range(len(TMAP[row])):
+                    if TMAP[row][col] != '#':
+                        rlfl.set_flag(m, (row, col), rlfl.CELL_SEEN|rlfl.CELL_OPEN)
+            maps.append(m)
+        pms = [rlfl.path_fill_map(m, TORIGOS[1]) for m in maps]
+        def step(m, pm, p):
+            try:
+                return rlfl.path_step_map(m, pm, p)
+            except Exception as e:
+                return str(e)
+        for row in range(len(TMAP)):
+            for col in range(len(TMAP[row])):
+                steps = [step(m, pm, (row, col)) for m, pm in zip(maps, pms)]
+                for s in steps[1:]:
+                    self.assertEqual(steps[0], s)
+        
     def test_step_input(self):
         return
         pm = rlfl.path_fill_map(self.map, TORIGOS[1])
@@ -0,0 +1,121 @@
+import unittest
+import random
+
+import sys
+sys.path.append('..')
+
+import rlfl
+
+WALKABLE = rlfl.CELL_WALK | rlfl.CELL_OPEN
+
+class TestRegion(unittest.TestCase):
+    def setUp(self):
+        rlfl.delete_all_maps()
+
+    def partition(self, m, w, h):
+        # Regions by flood fill, as sets of cells
+        seen, parts = set(), set()
+        for y in range(h):
+            for x in range(w):
+                if (x, y) in seen or not rlfl.has_flag(m, (x, y), WALKABLE):
+                    continue
+                part, todo = set(), [(x, y)]
+                seen.add((x, y))
+                while todo:
+                    c = todo.pop()
+                    part.add(c)
+                    for n in ((c[0] - 1, c[1]), (c[0] + 1, c[1]), (c[0], c[1] - 1), (c[0], c[1] + 1)):
+                        if 0 <= n[0] < w and 0 <= n[1] < h and n not in seen \
+                           and rlfl.has_flag(m, n, WALKABLE):
+                            seen.add(n)
+                            todo.append(n)
+                parts.add(frozenset(part))
+        return parts
+
+    def labelled(self, m, w, h):
+        labels = rlfl.region_labels(m)
+        parts = {}
+        for y in range(h):
+            for x in range(w):
+                self.assertEqual(labels[y, x], rlfl.region(m, (x, y)))
+                if labels[y, x]:
+                    parts.setdefault(labels[y, x], set()).add((x, y))
+        self.assertEqual(len(parts), rlfl.region_count(m))
+        return set(frozenset(p) for p in parts.values())
+
+    def test_rooms(self):
+        for layout in [rlfl.MAP_DENSE, rlfl.MAP_PLANES, rlfl.MAP_TILED, rlfl.MAP_SPARSE]:
+            m = rlfl.create_map(40, 20, layout)
+            self.assertRaises(Exception, rlfl.region, m, (1, 1))
+            self.assertRaises(Exception, rlfl.region_count, m)
+
+            # Two rooms and a wall
+            rlfl.set_flag_rect(m, (1, 1), (38, 18), WALKABLE)
+            rlfl.clear_flag_rect(m, (20, 0), (1, 20), WALKABLE)
+            rlfl.track_regions(m)
+            self.assertEqual(rlfl.region_count(m), 2)
+            self.assertEqual(rlfl.region(m, (0, 0)), 0)
+            self.assertFalse(rlfl.same_region(m, (1, 1), (30, 1)))
+            self.assertTrue(rlfl.same_region(m, (1, 1), (19, 18)))
+            self.assertFalse(rlfl.same_region(m, (0, 0), (0, 0)))
+
+            # A door joins them, a diagonal gap does not
+            rlfl.set_flag(m, (20, 5), rlfl.CELL_WALK)
+            self.assertEqual(rlfl.region_count(m), 1)
+            self.assertTrue(rlfl.same_region(m, (1, 1), (30, 1)))
+            rlfl.clear_flag(m, (20, 5), WALKABLE)
+            self.assertEqual(rlfl.region_count(m), 2)
+            rlfl.set_flag_list(m, [(20, 5), (21, 6)], rlfl.CELL_OPEN)
+            rlfl.clear_flag(m, (21, 5), WALKABLE)
+            self.assertEqual(rlfl.region_count(m), 2)
+            self.assertTrue(rlfl.same_region(m, (1, 1), (20, 5)))
+            self.assertTrue(rlfl.same_region(m, (30, 1), (21, 6)))
+
+            # Flags outside the region flags change nothing
+            rlfl.fov(m, (10, 10), 10, rlfl.FOV_SHADOW, True)
+            self.assertEqual(rlfl.region_count(m), 2)
+
+            # Regions of other flags, and stopping
+            rlfl.track_regions(m, rlfl.CELL_SEEN)
+            self.assertEqual(rlfl.region_count(m), 1)
+            rlfl.clear_map(m, rlfl.CELL_SEEN)
+            self.assertEqual(rlfl.region_count(m), 0)
+            rlfl.track_regions(m, 0)
+            self.assertRaises(Exception, rlfl.region_labels, m)
+            rlfl.delete_map(m)
+
+    def test_changes(self):
+        random.seed(7)
+        for layout in [rlfl.MAP_DENSE, rlfl.MAP_PLANES, rlfl.MAP_TILED, rlfl.MAP_SPARSE]:
+            w, h = 37, 29
+            m = rlfl.create_map(w, h, layout)
+            for i in range(500):
+                rlfl.set_flag(m, (random.randrange(w), random.randrange(h)), WALKABLE)
+            rlfl.track_regions(m)
+            self.assertEqual(self.labelled(m, w, h), self.partition(m, w, h))
+            c = rlfl.create_map(w, h)
+            rlfl.set_flag_rect(c, (3, 3), (20, 20), rlfl.CELL_WALK)
+            for step in range(300):
+                p = (random.randrange(w), random.randrange(h))
+                op = step % 10
+                if op < 4:
+                    rlfl.set_flag(m, p, random.choice([rlfl.CELL_WALK, rlfl.CELL_OPEN]))
+                elif op < 8:
+                    rlfl.clear_flag(m, p, random.choice([rlfl.CELL_WALK, WALKABLE]))
+                elif op == 8:
+                    rw, rh = random.randrange(1, w - p[0] + 1), random.randrange(1, h - p[1] + 1)
+                    if random.random() < .5:
+                        rlfl.set_flag_rect(m, p, (rw, rh), rlfl.CELL_OPEN)
+                    else:
+                        rlfl.clear_flag_rect(m, p, (rw, rh), WALKABLE)
+                else:
+                    rlfl.merge_map(m, c, random.choice([rlfl.MERGE_OR, rlfl.MERGE_XOR]), rlfl.CELL_WALK)
+                if step % 25 == 0:
+                    self.assertEqual(self.labelled(m, w, h), self.partition(m, w, h))
+            self.assertEqual(self.labelled(m, w, h), self.partition(m, w, h))
+            rlfl.write_cells(m, bytes(len(rlfl.read_cells(m))))
+            self.assertEqual(rlfl.region_count(m), 0)
+            rlfl.delete_all_maps()
+
+if __name__ == '__main__':
+    unittest.main()
@@ -27,6 +27,16 @@ class TestDistance(unittest.TestCase):
             self.assertTrue(py < (y + 10))
             self.assertTrue(py >= (y - 10))
             self.assertTrue(rlfl.has_flag(self.map, (px, py), rlfl.CELL_OPEN))
+
+    def test_seed(self):
+        p = ORIGOS[1]
+        rlfl.seed(1234)
+        first = [rlfl.scatter(self.map, p, 10) for i in range(10)]
+        first.append([rlfl.randint(1000) for i in range(10)])
+        rlfl.seed(1234)
+        again = [rlfl.scatter(self.map, p, 10) for i in range(10)]
+        again.append([rlfl.randint(1000) for i in range(10)])
+        self.assertEqual(first, again)
         
 if __name__ == '__main__':
     unittest.main()
\ No newline at end of file
@@ -0,0 +1,184 @@
+import unittest
+import random
+import heapq
+
+import sys
+sys.path.append('..')
+
+import rlfl
+
+WALKABLE = rlfl.CELL_WALK | rlfl.CELL_OPEN
+DIRS = [(0, -1), (0, 1), (-1, 0), (1, 0), (-1, -1), (-1, 1), (1, -1), (1, 1)]
+
+class TestStack(unittest.TestCase):
+    def setUp(self):
+        rlfl.delete_all_maps()
+        self.stacks = []
+
+    def tearDown(self):
+        for s in self.stacks:
+            rlfl.delete_stack(s)
+
+    def cave(self, w, h):
+        # Random walls inside a wall border
+        m = rlfl.create_map(w, h)
+        cells = [(x, y) for x in range(1, w - 1) for y in range(1, h - 1) if random.random() < .75]
+        rlfl.set_flag_list(m, cells, WALKABLE)
+        return m
+
+    def costs(self, maps, portals, goal, types, dcost):
+        # Cost from every node to goal, by a plain Dijkstra
+        walk = lambda l, x, y: rlfl.has_flag(maps[l], (x, y), WALKABLE) \
+            if 0 <= x < self.size[l][0] and 0 <= y < self.size[l][1] else False
+        back = {}
+        for a, b, t, c in portals:
+            if t & types:
+                back.setdefault(b, []).append((a, c))
+        dist, todo = {goal: 0}, [(0, goal)]
+        while todo:
+            d, n = heapq.heappop(todo)
+            if d > dist[n]:
+                continue
+            l, x, y = n
+            nexts = []
+            for i, (dx, dy) in enumerate(DIRS):
+                if not walk(l, x + dx, y + dy):
+                    continue
+                if i >= 4 and not (walk(l, x + dx, y) and walk(l, x, y + dy)):
+                    continue
+                nexts.append(((l, x + dx, y + dy), 1 + (dcost if i >= 4 else 0)))
+            for a, c in back.get(n, []):
+                if walk(*a):
+                    nexts.append((a, c))
+            for m, c in nexts:
+                if d + c < dist.get(m, float('inf')):
+                    dist[m] = d + c
+                    heapq.heappush(todo, (d + c, m))
+        return dist
+
+    def build(self, levels, w, h, nportals):
+        maps = [self.cave(w, h) for i in range(levels)]
+        self.size = [(w, h)] * levels
+        s = rlfl.create_stack(maps)
+        self.stacks.append(s)
+        portals = []
+        for i in range(nportals):
+            a = (random.randrange(levels), random.randrange(1, w - 1), random.randrange(1, h - 1))
+            b = (random.randrange(levels), random.randrange(1, w - 1), random.randrange(1, h - 1))
+            t = random.choice([rlfl.PORTAL_STAIRS, rlfl.PORTAL_LADDER, rlfl.PORTAL_PIT])
+            c = random.choice([1.0, 2.0, 5.0])
+            both = t != rlfl.PORTAL_PIT
+            rlfl.link_levels(s, a, b, t, c, both)
+            portals.append((a, b, t, c))
+            if both:
+                portals.append((b, a, t, c))
+        return s, maps, portals
+
+    def check_path(self, path, maps, portals, types, dcost):
+        # Steps are moves or portals, the total is the cost
+        cost = 0
+        for a, b in zip(path, path[1:]):
+            if a[0] == b[0] and max(abs(a[1] - b[1]), abs(a[2] - b[2])) == 1:
+                cost += 1 + (dcost if a[1] != b[1] and a[2] != b[2] else 0)
+                self.assertTrue(rlfl.has_flag(maps[b[0]], b[1:], WALKABLE))
+            else:
+                cost += min(c for p, q, t, c in portals if p == a and q == b and t & types)
+        return cost
+
+    def test_path(self):
+        random.seed(11)
+        # Few portals per level, and more than the estimate looks at
+        for types, dcost, n in [(rlfl.PORTAL_ALL, 0.0, 12), (rlfl.PORTAL_STAIRS|rlfl.PORTAL_PIT, 0.5, 12),
+                                (rlfl.PORTAL_LADDER, 0.0, 12), (rlfl.PORTAL_ALL, 0.5, 60)]:
+            s, maps, portals = self.build(6, 24, 16, n)
+            cells = [(l, x, y) for l in range(6) for x in range(24) for y in range(16)
+                     if rlfl.has_flag(maps[l], (x, y), WALKABLE)]
+            for i in range(15):
+                a, b = random.choice(cells), random.choice(cells)
+                dist = self.costs(maps, portals, b, types, dcost)
+                path = rlfl.stack_path(s, a, b, types, dcost)
+                if a not in dist:
+                    self.assertEqual(path, False)
+                    continue
+                self.assertEqual(path[0], a)
+                self.assertEqual(path[-1], b)
+                self.assertAlmostEqual(self.check_path(path, maps, portals, types, dcost), dist[a], places=4)
+            rlfl.delete_all_maps()
+
+    def test_fill_map(self):
+        random.seed(5)
+        s, maps, portals = self.build(4, 30, 20, 10)
+        goal = (3, 5, 5)
+        rlfl.set_flag(maps[3], goal[1:], WALKABLE)
+        pm = rlfl.stack_fill_map(s, goal)
+        dist = self.costs(maps, portals, goal, rlfl.PORTAL_ALL, 0.0)
+        for n in random.sample(sorted(dist), 40):
+            # Every step goes down, to the goal
+            steps = 0
+            while n != goal:
+                m = rlfl.stack_step_map(s, pm, n)
+                self.assertLess(dist[m], dist[n])
+                n = m
+                steps += 1
+                self.assertLess(steps, 1000)
+        self.assertEqual(rlfl.stack_step_map(s, pm, goal), goal)
+        rlfl.stack_clear_map(s, pm)
+        self.assertRaises(Exception, rlfl.stack_step_map, s, pm, goal)
+
+    def test_stairs(self):
+        # Forty levels, stairs alternate between the ends
+        rlfl.set_max_maps(64)
+        self.addCleanup(rlfl.set_max_maps, rlfl.MAX_MAPS)
+        maps = []
+        for i in range(40):
+            m = rlfl.create_map(30, 10)
+            rlfl.set_flag_rect(m, (1, 1), (28, 8), WALKABLE)
+            maps.append(m)
+        s = rlfl.create_stack(maps[:20])
+        self.stacks.append(s)
+        for m in maps[20:]:
+            self.assertEqual(rlfl.stack_add(s, m), maps.index(m))
+        self.assertEqual(rlfl.stack_levels(s), tuple(maps))
+        self.assertRaises(Exception, rlfl.stack_add, s, maps[0])
+        for l in range(39):
+            x = 28 if l % 2 == 0 else 1
+            rlfl.link_levels(s, (l, x, 5), (l + 1, x, 5))
+        path = rlfl.stack_path(s, (3, 1, 5), (7, 1, 5))
+        self.assertEqual(len(path), 27 * 4 + 4 + 1)
+        self.assertEqual([p[0] for p in path].count(5), 28)
+        self.assertEqual(len(rlfl.stack_path(s, (7, 1, 5), (3, 1, 5))), len(path))
+
+        # A pit straight down, one way
+        rlfl.link_levels(s, (3, 1, 1), (7, 1, 1), rlfl.PORTAL_PIT, 1, False)
+        self.assertEqual(len(rlfl.stack_path(s, (3, 1, 5), (7, 1, 5))), 10)
+        self.assertEqual(len(rlfl.stack_path(s, (3, 1, 5), (7, 1, 5), rlfl.PORTAL_STAIRS)), 113)
+        self.assertEqual(len(rlfl.stack_path(s, (7, 1, 5), (3, 1, 5))), 113)
+        self.assertEqual(rlfl.unlink_levels(s, (7, 1, 1)), 1)
+        self.assertEqual(len(rlfl.stack_path(s, (3, 1, 5), (7, 1, 5))), 113)
+
+        # Blocked stairs
+        rlfl.clear_flag(maps[5], (28, 5), WALKABLE)
+        self.assertEqual(rlfl.stack_path(s, (3, 1, 5), (7, 1, 5)), False)
+        self.assertEqual(rlfl.unlink_levels(s, (4, 28, 5)), 2)
+
+    def test_errors(self):
+        m = rlfl.create_map(10, 10)
+        s = rlfl.create_stack([m])
+        self.assertRaises(Exception, rlfl.link_levels, s, (0, 1, 1), (1, 1, 1))
+        self.assertRaises(Exception, rlfl.link_levels, s, (0, 1, 1), (0, 10, 1))
+        self.assertRaises(Exception, rlfl.link_levels, s, (0, 1, 1), (0, 2, 1), 0)
+        self.assertRaises(Exception, rlfl.link_levels, s, (0, 1, 1), (0, 2, 1), rlfl.PORTAL_GATE, -1)
+        self.assertEqual(rlfl.stack_path(s, (0, 1, 1), (0, 1, 1)), ((0, 1, 1),))
+        rlfl.delete_map(m)
+        self.assertRaises(Exception, rlfl.stack_path, s, (0, 1, 1), (0, 1, 1))
+        rlfl.delete_stack(s)
+        try:
+            rlfl.stack_path(s, (0, 1, 1), (0, 1, 1))
+        except Exception as e:
+            self.assertEqual(str(e), 'Stack does not exist')
+        else:
+            self.fail('Expected Exception')
+        self.assertRaises(Exception, rlfl.create_stack, [0, 'x'])
+
+if __name__ == '__main__':
+    unittest.main()